@@ -0,0 +1,2003 @@
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "bench.h"
+#include "jobs.h"
+#include "waves.h"
+#include "seabed.h"
+#include "waves_simd.h"
+#include "cpu.h"
+#include "ocean.h"
+#include "clipmap.h"
+#include "topology.h"
+#include "noise.h"
+#include "coast.h"
+#include "raycast.h"
+#include "boat.h"
+#include "heightfield.h"
+#include "png_loader.h"
+#include "mesh_cache.h"
+
+/* Grid sizes and number of ticks used by the scaling benchmarks */
+static const int benchGridSizes[] = { 200, 512, 1024, 2048, 4096 };
+#define N_BENCH_GRID_SIZES (int)(sizeof(benchGridSizes) / sizeof(benchGridSizes[0]))
+#define BENCH_TICKS 20
+
+/* Thread counts 1, 2, 4... up to the core count (inclusive) */
+static int nextThreadCount(int n, int cores)
+{
+	if (n >= cores)
+		return 0;
+	return min(n * 2, cores);
+}
+
+/* Times updateGrid and terrain generation/normals from 1 to N
+   threads for grids from 200^2 to 4096^2 */
+static void benchJobs(void)
+{
+	int s, n, cores, tick;
+	double start, seconds, base;
+	Grid grid;
+	Terrain terrain;
+
+	initJobs(0);
+	cores = jobThreadCount();
+	cleanupJobs();
+
+	printf("jobs: scaling over 1..%d threads\n", cores);
+	printf("%-10s %6s %7s %14s %9s\n", "task", "grid", "threads", "ms/iteration", "speedup");
+
+	for (s = 0; s < N_BENCH_GRID_SIZES; s++)
+	{
+		int size = benchGridSizes[s];
+
+		/* updateGrid, full (untiled) SoA grid */
+		base = 0;
+		for (n = 1; n; n = nextThreadCount(n, cores))
+		{
+			initJobs(n);
+			initGridLayout(&grid, size, size, 200, GRID_LAYOUT_SOA);
+			start = timeNow();
+			for (tick = 0; tick < BENCH_TICKS; tick++)
+				updateGrid(&grid, 0.016f);
+			seconds = (timeNow() - start) / BENCH_TICKS;
+			cleanupGrid(&grid);
+			cleanupJobs();
+
+			if (n == 1)
+				base = seconds;
+			printf("%-10s %6d %7d %14.3f %8.2fx\n", "waves", size, n, seconds * 1000.0, base / seconds);
+		}
+
+		/* initTerrain (heightmap + noise + normals) */
+		base = 0;
+		for (n = 1; n; n = nextThreadCount(n, cores))
+		{
+			initJobs(n);
+			start = timeNow();
+			initTerrain(&terrain, size, size, 200, 40);
+			seconds = timeNow() - start;
+			cleanupTerrain(&terrain);
+			cleanupJobs();
+
+			if (n == 1)
+				base = seconds;
+			printf("%-10s %6d %7d %14.3f %8.2fx\n", "terrain", size, n, seconds * 1000.0, base / seconds);
+		}
+	}
+}
+
+/* Component counts and kernels compared by benchSpectrum */
+static const int benchComponentCounts[] = { 8, 32, 64 };
+#define N_BENCH_COMPONENT_COUNTS (int)(sizeof(benchComponentCounts) / sizeof(benchComponentCounts[0]))
+#define SPECTRUM_BLOCK 256
+#define SPECTRUM_VERTICES (1 << 16)
+
+/* Times each wave kernel on one thread over a spectrum of 8 to 64
+   Gerstner components, in vertex-components per second */
+static void benchSpectrum(void)
+{
+	static const struct
+	{
+		const char *name;
+		WaveKernel kernel;
+		bool (*supported)(void);
+	} kernels[] = {
+		{ "scalar", waveKernelScalar, NULL },
+		{ "sse2", waveKernelSSE2, cpuHasSSE2 },
+		{ "avx2", waveKernelAVX2, cpuHasAVX2 },
+	};
+	SineFunction components[MAX_WAVES];
+	float *arrays[8];
+	int i, c, k, pass, passes;
+	double start, seconds;
+
+	for (i = 0; i < 8; i++)
+		arrays[i] = alignedCalloc(SPECTRUM_VERTICES, sizeof(float), WAVE_SIMD_ALIGN);
+	for (i = 0; i < SPECTRUM_VERTICES; i++)
+	{
+		arrays[0][i] = (i % 256) * 0.78f - 100.0f;
+		arrays[1][i] = (i / 256) * 0.78f - 100.0f;
+	}
+
+	printf("spectrum: %d vertices in blocks of %d\n", SPECTRUM_VERTICES, SPECTRUM_BLOCK);
+	printf("%-8s %10s %18s\n", "kernel", "components", "Mvertex-comp/s");
+
+	for (c = 0; c < N_BENCH_COMPONENT_COUNTS; c++)
+	{
+		int nWaves = benchComponentCounts[c];
+
+		makeWaveSpectrum(components, nWaves, 0.6f, 2.0f, 1234);
+		passes = max(1, 256 / nWaves);
+
+		for (k = 0; k < (int)(sizeof(kernels) / sizeof(kernels[0])); k++)
+		{
+			if (kernels[k].supported && !kernels[k].supported())
+				continue;
+
+			start = timeNow();
+			for (pass = 0; pass < passes; pass++)
+				for (i = 0; i < SPECTRUM_VERTICES; i += SPECTRUM_BLOCK)
+					kernels[k].kernel(arrays[0] + i, arrays[1] + i, arrays[2] + i,
+						arrays[3] + i, arrays[4] + i, arrays[5] + i, arrays[6] + i, arrays[7] + i,
+						SPECTRUM_BLOCK, components, nWaves, pass * 0.016f);
+			seconds = timeNow() - start;
+
+			printf("%-8s %10d %18.1f\n", kernels[k].name, nWaves,
+				(double)SPECTRUM_VERTICES * nWaves * passes / seconds / 1e6);
+		}
+	}
+
+	for (i = 0; i < 8; i++)
+		alignedFree(arrays[i]);
+}
+
+/* FFT resolutions compared by benchOcean */
+static const int benchOceanSizes[] = { 128, 256, 512, 1024 };
+#define N_BENCH_OCEAN_SIZES (int)(sizeof(benchOceanSizes) / sizeof(benchOceanSizes[0]))
+
+/* Compares a tick of the FFT ocean against summing a 32-component
+   spectrum on a grid of the same resolution, on all cores */
+static void benchOcean(void)
+{
+	SineFunction components[32];
+	const SineFunction *saved;
+	SineFunction restore[MAX_WAVES];
+	int s, tick, nSaved;
+	double start, fftSeconds, sumSeconds;
+	Ocean ocean;
+	Grid grid;
+
+	nSaved = getWaves(&saved);
+	for (s = 0; s < nSaved; s++)
+		restore[s] = saved[s];
+
+	initJobs(0);
+	makeWaveSpectrum(components, 32, 0.6f, 2.0f, 1234);
+	setWaves(components, 32);
+
+	printf("ocean: FFT vs 32 summed components on %d threads\n", jobThreadCount());
+	printf("%6s %12s %12s %9s\n", "n", "fft ms", "sum ms", "ratio");
+
+	for (s = 0; s < N_BENCH_OCEAN_SIZES; s++)
+	{
+		int n = benchOceanSizes[s];
+
+		initOcean(&ocean, n, 200, 12, 0.6f, 0.7f, 1234);
+		start = timeNow();
+		for (tick = 1; tick <= BENCH_TICKS; tick++)
+			updateOcean(&ocean, tick * 0.016f);
+		fftSeconds = (timeNow() - start) / BENCH_TICKS;
+		cleanupOcean(&ocean);
+
+		initGridLayout(&grid, n, n, 200, GRID_LAYOUT_SOA);
+		start = timeNow();
+		for (tick = 0; tick < BENCH_TICKS; tick++)
+			updateGrid(&grid, 0.016f);
+		sumSeconds = (timeNow() - start) / BENCH_TICKS;
+		cleanupGrid(&grid);
+
+		printf("%6d %12.3f %12.3f %8.2fx\n", n, fftSeconds * 1000.0, sumSeconds * 1000.0,
+			sumSeconds / fftSeconds);
+	}
+
+	setWaves(restore, nSaved);
+	cleanupJobs();
+}
+
+/* Sea extents compared by benchClipmap, the uniform grid is only
+   timed up to MAX_BENCH_UNIFORM_ROWS per side */
+static const float benchSeaExtents[] = { 256, 512, 1024, 2048, 8192 };
+#define N_BENCH_SEA_EXTENTS (int)(sizeof(benchSeaExtents) / sizeof(benchSeaExtents[0]))
+#define MAX_BENCH_UNIFORM_ROWS 2049
+
+/* Vertices and update time of a uniform grid against two clipmaps
+   (one per viewport) at the same finest spacing as the sea grows */
+static void benchClipmap(void)
+{
+	int s, tick;
+	double start, seconds;
+	Clipmap clipmap[2];
+	Grid grid;
+
+	initJobs(0);
+
+	printf("clipmap: 1 unit spacing, 65 vertices per ring side, %d threads\n", jobThreadCount());
+	printf("%-8s %7s %11s %14s\n", "water", "extent", "vertices", "ms/iteration");
+
+	for (s = 0; s < N_BENCH_SEA_EXTENTS; s++)
+	{
+		float extent = benchSeaExtents[s];
+		int rows = (int)extent + 1;
+
+		if (rows <= MAX_BENCH_UNIFORM_ROWS)
+		{
+			initGridLayout(&grid, rows, rows, extent, GRID_LAYOUT_SOA);
+			start = timeNow();
+			for (tick = 0; tick < BENCH_TICKS; tick++)
+				updateGrid(&grid, 0.016f);
+			seconds = (timeNow() - start) / BENCH_TICKS;
+			cleanupGrid(&grid);
+			printf("%-8s %7.0f %11d %14.3f\n", "uniform", extent, rows * rows, seconds * 1000.0);
+		}
+		else
+			printf("%-8s %7.0f %11.0f %14s\n", "uniform", extent, (double)rows * rows, "-");
+
+		initClipmap(&clipmap[0], 65, 1.0f, extent, extent);
+		initClipmap(&clipmap[1], 65, 1.0f, extent, extent);
+		start = timeNow();
+		for (tick = 0; tick < BENCH_TICKS; tick++)
+		{
+			/* Boats sailing apart, so the rings keep shifting */
+			advanceWaves(0.016f);
+			moveClipmap(&clipmap[0], tick * 0.5f, tick * 0.3f);
+			moveClipmap(&clipmap[1], -tick * 0.5f, tick * 0.2f);
+			updateClipmap(&clipmap[0]);
+			updateClipmap(&clipmap[1]);
+		}
+		seconds = (timeNow() - start) / BENCH_TICKS;
+		printf("%-8s %7.0f %11d %14.3f\n", "clipmap", extent,
+			clipmapVertexCount(&clipmap[0]) * 2, seconds * 1000.0);
+		cleanupClipmap(&clipmap[0]);
+		cleanupClipmap(&clipmap[1]);
+	}
+
+	cleanupJobs();
+}
+
+/* Post-transform cache sizes simulated by benchTopology */
+#define BENCH_SMALL_CACHE 16
+#define BENCH_LARGE_CACHE 32
+
+/* Builds the triangle list the grid used before strips: six 32 bit
+   indices per quad, row-major across the whole grid or in
+   chunkQuads x chunkQuads chunks when chunkQuads is non-zero */
+static int *buildTriangleList(int rows, int cols, int chunkQuads, int *nIndices)
+{
+	int i, j, ci, cj, index = 0;
+	int *indices = malloc((rows - 1) * (cols - 1) * 6 * sizeof(int));
+
+	if (!chunkQuads)
+		chunkQuads = max(rows, cols);
+
+	#define GRID_VERTEX(i, j) ((i)*cols+(j))
+	for (ci = 0; ci < rows - 1; ci += chunkQuads)
+	{
+		for (cj = 0; cj < cols - 1; cj += chunkQuads)
+		{
+			for (i = ci; i < min(ci + chunkQuads, rows - 1); i++)
+			{
+				for (j = cj; j < min(cj + chunkQuads, cols - 1); j++)
+				{
+					indices[index++] = GRID_VERTEX(i, j);
+					indices[index++] = GRID_VERTEX(i, j + 1);
+					indices[index++] = GRID_VERTEX(i + 1, j);
+					indices[index++] = GRID_VERTEX(i + 1, j);
+					indices[index++] = GRID_VERTEX(i, j + 1);
+					indices[index++] = GRID_VERTEX(i + 1, j + 1);
+				}
+			}
+		}
+	}
+	#undef GRID_VERTEX
+
+	*nIndices = index;
+	return indices;
+}
+
+/* Index bytes and simulated vertex cache misses (ACMR) of the old
+   triangle lists against the chunked 16 bit strips */
+static void benchTopology(void)
+{
+	int s, c, nIndices;
+	int *list;
+	GridTopology topology;
+	TopologyStats stats, small;
+
+	printf("topology: acmr for %d and %d entry FIFO vertex caches\n", BENCH_SMALL_CACHE, BENCH_LARGE_CACHE);
+	printf("%-12s %6s %11s %10s %9s %7s %7s\n", "layout", "grid", "triangles", "index KB", "bytes/tri",
+		"acmr16", "acmr32");
+
+	memset(&topology, 0, sizeof(topology));
+	for (s = 0; s < N_BENCH_GRID_SIZES - 1; s++)
+	{
+		int size = benchGridSizes[s];
+		static const struct { const char *name; int chunkQuads; } lists[] = {
+			{ "list rows", 0 }, { "list 16^2", 16 },
+		};
+
+		for (c = 0; c < 2; c++)
+		{
+			list = buildTriangleList(size, size, lists[c].chunkQuads, &nIndices);
+			measureTriangleList(list, nIndices, size * size, BENCH_SMALL_CACHE, &small);
+			measureTriangleList(list, nIndices, size * size, BENCH_LARGE_CACHE, &stats);
+			free(list);
+			printf("%-12s %6d %11d %10.0f %9.2f %7.3f %7.3f\n", lists[c].name, size, stats.nTriangles,
+				stats.indexBytes / 1024.0, stats.indexBytes / (double)stats.nTriangles, small.acmr, stats.acmr);
+		}
+
+		for (c = 16; c <= 32; c += 16)
+		{
+			buildGridTopology(&topology, size, size, c, 0, 0, 0);
+			measureGridTopology(&topology, BENCH_SMALL_CACHE, &small);
+			measureGridTopology(&topology, BENCH_LARGE_CACHE, &stats);
+			printf("strips %2d^2%2s %6d %11d %10.0f %9.2f %7.3f %7.3f\n", c, "", size, stats.nTriangles,
+				stats.indexBytes / 1024.0, stats.indexBytes / (double)stats.nTriangles, small.acmr, stats.acmr);
+		}
+	}
+	cleanupGridTopology(&topology);
+}
+
+/* Heightmap sizes compared by benchCDLOD */
+static const int benchTerrainSizes[] = { 200, 1024, 2048, 4096 };
+#define N_BENCH_TERRAIN_SIZES (int)(sizeof(benchTerrainSizes) / sizeof(benchTerrainSizes[0]))
+
+/* Selections benchCDLOD makes per run (two a frame with the boats),
+   and the distance its eye covers in each on the fast flight */
+#define BENCH_CDLOD_SELECTIONS 600
+#define BENCH_CDLOD_HZ 60
+#define BENCH_CDLOD_FLY_STEP 8.0f
+
+/* Nodes, vertices and selection time of the quadtree LOD as the
+   heightmap grows. There's no frustum here so every direction is
+   drawn, a viewport sees about a quarter of it. Only patches in a
+   morph band are built and streamed for each selection, the rest come
+   from the cache, which is only uploaded to as the eye reaches new
+   nodes: so it's run with the two viewports' eyes following boats at
+   full speed, and with one eye flying across the seabed far faster
+   than anything in the game */
+static void benchCDLOD(void)
+{
+	int s, run, tick;
+	double start, seconds;
+	Terrain terrain;
+
+	initJobs(0);
+
+	printf("cdlod: eyes 10 units up, no frustum, %d selections, %d threads\n", BENCH_CDLOD_SELECTIONS,
+		jobThreadCount());
+	printf("%-6s %8s %6s %-6s %8s %7s %10s %10s %11s %14s\n", "grid", "init ms", "levels", "eyes", "patches",
+		"cached", "streamed", "upload KB", "full mesh", "ms/selection");
+
+	for (s = 0; s < N_BENCH_TERRAIN_SIZES; s++)
+	{
+		int size = benchTerrainSizes[s];
+
+		start = timeNow();
+		initTerrain(&terrain, size, size, 200, 40);
+		seconds = timeNow() - start;
+
+		for (run = 0; run < 2; run++)
+		{
+			int patches = 0, cached = 0, streamed = 0, uploaded = 0, p;
+
+			if (run == 0)
+				printf("%-6d %8.0f %6d ", size, seconds * 1000.0, terrain.lod.nLevels);
+			else
+				printf("%-6s %8s %6s ", "", "", "");
+
+			/* Each run starts with an empty cache */
+			releaseCDLODGL(&terrain.lod);
+
+			start = timeNow();
+			for (tick = 0; tick < BENCH_CDLOD_SELECTIONS; tick++)
+			{
+				Vec3f eye;
+
+				if (run == 0)
+					eye = cVec3f(-80.0f + tick / 2 * BOAT_MAX_SPEED / BENCH_CDLOD_HZ, 10.0f,
+						tick % 2 ? 30.0f : -30.0f);
+				else
+					eye = cVec3f(-80.0f + fmodf(tick * BENCH_CDLOD_FLY_STEP, 160.0f), 10.0f,
+						-80.0f + fmodf(tick * BENCH_CDLOD_FLY_STEP / 4.0f, 160.0f));
+				selectCDLOD(&terrain.lod, eye);
+				patches += terrain.lod.nPatches;
+				for (p = 0; p < terrain.lod.nPatches; p++)
+					cached += terrain.lod.patches[p].slot >= 0;
+				streamed += terrain.lod.nStreamed;
+				uploaded += terrain.lod.nUploads;
+			}
+			seconds = (timeNow() - start) / BENCH_CDLOD_SELECTIONS;
+			printf("%-6s %8d %7d %10d %10.1f %11d %14.3f\n", run == 0 ? "boats" : "fly",
+				patches / BENCH_CDLOD_SELECTIONS, cached / BENCH_CDLOD_SELECTIONS,
+				streamed / BENCH_CDLOD_SELECTIONS,
+				uploaded * CDLOD_PATCH_VERTICES * sizeof(CDLODVertex) / 1024.0 / BENCH_CDLOD_SELECTIONS,
+				size * size, seconds * 1000.0);
+		}
+
+		cleanupTerrain(&terrain);
+	}
+
+	cleanupJobs();
+}
+
+/* Sample counts per side compared by benchNoise */
+static const int benchNoiseSizes[] = { 200, 1024, 4096 };
+#define N_BENCH_NOISE_SIZES (int)(sizeof(benchNoiseSizes) / sizeof(benchNoiseSizes[0]))
+
+/* The terrain's noise (3 octaves over 200 units) at 200^2 to 4096^2
+   samples, one thread: the old value noise, single noiseFBm samples
+   and each row kernel, with the kernels' largest difference from
+   noiseFBm */
+static void benchNoise(void)
+{
+	static const struct { const char *name; NoiseKernel kernel; } kernels[] = {
+		{ "scalar", noiseRowScalar }, { "sse2", noiseRowSSE2 }, { "avx2", noiseRowAVX2 },
+	};
+	int s, i, j, k;
+	double start, seconds, old;
+	float *z, *out, error;
+	volatile float sink = 0.0f;
+	Noise noise;
+
+	initNoise(&noise, NOISE_DEFAULT_SEED, 3, 1.0f, 2.0f, 2.0f);
+
+	printf("noise: 3 octaves over 200 units, 1 thread\n");
+	printf("%-6s %-12s %10s %9s %9s\n", "grid", "method", "ms", "speedup", "max err");
+
+	for (s = 0; s < N_BENCH_NOISE_SIZES; s++)
+	{
+		int size = benchNoiseSizes[s];
+
+		z = malloc(size * sizeof(float));
+		out = malloc(size * sizeof(float));
+		for (j = 0; j < size; j++)
+			z[j] = (j / (float)(size - 1) - 0.5f) * 200.0f;
+
+		start = timeNow();
+		for (i = 0; i < size; i++)
+			for (j = 0; j < size; j++)
+				sink += getPerlinNoise(z[i], z[j], 2, 4);
+		old = timeNow() - start;
+		printf("%-6d %-12s %10.1f %9s %9s\n", size, "value noise", old * 1000.0, "1.0", "-");
+
+		start = timeNow();
+		for (i = 0; i < size; i++)
+			for (j = 0; j < size; j++)
+				sink += noiseFBm(&noise, z[i], z[j]);
+		seconds = timeNow() - start;
+		printf("%-6d %-12s %10.1f %9.1f %9s\n", size, "noiseFBm", seconds * 1000.0, old / seconds, "-");
+
+		for (k = 0; k < 3; k++)
+		{
+			if (k == 1 && !cpuHasSSE2())
+				continue;
+			if (k == 2 && !cpuHasAVX2())
+				continue;
+
+			start = timeNow();
+			for (i = 0; i < size; i++)
+			{
+				kernels[k].kernel(&noise, z[i], z, out, size);
+				sink += out[size / 2];
+			}
+			seconds = timeNow() - start;
+
+			/* Compare a few rows against single samples */
+			error = 0.0f;
+			for (i = 0; i < size; i += max(size / 16, 1))
+			{
+				kernels[k].kernel(&noise, z[i], z, out, size);
+				for (j = 0; j < size; j++)
+					error = max(error, fabsf(out[j] - noiseFBm(&noise, z[i], z[j])));
+			}
+			printf("%-6d row %-8s %10.1f %9.1f %9.1e\n", size, kernels[k].name, seconds * 1000.0,
+				old / seconds, error);
+		}
+
+		free(z);
+		free(out);
+	}
+}
+
+/* Grid sizes, lookups and brute force checks used by benchCoast */
+static const int benchCoastSizes[] = { 200, 1024, 4096 };
+#define N_BENCH_COAST_SIZES (int)(sizeof(benchCoastSizes) / sizeof(benchCoastSizes[0]))
+#define BENCH_COAST_LOOKUPS 1000000
+#define BENCH_COAST_CHECKS 200
+
+/* Time to build the coast's distance field over every sample of the
+   terrain and to look it up at random points (a tenth of them off the
+   map), with the largest difference from a brute force search at a
+   few samples */
+static void benchCoast(void)
+{
+	int s, i, k;
+	double start, build, lookup;
+	float *x, *z, error;
+	volatile float sink = 0.0f;
+	Terrain terrain;
+	CoastField coast;
+
+	initJobs(0);
+	x = malloc(BENCH_COAST_LOOKUPS * sizeof(float));
+	z = malloc(BENCH_COAST_LOOKUPS * sizeof(float));
+	srand(1234);
+	for (i = 0; i < BENCH_COAST_LOOKUPS; i++)
+	{
+		x[i] = (rand() / (float)RAND_MAX - 0.5f) * 220.0f;
+		z[i] = (rand() / (float)RAND_MAX - 0.5f) * 220.0f;
+	}
+
+	printf("coast: distance field over the terrain, %d threads\n", jobThreadCount());
+	printf("%-6s %10s %12s %10s\n", "grid", "build ms", "ns/lookup", "max err");
+
+	for (s = 0; s < N_BENCH_COAST_SIZES; s++)
+	{
+		int size = benchCoastSizes[s];
+
+		initTerrain(&terrain, size, size, 200, 40);
+
+		start = timeNow();
+		initCoastField(&coast, terrain.vertices, size, size, 1, TERRAIN_WATER_LEVEL, TERRAIN_COAST_BAND);
+		build = timeNow() - start;
+
+		start = timeNow();
+		for (i = 0; i < BENCH_COAST_LOOKUPS; i++)
+			sink += coastDistance(&coast, x[i], z[i]);
+		lookup = timeNow() - start;
+
+		/* Nearest sample on the other side of the waterline, minus
+		   the half spacing the field assumes */
+		error = 0.0f;
+		for (i = 0; i < BENCH_COAST_CHECKS; i++)
+		{
+			int index = rand() % terrain.nVertices;
+			Vec3f v = terrain.vertices[index];
+			bool land = v.y > TERRAIN_WATER_LEVEL;
+			float nearest = HUGE_VALF;
+
+			for (k = 0; k < terrain.nVertices; k++)
+			{
+				Vec3f o = terrain.vertices[k];
+				if ((o.y > TERRAIN_WATER_LEVEL) != land)
+					nearest = min(nearest, (o.x - v.x) * (o.x - v.x) + (o.z - v.z) * (o.z - v.z));
+			}
+			nearest = min(sqrtf(nearest) - 0.5f * coast.spacingX, TERRAIN_COAST_BAND);
+			error = max(error, fabsf(coast.distance[index] - (land ? -nearest : nearest)));
+		}
+
+		printf("%-6d %10.1f %12.1f %10.1e\n", size, build * 1000.0,
+			lookup * 1e9 / BENCH_COAST_LOOKUPS, error);
+
+		cleanupCoastField(&coast);
+		cleanupTerrain(&terrain);
+	}
+
+	free(x);
+	free(z);
+	cleanupJobs();
+}
+
+/* Grid sizes and rays cast by benchRaycast. Only a few of the rays
+   are marched cell by cell, that's far slower */
+static const int benchRaycastSizes[] = { 200, 4096 };
+#define N_BENCH_RAYCAST_SIZES (int)(sizeof(benchRaycastSizes) / sizeof(benchRaycastSizes[0]))
+#define BENCH_RAYS 1000000
+#define BENCH_MARCHED_RAYS 10000
+
+/* Casts a ray by walking every cell its x/z path crosses, in order,
+   the way to do it without the pyramid */
+static bool marchHeightRay(const HeightPyramid *pyramid, Vec3f o, Vec3f d, float maxT, RayHit *hit)
+{
+	int rows = pyramid->rows, cols = pyramid->cols;
+	Vec3f first = pyramid->vertices[0], last = pyramid->vertices[rows * cols - 1];
+	float sx = (last.x - first.x) / (rows - 1), sz = (last.z - first.z) / (cols - 1);
+	float t0 = 0.0f, t1 = maxT, tNextX, tNextZ;
+	int i, j, stepI = d.x > 0.0f ? 1 : -1, stepJ = d.z > 0.0f ? 1 : -1;
+
+	hit->t = maxT;
+	hit->nodesVisited = 0;
+
+	/* Clip to the map */
+	if (d.x != 0.0f)
+	{
+		float a = (first.x - o.x) / d.x, b = (last.x - o.x) / d.x;
+		t0 = max(t0, min(a, b));
+		t1 = min(t1, max(a, b));
+	}
+	else if (o.x < first.x || o.x > last.x)
+		return false;
+	if (d.z != 0.0f)
+	{
+		float a = (first.z - o.z) / d.z, b = (last.z - o.z) / d.z;
+		t0 = max(t0, min(a, b));
+		t1 = min(t1, max(a, b));
+	}
+	else if (o.z < first.z || o.z > last.z)
+		return false;
+	if (t0 > t1)
+		return false;
+
+	i = clamp((int)((o.x + d.x * t0 - first.x) / sx), 0, rows - 2);
+	j = clamp((int)((o.z + d.z * t0 - first.z) / sz), 0, cols - 2);
+
+	for (;;)
+	{
+		hit->nodesVisited++;
+		if (intersectHeightCell(pyramid, i, j, o, d, hit))
+			return true;
+
+		/* Where the ray leaves the cell, worked out afresh each time
+		   so errors don't build up along long rays */
+		tNextX = d.x != 0.0f ? (first.x + (i + (d.x > 0.0f)) * sx - o.x) / d.x : HUGE_VALF;
+		tNextZ = d.z != 0.0f ? (first.z + (j + (d.z > 0.0f)) * sz - o.z) / d.z : HUGE_VALF;
+		if (min(tNextX, tNextZ) > t1)
+			return false;
+		if (tNextX < tNextZ)
+			i += stepI;
+		else
+			j += stepJ;
+		if (i < 0 || i > rows - 2 || j < 0 || j > cols - 2)
+			return false;
+	}
+}
+
+/* A million random rays looking down on the seabed from 5 to 60 units
+   up, cast through the min-max pyramid. A few are also marched cell
+   by cell, to compare the time and check both find the same hits */
+static void benchRaycast(void)
+{
+	int s, i, hits, mismatches;
+	long visited;
+	double start, cast, march;
+	Vec3f *origins, *dirs;
+	Terrain terrain;
+	RayHit hit, marched;
+
+	initJobs(0);
+	origins = malloc(BENCH_RAYS * sizeof(Vec3f));
+	dirs = malloc(BENCH_RAYS * sizeof(Vec3f));
+	srand(1234);
+	for (i = 0; i < BENCH_RAYS; i++)
+	{
+		float angle = rand() / (float)RAND_MAX * 2.0f * M_PI;
+		float y = rand() / (float)RAND_MAX * 1.1f - 1.0f, r = sqrtf(1.0f - y * y);
+
+		origins[i] = cVec3f((rand() / (float)RAND_MAX - 0.5f) * 200.0f,
+			5.0f + rand() / (float)RAND_MAX * 55.0f, (rand() / (float)RAND_MAX - 0.5f) * 200.0f);
+		dirs[i] = cVec3f(r * cosf(angle), y, r * sinf(angle));
+	}
+
+	printf("raycast: %d rays from 5 to 60 units up, 1 thread\n", BENCH_RAYS);
+	printf("%-6s %8s %10s %7s %12s %12s %9s %10s\n", "grid", "levels", "ns/ray", "hits",
+		"nodes/ray", "march ns", "speedup", "mismatch");
+
+	for (s = 0; s < N_BENCH_RAYCAST_SIZES; s++)
+	{
+		int size = benchRaycastSizes[s];
+
+		initTerrain(&terrain, size, size, 200, 40);
+
+		hits = 0;
+		visited = 0;
+		start = timeNow();
+		for (i = 0; i < BENCH_RAYS; i++)
+		{
+			hits += castHeightRay(&terrain.pyramid, origins[i], dirs[i], 400.0f, &hit);
+			visited += hit.nodesVisited;
+		}
+		cast = (timeNow() - start) / BENCH_RAYS;
+
+		start = timeNow();
+		for (i = 0; i < BENCH_MARCHED_RAYS; i++)
+			marchHeightRay(&terrain.pyramid, origins[i], dirs[i], 400.0f, &marched);
+		march = (timeNow() - start) / BENCH_MARCHED_RAYS;
+
+		mismatches = 0;
+		for (i = 0; i < BENCH_MARCHED_RAYS; i++)
+		{
+			bool a = castHeightRay(&terrain.pyramid, origins[i], dirs[i], 400.0f, &hit);
+			bool b = marchHeightRay(&terrain.pyramid, origins[i], dirs[i], 400.0f, &marched);
+			if (a != b || (a && fabsf(hit.t - marched.t) > 1e-3f))
+				mismatches++;
+		}
+
+		printf("%-6d %8d %10.0f %6.1f%% %12.1f %12.0f %8.1fx %6d/%d\n", size, terrain.pyramid.nLevels,
+			cast * 1e9, hits * 100.0 / BENCH_RAYS, visited / (double)BENCH_RAYS, march * 1e9,
+			march / cast, mismatches, BENCH_MARCHED_RAYS);
+
+		cleanupTerrain(&terrain);
+	}
+
+	free(origins);
+	free(dirs);
+	cleanupJobs();
+}
+
+/* Grid sizes timed by benchCache, cache files are a few hundred MB
+   past these */
+static const int benchCacheSizes[] = { 200, 1024, 2048 };
+#define N_BENCH_CACHE_SIZES (int)(sizeof(benchCacheSizes) / sizeof(benchCacheSizes[0]))
+
+/* initTerrain with no cache file (decoding the heightmap, adding
+   noise, building normals and strips, then writing the cache) against
+   mapping the file written by that first run. The quadtree, coast
+   and ray structures are built from the vertices either way */
+static void benchCache(void)
+{
+	int s;
+	double cold, warm;
+	char filename[256];
+	Terrain terrain;
+
+	initJobs(0);
+	setTerrainCaching(true);
+
+	printf("cache: initTerrain without and with the terrain cache, %d threads\n", jobThreadCount());
+	printf("%-6s %10s %10s %9s %10s\n", "grid", "cold ms", "warm ms", "speedup", "cache MB");
+
+	for (s = 0; s < N_BENCH_CACHE_SIZES; s++)
+	{
+		int size = benchCacheSizes[s];
+		bool cached;
+
+		snprintf(filename, sizeof(filename), "terrain-%dx%d-*.cache", size, size);
+		pruneTerrainCaches(filename, 0);
+
+		initTerrain(&terrain, size, size, 200, 40);
+		cold = terrain.initSeconds;
+		cleanupTerrain(&terrain);
+
+		initTerrain(&terrain, size, size, 200, 40);
+		warm = terrain.initSeconds;
+		cached = terrain.fromCache;
+		printf("%-6d %10.1f %10.1f %8.1fx %10.1f%s\n", size, cold * 1000.0, warm * 1000.0, cold / warm,
+			terrain.cache.bytes / 1048576.0, cached ? "" : " (not cached)");
+		cleanupTerrain(&terrain);
+
+		pruneTerrainCaches(filename, 0);
+	}
+
+	setTerrainCaching(false);
+	cleanupJobs();
+}
+
+static const int benchDeformSizes[] = { 200, 4096 };
+#define N_BENCH_DEFORM_SIZES (int)(sizeof(benchDeformSizes) / sizeof(benchDeformSizes[0]))
+
+static const int benchDeformImpacts[] = { 1, 10, 100, 1000 };
+#define N_BENCH_DEFORM_IMPACTS (int)(sizeof(benchDeformImpacts) / sizeof(benchDeformImpacts[0]))
+
+/* Steady fire: this many craters a frame at BENCH_DEFORM_HZ, for long
+   enough to see whether the coast field keeps up */
+#define BENCH_DEFORM_STEADY 10
+#define BENCH_DEFORM_HZ 60
+#define BENCH_DEFORM_SECONDS 5
+
+/* Craters n random points of the terrain */
+static void benchCraters(Terrain *terrain, int n)
+{
+	int k;
+
+	for (k = 0; k < n; k++)
+	{
+		float x = (rand() / (float)RAND_MAX - 0.5f) * terrain->size;
+		float z = (rand() / (float)RAND_MAX - 0.5f) * terrain->size;
+
+		deformTerrain(terrain, x, z, CRATER_RADIUS, -CRATER_DEPTH);
+	}
+}
+
+/* Craters a frame's worth of cannonballs into the seabed, then brings
+   everything derived from the heights up to date: only around the
+   craters with flushTerrainEdits, and over the whole terrain the way
+   it would be without it. The coast field can take more flushes to
+   catch up, those are counted and the slowest one timed. Afterwards
+   the patched pyramid and coast field are checked against ones built
+   from scratch. Last, each terrain takes a few seconds of steady fire */
+static void benchDeform(void)
+{
+	int s, k, i, l, frames, behind;
+	double start, flush, worst, full, total;
+	Terrain terrain;
+
+	initJobs(0);
+	printf("deform: craters of radius %d per frame, dirty region against full rebuild, %d threads\n",
+		CRATER_RADIUS, jobThreadCount());
+	printf("%-6s %8s %11s %9s %11s %11s %9s %10s %11s\n", "grid", "impacts", "flush ms", "catch-up",
+		"worst ms", "full ms", "speedup", "pyr diffs", "coast err");
+
+	for (s = 0; s < N_BENCH_DEFORM_SIZES; s++)
+	{
+		int size = benchDeformSizes[s];
+
+		initTerrain(&terrain, size, size, 200, 40);
+		srand(7);
+		for (k = 0; k < N_BENCH_DEFORM_IMPACTS; k++)
+		{
+			HeightPyramid fresh;
+			CoastField freshCoast;
+			int diffs = 0;
+			float err = 0.0f;
+
+			benchCraters(&terrain, benchDeformImpacts[k]);
+			start = timeNow();
+			flushTerrainEdits(&terrain);
+			flush = worst = timeNow() - start;
+
+			/* Then a flush a frame until the coast field has caught up */
+			for (frames = 0; terrain.coastPending > 0; frames++)
+			{
+				start = timeNow();
+				flushTerrainEdits(&terrain);
+				worst = max(worst, timeNow() - start);
+			}
+
+			start = timeNow();
+			calcTerrainNormals(&terrain);
+			cleanupCDLOD(&terrain.lod);
+			initCDLOD(&terrain.lod, terrain.vertices, terrain.normals, size, size, terrain.size,
+				CDLOD_DEFAULT_TOLERANCE);
+			initHeightPyramid(&fresh, terrain.vertices, size, size);
+			initCoastField(&freshCoast, terrain.vertices, size, size, terrain.coast.stride,
+				TERRAIN_WATER_LEVEL, TERRAIN_COAST_BAND);
+			full = timeNow() - start;
+
+			for (l = 0; l < fresh.nLevels; l++)
+			{
+				for (i = 0; i < fresh.levelRows[l] * fresh.levelCols[l]; i++)
+				{
+					if (fresh.levels[l][i].minY != terrain.pyramid.levels[l][i].minY ||
+						fresh.levels[l][i].maxY != terrain.pyramid.levels[l][i].maxY)
+						diffs++;
+				}
+			}
+			for (i = 0; i < freshCoast.rows * freshCoast.cols; i++)
+				err = max(err, fabsf(freshCoast.distance[i] - terrain.coast.distance[i]));
+			cleanupHeightPyramid(&fresh);
+			cleanupCoastField(&freshCoast);
+
+			printf("%-6d %8d %11.3f %9d %11.3f %11.1f %8.0fx %10d %11.2g\n", size, benchDeformImpacts[k],
+				flush * 1000.0, frames, worst * 1000.0, full * 1000.0, full / flush, diffs, err);
+		}
+
+		total = worst = 0.0;
+		behind = 0;
+		for (k = 0; k < BENCH_DEFORM_SECONDS * BENCH_DEFORM_HZ; k++)
+		{
+			benchCraters(&terrain, BENCH_DEFORM_STEADY);
+			start = timeNow();
+			flushTerrainEdits(&terrain);
+			flush = timeNow() - start;
+			total += flush;
+			worst = max(worst, flush);
+			behind = max(behind, terrain.coastPending);
+		}
+		printf("%-6d %4d/s steady: %.3f ms a frame, worst %.3f ms, shore tiles behind %d after %ds, "
+			"at most %d\n", size, BENCH_DEFORM_STEADY * BENCH_DEFORM_HZ,
+			total * 1000.0 / (BENCH_DEFORM_SECONDS * BENCH_DEFORM_HZ), worst * 1000.0, terrain.coastPending,
+			BENCH_DEFORM_SECONDS, behind);
+		cleanupTerrain(&terrain);
+	}
+
+	cleanupJobs();
+}
+
+/* Tiles per side of the world flown over, 32 km across, and the
+   route: waypoints flown between in turn at BENCH_FLY_SPEED */
+#define BENCH_TILES_SIDE (TERRAIN_WORLD_TILES * 2)
+static const Vec2f benchFlyRoute[] = {
+	{ -12000, -12000 }, { -4000, -10000 }, { -9000, -2000 }, { 2000, 3000 },
+	{ 9000, -6000 }, { 12000, 8000 }, { 0, 12000 }
+};
+#define N_BENCH_FLY_WAYPOINTS (int)(sizeof(benchFlyRoute) / sizeof(benchFlyRoute[0]))
+#define BENCH_FLY_SECONDS 20.0
+#define BENCH_FLY_HZ 60.0
+
+/* Each fly-through's speed (units/s) and the range tiles are wanted
+   around the viewer, each flown with and without fetching ahead. The
+   first is the game's; the second is fast enough, and the range
+   narrow enough, that the loader can't keep up with the tile under
+   the viewer unless it's fetched on the way */
+static const struct
+{
+	float speed, range;
+} benchFlyRuns[] = {
+	{ 400.0f, TERRAIN_TILES_DEFAULT_RANGE },
+	{ 9600.0f, 0.5f }
+};
+#define N_BENCH_FLY_RUNS (int)(sizeof(benchFlyRuns) / sizeof(benchFlyRuns[0]))
+
+/* Sleeps (rather than spins, the loader needs the core) until time t */
+static void sleepUntil(double t)
+{
+	double wait = t - timeNow();
+	struct timespec ts;
+
+	if (wait <= 0.0)
+		return;
+	ts.tv_sec = (time_t)wait;
+	ts.tv_nsec = (long)((wait - ts.tv_sec) * 1e9);
+	nanosleep(&ts, NULL);
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+	double da = *(const double *)a, db = *(const double *)b;
+
+	return (da > db) - (da < db);
+}
+
+/* Scripted fly-throughs of a world much bigger than the tile budget,
+   in real time at 60 Hz, with and without fetching ahead along the
+   heading, flying the route once or for BENCH_FLY_SECONDS if that's
+   sooner. Each frame streams, selects the tiles to draw and queries
+   the height underneath, as the game does; its time is the main
+   thread's, which must never wait on the disk. A frame is coarse if
+   the tile under the viewer wasn't resident at full resolution */
+static void benchTiles(void)
+{
+	static const float lookaheads[] = { TERRAIN_TILES_DEFAULT_LOOKAHEAD, 0.0f };
+	int maxFrames = (int)(BENCH_FLY_SECONDS * BENCH_FLY_HZ), nFrames, f, k, r;
+	double *frameTimes = malloc(maxFrames * sizeof(double)), start, built;
+	float routeLength = 0.0f;
+	int *selected;
+	TerrainTiles tiles;
+	char filename[256];
+
+	for (k = 1; k < N_BENCH_FLY_WAYPOINTS; k++)
+		routeLength += hypotf(benchFlyRoute[k].x - benchFlyRoute[k - 1].x,
+			benchFlyRoute[k].y - benchFlyRoute[k - 1].y);
+
+	initJobs(0);
+	printf("tiles: fly-throughs of a %.1f km route over %d^2 tiles (%.1f km), %d MB budget, %d threads\n",
+		routeLength / 1000.0f, BENCH_TILES_SIDE,
+		BENCH_TILES_SIDE * TERRAIN_TILE_QUADS * TERRAIN_WORLD_SPACING / 1000.0f, TERRAIN_WORLD_BUDGET >> 20,
+		jobThreadCount());
+
+	snprintf(filename, sizeof(filename), "terrain-world-%d.tiles", BENCH_TILES_SIDE);
+	remove(filename);
+	start = timeNow();
+	if (!openTerrainWorld(&tiles, BENCH_TILES_SIDE, TERRAIN_WORLD_BUDGET))
+	{
+		printf("couldn't build %s\n", filename);
+		free(frameTimes);
+		cleanupJobs();
+		return;
+	}
+	built = timeNow() - start;
+	closeTerrainTiles(&tiles);
+	{
+		FILE *file = fopen(filename, "rb");
+
+		fseek(file, 0, SEEK_END);
+		printf("built %s in %.1f s, %.1f MB\n", filename, built, ftell(file) / 1048576.0);
+		fclose(file);
+	}
+	printf("%-8s %6s %10s %9s %9s %9s %8s %8s %7s %8s %8s %8s\n", "speed", "range", "lookahead", "max ms",
+		"p99 ms", "mean ms", "coarse", "worst", "loads", "evicts", "cancels", "peak MB");
+
+	for (r = 0; r < N_BENCH_FLY_RUNS * 2; r++)
+	{
+		float speed = benchFlyRuns[r / 2].speed, lookahead = lookaheads[r % 2];
+		TileViewer viewer;
+		TerrainTilesStats stats;
+		int waypoint = 1, coarse = 0, worst = 0;
+		double total = 0.0, next;
+
+#ifdef POSIX_FADV_DONTNEED
+		/* Start cold, from the disk rather than the page cache */
+		{
+			int fd = open(filename, O_RDONLY);
+
+			if (fd >= 0)
+			{
+				/* Written pages must be clean to be dropped */
+				fdatasync(fd);
+				posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+				close(fd);
+			}
+		}
+#endif
+		openTerrainWorld(&tiles, BENCH_TILES_SIDE, TERRAIN_WORLD_BUDGET);
+		tiles.range = benchFlyRuns[r / 2].range;
+		tiles.lookahead = lookahead;
+		selected = malloc(tiles.nSlots * sizeof(int));
+
+		viewer.pos = cVec3f(benchFlyRoute[0].x, 50.0f, benchFlyRoute[0].y);
+		viewer.speed = speed;
+
+		/* Let the top tile and the first few in, as the game's
+		   loading does */
+		viewer.heading.x = viewer.heading.y = 0.0f;
+		updateTerrainTiles(&tiles, &viewer, 1);
+		sleepUntil(timeNow() + 0.25);
+
+		nFrames = min(maxFrames, (int)ceilf(routeLength / speed * BENCH_FLY_HZ));
+		next = timeNow();
+		for (f = 0; f < nFrames; f++)
+		{
+			Vec2f to = benchFlyRoute[waypoint];
+			float dx = to.x - viewer.pos.x, dz = to.y - viewer.pos.z, distance = sqrtf(dx * dx + dz * dz);
+			float step = speed / BENCH_FLY_HZ, y;
+			int level = tiles.nLevels;
+
+			if (distance < step && waypoint < N_BENCH_FLY_WAYPOINTS - 1)
+				waypoint++;
+			viewer.heading.x = dx / max(distance, 1e-3f);
+			viewer.heading.y = dz / max(distance, 1e-3f);
+			viewer.pos.x += viewer.heading.x * min(step, distance);
+			viewer.pos.z += viewer.heading.y * min(step, distance);
+
+			start = timeNow();
+			updateTerrainTiles(&tiles, &viewer, 1);
+			selectTerrainTiles(&tiles, viewer.pos, selected, tiles.nSlots);
+			terrainTilesHeight(&tiles, viewer.pos.x, viewer.pos.z, &y, &level);
+			frameTimes[f] = timeNow() - start;
+			total += frameTimes[f];
+
+			if (level > 0)
+				coarse++;
+			worst = max(worst, level);
+
+			next += 1.0 / BENCH_FLY_HZ;
+			sleepUntil(next);
+		}
+
+		getTerrainTilesStats(&tiles, &stats);
+		qsort(frameTimes, nFrames, sizeof(double), compareDoubles);
+		printf("%-8.0f %6.2f %8.1f s %9.3f %9.3f %9.3f %8d %8d %7d %8d %8d %8.1f\n", speed,
+			tiles.range, lookahead,
+			frameTimes[nFrames - 1] * 1000.0, frameTimes[(int)(nFrames * 0.99)] * 1000.0,
+			total / nFrames * 1000.0, coarse, worst, stats.loads, stats.evictions, stats.cancels,
+			stats.peakBytes / 1048576.0);
+
+		free(selected);
+		closeTerrainTiles(&tiles);
+	}
+
+	remove(filename);
+	free(frameTimes);
+	cleanupJobs();
+}
+
+/* Side of the heightmaps benchHeightmap reads, and the files it
+   writes them to */
+#define BENCH_HEIGHTMAP_SIDE 4096
+static const char *benchHeightmapFiles[] = {
+	"bench-heightmap-rgba.png", "bench-heightmap-16.png", "bench-heightmap.r16", "bench-heightmap.r32"
+};
+#define N_BENCH_HEIGHTMAP_FILES (int)(sizeof(benchHeightmapFiles) / sizeof(benchHeightmapFiles[0]))
+
+/* Writes one PNG chunk */
+static void writePNGChunk(FILE *file, const char *type, const unsigned char *data, unsigned int length)
+{
+	unsigned char word[4];
+	unsigned int crc = crc32(crc32(0, NULL, 0), (const unsigned char *)type, 4);
+
+	crc = crc32(crc, data, length);
+	word[0] = length >> 24; word[1] = length >> 16; word[2] = length >> 8; word[3] = length;
+	fwrite(word, 1, 4, file);
+	fwrite(type, 1, 4, file);
+	fwrite(data, 1, length, file);
+	word[0] = crc >> 24; word[1] = crc >> 16; word[2] = crc >> 8; word[3] = crc;
+	fwrite(word, 1, 4, file);
+}
+
+/* Writes 16 bit heights as an 8 bit RGBA PNG (grey, the layout of
+   heightmap.png) or a 16 bit greyscale one. Each row uses the next of
+   the five filters in turn, so the decoder sees all of them */
+static void writeBenchPNG(const char *filename, const unsigned short *heights, int side, bool sixteen)
+{
+	int bpp = sixteen ? 2 : 4, lineBytes = side * bpp, i, k;
+	unsigned char *lines = calloc(2, lineBytes), *line = lines, *above = lines + lineBytes, *swap;
+	unsigned char *filtered = malloc(lineBytes + 1), *out = malloc(1 << 16);
+	unsigned char header[13] = { 0 };
+	FILE *file = fopen(filename, "wb");
+	z_stream strm;
+
+	memset(&strm, 0, sizeof(strm));
+	deflateInit(&strm, 1);
+	fwrite("\x89PNG\r\n\x1a\n", 1, 8, file);
+	header[0] = side >> 24; header[1] = side >> 16; header[2] = side >> 8; header[3] = side;
+	memcpy(header + 4, header, 4);
+	header[8] = sixteen ? 16 : 8;
+	header[9] = sixteen ? 0 : 6;
+	writePNGChunk(file, "IHDR", header, 13);
+
+	for (i = 0; i <= side; i++)
+	{
+		int filter = i % 5;
+
+		if (i < side)
+		{
+			for (k = 0; k < side; k++)
+			{
+				unsigned short h = heights[i * side + k];
+
+				if (sixteen)
+				{
+					line[k * 2] = h >> 8;
+					line[k * 2 + 1] = h & 0xff;
+				}
+				else
+				{
+					line[k * 4] = line[k * 4 + 1] = line[k * 4 + 2] = h >> 8;
+					line[k * 4 + 3] = 255;
+				}
+			}
+			filtered[0] = filter;
+			for (k = 0; k < lineBytes; k++)
+			{
+				int a = k >= bpp ? line[k - bpp] : 0, b = above[k], c = k >= bpp ? above[k - bpp] : 0;
+				int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+				int predict[5] = { 0, a, b, (a + b) / 2, pa <= pb && pa <= pc ? a : pb <= pc ? b : c };
+
+				filtered[k + 1] = line[k] - predict[filter];
+			}
+			strm.next_in = filtered;
+			strm.avail_in = lineBytes + 1;
+		}
+		do
+		{
+			strm.next_out = out;
+			strm.avail_out = 1 << 16;
+			deflate(&strm, i < side ? Z_NO_FLUSH : Z_FINISH);
+			if (strm.avail_out < 1 << 16)
+				writePNGChunk(file, "IDAT", out, (1 << 16) - strm.avail_out);
+		} while (strm.avail_in > 0 || strm.avail_out == 0);
+
+		swap = line;
+		line = above;
+		above = swap;
+	}
+
+	writePNGChunk(file, "IEND", NULL, 0);
+	deflateEnd(&strm);
+	fclose(file);
+	free(lines);
+	free(filtered);
+	free(out);
+}
+
+/* Loads one of the bench files with the new loader, or (which 0)
+   with load_png into RGBA the way the terrain used to */
+static bool loadBenchHeightmap(int which, Heightfield *field, Image **image)
+{
+	if (which < 0)
+	{
+		*image = load_png(benchHeightmapFiles[0]);
+		return *image != NULL;
+	}
+	return loadHeightfield(field, benchHeightmapFiles[which]);
+}
+
+/* Reading a 4096^2 heightmap the old way (load_png's RGBA, channel 0
+   used) against loadHeightfield from each format. Peak memory is the
+   growth in resident set of a child process doing just the load, so
+   every allocation and mapping along the way is counted. The loaded
+   heights are then checked against the 16 bit source */
+static void benchHeightmap(void)
+{
+	int side = BENCH_HEIGHTMAP_SIDE, f, i, n = side * side;
+	unsigned short *heights = malloc(n * sizeof(unsigned short));
+	float *row = malloc(side * sizeof(float)), *z = malloc(side * sizeof(float));
+	Noise noise;
+	FILE *file;
+
+	printf("heightmap: %d^2 heightmap, load_png (RGBA) against loadHeightfield\n", side);
+
+	/* Smooth heights over the whole 16 bit range */
+	initNoise(&noise, NOISE_DEFAULT_SEED, 6, 4.0f / side, 2.0f, 0.5f);
+	for (i = 0; i < side; i++)
+		z[i] = i;
+	for (i = 0; i < side; i++)
+	{
+		int k;
+
+		noiseRowScalar(&noise, i, z, row, side);
+		for (k = 0; k < side; k++)
+			heights[i * side + k] = (unsigned short)clamp(32768.0f + row[k] * 32767.0f, 0.0f, 65535.0f);
+	}
+
+	writeBenchPNG(benchHeightmapFiles[0], heights, side, false);
+	writeBenchPNG(benchHeightmapFiles[1], heights, side, true);
+	file = fopen(benchHeightmapFiles[2], "wb");
+	for (i = 0; i < n; i++)
+	{
+		unsigned char bytes[2] = { heights[i] & 0xff, heights[i] >> 8 };
+		fwrite(bytes, 1, 2, file);
+	}
+	fclose(file);
+	file = fopen(benchHeightmapFiles[3], "wb");
+	for (i = 0; i < n; i++)
+	{
+		float h = heights[i] / 257.0f;
+		fwrite(&h, sizeof(float), 1, file);
+	}
+	fclose(file);
+
+	printf("%-26s %8s %10s %9s %12s\n", "file", "ms", "peak MB", "levels", "max error");
+	for (f = -1; f < N_BENCH_HEIGHTMAP_FILES; f++)
+	{
+		const char *name = f < 0 ? "load_png RGBA" : benchHeightmapFiles[f];
+		double result[2] = { 0.0, 0.0 }, maxError = 0.0;
+		int pipes[2], levels = f < 1 ? 256 : 65536;
+		Heightfield field;
+		Image *image = NULL;
+		pid_t child;
+
+		/* Time and peak memory in a fresh child */
+		fflush(stdout);
+		if (pipe(pipes) != 0)
+			continue;
+		child = fork();
+		if (child == 0)
+		{
+			struct rusage before, after;
+			double start;
+
+			getrusage(RUSAGE_SELF, &before);
+			start = timeNow();
+			if (loadBenchHeightmap(f, &field, &image))
+			{
+				result[0] = timeNow() - start;
+				getrusage(RUSAGE_SELF, &after);
+				result[1] = (after.ru_maxrss - before.ru_maxrss) / 1024.0;
+			}
+			if (write(pipes[1], result, sizeof(result)) != sizeof(result))
+				_exit(1);
+			_exit(0);
+		}
+		close(pipes[1]);
+		if (read(pipes[0], result, sizeof(result)) != sizeof(result))
+			result[0] = 0.0;
+		close(pipes[0]);
+		waitpid(child, NULL, 0);
+
+		/* Against the source, in 8 bit units */
+		if (!loadBenchHeightmap(f, &field, &image))
+		{
+			printf("%-26s couldn't be read\n", name);
+			continue;
+		}
+		for (i = 0; i < n; i++)
+		{
+			float h = image ? image->data[((side - 1 - i / side) * side + i % side) * 4] : field.heights[i];
+			maxError = max(maxError, fabs(h - heights[i] / 257.0));
+		}
+		if (image)
+			free_image(image);
+		else
+			freeHeightfield(&field);
+
+		printf("%-26s %8.1f %10.1f %9d %12.6f\n", name, result[0] * 1000.0, result[1], levels, maxError);
+	}
+
+	for (f = 0; f < N_BENCH_HEIGHTMAP_FILES; f++)
+		remove(benchHeightmapFiles[f]);
+	free(heights);
+	free(row);
+	free(z);
+}
+
+/* Grid sizes regenerated by benchRebuild, and the rays cast each
+   frame as stand-in game work against the terrain in use */
+static const int benchRebuildSizes[] = { 200, 1024, 2048 };
+#define N_BENCH_REBUILD_SIZES (int)(sizeof(benchRebuildSizes) / sizeof(benchRebuildSizes[0]))
+#define BENCH_REBUILD_RAYS 256
+
+/* One frame of benchRebuildFrame's rays */
+typedef struct
+{
+	const Terrain *terrain;
+	int frame;
+} BenchRebuildFrame;
+
+static void benchRebuildRays(int begin, int end, void *data)
+{
+	const BenchRebuildFrame *frame = data;
+	const Terrain *terrain = frame->terrain;
+	RayHit hit;
+	int k;
+
+	for (k = begin; k < end; k++)
+	{
+		float x = ((k * 37 + frame->frame * 11) % 97 / 96.0f - 0.5f) * terrain->size;
+		float z = ((k * 53 + frame->frame * 7) % 89 / 88.0f - 0.5f) * terrain->size;
+
+		castHeightRay(&terrain->pyramid, cVec3f(x, 100.0f, z), cVec3f(0.0f, -200.0f, 0.0f), 1.0f, &hit);
+		coastDistance(&terrain->coast, x, z);
+	}
+}
+
+/* Casts the frame's rays down onto the terrain, spread over the
+   workers like the game's per frame work */
+static void benchRebuildFrame(const Terrain *terrain, int frame)
+{
+	BenchRebuildFrame job = { terrain, frame };
+
+	parallelFor(0, BENCH_REBUILD_RAYS, 16, benchRebuildRays, &job);
+}
+
+/* Changing the seed the old way, regenerating in place between two
+   frames, against building the new terrain on a thread while 60 Hz
+   frames keep using the old one, then swapping. The hitch is the
+   longest frame; in the background it's the swap, or freeing the old
+   terrain the frame after */
+static void benchRebuild(void)
+{
+	int s;
+
+	initJobs(0);
+	printf("rebuild: new seed in place against in the background at %.0f Hz, %d threads\n", BENCH_FLY_HZ,
+		jobThreadCount());
+	printf("%-6s %10s %10s %8s %12s %10s %10s\n", "grid", "sync ms", "build ms", "frames", "max frame ms",
+		"swap ms", "free ms");
+
+	for (s = 0; s < N_BENCH_REBUILD_SIZES; s++)
+	{
+		int size = benchRebuildSizes[s], frames = 0;
+		TerrainParams params;
+		TerrainRebuild rebuild;
+		Terrain terrain;
+		double start, sync, maxFrame = 0.0, freeSeconds = 0.0, next;
+		unsigned int oldSeed;
+
+		defaultTerrainParams(&params, size, size, 200, 40);
+		initTerrainWith(&terrain, &params);
+
+		/* In place: the frame waits for all of it */
+		params.seed++;
+		start = timeNow();
+		cleanupTerrain(&terrain);
+		initTerrainWith(&terrain, &params);
+		sync = timeNow() - start;
+
+		/* In the background */
+		memset(&rebuild, 0, sizeof(rebuild));
+		params.seed++;
+		oldSeed = terrain.params.seed;
+		requestTerrainRebuild(&rebuild, &params);
+		next = timeNow();
+		while (terrainRebuilding(&rebuild) || rebuild.hasRetired)
+		{
+			bool retiring = rebuild.hasRetired;
+			double frame;
+
+			start = timeNow();
+			swapRebuiltTerrain(&rebuild, &terrain);
+			benchRebuildFrame(&terrain, frames);
+			frame = timeNow() - start;
+			maxFrame = max(maxFrame, frame);
+			if (retiring)
+				freeSeconds = frame;
+			frames++;
+
+			next += 1.0 / BENCH_FLY_HZ;
+			sleepUntil(next);
+		}
+
+		printf("%-6d %10.1f %10.1f %8d %12.2f %10.3f %10.3f%s\n", size, sync * 1000.0,
+			rebuild.buildSeconds * 1000.0, frames, maxFrame * 1000.0, rebuild.swapSeconds * 1000.0,
+			freeSeconds * 1000.0, terrain.params.seed != oldSeed ? "" : " (not swapped)");
+
+		cleanupTerrainRebuild(&rebuild);
+		cleanupTerrain(&terrain);
+	}
+
+	cleanupJobs();
+}
+
+/* Fleet sizes benchMeshes loads the galleon for */
+static const int benchFleetSizes[] = { 2, 16, 64 };
+#define N_BENCH_FLEET_SIZES (int)(sizeof(benchFleetSizes) / sizeof(benchFleetSizes[0]))
+#define BENCH_MESH_FILE "galleon.obj"
+
+/* One ship's load, on a job as init does */
+typedef struct
+{
+	MeshAsset *asset;
+} BenchShipLoad;
+
+static void benchAcquireJob(void *data)
+{
+	BenchShipLoad *load = data;
+	load->asset = acquireMesh(BENCH_MESH_FILE);
+}
+
+/* Loading the galleon for every ship of a fleet with objMeshLoad, as
+   initBoat used to, against acquiring it from the mesh cache on a job
+   per ship at once. Bytes are the parsed vertices and indices, which
+   uploading would duplicate again on the GPU */
+static void benchMeshes(void)
+{
+	int f, k;
+
+	initJobs(0);
+	printf("meshes: %s per ship of a fleet, objMeshLoad each against the mesh cache, %d threads\n",
+		BENCH_MESH_FILE, jobThreadCount());
+	printf("%-6s %10s %10s %10s %10s %6s %6s %10s %7s\n", "ships", "load ms", "load MB", "cache ms",
+		"cache MB", "hits", "misses", "saved MB", "shared");
+
+	for (f = 0; f < N_BENCH_FLEET_SIZES; f++)
+	{
+		int n = benchFleetSizes[f], shared = 0;
+		OBJMesh **meshes = malloc(n * sizeof(OBJMesh *));
+		BenchShipLoad *loads = calloc(n, sizeof(BenchShipLoad));
+		Job **jobs = malloc(n * sizeof(Job *));
+		MeshCacheStats before, after;
+		double start, load, cached;
+		size_t loadBytes = 0;
+
+		start = timeNow();
+		for (k = 0; k < n; k++)
+		{
+			meshes[k] = objMeshLoad(BENCH_MESH_FILE);
+			if (!meshes[k])
+			{
+				printf("couldn't load %s\n", BENCH_MESH_FILE);
+				n = k;
+				break;
+			}
+			loadBytes += (size_t)meshes[k]->numVertices * meshes[k]->stride +
+				(size_t)meshes[k]->numIndices * sizeof(unsigned int);
+		}
+		load = timeNow() - start;
+		for (k = 0; k < n; k++)
+			objMeshFree(&meshes[k]);
+
+		getMeshCacheStats(&before);
+		start = timeNow();
+		for (k = 0; k < n; k++)
+		{
+			jobs[k] = createJob(benchAcquireJob, &loads[k]);
+			submitJob(jobs[k]);
+		}
+		for (k = 0; k < n; k++)
+			waitJob(jobs[k]);
+		cached = timeNow() - start;
+		getMeshCacheStats(&after);
+
+		for (k = 0; k < n; k++)
+			shared += loads[k].asset == loads[0].asset && loads[k].asset->mesh;
+		printf("%-6d %10.1f %10.2f %10.1f %10.2f %6d %6d %10.2f %4d/%d\n", n, load * 1000.0,
+			loadBytes / 1048576.0, cached * 1000.0, (after.bytesLoaded - before.bytesLoaded) / 1048576.0,
+			after.hits - before.hits, after.misses - before.misses,
+			(after.bytesSaved - before.bytesSaved) / 1048576.0, shared, n);
+
+		for (k = 0; k < n; k++)
+			releaseMesh(loads[k].asset);
+		free(meshes);
+		free(loads);
+		free(jobs);
+	}
+
+	cleanupJobs();
+}
+
+/* Triangles in the synthetic meshes benchMeshDraw plans, besides
+   the galleon */
+static const int benchMeshTriangles[] = { 1000, 100000, 1000000 };
+#define N_BENCH_MESH_TRIANGLES (int)(sizeof(benchMeshTriangles) / sizeof(benchMeshTriangles[0]))
+#define BENCH_MESH_FACESETS 8
+
+/* GL calls drawMeshRenderer makes for a renderer's ranges */
+static int meshRendererCalls(const MeshRenderer *renderer)
+{
+	int r, calls = 10 + 2 * renderer->hasNormals + 2 * renderer->hasTexCoords;
+
+	for (r = 0; r < renderer->nRanges; r++)
+		calls += 2 + (renderer->ranges[r].material >= 0 ? 4 : 0);
+	return calls;
+}
+
+/* Prints one mesh's row of benchMeshDraw */
+static void benchMeshDrawRow(const char *name, const OBJMesh *mesh)
+{
+	MeshRenderer renderer;
+	double start, plan;
+
+	start = timeNow();
+	buildMeshRanges(&renderer, mesh);
+	plan = timeNow() - start;
+
+	printf("%-12s %10d %9d %7d %12d %10d %10.2f %10.2f %9.3f\n", name, mesh->numIndices / 3,
+		mesh->numFacesets, renderer.nRanges, mesh->numIndices * (1 + (mesh->hasNormals != 0)) + 2,
+		meshRendererCalls(&renderer), mesh->numIndices * sizeof(unsigned int) / 1048576.0,
+		renderer.indexBytes / 1048576.0, plan * 1000.0);
+	cleanupMeshRenderer(&renderer);
+}
+
+/* What a boat's draw costs the CPU: GL calls per frame drawing the
+   mesh in immediate mode, as drawMesh does, against the ranges of a
+   MeshRenderer, for the galleon and for meshes of growing triangle
+   counts split into facesets with their own materials. There's no GL
+   context here, so calls are counted rather than timed; the renderer's
+   stay the same whatever the triangle count */
+static void benchMeshDraw(void)
+{
+	int t, k;
+	OBJMesh *galleon = objMeshLoad(BENCH_MESH_FILE);
+
+	printf("meshdraw: GL calls per draw, immediate against indexed buffer ranges\n");
+	printf("%-12s %10s %9s %7s %12s %10s %10s %10s %9s\n", "mesh", "triangles", "facesets", "ranges",
+		"immediate", "buffered", "u32 MB", "index MB", "plan ms");
+
+	if (galleon)
+	{
+		benchMeshDrawRow(BENCH_MESH_FILE, galleon);
+		objMeshFree(&galleon);
+	}
+
+	for (t = 0; t < N_BENCH_MESH_TRIANGLES; t++)
+	{
+		int nTriangles = benchMeshTriangles[t], nVertices = min(nTriangles * 3, 60000);
+		OBJMesh mesh;
+		OBJMaterial materials[BENCH_MESH_FACESETS];
+		OBJFaceSet facesets[BENCH_MESH_FACESETS];
+		char name[32];
+
+		memset(&mesh, 0, sizeof(mesh));
+		memset(materials, 0, sizeof(materials));
+		mesh.numVertices = nVertices;
+		mesh.numIndices = nTriangles * 3;
+		mesh.hasNormals = 1;
+		mesh.normalOffset = 3 * sizeof(float);
+		mesh.stride = 6 * sizeof(float);
+		mesh.indices = malloc(mesh.numIndices * sizeof(unsigned int));
+		for (k = 0; k < mesh.numIndices; k++)
+			mesh.indices[k] = k % nVertices;
+
+		/* Equal runs, alternating between two materials */
+		mesh.numFacesets = mesh.numMaterials = BENCH_MESH_FACESETS;
+		mesh.facesets = facesets;
+		mesh.materials = materials;
+		for (k = 0; k < BENCH_MESH_FACESETS; k++)
+		{
+			facesets[k].material = k % 2;
+			facesets[k].smooth = 1;
+			facesets[k].indexStart = nTriangles * k / BENCH_MESH_FACESETS * 3;
+			facesets[k].indexEnd = nTriangles * (k + 1) / BENCH_MESH_FACESETS * 3;
+		}
+
+		snprintf(name, sizeof(name), "%dk tris", nTriangles / 1000);
+		benchMeshDrawRow(name, &mesh);
+		free(mesh.indices);
+	}
+}
+
+/* Boats in the fleets benchFleet updates and draws */
+static const int benchBoatCounts[] = { 2, 100, 1000 };
+#define N_BENCH_BOAT_COUNTS (int)(sizeof(benchBoatCounts) / sizeof(benchBoatCounts[0]))
+#define BENCH_FLEET_FRAMES 300
+
+/* A boat as it was kept before the fleet, a struct each */
+typedef struct
+{
+	Vec3f pos;
+	float heading, speed, turnVelocity, roll, pitch;
+	float throttle, steer;
+} BenchBoat;
+
+/* What updateBoat did for one boat */
+static void benchUpdateBoat(BenchBoat *boat, float dt)
+{
+	Vec4f v;
+	float dirX = sinf(boat->heading * M_PI / 180.0), dirZ = cosf(boat->heading * M_PI / 180.0);
+
+	boat->speed = clamp(boat->speed + BOAT_ACCELERATION * boat->throttle * dt, 0, BOAT_MAX_SPEED);
+	boat->turnVelocity = clamp(boat->turnVelocity + BOAT_TURNING_ACCELERATION * boat->steer * dt,
+		-fabs(boat->speed) * 5.0, fabs(boat->speed) * 5.0);
+	boat->turnVelocity -= min(fabs(boat->turnVelocity), 0.5) * (boat->turnVelocity > 0 ? 1 : -1);
+	boat->heading += boat->turnVelocity * dt;
+	boat->pos.x += dirX * boat->speed * dt;
+	boat->pos.z += dirZ * boat->speed * dt;
+
+	v = calcSineValue(boat->pos.x, boat->pos.z);
+	boat->pos.y = v.w - BOAT_DISPLACEMENT;
+	boat->roll = asin(v.x) * 180.0 / M_PI;
+	boat->pitch = asin(v.z) * 180.0 / M_PI;
+}
+
+/* GL calls drawMeshInstances makes for n instances, with the ambient
+   changing nAmbients times along them */
+static int meshInstanceCalls(const MeshRenderer *renderer, int n, int nAmbients)
+{
+	int r, calls = 13 + 2 * renderer->hasNormals + 2 * renderer->hasTexCoords;
+
+	for (r = 0; r < renderer->nRanges; r++)
+		calls += 1 + 2 * n + (renderer->ranges[r].material >= 0 ? 4 : nAmbients);
+	return calls;
+}
+
+/* Updating and drawing fleets of growing size: a struct per boat
+   stepped one at a time as updateBoat did, against the fleet's
+   arrays stepped a pass at a time with the waves sampled in one
+   batch. Draws are counted in GL calls (there's no context here),
+   drawBoat's transform, material and drawMeshRenderer per boat
+   against one drawMeshInstances for the fleet */
+static void benchFleet(void)
+{
+	static const float ambient[] = { 0.3f, 0.3f, 0.3f, 1.0f };
+	OBJMesh *galleon = objMeshLoad(BENCH_MESH_FILE);
+	MeshRenderer renderer;
+	int c, k, f;
+
+	initJobs(0);
+	if (galleon)
+		buildMeshRanges(&renderer, galleon);
+	else
+	{
+		/* One range of the caller's material, like the galleon */
+		memset(&renderer, 0, sizeof(renderer));
+		renderer.hasNormals = true;
+		renderer.nRanges = 1;
+		renderer.ranges = calloc(1, sizeof(MeshDrawRange));
+		renderer.ranges[0].material = -1;
+	}
+
+	printf("fleet: %d frames of boats sailing in circles, %s, %d threads\n", BENCH_FLEET_FRAMES,
+		galleon ? BENCH_MESH_FILE : "one range mesh", jobThreadCount());
+	printf("%-6s %12s %12s %8s %12s %12s %10s %10s\n", "boats", "boat us/boat", "fleet us/boat", "speedup",
+		"boat calls", "fleet calls", "per boat", "max error");
+
+	for (c = 0; c < N_BENCH_BOAT_COUNTS; c++)
+	{
+		int n = benchBoatCounts[c];
+		BenchBoat *boats = calloc(n, sizeof(BenchBoat));
+		Fleet fleet;
+		double start, scalar, batched;
+		float error = 0.0f;
+		int boatCalls, fleetCalls;
+
+		initFleet(&fleet, n, NULL);
+		srand(1234);
+		for (k = 0; k < n; k++)
+		{
+			Vec3f pos = cVec3f((rand() / (float)RAND_MAX - 0.5f) * 200.0f, 0.3f,
+				(rand() / (float)RAND_MAX - 0.5f) * 200.0f);
+			int boat = addBoat(&fleet, pos, ambient);
+
+			fleet.throttle[boat] = 1.0f;
+			fleet.steer[boat] = k % 2 ? 1.0f : -1.0f;
+			boats[k].pos = pos;
+			boats[k].heading = fleet.heading[boat];
+			boats[k].throttle = fleet.throttle[boat];
+			boats[k].steer = fleet.steer[boat];
+		}
+
+		start = timeNow();
+		for (f = 0; f < BENCH_FLEET_FRAMES; f++)
+			for (k = 0; k < n; k++)
+				benchUpdateBoat(&boats[k], 1.0f / BENCH_FLY_HZ);
+		scalar = timeNow() - start;
+
+		start = timeNow();
+		for (f = 0; f < BENCH_FLEET_FRAMES; f++)
+			updateFleet(&fleet, 1.0f / BENCH_FLY_HZ);
+		batched = timeNow() - start;
+
+		/* Both should have sailed the same courses */
+		for (k = 0; k < n; k++)
+			error = max(error, getDistanceDiff(boats[k].pos, boatPos(&fleet, k)));
+
+		/* The two players' colours, then everyone else's */
+		boatCalls = n * (15 + meshRendererCalls(&renderer));
+		fleetCalls = 3 + meshInstanceCalls(&renderer, n, min(n, 3));
+		printf("%-6d %12.3f %12.3f %7.1fx %12d %12d %10.2f %10.4f\n", n,
+			scalar * 1e6 / ((double)n * BENCH_FLEET_FRAMES), batched * 1e6 / ((double)n * BENCH_FLEET_FRAMES),
+			scalar / batched, boatCalls, fleetCalls, fleetCalls / (double)n, error);
+
+		cleanupFleet(&fleet);
+		free(boats);
+	}
+
+	if (galleon)
+		objMeshFree(&galleon);
+	cleanupMeshRenderer(&renderer);
+	cleanupJobs();
+}
+
+/* Fleets benchContacts tests, each ship with a rack of balls in the
+   air around it */
+static const int benchContactBoats[] = { 100, 1000 };
+#define N_BENCH_CONTACT_BOATS (int)(sizeof(benchContactBoats) / sizeof(benchContactBoats[0]))
+#define BENCH_CONTACT_DENSITY 250.0f	/* Square units of sea per boat */
+#define BENCH_CONTACT_SPREAD 30.0f	/* Balls are this far around their ship */
+#define BENCH_BALLS_PER_BOAT 50
+
+/* Every sphere-sphere test done pair by pair, as ballsHitBoat and
+   boatsCollided were used, against the spatial hashes of
+   findFleetContacts: boats against boats, balls in flight against
+   other ships and against other ships' balls in flight. Both count the
+   same contacts */
+static void benchContacts(void)
+{
+	static const float ambient[] = { 0.3f, 0.3f, 0.3f, 1.0f };
+	int c, i, j;
+
+	printf("contacts: boats, balls in the air, pair by pair against spatial hashes\n");
+	printf("%-6s %7s %12s %12s %10s %12s %8s %8s %8s %8s\n", "boats", "balls", "pair tests", "pair ms",
+		"hash ms", "candidates", "speedup", "boat", "hits", "clashes");
+
+	for (c = 0; c < N_BENCH_CONTACT_BOATS; c++)
+	{
+		int nBoats = benchContactBoats[c], nBalls = nBoats * BENCH_BALLS_PER_BOAT;
+		float side = sqrtf(nBoats * BENCH_CONTACT_DENSITY);
+		int boatPairs = 0, ballHits = 0, ballClashes = 0;
+		double start, pairwise, hashed;
+		long long tests = 0;
+		Fleet fleet;
+		BallPool pool;
+		FleetContacts contacts;
+
+		initFleet(&fleet, nBoats, NULL);
+		initBallPool(&pool, nBalls);
+		initFleetContacts(&contacts);
+		srand(1234);
+		for (i = 0; i < nBoats; i++)
+		{
+			Vec3f pos = cVec3f((rand() / (float)RAND_MAX - 0.5f) * side, 0.4f,
+				(rand() / (float)RAND_MAX - 0.5f) * side);
+			int boat = addBoat(&fleet, pos, ambient);
+
+			for (j = 0; j < BENCH_BALLS_PER_BOAT; j++)
+			{
+				CannonBall *ball = spawnBall(&pool, boat);
+
+				ball->pos = cVec3f(pos.x + (rand() / (float)RAND_MAX - 0.5f) * 2.0f * BENCH_CONTACT_SPREAD,
+					rand() / (float)RAND_MAX * 10.0f,
+					pos.z + (rand() / (float)RAND_MAX - 0.5f) * 2.0f * BENCH_CONTACT_SPREAD);
+				ball->radius = BALL_RADIUS;
+				ball->state = j % 10 == 0 ? BALL_LANDED : BALL_FLYING;
+			}
+		}
+
+		start = timeNow();
+		for (i = 0; i < nBoats; i++)
+			for (j = i + 1; j < nBoats; j++)
+				boatPairs += boatsCollided(&fleet, i, j);
+		for (i = 0; i < nBalls; i++)
+		{
+			CannonBall *ball = &pool.balls[i];
+			float reach = (BOAT_RADIUS + ball->radius) - COLLISION_OFFSET;
+
+			for (j = 0; j < nBoats; j++)
+				ballHits += ball->state == BALL_FLYING && j != ball->owner &&
+					getDistanceSquared(boatPos(&fleet, j), ball->pos) < reach * reach;
+		}
+		for (i = 0; i < nBalls; i++)
+		{
+			CannonBall *a = &pool.balls[i];
+
+			if (a->state == BALL_LANDED)
+				continue;
+			for (j = i + 1; j < nBalls; j++)
+			{
+				CannonBall *b = &pool.balls[j];
+				float reach = a->radius + b->radius;
+
+				ballClashes += b->state != BALL_LANDED && a->owner != b->owner &&
+					getDistanceSquared(a->pos, b->pos) < reach * reach;
+			}
+		}
+		pairwise = timeNow() - start;
+		tests = (long long)nBoats * (nBoats - 1) / 2 + (long long)nBalls * nBoats + (long long)nBalls * (nBalls - 1) / 2;
+
+		start = timeNow();
+		findFleetContacts(&contacts, &fleet, &pool);
+		hashed = timeNow() - start;
+
+		printf("%-6d %7d %12lld %12.1f %10.2f %12d %7.0fx %4d/%-3d %4d/%-3d %4d/%-3d\n", nBoats, nBalls, tests,
+			pairwise * 1000.0, hashed * 1000.0, contacts.candidates, pairwise / hashed,
+			contacts.nBoatContacts, boatPairs, contacts.ballHits, ballHits, contacts.ballClashes, ballClashes);
+
+		cleanupFleetContacts(&contacts);
+		cleanupBallPool(&pool);
+		cleanupFleet(&fleet);
+	}
+}
+
+/* Fleets benchBalls fires from, with a pool big enough for what
+   they keep in the air, over BENCH_BALL_FRAMES at BENCH_FLY_HZ */
+static const int benchBallBoats[] = { 10, 100, 1000 };
+static const int benchBallCapacities[] = { 256, 2048, 16384 };
+#define N_BENCH_BALL_BOATS (int)(sizeof(benchBallBoats) / sizeof(benchBallBoats[0]))
+#define BENCH_BALL_FRAMES 1200
+#define BENCH_BALL_FIRE_CHANCE 0.02f	/* A boat fires a broadside this often a frame */
+
+/* The balls as they were kept before the pool: appended and never
+   taken out, so every frame walks over the dead ones too */
+static void benchUpdateAppended(CannonBall *balls, int n, Terrain *terrain, float dt)
+{
+	int i;
+	Vec3f from;
+	RayHit hit;
+
+	for (i = 0; i < n; i++)
+	{
+		CannonBall *ball = &balls[i];
+
+		if (ball->state == BALL_SPENT)
+			continue;
+		ball->life -= dt;
+		if (ball->life <= 0)
+		{
+			ball->state = BALL_SPENT;
+			continue;
+		}
+		if (ball->state == BALL_FLYING)
+		{
+			from = ball->pos;
+			updateBall(ball, dt);
+			if (ball->pos.y < BALL_SUNK_DEPTH)
+				ball->state = BALL_SPENT;
+			else if (castHeightSegment(&terrain->pyramid, from, ball->pos, &hit))
+			{
+				ball->pos = hit.pos;
+				ball->state = BALL_LANDED;
+				ball->life = BALL_LANDED_LIFETIME;
+				deformTerrain(terrain, hit.pos.x, hit.pos.z, CRATER_RADIUS, -CRATER_DEPTH);
+			}
+		}
+	}
+}
+
+/* Boats firing broadsides at random for BENCH_BALL_FRAMES, the balls
+   updated in the pool against the same shots appended to one array.
+   Both fly over their own copy of the terrain, flushed outside the
+   timing */
+static void benchBalls(void)
+{
+	static const float ambient[] = { 0.3f, 0.3f, 0.3f, 1.0f };
+	float dt = 1.0f / BENCH_FLY_HZ;
+	int c, k, f;
+
+	initJobs(0);
+	printf("balls: %d frames of random broadsides, pooled against append only, %d threads\n",
+		BENCH_BALL_FRAMES, jobThreadCount());
+	printf("%-6s %8s %8s %8s %9s %8s %12s %12s %8s %10s %10s\n", "boats", "capacity", "fired", "peak",
+		"recycled", "dropped", "pool us/fr", "append us/fr", "speedup", "pool KB", "append KB");
+
+	for (c = 0; c < N_BENCH_BALL_BOATS; c++)
+	{
+		int n = benchBallBoats[c], peak = 0, nAppended = 0;
+		CannonBall *appended = malloc((size_t)n * 2 * BENCH_BALL_FRAMES * sizeof(CannonBall));
+		double start, pooled = 0.0, append = 0.0;
+		Terrain terrains[2];
+		BallPool pool;
+		Fleet fleet;
+
+		initTerrain(&terrains[0], 200, 200, 200, 40);
+		initTerrain(&terrains[1], 200, 200, 200, 40);
+		initFleet(&fleet, n, NULL);
+		initBallPool(&pool, benchBallCapacities[c]);
+		srand(1234);
+		for (k = 0; k < n; k++)
+			addBoat(&fleet, cVec3f((rand() / (float)RAND_MAX - 0.5f) * 200.0f, 0.3f,
+				(rand() / (float)RAND_MAX - 0.5f) * 200.0f), ambient);
+
+		for (f = 0; f < BENCH_BALL_FRAMES; f++)
+		{
+			for (k = 0; k < n; k++)
+			{
+				int before = pool.nBalls;
+
+				if (rand() / (float)RAND_MAX >= BENCH_BALL_FIRE_CHANCE)
+					continue;
+				initBall(&pool, &fleet, k, true);
+				initBall(&pool, &fleet, k, false);
+
+				/* The same shots, for the append only array */
+				memcpy(&appended[nAppended], &pool.balls[before], (pool.nBalls - before) * sizeof(CannonBall));
+				nAppended += pool.nBalls - before;
+			}
+			peak = max(peak, pool.nBalls);
+
+			start = timeNow();
+			updateAllBalls(&pool, &terrains[0], NULL, dt);
+			pooled += timeNow() - start;
+
+			start = timeNow();
+			benchUpdateAppended(appended, nAppended, &terrains[1], dt);
+			append += timeNow() - start;
+
+			flushTerrainEdits(&terrains[0]);
+			flushTerrainEdits(&terrains[1]);
+		}
+
+		printf("%-6d %8d %8d %8d %9d %8d %12.2f %12.2f %7.1fx %10.1f %10.1f\n", n, pool.capacity, pool.fired,
+			peak, pool.recycled, pool.dropped, pooled * 1e6 / BENCH_BALL_FRAMES, append * 1e6 / BENCH_BALL_FRAMES,
+			append / pooled, pool.capacity * sizeof(CannonBall) / 1024.0, nAppended * sizeof(CannonBall) / 1024.0);
+
+		cleanupBallPool(&pool);
+		cleanupFleet(&fleet);
+		cleanupTerrain(&terrains[0]);
+		cleanupTerrain(&terrains[1]);
+		free(appended);
+	}
+	cleanupJobs();
+}
+
+/* Every benchmark, by the name used on the command line */
+static const struct
+{
+	const char *name;
+	void (*run)(void);
+} benchmarks[] = {
+	{ "jobs", benchJobs },
+	{ "spectrum", benchSpectrum },
+	{ "ocean", benchOcean },
+	{ "clipmap", benchClipmap },
+	{ "topology", benchTopology },
+	{ "cdlod", benchCDLOD },
+	{ "noise", benchNoise },
+	{ "coast", benchCoast },
+	{ "raycast", benchRaycast },
+	{ "cache", benchCache },
+	{ "deform", benchDeform },
+	{ "tiles", benchTiles },
+	{ "heightmap", benchHeightmap },
+	{ "rebuild", benchRebuild },
+	{ "meshes", benchMeshes },
+	{ "meshdraw", benchMeshDraw },
+	{ "fleet", benchFleet },
+	{ "contacts", benchContacts },
+	{ "balls", benchBalls },
+};
+#define N_BENCHMARKS (int)(sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+/* Runs the named benchmarks, or all of them */
+int runBenchmarks(int argc, char **argv)
+{
+	int i, j, ran = 0;
+
+	/* Don't leave cache files behind for every size benchmarked */
+	setTerrainCaching(false);
+
+	for (i = 0; i < N_BENCHMARKS; i++)
+	{
+		bool selected = argc <= 2;
+		for (j = 2; j < argc; j++)
+			if (strcmp(argv[j], benchmarks[i].name) == 0)
+				selected = true;
+
+		if (selected)
+		{
+			benchmarks[i].run();
+			printf("\n");
+			ran++;
+		}
+	}
+
+	if (!ran)
+	{
+		printf("Unknown benchmark, available:");
+		for (i = 0; i < N_BENCHMARKS; i++)
+			printf(" %s", benchmarks[i].name);
+		printf("\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Runs the benchmarks named on the command line (all of them if none
+   are given) and prints the results to stdout. Used by
+   "i3dAssign2 --bench [name...]", which runs without opening a window */
+int runBenchmarks(int argc, char **argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,12 +1,20 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "boat.h"
 #include "controls.h"
 #include "waves.h"
+#include "waves_simd.h"
+#include "frustum.h"
 #include "gl.h"
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BOAT_X86 1
+#include <immintrin.h>
+#endif
+
 #ifndef min
 #define min(a, b) (a <= b ? a : b)
 #endif
@@ -22,30 +30,125 @@
 #define myCrossPlatformMin(a, b) ((a)<(b)?(a):(b))
 #define sign(val) ((val)>0?1:-1)
 
-/* Initialises the given boat with default values, and loads the obj
-   file given by the filename */
-void initBoat(Boat *boat, const char *meshFilename, Vec3f position)
+/* Rounds a boat count up to whole batches of the wave kernel */
+static int paddedBoats(int n)
 {
-	boat->damage = 0;
-	boat->radius = BOAT_RADIUS;
-	boat->pos = position;
-	boat->heading = 90; /* The gallon obj faces this direction initially */
-	boat->speed = 0;
-	boat->maxSpeed = 5.0;
-	boat->acceleration = 3.0;
-	boat->turningAcceleration = 50.0;
-	boat->turnVelocity = 0;
-	boat->displacement = -0.4;
-	boat->roll = 0;
-	boat->pitch = 0;
-	
-	boat->nBalls = 0;
-	boat->balls = malloc(MAX_CANNON_BALLS * sizeof(CannonBall));
-	
-	boat->mesh = objMeshLoad(meshFilename);
+	return (n + WAVE_SIMD_WIDTH - 1) & ~(WAVE_SIMD_WIDTH - 1);
+}
+
+static void orientBoats(Fleet *fleet, int begin, int end);
+
+static float *fleetArray(int capacity, int components)
+{
+	return alignedCalloc(paddedBoats(capacity) * components, sizeof(float), WAVE_SIMD_ALIGN);
+}
+
+/* Allocates the fleet's arrays, and acquires the obj file given by
+   the filename unless another fleet (or an older boat) already has */
+void initFleet(Fleet *fleet, int capacity, const char *meshFilename)
+{
+	memset(fleet, 0, sizeof(*fleet));
+	fleet->capacity = capacity;
+
+	fleet->posX = fleetArray(capacity, 1);
+	fleet->posY = fleetArray(capacity, 1);
+	fleet->posZ = fleetArray(capacity, 1);
+	fleet->heading = fleetArray(capacity, 1);
+	fleet->dirX = fleetArray(capacity, 1);
+	fleet->dirZ = fleetArray(capacity, 1);
+	fleet->speed = fleetArray(capacity, 1);
+	fleet->turnVelocity = fleetArray(capacity, 1);
+	fleet->roll = fleetArray(capacity, 1);
+	fleet->pitch = fleetArray(capacity, 1);
+	fleet->throttle = fleetArray(capacity, 1);
+	fleet->steer = fleetArray(capacity, 1);
+	fleet->waveY = fleetArray(capacity, 1);
+	fleet->waveNX = fleetArray(capacity, 1);
+	fleet->waveNY = fleetArray(capacity, 1);
+	fleet->waveNZ = fleetArray(capacity, 1);
+	fleet->transforms = fleetArray(capacity, 16);
+	fleet->ambients = fleetArray(capacity, 4);
+	fleet->damage = calloc(max(capacity, 1), sizeof(int));
+	fleet->visible = calloc(max(capacity, 1), sizeof(int));
+
+	if (meshFilename)
+	{
+		fleet->asset = acquireMesh(meshFilename);
+		fleet->mesh = fleet->asset->mesh;
+	}
+}
+
+void cleanupFleet(Fleet *fleet)
+{
+	alignedFree(fleet->posX);
+	alignedFree(fleet->posY);
+	alignedFree(fleet->posZ);
+	alignedFree(fleet->heading);
+	alignedFree(fleet->dirX);
+	alignedFree(fleet->dirZ);
+	alignedFree(fleet->speed);
+	alignedFree(fleet->turnVelocity);
+	alignedFree(fleet->roll);
+	alignedFree(fleet->pitch);
+	alignedFree(fleet->throttle);
+	alignedFree(fleet->steer);
+	alignedFree(fleet->waveY);
+	alignedFree(fleet->waveNX);
+	alignedFree(fleet->waveNY);
+	alignedFree(fleet->waveNZ);
+	alignedFree(fleet->transforms);
+	alignedFree(fleet->ambients);
+	free(fleet->damage);
+	free(fleet->visible);
+	releaseMesh(fleet->asset);
+	memset(fleet, 0, sizeof(*fleet));
+}
+
+int addBoat(Fleet *fleet, Vec3f position, const float *ambient)
+{
+	int i = fleet->nBoats;
+
+	if (i >= fleet->capacity)
+		return -1;
+	fleet->nBoats++;
+
+	fleet->posX[i] = position.x;
+	fleet->posY[i] = position.y;
+	fleet->posZ[i] = position.z;
+	fleet->heading[i] = 90; /* The gallon obj faces this direction initially */
+	fleet->dirX[i] = 1;
+	fleet->dirZ[i] = 0;
+	fleet->speed[i] = 0;
+	fleet->turnVelocity[i] = 0;
+	fleet->roll[i] = 0;
+	fleet->pitch[i] = 0;
+	fleet->throttle[i] = 0;
+	fleet->steer[i] = 0;
+	fleet->damage[i] = 0;
+	memcpy(fleet->ambients + i * 4, ambient, 4 * sizeof(float));
+
+	/* Level at the given height until the first update */
+	fleet->waveY[i] = position.y + BOAT_DISPLACEMENT;
+	fleet->waveNX[i] = 0;
+	fleet->waveNY[i] = 1;
+	fleet->waveNZ[i] = 0;
+	orientBoats(fleet, i, i + 1);
+	return i;
 }
 
-/* Draws the obj mesh */
+void steerBoat(Fleet *fleet, int boat, bool up, bool down, bool left, bool right)
+{
+	fleet->throttle[boat] = (float)up - (float)down;
+	fleet->steer[boat] = (float)left - (float)right;
+}
+
+Vec3f boatPos(Fleet *fleet, int boat)
+{
+	return cVec3f(fleet->posX[boat], fleet->posY[boat], fleet->posZ[boat]);
+}
+
+/* Draws the obj mesh in immediate mode, a couple of calls per index.
+   Boats draw through their MeshAsset instead */
 void drawMesh(OBJMesh *mesh)
 {
 	glBegin(GL_TRIANGLES);
@@ -61,217 +164,496 @@ void drawMesh(OBJMesh *mesh)
 	glEnd();
 }
 
-/* Draws the given boat */
-void drawBoat(Boat *boat, float* ambient)
+/* Draws the boats in view from the mesh they share, each under its
+   transform and in its own ambient colour */
+void drawFleet(Fleet *fleet)
 {
-	/* Draw the boat as red to contrast with the waves */
 	static float diffuse[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-	//static float ambient[] = { 1.0f, 0.0f, 0.0f, 1.0f };
 	static float specular[] = { 1.0f, 1.0f, 1.0f, 1.0f };
 	static float shininess = 256.0f;
+	int i, nVisible = 0;
 
-	glPushMatrix();
+	/* Skip boats outside the viewport's frustum */
+	for (i = 0; i < fleet->nBoats; i++)
+		if (sphereVisible(CULL_BOATS, boatPos(fleet, i), BOAT_RADIUS))
+			fleet->visible[nVisible++] = i;
 
-	glTranslatef(boat->pos.x, boat->pos.y, boat->pos.z);
-	
-	if (controls.wireframe)
-		glutWireSphere(BOAT_RADIUS, 20, 20);
-	
-	if (controls.axes)
-		drawAxes(cVec3f(0, 0, 0), cVec3f(10, 10, 10));
-	
-	glRotatef(boat->roll, 0, 0, -1);
-	glRotatef(boat->pitch, 1, 0, 0);
-	glRotatef(boat->heading, 0, 1, 0);
-
-	if (controls.axes)
-		drawAxes(cVec3f(0, 0, 0), cVec3f(10, 10, 10));
+	if (controls.wireframe || controls.axes)
+	{
+		for (i = 0; i < nVisible; i++)
+		{
+			int boat = fleet->visible[i];
+
+			glPushMatrix();
+			glTranslatef(fleet->posX[boat], fleet->posY[boat], fleet->posZ[boat]);
+			if (controls.wireframe)
+				glutWireSphere(BOAT_RADIUS, 20, 20);
+			if (controls.axes)
+				drawAxes(cVec3f(0, 0, 0), cVec3f(10, 10, 10));
+			glPopMatrix();
+		}
+	}
 
-	/* The boat is a little big */
-	glScalef(0.1, 0.1, 0.1);
-	glPushMatrix();
-	glRotatef(-90, 0, 1, 0); /* To account for the initial heading */
+	if (nVisible == 0 || !uploadMeshAsset(fleet->asset))
+		return;
 
 	/* Apply the material, this will interact with the light to
-	   produce the final colour */
-	glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, ambient);
+	   produce the final colour. The ambient is each boat's own */
 	glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, diffuse);
 	glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, specular);
 	glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, shininess);
 
-	drawMesh(boat->mesh);
-	glPopMatrix();
+	/* From the buffers every boat shares, with their state set up
+	   once for the lot */
+	drawMeshInstances(&fleet->asset->renderer, fleet->transforms, fleet->ambients,
+		fleet->visible, nVisible);
+}
 
-	glPopMatrix();
+#ifdef BOAT_X86
+/* Speeds, turn rates and positions from the input, four boats at a
+   time for boats [0, n) where n is padded to a multiple of four */
+__attribute__((target("sse2")))
+static void moveBoats(Fleet *fleet, int n, float dt)
+{
+	const __m128 zero = _mm_setzero_ps(), signMask = _mm_set1_ps(-0.0f);
+	const __m128 maxSpeed = _mm_set1_ps(BOAT_MAX_SPEED), five = _mm_set1_ps(5.0f), half = _mm_set1_ps(0.5f);
+	const __m128 acceleration = _mm_set1_ps(BOAT_ACCELERATION * dt);
+	const __m128 turning = _mm_set1_ps(BOAT_TURNING_ACCELERATION * dt), step = _mm_set1_ps(dt);
+	int i;
 
-	glPopMatrix();
+	for (i = 0; i < n; i += 4)
+	{
+		__m128 s = _mm_add_ps(_mm_load_ps(fleet->speed + i), _mm_mul_ps(acceleration, _mm_load_ps(fleet->throttle + i)));
+		__m128 tv = _mm_add_ps(_mm_load_ps(fleet->turnVelocity + i), _mm_mul_ps(turning, _mm_load_ps(fleet->steer + i)));
+		__m128 limit, damping, distance;
+
+		/* Limit the boat speed, and the turning speed to 5x it */
+		s = _mm_min_ps(_mm_max_ps(s, zero), maxSpeed);
+		limit = _mm_mul_ps(s, five);
+		tv = _mm_min_ps(_mm_max_ps(tv, _mm_sub_ps(zero, limit)), limit);
+
+		/* Damp the turn by up to 0.5 towards zero */
+		damping = _mm_min_ps(_mm_andnot_ps(signMask, tv), half);
+		tv = _mm_sub_ps(tv, _mm_or_ps(damping, _mm_and_ps(signMask, tv)));
+
+		distance = _mm_mul_ps(s, step);
+		_mm_store_ps(fleet->heading + i, _mm_add_ps(_mm_load_ps(fleet->heading + i), _mm_mul_ps(tv, step)));
+		_mm_store_ps(fleet->posX + i, _mm_add_ps(_mm_load_ps(fleet->posX + i), _mm_mul_ps(_mm_load_ps(fleet->dirX + i), distance)));
+		_mm_store_ps(fleet->posZ + i, _mm_add_ps(_mm_load_ps(fleet->posZ + i), _mm_mul_ps(_mm_load_ps(fleet->dirZ + i), distance)));
+		_mm_store_ps(fleet->speed + i, s);
+		_mm_store_ps(fleet->turnVelocity + i, tv);
+	}
 }
+#else
+/* Speeds, turn rates and positions from the input, for boats [0, n) */
+static void moveBoats(Fleet *fleet, int n, float dt)
+{
+	int i;
 
-/* Updates the boat's position based on movement flags */
-void updateBoat(Boat *boat, bool up, bool down, bool left, bool right, float dt, bool *fireleft, bool *fireright)
+	for (i = 0; i < n; i++)
+	{
+		float s = fleet->speed[i] + BOAT_ACCELERATION * dt * fleet->throttle[i];
+		float tv = fleet->turnVelocity[i] + BOAT_TURNING_ACCELERATION * dt * fleet->steer[i];
+
+		/* Limit the boat speed */
+		s = clamp(s, 0.0f, BOAT_MAX_SPEED);
+
+		/* Limit turning speed relative to 5x boat speed in degrees
+		   per second */
+		tv = clamp(tv, -s * 5.0f, s * 5.0f);
+
+		/* Apply turning velocity damping (so the ship stops turning
+		   when the button is released) */
+		tv -= copysignf(min(fabsf(tv), 0.5f), tv);
+
+		/* Move the ship forwards at its current speed, along the
+		   heading it had before turning */
+		fleet->heading[i] += tv * dt;
+		fleet->posX[i] += fleet->dirX[i] * s * dt;
+		fleet->posZ[i] += fleet->dirZ[i] * s * dt;
+		fleet->speed[i] = s;
+		fleet->turnVelocity[i] = tv;
+	}
+}
+#endif
+
+/* Floats boats [begin, end) on the wave samples under them, and
+   builds their transforms: translate, roll, pitch and heading as
+   they were drawn with glRotatef, then the mesh's scale and a turn
+   of -90 degrees for the way it faces */
+static void orientBoats(Fleet *fleet, int begin, int end)
 {
-	Vec4f v;
-	Vec2f headingDir;
+	int i;
 
-	/* Check flag states and add or sbtract from the forward/turn
-	   rate of the boat */
-	if (up) boat->speed += boat->acceleration * dt;
-	if (down) boat->speed -= boat->acceleration * dt;
+	for (i = begin; i < end; i++)
+	{
+		float *m = fleet->transforms + (size_t)i * 16;
+		float sr = fleet->waveNX[i], sp = fleet->waveNZ[i];
+		float cr = sqrtf(max(1.0f - sr * sr, 0.0f)), cp = sqrtf(max(1.0f - sp * sp, 0.0f));
+		float h = fleet->heading[i] * (float)M_PI / 180.0f;
+		float sh = sinf(h), ch = cosf(h);
+
+		fleet->posY[i] = fleet->waveY[i] - BOAT_DISPLACEMENT;
+		fleet->roll[i] = asinf(sr) * 180.0f / (float)M_PI;
+		fleet->pitch[i] = asinf(sp) * 180.0f / (float)M_PI;
+		fleet->dirX[i] = sh;
+		fleet->dirZ[i] = ch;
+
+		/* Rz(-roll) Rx(pitch) Ry(heading - 90), where the sine and
+		   cosine of heading - 90 are -ch and sh */
+		m[0] = (cr * sh - sr * sp * ch) * BOAT_MESH_SCALE;
+		m[1] = (-sr * sh - cr * sp * ch) * BOAT_MESH_SCALE;
+		m[2] = cp * ch * BOAT_MESH_SCALE;
+		m[3] = 0;
+		m[4] = sr * cp * BOAT_MESH_SCALE;
+		m[5] = cr * cp * BOAT_MESH_SCALE;
+		m[6] = sp * BOAT_MESH_SCALE;
+		m[7] = 0;
+		m[8] = (-cr * ch - sr * sp * sh) * BOAT_MESH_SCALE;
+		m[9] = (sr * ch - cr * sp * sh) * BOAT_MESH_SCALE;
+		m[10] = cp * sh * BOAT_MESH_SCALE;
+		m[11] = 0;
+		m[12] = fleet->posX[i];
+		m[13] = fleet->posY[i];
+		m[14] = fleet->posZ[i];
+		m[15] = 1;
+	}
+}
 
-	/* Limit the boat speed */
-	boat->speed = clamp(boat->speed, 0, boat->maxSpeed);
-	
-	/* Accelerate the turning velocity of the boat when a key is down */
-	if (left) boat->turnVelocity += boat->turningAcceleration * dt;
-	if (right) boat->turnVelocity -= boat->turningAcceleration * dt;
+/* Updates every boat's position from its input, a pass over the
+   arrays at a time: moving, sampling the waves at all the new
+   positions in one batch, then orienting */
+void updateFleet(Fleet *fleet, float dt)
+{
+	if (fleet->nBoats == 0)
+		return;
 
-	/* Limit turning speed relative to 5x boat speed in degrees
-	   per second */
-	boat->turnVelocity = clamp(boat->turnVelocity, -fabs(boat->speed) * 5.0, fabs(boat->speed) * 5.0);
+	moveBoats(fleet, paddedBoats(fleet->nBoats), dt);
 
-	/* Apply turning velocity damping (so the ship stops turning
-	   when the button is released) */
-	boat->turnVelocity -= myCrossPlatformMin(fabs(boat->turnVelocity), 0.5) * sign(boat->turnVelocity);
-	
-	/* Calculate the heading direction vector of the boat */
-	headingDir.x = sinf(boat->heading * M_PI / 180.0);
-	headingDir.y = cosf(boat->heading * M_PI / 180.0);
-
-	/* Move the ship forwards at its current speed */
-	boat->heading += boat->turnVelocity * dt;
-	boat->pos.x += headingDir.x * boat->speed * dt;
-	boat->pos.z += headingDir.y * boat->speed * dt;
-
-	/* Orient the boat appropriately given its current location in
-	   the waves */
-	v = calcSineValue(boat->pos.x, boat->pos.z);
-	boat->pos.y = v.w - boat->displacement;
-	boat->roll = asin(v.x) * 180.0 / M_PI;
-	boat->pitch = asin(v.z) * 180.0 / M_PI;
-	
-	if(*fireleft){
-		*fireleft = false;
-		initBall(boat, true);
-	}
-	
-	if(*fireright){
-		*fireright = false;
-		initBall(boat, false);
-	}
+	/* Orient the boats appropriately given their current location
+	   in the waves */
+	evalWavePoints(fleet->posX, fleet->posZ, fleet->waveY, fleet->waveNX, fleet->waveNY, fleet->waveNZ,
+		NULL, NULL, paddedBoats(fleet->nBoats));
+	orientBoats(fleet, 0, fleet->nBoats);
 }
 
-void initBall(Boat *boat, bool left){
-	CannonBall ball;
+void initBall(BallPool *pool, Fleet *fleet, int boat, bool left){
+	CannonBall *ball = spawnBall(pool, boat);
 	
-	if(boat->nBalls < MAX_CANNON_BALLS){
-		ball.pos = boat->pos;
-		ball.radius = BALL_RADIUS;
-		ball.previousTime = glutGet(GLUT_ELAPSED_TIME);
+	if(ball){
+		ball->pos = boatPos(fleet, boat);
+		ball->radius = BALL_RADIUS;
 		
 		if(left){
-			ball.dir.z = boat->heading + 90;
+			ball->dir.z = fleet->heading[boat] + 90;
 		}else{
-			ball.dir.z = boat->heading - 90;
+			ball->dir.z = fleet->heading[boat] - 90;
 		}
-		ball.dir.x = sinf(ball.dir.z * M_PI/180.0);
-		ball.dir.y = cosf(ball.dir.z * M_PI/180.0);
-		
-		ball.v.x = ball.dir.x * INIT_FORCE;
-		ball.v.y = INIT_FORCE/2;
-		ball.v.z = ball.dir.y * INIT_FORCE;
+		ball->dir.x = sinf(ball->dir.z * M_PI/180.0);
+		ball->dir.y = cosf(ball->dir.z * M_PI/180.0);
 		
-		boat->balls[boat->nBalls] = ball;
-		boat->nBalls++;
+		ball->v.x = ball->dir.x * INIT_FORCE;
+		ball->v.y = INIT_FORCE/2;
+		ball->v.z = ball->dir.y * INIT_FORCE;
 	}
 }
 
-void drawAllBalls(Boat *boat){
+void drawAllBalls(BallPool *pool){
 	int i;
-	for (i=0; i<boat->nBalls; i++){
-		drawBall(&(boat->balls[i]));
+	for (i=0; i<pool->nBalls; i++){
+		if (sphereVisible(CULL_BALLS, pool->balls[i].pos, pool->balls[i].radius))
+			drawBall(&pool->balls[i]);
 	}
 }
 
-void updateAllBalls(Boat *boat){
+/* Moves the balls still in flight, stopping any whose path this tick
+   crosses the terrain where it hit. Walks backwards so the ball
+   swapped into a removed one's place has already been updated */
+/* Whether a ball flying from one point to the next hit the seabed,
+   and where. The streamed tiles are only sampled where the ball ends
+   up, they have no pyramid to cast against */
+static bool ballHitGround(Terrain *terrain, TerrainTiles *tiles, Vec3f from, Vec3f to, RayHit *hit){
+	float y;
+	
+	if (!tiles)
+		return castHeightSegment(&terrain->pyramid, from, to, hit);
+	if (!terrainTilesHeight(tiles, to.x, to.z, &y, NULL) || to.y > y)
+		return false;
+	hit->pos = cVec3f(to.x, y, to.z);
+	return true;
+}
+
+void updateAllBalls(BallPool *pool, Terrain *terrain, TerrainTiles *tiles, float dt){
 	int i;
 	CannonBall *ball;
-	for (i=0; i<boat->nBalls; i++){
-		ball = &(boat->balls[i]);
-		if(ball->pos.y >= -10){
-			updateBall(ball);
+	Vec3f from;
+	RayHit hit;
+	for (i=pool->nBalls-1; i>=0; i--){
+		ball = &pool->balls[i];
+		ball->life -= dt;
+		if(ball->state == BALL_SPENT || ball->life <= 0){
+			removeBall(pool, i);
+			continue;
+		}
+		if(ball->state == BALL_FLYING){
+			from = ball->pos;
+			updateBall(ball, dt);
+			if(ball->pos.y < BALL_SUNK_DEPTH){
+				removeBall(pool, i);
+			}else if(ballHitGround(terrain, tiles, from, ball->pos, &hit)){
+				ball->pos = hit.pos;
+				ball->state = BALL_LANDED;
+				ball->life = BALL_LANDED_LIFETIME;
+				
+				/* The tiles are read from disk as they are */
+				if (!tiles)
+					deformTerrain(terrain, hit.pos.x, hit.pos.z, CRATER_RADIUS, -CRATER_DEPTH);
+			}
 		}
 	}
 }
 
-bool boatsCollided(Boat *boat1, Boat *boat2){
-	float distance;
-	distance = getDistanceDiff(boat1->pos, boat2->pos);
-	if(distance < ((boat1->radius + boat2->radius) - COLLISION_OFFSET)){
-		return true;
+/* How close two boats' centres are when they touch */
+#define BOAT_CONTACT_DISTANCE (BOAT_RADIUS + BOAT_RADIUS - COLLISION_OFFSET)
+
+bool boatsCollided(Fleet *fleet, int boat1, int boat2){
+	float reach = BOAT_CONTACT_DISTANCE;
+	return getDistanceSquared(boatPos(fleet, boat1), boatPos(fleet, boat2)) < reach * reach;
+}
+
+void ballHitBoat(CannonBall *ball, Fleet *fleet, int boat){
+	float reach = (BOAT_RADIUS + ball->radius) - COLLISION_OFFSET;
+	if(ball->state == BALL_FLYING && getDistanceSquared(boatPos(fleet, boat), ball->pos) < reach * reach){
+		fleet->damage[boat] += DAMAGE_FACTOR;
 	}
-	return false;
 }
 
-void ballHitBoat(CannonBall *ball, Boat *boat){
-	float distance;
-	distance = getDistanceDiff(boat->pos, ball->pos);
-	//printf("Distance: %f\n", distance);
-	if(distance < ((boat->radius + ball->radius) - COLLISION_OFFSET)){
-		boat->damage += DAMAGE_FACTOR;
-		//printf("\nBoat hit: %d\n", boat->damage);
+void ballsHitBoat(BallPool *pool, Fleet *fleet, int shooter, int target){
+	int i;
+	for (i=0; i<pool->nBalls; i++){
+		if (pool->balls[i].owner == shooter)
+			ballHitBoat(&pool->balls[i], fleet, target);
 	}
 }
 
-void ballsHitBoat(Boat *boat1, Boat *boat2){
+bool boatDestroyed(Fleet *fleet, int boat){
+	return (fleet->damage[boat] >= MAX_DAMAGE);
+}
+
+/* Points sampled around the hull for grounding, as (ahead, to port)
+   in boat radii: bow, stern and either beam */
+static const Vec2f hullPoints[] = {
+	{ 1.0f, 0.0f }, { -1.0f, 0.0f }, { 0.0f, 0.5f }, { 0.0f, -0.5f }
+};
+#define N_HULL_POINTS (int)(sizeof(hullPoints) / sizeof(hullPoints[0]))
+
+/* The hull points in world (x, z) */
+static void getHullPoints(Fleet *fleet, int boat, Vec2f *points){
+	float dirX = sinf(fleet->heading[boat] * M_PI / 180.0), dirZ = cosf(fleet->heading[boat] * M_PI / 180.0);
 	int i;
-	for (i=0; i<boat1->nBalls; i++){
-		ballHitBoat(&(boat1->balls[i]), boat2);
+	
+	/* Port is the heading turned a quarter to the left, (dirZ, -dirX),
+	   like the left cannons fire */
+	for (i = 0; i < N_HULL_POINTS; i++)
+	{
+		points[i].x = fleet->posX[boat] + (hullPoints[i].x * dirX + hullPoints[i].y * dirZ) * BOAT_RADIUS;
+		points[i].y = fleet->posZ[boat] + (hullPoints[i].x * dirZ - hullPoints[i].y * dirX) * BOAT_RADIUS;
 	}
 }
 
-bool boatDestroyed(Boat *boat){
-	return (boat->damage >= MAX_DAMAGE);
+/* True if any part of the hull is within TERRAIN_COLLISION_OFFSET of
+   the shore. Works anywhere, on or off the map */
+bool boatTerrainCollision(Terrain *terrain, Fleet *fleet, int boat){
+	Vec2f points[N_HULL_POINTS];
+	
+	getHullPoints(fleet, boat, points);
+	return coastClearance(&terrain->coast, points, N_HULL_POINTS) <= TERRAIN_COLLISION_OFFSET;
 }
 
-bool boatTerrainCollision(Terrain *terrain, Boat *boat){
-	float frontDistance, rightDistance, leftDistance;
-	int fi, fj, fIndex, ri, rj, rIndex, li, lj, lIndex;
-	int rows, cols;
-	Vec3f terrainFrontPos, terrainRightPos, terrainLeftPos;
+/* Same against the streamed world, for which there's no coast field:
+   true if the resident seabed under any part of the hull is within
+   TERRAIN_COLLISION_OFFSET of the surface */
+bool boatTilesCollision(TerrainTiles *tiles, Fleet *fleet, int boat){
+	Vec2f points[N_HULL_POINTS];
+	float y;
+	int i;
 	
-	Vec3f boatPos = boat->pos;
-	Vec3f boatFrontPos = {boatPos.x, boatPos.y, boatPos.z + boat->radius};
-	Vec3f boatRightPos = {boatPos.x - boat->radius, boatPos.y, boatPos.z};
-	Vec3f boatLeftPos = {boatPos.x + boat->radius, boatPos.y, boatPos.z};
+	getHullPoints(fleet, boat, points);
+	for (i = 0; i < N_HULL_POINTS; i++)
+	{
+		if (terrainTilesHeight(tiles, points[i].x, points[i].y, &y, NULL) &&
+			y > TERRAIN_WATER_LEVEL - TERRAIN_COLLISION_OFFSET)
+			return true;
+	}
+	return false;
+}
+
+bool placeBoatClear(Terrain *terrain, TerrainTiles *tiles, Fleet *fleet, int boat, float maxDistance){
+	float x = fleet->posX[boat], z = fleet->posZ[boat], step = BOAT_CONTACT_DISTANCE, r;
+	int k, n, other;
 	
-	rows = terrain->rows - 1;
-	cols = terrain->cols - 1;
+	for (r = 0.0f; r <= maxDistance; r += step)
+	{
+		n = r > 0.0f ? max(8, (int)(2.0f * M_PI * r / step)) : 1;
+		for (k = 0; k < n; k++)
+		{
+			fleet->posX[boat] = x + r * sinf(2.0f * M_PI * k / n);
+			fleet->posZ[boat] = z + r * cosf(2.0f * M_PI * k / n);
+			if (tiles ? boatTilesCollision(tiles, fleet, boat) : boatTerrainCollision(terrain, fleet, boat))
+				continue;
+			for (other = 0; other < fleet->nBoats; other++)
+				if (other != boat && boatsCollided(fleet, boat, other))
+					break;
+			if (other == fleet->nBoats)
+				return true;
+		}
+	}
+	fleet->posX[boat] = x;
+	fleet->posZ[boat] = z;
+	return false;
+}
+
+/* Where the boat is headed, for streaming tiles in ahead of it */
+TileViewer getBoatViewer(Fleet *fleet, int boat){
+	TileViewer viewer;
 	
-	fi = ((boatFrontPos.x/terrain->size) + 0.5)*rows;
-	fj = ((boatFrontPos.z/terrain->size) + 0.5)*cols;
+	viewer.pos = boatPos(fleet, boat);
+	viewer.heading.x = sinf(fleet->heading[boat] * M_PI / 180.0);
+	viewer.heading.y = cosf(fleet->heading[boat] * M_PI / 180.0);
+	viewer.speed = fabsf(fleet->speed[boat]);
+	return viewer;
+}
+
+/* The balls' hash cells fit two of them side by side, the boats'
+   the distance at which boats touch (which also covers a ball
+   reaching a hull) */
+void initFleetContacts(FleetContacts *contacts){
+	memset(contacts, 0, sizeof(*contacts));
+	initSpatialHash(&contacts->boatHash, BOAT_CONTACT_DISTANCE);
+	initSpatialHash(&contacts->ballHash, 2 * BALL_RADIUS);
+}
+
+void cleanupFleetContacts(FleetContacts *contacts){
+	cleanupSpatialHash(&contacts->boatHash);
+	cleanupSpatialHash(&contacts->ballHash);
+	free(contacts->balls);
+	free(contacts->ballX);
+	free(contacts->ballZ);
+	free(contacts->boatContacts);
+	memset(contacts, 0, sizeof(*contacts));
+}
+
+/* What the visits below need */
+typedef struct
+{
+	Fleet *fleet;
+	BallPool *pool;
+	FleetContacts *contacts;
+} ContactVisit;
+
+static void visitBoatPair(int a, int b, void *data){
+	ContactVisit *visit = data;
+	FleetContacts *contacts = visit->contacts;
 	
-	fIndex = (fi*terrain->cols) + fj;
-	terrainFrontPos = terrain->vertices[fIndex];
+	contacts->candidates++;
+	if (!boatsCollided(visit->fleet, a, b))
+		return;
+	if (contacts->nBoatContacts == contacts->boatContactCapacity)
+	{
+		contacts->boatContactCapacity = max(16, contacts->boatContactCapacity * 2);
+		contacts->boatContacts = realloc(contacts->boatContacts,
+			contacts->boatContactCapacity * sizeof(BoatContact));
+	}
+	contacts->boatContacts[contacts->nBoatContacts].a = a;
+	contacts->boatContacts[contacts->nBoatContacts].b = b;
+	contacts->nBoatContacts++;
+}
+
+/* A ball in flight against a boat, which its own ship can't be. Balls
+   resting where they landed do no damage */
+static void visitBallBoat(int ball, int boat, void *data){
+	ContactVisit *visit = data;
+	CannonBall *b = &visit->pool->balls[visit->contacts->balls[ball]];
+	float reach = (BOAT_RADIUS + b->radius) - COLLISION_OFFSET;
 	
-	li = ((boatLeftPos.x/terrain->size) + 0.5)*rows;
-	lj = ((boatLeftPos.z/terrain->size) + 0.5)*cols;
+	visit->contacts->candidates++;
+	if (b->state == BALL_FLYING && b->owner != boat &&
+		getDistanceSquared(boatPos(visit->fleet, boat), b->pos) < reach * reach)
+	{
+		visit->fleet->damage[boat] += DAMAGE_FACTOR;
+		visit->contacts->ballHits++;
+	}
+}
+
+/* Two balls in play, which only clash if both are in flight and were
+   fired by different ships */
+static void visitBallPair(int a, int b, void *data){
+	ContactVisit *visit = data;
+	CannonBall *ballA = &visit->pool->balls[visit->contacts->balls[a]];
+	CannonBall *ballB = &visit->pool->balls[visit->contacts->balls[b]];
+	float reach = ballA->radius + ballB->radius;
 	
-	lIndex = (li*terrain->cols) + lj;
-	terrainLeftPos = terrain->vertices[lIndex];
+	visit->contacts->candidates++;
+	if (ballA->owner == ballB->owner || ballA->state == BALL_LANDED || ballB->state == BALL_LANDED)
+		return;
+	if (getDistanceSquared(ballA->pos, ballB->pos) < reach * reach)
+	{
+		ballA->state = ballB->state = BALL_SPENT;
+		visit->contacts->ballClashes++;
+	}
+}
+
+void findFleetContacts(FleetContacts *contacts, Fleet *fleet, BallPool *pool){
+	ContactVisit visit = { fleet, pool, contacts };
+	int i;
 	
-	ri = ((boatRightPos.x/terrain->size) + 0.5)*rows;
-	rj = ((boatRightPos.z/terrain->size) + 0.5)*cols;
+	contacts->nBoatContacts = 0;
+	contacts->candidates = 0;
+	contacts->ballHits = 0;
+	contacts->ballClashes = 0;
 	
-	rIndex = (ri*terrain->cols) + rj;
-	terrainRightPos = terrain->vertices[rIndex];
+	/* Every ball in the pool is in play */
+	if (pool->nBalls > contacts->ballCapacity)
+	{
+		contacts->ballCapacity = pool->capacity;
+		contacts->balls = realloc(contacts->balls, contacts->ballCapacity * sizeof(int));
+		contacts->ballX = realloc(contacts->ballX, contacts->ballCapacity * sizeof(float));
+		contacts->ballZ = realloc(contacts->ballZ, contacts->ballCapacity * sizeof(float));
+	}
+	for (i = 0; i < pool->nBalls; i++)
+	{
+		contacts->balls[i] = i;
+		contacts->ballX[i] = pool->balls[i].pos.x;
+		contacts->ballZ[i] = pool->balls[i].pos.z;
+	}
+	contacts->nBalls = pool->nBalls;
+	
+	buildSpatialHash(&contacts->boatHash, fleet->posX, fleet->posZ, 1, fleet->nBoats);
+	buildSpatialHash(&contacts->ballHash, contacts->ballX, contacts->ballZ, 1, contacts->nBalls);
 	
-	frontDistance = getDistanceDiff(terrainFrontPos, boatFrontPos);
-	rightDistance = getDistanceDiff(terrainRightPos, boatRightPos);
-	leftDistance = getDistanceDiff(terrainLeftPos, boatLeftPos);
+	spatialHashPairs(&contacts->boatHash, visitBoatPair, &visit);
+	for (i = 0; i < contacts->nBalls; i++)
+	{
+		CannonBall *ball = &pool->balls[i];
 		
-	if(frontDistance <= TERRAIN_COLLISION_OFFSET || rightDistance <= TERRAIN_COLLISION_OFFSET || leftDistance <= TERRAIN_COLLISION_OFFSET){
-		return true;
+		spatialHashQuery(&contacts->boatHash, i, ball->pos.x, ball->pos.z,
+			BOAT_RADIUS + ball->radius - COLLISION_OFFSET, visitBallBoat, &visit);
 	}
-	return false;
+	spatialHashPairs(&contacts->ballHash, visitBallPair, &visit);
+	
+	/* Balls that met are gone before they're drawn */
+	sweepBalls(pool);
 }
 
+bool boatsInContact(const FleetContacts *contacts, int boat1, int boat2){
+	int i;
+	
+	for (i = 0; i < contacts->nBoatContacts; i++)
+	{
+		const BoatContact *contact = &contacts->boatContacts[i];
+		
+		if ((contact->a == boat1 && contact->b == boat2) || (contact->a == boat2 && contact->b == boat1))
+			return true;
+	}
+	return false;
+}
@@ -9,8 +9,9 @@ extern "C" {
 #include "obj/obj.h"
 #include "cannon_ball.h"
 #include "seabed.h"
+#include "mesh_cache.h"
+#include "spatial_hash.h"
 	
-#define MAX_CANNON_BALLS 50
 #define BOAT_RADIUS 4
 #define COLLISION_OFFSET 4
 #define TERRAIN_COLLISION_OFFSET 1
@@ -18,53 +19,144 @@ extern "C" {
 #define DAMAGE_FACTOR 10
 #define MAX_DAMAGE 50
 
+/* Balls landing on the seabed dig a crater this wide and deep */
+#define CRATER_RADIUS 2
+#define CRATER_DEPTH 0.5
+
+/* Shared by every boat of the fleet */
+#define BOAT_MAX_SPEED 5.0f		/* Forward */
+#define BOAT_ACCELERATION 3.0f		/* Forward */
+#define BOAT_TURNING_ACCELERATION 50.0f	/* In degrees per second per second */
+#define BOAT_DISPLACEMENT -0.4f		/* How deep in the water boats sit */
+#define BOAT_MESH_SCALE 0.1f		/* The galleon obj is a little big */
+
 /* forward declare instead of #include "obj.h" */
 struct _OBJMesh;
 
-/* Struct to hold the position, heading and mesh of the boat */
+/* Every boat in play, the two players first. Each field is an array
+   with an entry per boat, so updateFleet runs down them in batches
+   rather than boat by boat, and the arrays the wave kernel reads or
+   writes are padded and aligned for it. The boats share one mesh and
+   are drawn together from their transforms */
 typedef struct
 {
-	float radius;
-	Vec3f pos;			/* Position of the boat */
-	float heading;		/* The boat's heading, in degrees */
-	struct _OBJMesh *mesh;		/* The boat's mesh */
-
-	float speed;		/* Forward speed of the boat */
-	float maxSpeed;		/* Maximum forward speed of the boat */
-	float acceleration;	/* Forward acceleration of the boat (constant) */
-	float turnVelocity;	/* Turning speed of the boat, in degrees per second */
-	float turningAcceleration; /* Turning acceleration (constant) */
-
-	float displacement; /* How deep in the water the boat will sit */
-
-	float roll;			/* How much the boat has rotated from side to side, in degrees */
-	float pitch;        /* How much the boat has rotated up and down, in degrees */
-	int nBalls;
-	int currentBall;
-	CannonBall *balls;
-	int damage;
-	
-} Boat;
+	int nBoats, capacity;
+
+	float *posX, *posY, *posZ;	/* Positions */
+	float *heading;		/* In degrees */
+	float *dirX, *dirZ;	/* Unit vector of the heading */
+	float *speed;		/* Forward speed */
+	float *turnVelocity;	/* In degrees per second */
+	float *roll;		/* How much the boat has rotated from side to side, in degrees */
+	float *pitch;		/* How much the boat has rotated up and down, in degrees */
+	int *damage;
+
+	/* Input for the next updateFleet, -1 to 1: forwards/backwards and
+	   left/right */
+	float *throttle, *steer;
+
+	/* Wave height and normal under each boat, from the last update */
+	float *waveY, *waveNX, *waveNY, *waveNZ;
+
+	/* Column major model matrix per boat, rebuilt by updateFleet, and
+	   the ambient colour each is drawn in */
+	float *transforms;
+	float *ambients;
+	int *visible;		/* Boats drawFleet found in view */
+
+	struct _OBJMesh *mesh;
+	MeshAsset *asset;
+} Fleet;
+
+/* Two boats touching */
+typedef struct
+{
+	int a, b;
+} BoatContact;
+
+/* What touched what on the last findFleetContacts, with the hashes
+   the boats and the balls in play were bucketed into to find it */
+typedef struct
+{
+	SpatialHash boatHash, ballHash;
+
+	/* Balls in play, as indices into the pool, and where */
+	int nBalls, ballCapacity;
+	int *balls;
+	float *ballX, *ballZ;
+
+	int nBoatContacts, boatContactCapacity;
+	BoatContact *boatContacts;
+
+	int candidates;		/* Pairs the hashes turned up */
+	int ballHits;		/* Balls within reach of another ship's hull */
+	int ballClashes;	/* Pairs of balls that met */
+} FleetContacts;
+
+/* Allocates room for capacity boats, and acquires the obj file given
+   by the filename unless someone already has. Safe off the GL thread */
+void initFleet(Fleet *fleet, int capacity, const char *meshFilename);
+
+/* Releases the balls, the arrays and the fleet's reference to the mesh */
+void cleanupFleet(Fleet *fleet);
+
+/* Adds a boat at rest, drawn with the given ambient colour, and
+   returns its index or -1 if the fleet is full */
+int addBoat(Fleet *fleet, Vec3f position, const float *ambient);
 
-/* Initialises the given boat with default values, and loads the obj file given by the filename */
-void initBoat(Boat *boat, const char *meshFilename, Vec3f);
+/* Sets a boat's input from movement flags */
+void steerBoat(Fleet *fleet, int boat, bool up, bool down, bool left, bool right);
 
-/* Draws the given boat */
-void drawBoat(Boat *boat, float*);
+/* Moves every boat by its input, floats them on the waves and
+   rebuilds their transforms */
+void updateFleet(Fleet *fleet, float dt);
 
-/* Updates the boat's position based on movement flags */
-void updateBoat(Boat *boat, bool up, bool down, bool left, bool right, float dt, bool *fireleft, bool *fireright);
+/* Draws the boats in view */
+void drawFleet(Fleet *fleet);
+
+/* Position of a boat */
+Vec3f boatPos(Fleet *fleet, int boat);
 	
 void drawMesh(OBJMesh *mesh);
 	
-	void initBall(Boat* boat, bool left);
-	void drawAllBalls(Boat* boat);
-	void updateAllBalls(Boat* boat);
-	void ballHitBoat(CannonBall *ball, Boat *boat);
-	void ballsHitBoat(Boat *boat1, Boat *boat2);
-	bool boatDestroyed(Boat *boat);
-	bool boatsCollided(Boat *boat1, Boat *boat2);
-	bool boatTerrainCollision(Terrain *terrain, Boat *boat);
+	/* Fires one of a boat's cannons into the pool, unless it's full */
+	void initBall(BallPool *pool, Fleet *fleet, int boat, bool left);
+	void drawAllBalls(BallPool *pool);
+	
+	/* Moves the balls in flight on by dt and ages the rest, taking
+	   those that sink, run out of life or were spent out of play.
+	   Balls land on the streamed tiles if given, else on the terrain,
+	   which they crater */
+	void updateAllBalls(BallPool *pool, Terrain *terrain, TerrainTiles *tiles, float dt);
+	void ballHitBoat(CannonBall *ball, Fleet *fleet, int boat);
+	void ballsHitBoat(BallPool *pool, Fleet *fleet, int shooter, int target);
+	bool boatDestroyed(Fleet *fleet, int boat);
+	bool boatsCollided(Fleet *fleet, int boat1, int boat2);
+	bool boatTerrainCollision(Terrain *terrain, Fleet *fleet, int boat);
+	bool boatTilesCollision(TerrainTiles *tiles, Fleet *fleet, int boat);
+	TileViewer getBoatViewer(Fleet *fleet, int boat);
+	
+	/* Moves a boat to the nearest spot within maxDistance where it's
+	   clear of the seabed (the streamed tiles if given, else the
+	   terrain) and of the other boats, searching rings out from where
+	   it is. Returns false, leaving it be, if there's none */
+	bool placeBoatClear(Terrain *terrain, TerrainTiles *tiles, Fleet *fleet, int boat, float maxDistance);
+
+/* Sizes the hashes' cells for the tests findFleetContacts makes */
+void initFleetContacts(FleetContacts *contacts);
+void cleanupFleetContacts(FleetContacts *contacts);
+
+/* Tests every boat against every other, every ball against every
+   other ship and every ball in flight against the other ships'
+   balls, through the hashes rather than pair by pair. Balls near
+   a hull damage it as ballsHitBoat did, balls that meet are taken
+   out of the pool, and the boats touching are kept for
+   boatsInContact */
+void findFleetContacts(FleetContacts *contacts, Fleet *fleet, BallPool *pool);
+
+/* Whether two boats touched on the last findFleetContacts, the same
+   test as boatsCollided */
+bool boatsInContact(const FleetContacts *contacts, int boat1, int boat2);
 	
 #ifdef __cplusplus
 }
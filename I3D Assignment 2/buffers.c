@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <string.h>
+#include "buffers.h"
+#include "gl.h"
+
+/* Returns true if the current GL context supports vertex buffer
+   objects, the result is cached after the first query */
+bool buffersSupported(void)
+{
+	static int supported = -1;
+	const char *version, *extensions;
+	int major = 0, minor = 0;
+
+	if (supported != -1)
+		return supported;
+
+	version = (const char *)glGetString(GL_VERSION);
+	extensions = (const char *)glGetString(GL_EXTENSIONS);
+
+	/* No context yet, don't cache so we can ask again later */
+	if (!version)
+		return false;
+
+	sscanf(version, "%d.%d", &major, &minor);
+	supported = (major > 1 || (major == 1 && minor >= 5)) ||
+		(extensions && strstr(extensions, "GL_ARB_vertex_buffer_object"));
+
+	return supported;
+}
+
+/* Whether primitive restart is core or the NV extension, set by
+   primitiveRestartSupported */
+static bool restartCore = false;
+
+/* Returns true if primitive restart is available, either core (GL
+   3.1) or through NV_primitive_restart */
+bool primitiveRestartSupported(void)
+{
+	static int supported = -1;
+	const char *version, *extensions;
+	int major = 0, minor = 0;
+
+	if (supported != -1)
+		return supported;
+
+	version = (const char *)glGetString(GL_VERSION);
+	extensions = (const char *)glGetString(GL_EXTENSIONS);
+
+	/* No context yet, don't cache so we can ask again later */
+	if (!version)
+		return false;
+
+	sscanf(version, "%d.%d", &major, &minor);
+	restartCore = major > 3 || (major == 3 && minor >= 1);
+	supported = restartCore ||
+		(extensions && strstr(extensions, "GL_NV_primitive_restart"));
+
+	return supported;
+}
+
+void setPrimitiveRestart(bool enabled, unsigned int index)
+{
+	if (restartCore)
+	{
+		if (enabled)
+		{
+			glEnable(GL_PRIMITIVE_RESTART);
+			glPrimitiveRestartIndex(index);
+		}
+		else
+			glDisable(GL_PRIMITIVE_RESTART);
+	}
+	else
+	{
+		/* The NV extension makes it client state */
+		if (enabled)
+		{
+			glEnableClientState(GL_PRIMITIVE_RESTART_NV);
+			glPrimitiveRestartIndexNV(index);
+		}
+		else
+			glDisableClientState(GL_PRIMITIVE_RESTART_NV);
+	}
+}
+
+/* Returns true if glMultiDrawElementsBaseVertex is available */
+bool baseVertexSupported(void)
+{
+	static int supported = -1;
+	const char *version, *extensions;
+	int major = 0, minor = 0;
+
+	if (supported != -1)
+		return supported;
+
+	version = (const char *)glGetString(GL_VERSION);
+	extensions = (const char *)glGetString(GL_EXTENSIONS);
+
+	/* No context yet, don't cache so we can ask again later */
+	if (!version)
+		return false;
+
+	sscanf(version, "%d.%d", &major, &minor);
+	supported = (major > 3 || (major == 3 && minor >= 2)) ||
+		(extensions && strstr(extensions, "GL_ARB_draw_elements_base_vertex"));
+
+	return supported;
+}
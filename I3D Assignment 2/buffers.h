@@ -0,0 +1,31 @@
+#ifndef BUFFERS_H
+#define BUFFERS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "utils.h"
+
+/* Returns true if the current GL context supports vertex buffer
+   objects (GL 1.5 or ARB_vertex_buffer_object). Must be called with
+   a current context; the answer is cached after the first call */
+bool buffersSupported(void);
+
+/* Returns true if the context can restart strips at a marker index
+   (GL 3.1 or NV_primitive_restart), cached like buffersSupported */
+bool primitiveRestartSupported(void);
+
+/* Returns true if the context can offset every index of a draw by
+   a base vertex (GL 3.2 or ARB_draw_elements_base_vertex) */
+bool baseVertexSupported(void);
+
+/* Turns primitive restart at the given index on or off, only call
+   when primitiveRestartSupported */
+void setPrimitiveRestart(bool enabled, unsigned int index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,5 +1,7 @@
 #include "cannon_ball.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 void drawBall(CannonBall *ball){
 	static float diffuse[] = { 1.0f, 1.0f, 1.10f, 1.0f };
@@ -19,9 +21,9 @@ void drawBall(CannonBall *ball){
 	glPopMatrix();
 }
 
-void updateBall(CannonBall *ball){
-	float now = glutGet(GLUT_ELAPSED_TIME);
-	float dt = (now - ball->previousTime)*ANIMATION_TIME;
+void updateBall(CannonBall *ball, float dt){
+	/* The flight is animated at ANIMATION_TIME per millisecond */
+	dt *= 1000.0f * ANIMATION_TIME;
 	
 	ball->v.x = ball->dir.x * INIT_FORCE;
 	ball->v.y += (dt*GRAVITY) * INIT_FORCE;
@@ -30,6 +32,46 @@ void updateBall(CannonBall *ball){
 	ball->pos.x += ball->v.x*dt;
 	ball->pos.y += ball->v.y*dt;
 	ball->pos.z += ball->v.z*dt;
+}
+
+void initBallPool(BallPool *pool, int capacity){
+	memset(pool, 0, sizeof(*pool));
+	pool->capacity = capacity;
+	pool->balls = malloc(max(capacity, 1) * sizeof(CannonBall));
+}
+
+void cleanupBallPool(BallPool *pool){
+	free(pool->balls);
+	memset(pool, 0, sizeof(*pool));
+}
+
+CannonBall *spawnBall(BallPool *pool, int owner){
+	CannonBall *ball;
+	
+	if (pool->nBalls == pool->capacity)
+	{
+		pool->dropped++;
+		return NULL;
+	}
+	ball = &pool->balls[pool->nBalls++];
+	memset(ball, 0, sizeof(*ball));
+	ball->owner = owner;
+	ball->state = BALL_FLYING;
+	ball->life = BALL_FLIGHT_LIFETIME;
+	pool->fired++;
+	return ball;
+}
+
+void removeBall(BallPool *pool, int i){
+	pool->balls[i] = pool->balls[--pool->nBalls];
+	pool->recycled++;
+}
+
+void sweepBalls(BallPool *pool){
+	int i;
 	
-	ball->previousTime = now;
+	/* Backwards, so the ball swapped in has already been looked at */
+	for (i = pool->nBalls - 1; i >= 0; i--)
+		if (pool->balls[i].state == BALL_SPENT)
+			removeBall(pool, i);
 }
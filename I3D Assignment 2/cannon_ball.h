@@ -14,20 +14,64 @@ extern "C" {
 #define ANIMATION_TIME 0.0001
 #define INIT_FORCE 500
 	
-	/* The Grid struct is used to hold the grid of vertices representing
-	 the waves */
+/* How long a ball stays in play, in seconds: at most this long in
+   the air, and this long where it fell on the terrain */
+#define BALL_FLIGHT_LIFETIME 20.0f
+#define BALL_LANDED_LIFETIME 5.0f
+
+/* Below this it has sunk out of sight */
+#define BALL_SUNK_DEPTH (-10.0f)
+	
+	typedef enum
+	{
+		BALL_FLYING,
+		BALL_LANDED,	/* Hit the terrain, it stays where it fell */
+		BALL_SPENT	/* Out of play, recycled by the next sweep */
+	} BallState;
+	
 	typedef struct
 	{
 		Vec3f dir;
 		Vec3f pos;
 		Vec3f v;
-		float previousTime;
 		float radius;
-		
+		float life;		/* Seconds left in its state */
+		int owner;		/* Boat that fired it */
+		BallState state;
 	} CannonBall;
 	
+	/* Every ball in play, whoever fired it. The live balls are always
+	   the first nBalls, a ball leaving play is swapped with the last
+	   one, so nothing walks over dead balls and firing never
+	   allocates */
+	typedef struct
+	{
+		int nBalls, capacity;
+		CannonBall *balls;
+		
+		int fired;		/* Since the pool was made */
+		int recycled;		/* Balls that left play */
+		int dropped;		/* Shots with no room left */
+	} BallPool;
+	
 	void drawBall(CannonBall *ball);
-	void updateBall(CannonBall *ball);
+	
+	/* Moves a ball in flight on by dt seconds */
+	void updateBall(CannonBall *ball, float dt);
+	
+	/* Allocates room for capacity balls in play at once */
+	void initBallPool(BallPool *pool, int capacity);
+	void cleanupBallPool(BallPool *pool);
+	
+	/* A ball newly in play, flying for BALL_FLIGHT_LIFETIME, or NULL
+	   if the pool is full */
+	CannonBall *spawnBall(BallPool *pool, int owner);
+	
+	/* Takes ball i out of play, moving the last ball into its place */
+	void removeBall(BallPool *pool, int i);
+	
+	/* Takes every BALL_SPENT ball out of play */
+	void sweepBalls(BallPool *pool);
 	
 #ifdef __cplusplus
 }
@@ -0,0 +1,750 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cdlod.h"
+#include "frustum.h"
+#include "buffers.h"
+#include "jobs.h"
+#include "gl.h"
+
+/* Each level is used up to this many of its node widths from the
+   eye. It has to be over four so a node is never next to one more
+   than a level coarser, and the neighbour hasn't started morphing
+   where they meet */
+#define CDLOD_RANGE_NODES 6.0f
+
+/* Last part of each level's range spent morphing to the next */
+#define CDLOD_MORPH_FRACTION 0.3f
+
+/* Minimum node rows per job when measuring errors, and patches per
+   job when building vertices */
+#define CDLOD_NODE_GRAIN 4
+#define CDLOD_PATCH_GRAIN 8
+
+/* Slots the cache starts with, and how many selections back a slot
+   must have been drawn in to be kept: enough for both viewports */
+#define CDLOD_CACHE_MIN_SLOTS 256
+#define CDLOD_CACHE_SELECTIONS 4
+
+/* Most nodes added to the cache per selection, so a fast moving eye
+   costs no more than streaming everything. The cache fills over a
+   few frames instead */
+#define CDLOD_MAX_UPLOADS 32
+
+/* Samples covered by one side of a node at the given level */
+#define NODE_SAMPLES(level) (CDLOD_PATCH_QUADS << (level))
+
+/* Shared state for the jobs below */
+typedef struct
+{
+	CDLOD *lod;
+	int level;
+	Vec3f eye;
+} CDLODJob;
+
+/* Height of sample (i, j), clamped to the grid */
+static float sampleHeight(const CDLOD *lod, int i, int j)
+{
+	i = clamp(i, 0, lod->rows - 1);
+	j = clamp(j, 0, lod->cols - 1);
+	return lod->vertices[i * lod->cols + j].y;
+}
+
+/* Widens node's bounds over samples [i0, i1] x [j0, j1], and its error
+   to their largest difference from the level's surface: that has
+   samples every stride, triangulated with the (i, j+1) to (i+1, j)
+   diagonal like the full mesh. Walks a coarse cell at a time so its
+   corners are only looked up once */
+static void measureArea(const CDLOD *lod, int level, int i0, int j0, int i1, int j1, CDLODNode *node)
+{
+	int stride = 1 << level, i, j;
+
+	for (i = i0; i <= i1; i++)
+	{
+		const Vec3f *row = lod->vertices + i * lod->cols;
+		int ci = i - i % stride;
+		float u = (i - ci) / (float)stride;
+
+		for (j = j0; j <= j1; )
+		{
+			int cj = j - j % stride, end = min(cj + stride - 1, j1);
+			float h00 = sampleHeight(lod, ci, cj), h01 = sampleHeight(lod, ci, cj + stride);
+			float h10 = sampleHeight(lod, ci + stride, cj), h11 = sampleHeight(lod, ci + stride, cj + stride);
+
+			for (; j <= end; j++)
+			{
+				float y = row[j].y, v = (j - cj) / (float)stride, coarse;
+
+				node->minY = min(node->minY, y);
+				node->maxY = max(node->maxY, y);
+				if (level == 0)
+					continue;
+				if (u + v <= 1.0f)
+					coarse = h00 + u * (h10 - h00) + v * (h01 - h00);
+				else
+					coarse = h11 + (1.0f - u) * (h01 - h11) + (1.0f - v) * (h10 - h11);
+				node->error = max(node->error, fabsf(y - coarse));
+			}
+		}
+	}
+}
+
+/* Measures bounds and error of node rows [begin, end) of one level */
+static void measureNodeRows(int begin, int end, void *data)
+{
+	CDLODJob *job = data;
+	CDLOD *lod = job->lod;
+	int level = job->level, n = NODE_SAMPLES(level);
+	int ni, nj;
+
+	for (ni = begin; ni < end; ni++)
+	{
+		for (nj = 0; nj < lod->nodeCols[level]; nj++)
+		{
+			CDLODNode *node = &lod->nodes[level][ni * lod->nodeCols[level] + nj];
+
+			node->minY = HUGE_VALF;
+			node->maxY = -HUGE_VALF;
+			node->error = 0.0f;
+			measureArea(lod, level, ni * n, nj * n, min(ni * n + n, lod->rows - 1),
+				min(nj * n + n, lod->cols - 1), node);
+		}
+	}
+}
+
+/* Widens the bounds and error of a node over samples [i0, i1] x
+   [j0, j1] */
+static void growNode(CDLOD *lod, int level, int ni, int nj, int i0, int j0, int i1, int j1)
+{
+	CDLODNode *node = &lod->nodes[level][ni * lod->nodeCols[level] + nj];
+	int n = NODE_SAMPLES(level);
+
+	measureArea(lod, level, max(i0, ni * n), max(j0, nj * n), min(i1, min(ni * n + n, lod->rows - 1)),
+		min(j1, min(nj * n + n, lod->cols - 1)), node);
+	lod->error[level] = max(lod->error[level], node->error);
+}
+
+/* Gives a slot back, its node is drawn from the stream until it's
+   cached again */
+static void freeSlot(CDLOD *lod, int s)
+{
+	CDLODSlot *slot = &lod->slots[s];
+
+	lod->slotOf[slot->level][slot->key] = -1;
+	slot->level = -1;
+	lod->freeSlots[lod->nFree++] = s;
+}
+
+/* Empties the cache, resizing it to nSlots */
+static void resetCDLODCache(CDLOD *lod, int nSlots)
+{
+	int l, s;
+
+	for (l = 0; l < lod->nLevels; l++)
+		for (s = 0; s < 2 * lod->nodeRows[l] * lod->nodeCols[l]; s++)
+			lod->slotOf[l][s] = -1;
+	if (nSlots != lod->nSlots)
+	{
+		lod->nSlots = nSlots;
+		lod->slots = realloc(lod->slots, nSlots * sizeof(CDLODSlot));
+		lod->freeSlots = realloc(lod->freeSlots, nSlots * sizeof(int));
+	}
+	for (s = 0; s < nSlots; s++)
+	{
+		lod->slots[s].level = -1;
+		lod->freeSlots[s] = nSlots - 1 - s;
+	}
+	lod->nFree = nSlots;
+	lod->cacheFull = false;
+}
+
+/* A free slot, reclaiming those not drawn lately when there's none.
+   Returns -1 (and has the cache grown before the next selection) if
+   they're all still in use */
+static int takeSlot(CDLOD *lod)
+{
+	int s;
+
+	if (lod->nFree == 0 && !lod->cacheFull)
+	{
+		for (s = 0; s < lod->nSlots; s++)
+			if (lod->slots[s].level >= 0 && lod->selection - lod->slots[s].lastUsed >= CDLOD_CACHE_SELECTIONS)
+				freeSlot(lod, s);
+		lod->cacheFull = lod->nFree == 0;
+	}
+	return lod->nFree > 0 ? lod->freeSlots[--lod->nFree] : -1;
+}
+
+/* Bounds and errors only ever grow here, so nodes stay safe to cull
+   and refine without rescanning all of their samples. A changed
+   sample changes its own error at every level, and where it's on a
+   level's grid it moves that level's surface over the coarse cells
+   around it too */
+void updateCDLODArea(CDLOD *lod, int i0, int j0, int i1, int j1)
+{
+	int l;
+
+	for (l = 0; l < lod->nLevels; l++)
+	{
+		int stride = 1 << l, n = NODE_SAMPLES(l);
+		int gi0 = (i0 + stride - 1) / stride * stride, gi1 = i1 / stride * stride;
+		int gj0 = (j0 + stride - 1) / stride * stride, gj1 = j1 / stride * stride;
+		int si0 = i0, sj0 = j0, si1 = i1, sj1 = j1, ni, nj, k;
+
+		if (gi0 <= gi1 && gj0 <= gj1)
+		{
+			si0 = min(si0, max(gi0 - stride, 0));
+			sj0 = min(sj0, max(gj0 - stride, 0));
+			si1 = max(si1, min(gi1 + stride, lod->rows - 1));
+			sj1 = max(sj1, min(gj1 + stride, lod->cols - 1));
+		}
+
+		/* Samples on a node's edge belong to the node before too */
+		for (ni = max(si0 - 1, 0) / n; ni <= min(si1 / n, lod->nodeRows[l] - 1); ni++)
+			for (nj = max(sj0 - 1, 0) / n; nj <= min(sj1 / n, lod->nodeCols[l] - 1); nj++)
+				growNode(lod, l, ni, nj, si0, sj0, si1, sj1);
+
+		/* Normals change a sample further out than the heights */
+		for (ni = max(i0 - 2, 0) / n; ni <= min((i1 + 1) / n, lod->nodeRows[l] - 1); ni++)
+			for (nj = max(j0 - 2, 0) / n; nj <= min((j1 + 1) / n, lod->nodeCols[l] - 1); nj++)
+				for (k = 0; k < 2; k++)
+					if (lod->slotOf[l][(ni * lod->nodeCols[l] + nj) * 2 + k] >= 0)
+						freeSlot(lod, lod->slotOf[l][(ni * lod->nodeCols[l] + nj) * 2 + k]);
+	}
+}
+
+/* The quarter strips with each row a full patch's width apart, so a
+   cached node's quadrants are drawn from its vertices */
+static void buildQuarterInPatch(CDLOD *lod)
+{
+	GridTopology *t = &lod->quarterInPatch;
+	int k;
+
+	*t = lod->quarter;
+	t->indices = malloc(t->nIndices * sizeof(unsigned short));
+	t->chunks = malloc(t->nChunks * sizeof(MeshChunk));
+	t->indexCapacity = t->nIndices;
+	t->chunkCapacity = t->nChunks;
+	memcpy(t->chunks, lod->quarter.chunks, t->nChunks * sizeof(MeshChunk));
+	for (k = 0; k < t->nIndices; k++)
+	{
+		int v = lod->quarter.indices[k];
+
+		t->indices[k] = v == TOPOLOGY_RESTART ? v :
+			v / lod->quarter.cols * (CDLOD_PATCH_QUADS + 1) + v % lod->quarter.cols;
+	}
+}
+
+void initCDLOD(CDLOD *lod, const Vec3f *vertices, const Vec3f *normals,
+	int rows, int cols, float size, float tolerance)
+{
+	int l;
+	float spacing = size / (float)(max(rows, cols) - 1);
+	CDLODJob job;
+
+	memset(lod, 0, sizeof(*lod));
+	lod->rows = rows;
+	lod->cols = cols;
+	lod->size = size;
+	lod->vertices = vertices;
+	lod->normals = normals;
+	lod->tolerance = tolerance;
+
+	/* Enough levels for one node to cover everything */
+	lod->nLevels = 1;
+	while (NODE_SAMPLES(lod->nLevels - 1) < max(rows, cols) - 1 && lod->nLevels < CDLOD_MAX_LEVELS)
+		lod->nLevels++;
+
+	job.lod = lod;
+	for (l = 0; l < lod->nLevels; l++)
+	{
+		int i;
+
+		lod->nodeRows[l] = (rows - 2) / NODE_SAMPLES(l) + 1;
+		lod->nodeCols[l] = (cols - 2) / NODE_SAMPLES(l) + 1;
+		lod->nodes[l] = malloc(lod->nodeRows[l] * lod->nodeCols[l] * sizeof(CDLODNode));
+		lod->slotOf[l] = malloc(2 * lod->nodeRows[l] * lod->nodeCols[l] * sizeof(int));
+		for (i = 0; i < 2 * lod->nodeRows[l] * lod->nodeCols[l]; i++)
+			lod->slotOf[l][i] = -1;
+
+		job.level = l;
+		parallelFor(0, lod->nodeRows[l], CDLOD_NODE_GRAIN, measureNodeRows, &job);
+
+		lod->error[l] = 0.0f;
+		for (i = 0; i < lod->nodeRows[l] * lod->nodeCols[l]; i++)
+			lod->error[l] = max(lod->error[l], lod->nodes[l][i].error);
+	}
+
+	/* Ranges double with the node size, so the vertices drawn don't
+	   depend on the resolution, only on the number of levels */
+	for (l = 0; l < lod->nLevels; l++)
+	{
+		float previous = l > 0 ? lod->range[l - 1] : 0.0f;
+
+		if (l + 1 < lod->nLevels)
+			lod->range[l] = CDLOD_RANGE_NODES * NODE_SAMPLES(l) * spacing;
+		else
+			lod->range[l] = HUGE_VALF;
+
+		lod->morphStart[l] = previous + (1.0f - CDLOD_MORPH_FRACTION) * (lod->range[l] - previous);
+	}
+
+	buildGridTopology(&lod->patch, CDLOD_PATCH_QUADS + 1, CDLOD_PATCH_QUADS + 1,
+		CDLOD_PATCH_QUADS, 0, 0, 0);
+	buildGridTopology(&lod->quarter, CDLOD_PATCH_QUADS / 2 + 1, CDLOD_PATCH_QUADS / 2 + 1,
+		CDLOD_PATCH_QUADS, 0, 0, 0);
+	buildQuarterInPatch(lod);
+
+	/* The cache is sized by the first selection */
+	lod->cacheFull = true;
+}
+
+void cleanupCDLOD(CDLOD *lod)
+{
+	int l;
+
+	for (l = 0; l < lod->nLevels; l++)
+	{
+		free(lod->nodes[l]);
+		free(lod->slotOf[l]);
+	}
+	free(lod->patches);
+	free(lod->uploads);
+	free(lod->verts);
+	free(lod->slots);
+	free(lod->freeSlots);
+	cleanupGridTopology(&lod->patch);
+	cleanupGridTopology(&lod->quarter);
+	cleanupGridTopology(&lod->quarterInPatch);
+	memset(lod, 0, sizeof(*lod));
+}
+
+void releaseCDLODGL(CDLOD *lod)
+{
+	if (lod->vertexBuffer)
+	{
+		glDeleteBuffers(1, &lod->vertexBuffer);
+		glDeleteBuffers(1, &lod->cacheBuffer);
+		glDeleteBuffers(3, lod->indexBuffers);
+	}
+	lod->vertexBuffer = lod->cacheBuffer = 0;
+	lod->cacheBufferSlots = 0;
+	memset(lod->indexBuffers, 0, sizeof(lod->indexBuffers));
+
+	/* What was cached went with the buffer */
+	if (lod->slots)
+		resetCDLODCache(lod, lod->nSlots);
+}
+
+/* Bounds of the area with the given first sample and width */
+static void areaBounds(const CDLOD *lod, int i, int j, int n, const CDLODNode *node,
+	Vec3f *minV, Vec3f *maxV)
+{
+	Vec3f a = lod->vertices[min(i, lod->rows - 1) * lod->cols + min(j, lod->cols - 1)];
+	Vec3f b = lod->vertices[min(i + n, lod->rows - 1) * lod->cols + min(j + n, lod->cols - 1)];
+
+	*minV = cVec3f(min(a.x, b.x), node->minY, min(a.z, b.z));
+	*maxV = cVec3f(max(a.x, b.x), node->maxY, max(a.z, b.z));
+}
+
+/* True if the box comes within radius of the eye. Distances for LOD
+   are measured across x/z only: the seabed has cliffs, and with
+   height counted a node spanning one could be selected close to the
+   eye while some of its vertices are far enough to need the level
+   after next, leaving a seam */
+static bool boxInRange(Vec3f minV, Vec3f maxV, Vec3f eye, float radius)
+{
+	float dx = max(max(minV.x - eye.x, 0.0f), eye.x - maxV.x);
+	float dz = max(max(minV.z - eye.z, 0.0f), eye.z - maxV.z);
+
+	return dx * dx + dz * dz <= radius * radius;
+}
+
+/* Appends to list, growing it */
+static CDLODPatch *appendPatch(CDLODPatch **list, int *n, int *capacity)
+{
+	if (*n == *capacity)
+	{
+		*capacity = max(*capacity * 2, 64);
+		*list = realloc(*list, *capacity * sizeof(CDLODPatch));
+	}
+	return &(*list)[(*n)++];
+}
+
+/* Adds a patch to draw. If all of it is short of its level's morph
+   band, or past it, it's drawn from its node's slot in the cache and
+   the node is queued for upload if it isn't there yet. A full patch
+   straddling the band is split into quadrants so those clear of it
+   can still be cached. The rest, or all of it when the cache has no
+   room or this selection's uploads are used up, is morphed and
+   streamed */
+static void addPatch(CDLOD *lod, int i, int j, int level, int quads, Vec3f eye)
+{
+	CDLODPatch *patch;
+	int s = 1 << level, n = NODE_SAMPLES(level), ni = i / n, nj = j / n, c;
+	Vec3f a = lod->vertices[min(i, lod->rows - 1) * lod->cols + min(j, lod->cols - 1)];
+	Vec3f b = lod->vertices[min(i + quads * s, lod->rows - 1) * lod->cols + min(j + quads * s, lod->cols - 1)];
+	float nearX = max(max(min(a.x, b.x) - eye.x, 0.0f), eye.x - max(a.x, b.x));
+	float nearZ = max(max(min(a.z, b.z) - eye.z, 0.0f), eye.z - max(a.z, b.z));
+	float farX = max(fabsf(a.x - eye.x), fabsf(b.x - eye.x));
+	float farZ = max(fabsf(a.z - eye.z), fabsf(b.z - eye.z));
+	bool before = farX * farX + farZ * farZ <= lod->morphStart[level] * lod->morphStart[level];
+	bool past = nearX * nearX + nearZ * nearZ >= lod->range[level] * lod->range[level];
+
+	if (!before && !past && quads == CDLOD_PATCH_QUADS)
+	{
+		/* Quadrants past the edge of the grid have nothing to draw */
+		for (c = 0; c < 4; c++)
+			if (i + c / 2 * n / 2 < lod->rows - 1 && j + c % 2 * n / 2 < lod->cols - 1)
+				addPatch(lod, i + c / 2 * n / 2, j + c % 2 * n / 2, level, quads / 2, eye);
+		return;
+	}
+
+	patch = appendPatch(&lod->patches, &lod->nPatches, &lod->patchCapacity);
+	patch->i = i;
+	patch->j = j;
+	patch->level = level;
+	patch->quads = quads;
+	patch->slot = -1;
+	patch->morphed = past;
+
+	if (before || past)
+	{
+		int key = (ni * lod->nodeCols[level] + nj) * 2 + past;
+		int *slotOf = &lod->slotOf[level][key];
+
+		if (*slotOf < 0 && lod->nUploads < CDLOD_MAX_UPLOADS && (*slotOf = takeSlot(lod)) >= 0)
+		{
+			CDLODPatch *upload = appendPatch(&lod->uploads, &lod->nUploads, &lod->uploadCapacity);
+
+			lod->slots[*slotOf].level = level;
+			lod->slots[*slotOf].key = key;
+			upload->i = ni * n;
+			upload->j = nj * n;
+			upload->level = level;
+			upload->quads = CDLOD_PATCH_QUADS;
+			upload->slot = *slotOf;
+			upload->morphed = past;
+		}
+		patch->slot = *slotOf;
+	}
+
+	if (patch->slot >= 0)
+	{
+		lod->slots[patch->slot].lastUsed = lod->selection;
+		patch->first = (i - ni * n) / s * (CDLOD_PATCH_QUADS + 1) + (j - nj * n) / s;
+	}
+	else
+	{
+		patch->first = lod->nStreamed;
+		lod->nStreamed += (quads + 1) * (quads + 1);
+	}
+}
+
+/* Adds the node, or whichever of its children are within range of
+   the finer level (recursively) plus the rest of it as quadrants.
+   Nodes already within tolerance of the full resolution surface
+   aren't refined, their neighbours may then be more than a level
+   finer but the seam between them is within the tolerance too */
+static void selectNode(CDLOD *lod, int level, int ni, int nj, Vec3f eye)
+{
+	const CDLODNode *node = &lod->nodes[level][ni * lod->nodeCols[level] + nj];
+	int n = NODE_SAMPLES(level), c;
+	Vec3f minV, maxV;
+
+	areaBounds(lod, ni * n, nj * n, n, node, &minV, &maxV);
+	if (!boxVisible(CULL_TERRAIN, minV, maxV))
+		return;
+
+	if (level == 0 || node->error <= lod->tolerance ||
+		!boxInRange(minV, maxV, eye, lod->range[level - 1]))
+	{
+		addPatch(lod, ni * n, nj * n, level, CDLOD_PATCH_QUADS, eye);
+		return;
+	}
+
+	for (c = 0; c < 4; c++)
+	{
+		int ci = ni * 2 + c / 2, cj = nj * 2 + c % 2;
+		const CDLODNode *child;
+
+		/* Children past the edge of the grid */
+		if (ci >= lod->nodeRows[level - 1] || cj >= lod->nodeCols[level - 1])
+			continue;
+
+		child = &lod->nodes[level - 1][ci * lod->nodeCols[level - 1] + cj];
+		areaBounds(lod, ci * n / 2, cj * n / 2, n / 2, child, &minV, &maxV);
+		if (boxInRange(minV, maxV, eye, lod->range[level - 1]))
+			selectNode(lod, level - 1, ci, cj, eye);
+		else if (boxVisible(CULL_TERRAIN, minV, maxV))
+			addPatch(lod, ci * n / 2, cj * n / 2, level, CDLOD_PATCH_QUADS / 2, eye);
+	}
+}
+
+/* Vertex of sample (i, j) of a patch at the given level, morphed by
+   k (clamped to [0, 1]): vertices on odd rows or columns of the level
+   slide to the next level's surface, which runs through their even
+   neighbours */
+static CDLODVertex makeVertex(const CDLOD *lod, int i, int j, int level, float k)
+{
+	int s = 1 << level, oddI = (i >> level) & 1, oddJ = (j >> level) & 1;
+	CDLODVertex vert;
+	Vec3f *v = &vert.pos, *n = &vert.normal;
+
+	i = min(i, lod->rows - 1);
+	j = min(j, lod->cols - 1);
+	*v = lod->vertices[i * lod->cols + j];
+	*n = lod->normals[i * lod->cols + j];
+
+	if (k > 0.0f && (oddI || oddJ))
+	{
+		/* Ends of the coarse edge or diagonal this vertex is the
+		   middle of */
+		int di = oddI ? s : 0, dj = oddJ ? s : 0;
+		int e0 = clamp(i - di, 0, lod->rows - 1) * lod->cols + clamp(j + dj, 0, lod->cols - 1);
+		int e1 = clamp(i + di, 0, lod->rows - 1) * lod->cols + clamp(j - dj, 0, lod->cols - 1);
+
+		k = min(k, 1.0f);
+		v->y += k * ((lod->vertices[e0].y + lod->vertices[e1].y) * 0.5f - v->y);
+		n->x += k * ((lod->normals[e0].x + lod->normals[e1].x) * 0.5f - n->x);
+		n->y += k * ((lod->normals[e0].y + lod->normals[e1].y) * 0.5f - n->y);
+		n->z += k * ((lod->normals[e0].z + lod->normals[e1].z) * 0.5f - n->z);
+	}
+
+	vert.texcoord.x = (v->x / lod->size) - 0.5;
+	vert.texcoord.y = (v->z / lod->size) - 0.5;
+	return vert;
+}
+
+/* Builds the vertices of the streamed patches among [begin, end),
+   each morphed by how far through its level's morph range it is */
+static void buildPatches(int begin, int end, void *data)
+{
+	CDLODJob *job = data;
+	CDLOD *lod = job->lod;
+	Vec3f eye = job->eye;
+	int p, a, b;
+
+	for (p = begin; p < end; p++)
+	{
+		const CDLODPatch *patch = &lod->patches[p];
+		CDLODVertex *vert = &lod->verts[patch->first];
+		int s = 1 << patch->level;
+		float morphStart = lod->morphStart[patch->level];
+		float morphScale = 1.0f / (lod->range[patch->level] - morphStart);
+
+		if (patch->slot >= 0)
+			continue;
+
+		for (a = 0; a <= patch->quads; a++)
+		{
+			int i = min(patch->i + a * s, lod->rows - 1);
+
+			for (b = 0; b <= patch->quads; b++)
+			{
+				int j = min(patch->j + b * s, lod->cols - 1);
+				Vec3f v = lod->vertices[i * lod->cols + j];
+				float dx = v.x - eye.x, dz = v.z - eye.z;
+
+				*vert++ = makeVertex(lod, patch->i + a * s, patch->j + b * s, patch->level,
+					(sqrtf(dx * dx + dz * dz) - morphStart) * morphScale);
+			}
+		}
+	}
+}
+
+/* Builds the vertices of the nodes uploaded to the cache among
+   [begin, end) */
+static void buildUploads(int begin, int end, void *data)
+{
+	CDLODJob *job = data;
+	CDLOD *lod = job->lod;
+	int p, a, b;
+
+	for (p = begin; p < end; p++)
+	{
+		const CDLODPatch *upload = &lod->uploads[p];
+		CDLODVertex *vert = &lod->verts[upload->first];
+		int s = 1 << upload->level;
+
+		for (a = 0; a <= CDLOD_PATCH_QUADS; a++)
+			for (b = 0; b <= CDLOD_PATCH_QUADS; b++)
+				*vert++ = makeVertex(lod, upload->i + a * s, upload->j + b * s, upload->level,
+					upload->morphed ? 1.0f : 0.0f);
+	}
+}
+
+void selectCDLOD(CDLOD *lod, Vec3f eye)
+{
+	int l = lod->nLevels - 1, ni, nj, p;
+	CDLODJob job;
+
+	/* Some patch went without a slot last time */
+	if (lod->cacheFull)
+		resetCDLODCache(lod, max(lod->nSlots * 2, CDLOD_CACHE_MIN_SLOTS));
+
+	lod->selection++;
+	lod->nPatches = 0;
+	lod->nUploads = 0;
+	lod->nStreamed = 0;
+	for (ni = 0; ni < lod->nodeRows[l]; ni++)
+		for (nj = 0; nj < lod->nodeCols[l]; nj++)
+			selectNode(lod, l, ni, nj, eye);
+
+	lod->nVertices = lod->nStreamed;
+	for (p = 0; p < lod->nUploads; p++)
+	{
+		lod->uploads[p].first = lod->nVertices;
+		lod->nVertices += CDLOD_PATCH_VERTICES;
+	}
+
+	if (lod->nVertices > lod->vertexCapacity)
+	{
+		lod->vertexCapacity = lod->nVertices * 2;
+		free(lod->verts);
+		lod->verts = malloc(lod->vertexCapacity * sizeof(CDLODVertex));
+	}
+
+	job.lod = lod;
+	job.eye = eye;
+	parallelFor(0, lod->nPatches, CDLOD_PATCH_GRAIN, buildPatches, &job);
+	parallelFor(0, lod->nUploads, CDLOD_PATCH_GRAIN, buildUploads, &job);
+}
+
+/* Points the arrays at the bound buffer's vertices from vertex base */
+static void bindCDLODBuffers(int baseVertex, void *data)
+{
+	size_t offset = baseVertex * sizeof(CDLODVertex);
+
+	(void)data;
+	glVertexPointer(3, GL_FLOAT, sizeof(CDLODVertex), (void *)offset);
+	glNormalPointer(GL_FLOAT, sizeof(CDLODVertex), (void *)(offset + sizeof(Vec3f)));
+	glTexCoordPointer(2, GL_FLOAT, sizeof(CDLODVertex), (void *)(offset + 2 * sizeof(Vec3f)));
+}
+
+/* Immediate mode vertex of a streamed patch whose first vertex is
+   data */
+static void emitCDLODVertex(int i, void *data)
+{
+	const CDLODVertex *v = (const CDLODVertex *)data + i;
+
+	glTexCoord2f(v->texcoord.x, v->texcoord.y);
+	glNormal3f(v->normal.x, v->normal.y, v->normal.z);
+	glVertex3f(v->pos.x, v->pos.y, v->pos.z);
+}
+
+/* A cached patch, drawn in immediate mode from the samples */
+typedef struct
+{
+	const CDLOD *lod;
+	const CDLODPatch *patch;
+} CDLODEmit;
+
+static void emitCachedCDLODVertex(int i, void *data)
+{
+	const CDLODEmit *emit = data;
+	int s = 1 << emit->patch->level, side = emit->patch->quads + 1;
+	CDLODVertex v = makeVertex(emit->lod, emit->patch->i + i / side * s, emit->patch->j + i % side * s,
+		emit->patch->level, emit->patch->morphed ? 1.0f : 0.0f);
+
+	emitCDLODVertex(0, &v);
+}
+
+/* Draws the patches with the given quads per side that are cached
+   (or not) from the bound buffers */
+static void drawCDLODBatch(CDLOD *lod, const GridTopology *topology, int quads, bool cached, int *bases)
+{
+	int p, n = 0;
+
+	for (p = 0; p < lod->nPatches; p++)
+	{
+		const CDLODPatch *patch = &lod->patches[p];
+
+		if (patch->quads == quads && (patch->slot >= 0) == cached)
+			bases[n++] = cached ? patch->slot * CDLOD_PATCH_VERTICES + patch->first : patch->first;
+	}
+	drawTopologyInstances(topology, bases, n, bindCDLODBuffers, NULL);
+}
+
+void drawCDLOD(CDLOD *lod)
+{
+	int p, t;
+	int *bases;
+
+	if (lod->nPatches == 0)
+		return;
+
+	if (!buffersSupported())
+	{
+		for (p = 0; p < lod->nPatches; p++)
+		{
+			const GridTopology *topology =
+				lod->patches[p].quads == CDLOD_PATCH_QUADS ? &lod->patch : &lod->quarter;
+			CDLODEmit emit = { lod, &lod->patches[p] };
+
+			if (lod->patches[p].slot >= 0)
+				drawTopologyChunkImmediate(topology, 0, emitCachedCDLODVertex, &emit);
+			else
+				drawTopologyChunkImmediate(topology, 0, emitCDLODVertex, &lod->verts[lod->patches[p].first]);
+		}
+		return;
+	}
+
+	if (!lod->vertexBuffer)
+	{
+		const GridTopology *topologies[3] = { &lod->patch, &lod->quarter, &lod->quarterInPatch };
+
+		glGenBuffers(1, &lod->vertexBuffer);
+		glGenBuffers(1, &lod->cacheBuffer);
+		glGenBuffers(3, lod->indexBuffers);
+		for (t = 0; t < 3; t++)
+		{
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lod->indexBuffers[t]);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, topologies[t]->nIndices * sizeof(unsigned short),
+				topologies[t]->indices, GL_STATIC_DRAW);
+		}
+	}
+
+	/* Slots are only ever added to an empty cache, so growing the
+	   store loses nothing */
+	glBindBuffer(GL_ARRAY_BUFFER, lod->cacheBuffer);
+	if (lod->cacheBufferSlots != lod->nSlots)
+	{
+		lod->cacheBufferSlots = lod->nSlots;
+		glBufferData(GL_ARRAY_BUFFER, (size_t)lod->nSlots * CDLOD_PATCH_VERTICES * sizeof(CDLODVertex),
+			NULL, GL_DYNAMIC_DRAW);
+	}
+	for (p = 0; p < lod->nUploads; p++)
+		glBufferSubData(GL_ARRAY_BUFFER,
+			(size_t)lod->uploads[p].slot * CDLOD_PATCH_VERTICES * sizeof(CDLODVertex),
+			CDLOD_PATCH_VERTICES * sizeof(CDLODVertex), &lod->verts[lod->uploads[p].first]);
+
+	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+	/* Full patches then quadrants, each a batch sharing one set of
+	   strips. Cached quadrants index into their node's vertices */
+	bases = malloc(lod->nPatches * sizeof(int));
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lod->indexBuffers[0]);
+	drawCDLODBatch(lod, &lod->patch, CDLOD_PATCH_QUADS, true, bases);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lod->indexBuffers[2]);
+	drawCDLODBatch(lod, &lod->quarterInPatch, CDLOD_PATCH_QUADS / 2, true, bases);
+
+	/* The rest change with every viewport, orphan the old store */
+	if (lod->nStreamed > 0)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, lod->vertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, lod->nStreamed * sizeof(CDLODVertex), lod->verts, GL_STREAM_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lod->indexBuffers[0]);
+		drawCDLODBatch(lod, &lod->patch, CDLOD_PATCH_QUADS, false, bases);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, lod->indexBuffers[1]);
+		drawCDLODBatch(lod, &lod->quarter, CDLOD_PATCH_QUADS / 2, false, bases);
+	}
+	free(bases);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glPopClientAttrib();
+}
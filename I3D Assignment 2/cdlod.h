@@ -0,0 +1,152 @@
+#ifndef CDLOD_H
+#define CDLOD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "utils.h"
+#include "topology.h"
+
+/* Quads per side of a full patch, every selected node is drawn as one
+   (or a quarter of one) at its level's sample stride */
+#define CDLOD_PATCH_QUADS 16
+
+/* Most levels a quadtree can have, enough for 16 * 2^11 samples */
+#define CDLOD_MAX_LEVELS 12
+
+/* Height error (GL units) below which a node is never refined, so
+   flat stretches of seabed stay coarse however close the eye is */
+#define CDLOD_DEFAULT_TOLERANCE 0.05f
+
+/* Vertices of a full patch */
+#define CDLOD_PATCH_VERTICES ((CDLOD_PATCH_QUADS + 1) * (CDLOD_PATCH_QUADS + 1))
+
+/* Height bounds of a quadtree node and the largest difference between
+   the full resolution samples it covers and its own coarser surface */
+typedef struct
+{
+	float minY, maxY;
+	float error;
+} CDLODNode;
+
+/* A node chosen for drawing: its first sample, level (the stride is
+   2^level samples) and quads per side, CDLOD_PATCH_QUADS or half that
+   for a quadrant. Patches short of their level's morph band, or past
+   it and so fully morphed, are drawn from their node's slot in the
+   cache, the rest are morphed and streamed */
+typedef struct
+{
+	int i, j;
+	int level;
+	int quads;
+	int slot;		/* In the cache, or -1 if streamed */
+	bool morphed;		/* Cached fully morphed to the next level */
+	int first;		/* Vertex in verts if streamed, else in the slot */
+} CDLODPatch;
+
+/* A node's vertices kept in the cache buffer, unmorphed or fully
+   morphed. key is the node's index times two, plus one if morphed */
+typedef struct
+{
+	int level, key;		/* level is -1 if the slot is free */
+	int lastUsed;		/* Selection it was last drawn in */
+} CDLODSlot;
+
+/* Layout of one vertex in the patch buffers */
+typedef struct
+{
+	Vec3f pos;
+	Vec3f normal;
+	Vec2f texcoord;
+} CDLODVertex;
+
+/* Continuous distance-dependent LOD (Strugar's CDLOD) over a rows x
+   cols heightfield. Level 0 nodes cover CDLOD_PATCH_QUADS quads at
+   full resolution, each level up doubles the stride and the distance
+   it's used to. Every viewport selects the nodes to draw from its
+   eye, and vertices approaching the end of their level's range are
+   morphed towards the next level's surface so changing level doesn't
+   pop. Each node knows its error against the full resolution samples
+   and isn't refined once that's within the tolerance. Only patches
+   inside a morph band change with the eye, so only those are rebuilt
+   and streamed for every viewport; the rest are drawn from whole
+   nodes' vertices kept in a buffer across frames */
+typedef struct
+{
+	int rows, cols;
+	float size;			/* For the texcoords */
+	const Vec3f *vertices;		/* Full resolution samples and */
+	const Vec3f *normals;		/* normals, owned by the caller */
+
+	int nLevels;
+	int nodeRows[CDLOD_MAX_LEVELS], nodeCols[CDLOD_MAX_LEVELS];
+	CDLODNode *nodes[CDLOD_MAX_LEVELS];
+	float range[CDLOD_MAX_LEVELS];		/* Furthest each level is used */
+	float morphStart[CDLOD_MAX_LEVELS];	/* Where morphing to the next begins */
+	float error[CDLOD_MAX_LEVELS];		/* Largest node error per level */
+	float tolerance;
+
+	/* The last selection, rebuilt for each viewport. verts holds the
+	   nStreamed morphed vertices, then those of the nodes to upload to
+	   the cache */
+	int nPatches, patchCapacity;
+	CDLODPatch *patches;
+	int nUploads, uploadCapacity;
+	CDLODPatch *uploads;		/* Whole nodes, slot is the target */
+	int nStreamed, nVertices, vertexCapacity;
+	CDLODVertex *verts;
+
+	/* Slots of CDLOD_PATCH_VERTICES vertices, and the slot of each
+	   node's two versions (by key) or -1. Slots not drawn in the last
+	   few selections are reused, the cache doubles when that isn't
+	   enough */
+	int nSlots, nFree;
+	CDLODSlot *slots;
+	int *freeSlots;
+	int *slotOf[CDLOD_MAX_LEVELS];
+	int selection;
+	bool cacheFull;			/* A patch found no slot, grow it */
+
+	/* Full and quarter patch strips, shared by every node, and the
+	   quarter strips laid over a full patch's vertices */
+	GridTopology patch, quarter, quarterInPatch;
+	unsigned int vertexBuffer;	/* Streamed */
+	unsigned int cacheBuffer;
+	int cacheBufferSlots;		/* Slots cacheBuffer has room for */
+	unsigned int indexBuffers[3];
+} CDLOD;
+
+/* Builds the quadtree over the given samples (row-major, rows x cols)
+   and measures every node's error, nodes within tolerance are drawn
+   as they are (see CDLOD_DEFAULT_TOLERANCE). The arrays must outlive
+   the CDLOD */
+void initCDLOD(CDLOD *lod, const Vec3f *vertices, const Vec3f *normals,
+	int rows, int cols, float size, float tolerance);
+
+/* Takes in changes to the heights of samples [i0, i1] x [j0, j1],
+   widening the bounds and errors of the nodes they touch and dropping
+   the cached vertices of the nodes whose heights or normals change */
+void updateCDLODArea(CDLOD *lod, int i0, int j0, int i1, int j1);
+
+/* Frees everything allocated by initCDLOD. Touches no GL state, so
+   it can run on any thread once releaseCDLODGL has */
+void cleanupCDLOD(CDLOD *lod);
+
+/* Deletes the buffers drawCDLOD made, on the GL thread, emptying the
+   cache. They're made again on the next draw */
+void releaseCDLODGL(CDLOD *lod);
+
+/* Selects the nodes to draw from eye, leaving out those outside the
+   cull frustum, and builds the vertices of those in a morph band and
+   of nodes newly added to the cache */
+void selectCDLOD(CDLOD *lod, Vec3f eye);
+
+/* Draws the last selection */
+void drawCDLOD(CDLOD *lod);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,149 @@
+#include <math.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "clipmap.h"
+
+/* Builds the levels, all centred on the origin until the first move */
+void initClipmap(Clipmap *clipmap, int m, float spacing, float extent, float size)
+{
+	int l;
+	float covered;
+
+	/* (m - 1) / 2 must be even so each level's hole is a whole number
+	   of coarse cells starting on a coarse vertex */
+	m = ((max(m, 9) - 1 + 3) & ~3) + 1;
+
+	clipmap->m = m;
+	clipmap->size = size;
+	clipmap->nLevels = 1;
+	for (covered = (m - 1) * spacing; covered < extent && clipmap->nLevels < CLIPMAP_MAX_LEVELS; covered *= 2)
+		clipmap->nLevels++;
+
+	for (l = 0; l < clipmap->nLevels; l++)
+	{
+		ClipmapLevel *level = &clipmap->levels[l];
+
+		initGridLayout(&level->grid, m, m, size, GRID_LAYOUT_SOA);
+		level->spacing = spacing * (float)(1 << l);
+
+		/* Force the first move to place everything */
+		level->originI = level->originJ = INT_MAX;
+		level->holeI = level->holeJ = -1;
+	}
+
+	moveClipmap(clipmap, 0.0f, 0.0f);
+}
+
+void cleanupClipmap(Clipmap *clipmap)
+{
+	int l;
+
+	for (l = 0; l < clipmap->nLevels; l++)
+		cleanupGrid(&clipmap->levels[l].grid);
+	clipmap->nLevels = 0;
+}
+
+/* Vertex (0, 0) of a level, in multiples of its spacing: the even
+   index that puts the eye closest to the middle */
+static int snapOrigin(float eye, float spacing, int m)
+{
+	return (int)floorf(eye / (2.0f * spacing) - (m - 1) / 4.0f) * 2;
+}
+
+/* Snaps every level around the eye. A level only moves once the eye
+   has crossed two of its cells, so the coarse rings barely ever do,
+   and moving is just rewriting x/z in place */
+void moveClipmap(Clipmap *clipmap, float eyeX, float eyeZ)
+{
+	int l, m = clipmap->m, hole = (m - 1) / 2;
+
+	for (l = 0; l < clipmap->nLevels; l++)
+	{
+		ClipmapLevel *level = &clipmap->levels[l];
+		int originI = snapOrigin(eyeX, level->spacing, m);
+		int originJ = snapOrigin(eyeZ, level->spacing, m);
+
+		if (originI != level->originI || originJ != level->originJ)
+		{
+			level->originI = originI;
+			level->originJ = originJ;
+			placeGrid(&level->grid, originI * level->spacing, originJ * level->spacing, level->spacing);
+		}
+	}
+
+	/* The finer level's origin lands on one of our vertices since
+	   it's even, its hole is half our width */
+	for (l = 0; l < clipmap->nLevels; l++)
+	{
+		ClipmapLevel *level = &clipmap->levels[l];
+		int holeI = -1, holeJ = -1;
+
+		if (l > 0)
+		{
+			holeI = clipmap->levels[l - 1].originI / 2 - level->originI;
+			holeJ = clipmap->levels[l - 1].originJ / 2 - level->originJ;
+		}
+
+		if (holeI != level->holeI || holeJ != level->holeJ)
+		{
+			level->holeI = holeI;
+			level->holeJ = holeJ;
+			setGridHole(&level->grid, holeI, holeJ, l > 0 ? hole : 0);
+		}
+	}
+}
+
+/* Replaces vertex b with the midpoint of a and c */
+static void averageVertex(Grid *grid, int a, int b, int c)
+{
+	grid->y[b] = 0.5f * (grid->y[a] + grid->y[c]);
+	grid->nx[b] = 0.5f * (grid->nx[a] + grid->nx[c]);
+	grid->ny[b] = 0.5f * (grid->ny[a] + grid->ny[c]);
+	grid->nz[b] = 0.5f * (grid->nz[a] + grid->nz[c]);
+	grid->dx[b] = 0.5f * (grid->dx[a] + grid->dx[c]);
+	grid->dz[b] = 0.5f * (grid->dz[a] + grid->dz[c]);
+}
+
+/* Pulls the odd vertices on a level's outer edge onto the straight
+   edge of the coarser level around it, so there are no cracks where
+   the two meet. Even vertices already coincide with the coarse ones */
+static void stitchLevel(Grid *grid)
+{
+	int i, m = grid->rows, last = m - 1;
+
+	for (i = 1; i < last; i += 2)
+	{
+		averageVertex(grid, i - 1, i, i + 1);
+		averageVertex(grid, last * m + i - 1, last * m + i, last * m + i + 1);
+		averageVertex(grid, (i - 1) * m, i * m, (i + 1) * m);
+		averageVertex(grid, (i - 1) * m + last, i * m + last, (i + 1) * m + last);
+	}
+}
+
+/* Evaluates the waves on each level then stitches the seams */
+void updateClipmap(Clipmap *clipmap)
+{
+	int l;
+
+	for (l = 0; l < clipmap->nLevels; l++)
+	{
+		evalGrid(&clipmap->levels[l].grid);
+		if (l < clipmap->nLevels - 1)
+			stitchLevel(&clipmap->levels[l].grid);
+	}
+}
+
+/* Draws every level, coarsest first. They don't overlap, so the
+   order only matters for keeping the near water drawn last */
+void drawClipmap(Clipmap *clipmap)
+{
+	int l;
+
+	for (l = clipmap->nLevels - 1; l >= 0; l--)
+		drawGrid(&clipmap->levels[l].grid);
+}
+
+int clipmapVertexCount(const Clipmap *clipmap)
+{
+	return clipmap->nLevels * clipmap->m * clipmap->m;
+}
@@ -0,0 +1,65 @@
+#ifndef CLIPMAP_H
+#define CLIPMAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "waves.h"
+
+/* Most nested levels a clipmap can have */
+#define CLIPMAP_MAX_LEVELS 12
+
+/* One ring of a clipmap: an m x m grid whose spacing doubles with
+   each level. All but the finest leave a hole where the next finer
+   level is drawn */
+typedef struct
+{
+	Grid grid;		/* Vertex data, buffers and ring indices */
+	float spacing;		/* Distance between vertices */
+	int originI, originJ;	/* Vertex (0, 0) in multiples of spacing,
+				   always even so it lands on the next
+				   coarser level's vertices */
+	int holeI, holeJ;	/* First cell of the hole, -1 for none */
+} ClipmapLevel;
+
+/* A set of nested square rings of water centred on an eye position.
+   Each level has the same number of vertices, so the total doesn't
+   depend on how far the sea stretches, only on how many doublings
+   it takes to reach it */
+typedef struct
+{
+	int nLevels;
+	int m;			/* Vertices per side of each level */
+	float size;		/* Sea size the water texture spans */
+	ClipmapLevel levels[CLIPMAP_MAX_LEVELS];
+} Clipmap;
+
+/* Initialises a clipmap with m x m vertices per level (m - 1 is
+   rounded up to a multiple of 4), the finest level spaced by spacing,
+   with enough levels for the coarsest to cover extent GL units. The
+   water texture is stretched over size like the uniform grid's */
+void initClipmap(Clipmap *clipmap, int m, float spacing, float extent, float size);
+
+/* Frees everything allocated by initClipmap */
+void cleanupClipmap(Clipmap *clipmap);
+
+/* Recentres the rings on the eye. Only levels whose snapped origin
+   changes are moved, in place */
+void moveClipmap(Clipmap *clipmap, float eyeX, float eyeZ);
+
+/* Evaluates the waves on every level at the current time (see
+   advanceWaves) and stitches the seams between levels */
+void updateClipmap(Clipmap *clipmap);
+
+/* Draws all levels, coarsest first */
+void drawClipmap(Clipmap *clipmap);
+
+/* Total vertices across all levels */
+int clipmapVertexCount(const Clipmap *clipmap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,333 @@
+#include <math.h>
+#include <stdlib.h>
+#include "coast.h"
+#include "jobs.h"
+
+/* Squared distance standing in for "no site", large enough to lose
+   to any real one but small enough not to overflow when summed */
+#define COAST_FAR 1e20f
+
+/* Minimum rows (or columns) per job in each pass */
+#define COAST_ROW_GRAIN 16
+
+/* Shared state for the transform passes over an update's window.
+   Its land and water hold the squared distance from each sample in
+   the window to the nearest land and water sample in it */
+typedef struct
+{
+	CoastField *coast;
+	CoastUpdate *update;
+} CoastJob;
+
+/* Scratch for one run of 1d transforms of up to n samples */
+typedef struct
+{
+	int *v;
+	float *z, *f, *d;
+} CoastScratch;
+
+static void initScratch(CoastScratch *scratch, int n)
+{
+	scratch->v = malloc(n * sizeof(int));
+	scratch->z = malloc((n + 1) * sizeof(float));
+	scratch->f = malloc(n * sizeof(float));
+	scratch->d = malloc(n * sizeof(float));
+}
+
+static void cleanupScratch(CoastScratch *scratch)
+{
+	free(scratch->v);
+	free(scratch->z);
+	free(scratch->f);
+	free(scratch->d);
+}
+
+/* Felzenszwalb and Huttenlocher's 1d squared distance transform of
+   scratch->f into scratch->d, samples h units apart. It keeps the
+   lower envelope of the parabolas rooted at each sample, so it's
+   linear in n */
+static void transform1D(CoastScratch *scratch, int n, float h)
+{
+	int *v = scratch->v;
+	float *z = scratch->z, *f = scratch->f, *d = scratch->d;
+	float h2 = h * h, s;
+	int q, k = 0;
+
+	v[0] = 0;
+	z[0] = -HUGE_VALF;
+	z[1] = HUGE_VALF;
+	for (q = 1; q < n; q++)
+	{
+		/* Drop the parabolas the new one hides */
+		for (;;)
+		{
+			int p = v[k];
+			/* Where the parabolas at p and q cross, with q^2 - p^2
+			   kept exact so it holds up far along long rows */
+			s = ((f[q] - f[p]) / (h2 * (q - p)) + (q + p)) * 0.5f;
+			if (s > z[k])
+				break;
+			k--;
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = HUGE_VALF;
+	}
+
+	k = 0;
+	for (q = 0; q < n; q++)
+	{
+		while (z[k + 1] < q)
+			k++;
+		d[q] = h2 * (q - v[k]) * (q - v[k]) + f[v[k]];
+	}
+}
+
+/* Transforms window rows [begin, end) of both grids along j */
+static void transformRows(int begin, int end, void *data)
+{
+	CoastJob *job = data;
+	float *grids[2] = { job->update->land, job->update->water };
+	int i, j, g, cols = job->update->cols;
+	CoastScratch scratch;
+
+	initScratch(&scratch, cols);
+	for (g = 0; g < 2; g++)
+	{
+		for (i = begin; i < end; i++)
+		{
+			float *row = grids[g] + i * cols;
+			for (j = 0; j < cols; j++)
+				scratch.f[j] = row[j];
+			transform1D(&scratch, cols, job->coast->spacingZ);
+			for (j = 0; j < cols; j++)
+				row[j] = scratch.d[j];
+		}
+	}
+	cleanupScratch(&scratch);
+}
+
+/* Transforms the kept window columns [begin, end) of both grids along
+   i, then turns them into signed distances within the band */
+static void transformColumns(int begin, int end, void *data)
+{
+	CoastJob *job = data;
+	CoastField *coast = job->coast;
+	const CoastUpdate *update = job->update;
+	int i, j, rows = update->rows, cols = update->cols;
+	float half = 0.5f * min(coast->spacingX, coast->spacingZ);
+	CoastScratch land, water;
+
+	initScratch(&land, rows);
+	initScratch(&water, rows);
+	for (j = begin; j < end; j++)
+	{
+		float *out = coast->distance + update->j0 + j;
+
+		for (i = 0; i < rows; i++)
+		{
+			land.f[i] = update->land[i * cols + j];
+			water.f[i] = update->water[i * cols + j];
+		}
+		transform1D(&land, rows, coast->spacingX);
+		transform1D(&water, rows, coast->spacingX);
+
+		/* The waterline lies somewhere between a sample and its
+		   nearest opposite, call it halfway */
+		for (i = update->keepI0 - update->i0; i <= update->keepI1 - update->i0; i++)
+		{
+			if (land.d[i] > 0.0f)
+				out[(update->i0 + i) * coast->cols] = min(sqrtf(land.d[i]) - half, coast->band);
+			else
+				out[(update->i0 + i) * coast->cols] = max(half - sqrtf(water.d[i]), -coast->band);
+		}
+	}
+	cleanupScratch(&land);
+	cleanupScratch(&water);
+}
+
+/* Field samples [i0, i1] x [j0, j1] whose distances may have moved,
+   and the window they depend on, for grid samples [gi0, gi1] x [gj0,
+   gj1] having changed: only the band around them */
+static void updateWindow(const CoastField *coast, int gi0, int gj0, int gi1, int gj1, CoastUpdate *update)
+{
+	int bandI = (int)ceilf(coast->band / coast->spacingX) + 1;
+	int bandJ = (int)ceilf(coast->band / coast->spacingZ) + 1;
+	int i0 = gi0 / coast->stride, i1 = min((gi1 + coast->stride - 1) / coast->stride, coast->rows - 1);
+	int j0 = gj0 / coast->stride, j1 = min((gj1 + coast->stride - 1) / coast->stride, coast->cols - 1);
+
+	update->keepI0 = max(i0 - bandI, 0);
+	update->keepI1 = min(i1 + bandI, coast->rows - 1);
+	update->keepJ0 = max(j0 - bandJ, 0);
+	update->keepJ1 = min(j1 + bandJ, coast->cols - 1);
+	update->i0 = max(update->keepI0 - bandI, 0);
+	update->j0 = max(update->keepJ0 - bandJ, 0);
+	update->rows = min(update->keepI1 + bandI, coast->rows - 1) - update->i0 + 1;
+	update->cols = min(update->keepJ1 + bandJ, coast->cols - 1) - update->j0 + 1;
+}
+
+/* Takes the side of the water every sample in the update's window is
+   on: each is a site of one grid or the other */
+static void startUpdate(const CoastField *coast, const Vec3f *vertices, CoastUpdate *update)
+{
+	int i, j, n = update->rows * update->cols;
+
+	update->rowsDone = update->columnsDone = 0;
+	update->land = malloc(n * sizeof(float));
+	update->water = malloc(n * sizeof(float));
+	for (i = 0; i < update->rows; i++)
+	{
+		const Vec3f *row = vertices +
+			min((update->i0 + i) * coast->stride, coast->gridRows - 1) * coast->gridCols;
+
+		for (j = 0; j < update->cols; j++)
+		{
+			bool land = row[min((update->j0 + j) * coast->stride, coast->gridCols - 1)].y > coast->waterLevel;
+			update->land[i * update->cols + j] = land ? 0.0f : COAST_FAR;
+			update->water[i * update->cols + j] = land ? COAST_FAR : 0.0f;
+		}
+	}
+}
+
+void initCoastField(CoastField *coast, const Vec3f *vertices, int rows, int cols, int stride,
+	float waterLevel, float band)
+{
+	CoastUpdate update;
+	double budget = HUGE_VAL;
+
+	coast->stride = stride;
+	coast->gridRows = rows;
+	coast->gridCols = cols;
+	coast->rows = (rows - 2) / stride + 2;
+	coast->cols = (cols - 2) / stride + 2;
+	coast->originX = vertices[0].x;
+	coast->originZ = vertices[0].z;
+	coast->spacingX = (vertices[(rows - 1) * cols].x - coast->originX) / (rows - 1) * stride;
+	coast->spacingZ = (vertices[cols - 1].z - coast->originZ) / (cols - 1) * stride;
+	coast->waterLevel = waterLevel;
+	coast->band = band;
+	coast->distance = malloc(coast->rows * coast->cols * sizeof(float));
+
+	update.i0 = update.j0 = update.keepI0 = update.keepJ0 = 0;
+	update.keepI1 = coast->rows - 1;
+	update.keepJ1 = coast->cols - 1;
+	update.rows = coast->rows;
+	update.cols = coast->cols;
+	startUpdate(coast, vertices, &update);
+	continueCoastUpdate(coast, &update, &budget);
+}
+
+void beginCoastUpdate(const CoastField *coast, const Vec3f *vertices, int i0, int j0, int i1, int j1,
+	CoastUpdate *update)
+{
+	updateWindow(coast, i0, j0, i1, j1, update);
+	startUpdate(coast, vertices, update);
+}
+
+bool continueCoastUpdate(CoastField *coast, CoastUpdate *update, double *budget)
+{
+	int keptCols = update->keepJ1 - update->keepJ0 + 1, n;
+	CoastJob job;
+
+	job.coast = coast;
+	job.update = update;
+
+	/* Rows first, the columns need the whole of them */
+	if (update->rowsDone < update->rows)
+	{
+		n = (int)max(min(*budget / update->cols, update->rows - update->rowsDone), 1.0);
+		parallelFor(update->rowsDone, update->rowsDone + n, COAST_ROW_GRAIN, transformRows, &job);
+		update->rowsDone += n;
+		*budget -= (double)n * update->cols;
+		if (update->rowsDone < update->rows || *budget < update->rows)
+			return false;
+	}
+
+	n = (int)max(min(*budget / update->rows, keptCols - update->columnsDone), 1.0);
+	parallelFor(update->keepJ0 - update->j0 + update->columnsDone,
+		update->keepJ0 - update->j0 + update->columnsDone + n, COAST_ROW_GRAIN, transformColumns, &job);
+	update->columnsDone += n;
+	*budget -= (double)n * update->rows;
+	if (update->columnsDone < keptCols)
+		return false;
+
+	cancelCoastUpdate(update);
+	return true;
+}
+
+void cancelCoastUpdate(CoastUpdate *update)
+{
+	free(update->land);
+	free(update->water);
+	update->land = update->water = NULL;
+}
+
+double coastUpdateCost(const CoastField *coast, int i0, int j0, int i1, int j1)
+{
+	CoastUpdate update;
+
+	updateWindow(coast, i0, j0, i1, j1, &update);
+	return (double)update.rows * (update.cols + update.keepJ1 - update.keepJ0 + 1);
+}
+
+/* A change can only move distances within the band of it, and those
+   only depend on samples within the band of them */
+void updateCoastField(CoastField *coast, const Vec3f *vertices, int i0, int j0, int i1, int j1)
+{
+	CoastUpdate update;
+	double budget = HUGE_VAL;
+
+	beginCoastUpdate(coast, vertices, i0, j0, i1, j1, &update);
+	continueCoastUpdate(coast, &update, &budget);
+}
+
+void cleanupCoastField(CoastField *coast)
+{
+	free(coast->distance);
+	coast->distance = NULL;
+}
+
+float coastDistance(const CoastField *coast, float x, float z)
+{
+	float u = (x - coast->originX) / coast->spacingX;
+	float v = (z - coast->originZ) / coast->spacingZ;
+	float cu = clamp(u, 0.0f, (float)(coast->rows - 1));
+	float cv = clamp(v, 0.0f, (float)(coast->cols - 1));
+	int i = min((int)cu, coast->rows - 2), j = min((int)cv, coast->cols - 2);
+	const float *d = coast->distance + i * coast->cols + j;
+	float fu = cu - i, fv = cv - j;
+	float outsideX = (u - cu) * coast->spacingX, outsideZ = (v - cv) * coast->spacingZ;
+
+	float d0 = d[0] + (d[1] - d[0]) * fv;
+	float d1 = d[coast->cols] + (d[coast->cols + 1] - d[coast->cols]) * fv;
+
+	return d0 + (d1 - d0) * fu + sqrtf(outsideX * outsideX + outsideZ * outsideZ);
+}
+
+Vec2f coastGradient(const CoastField *coast, float x, float z)
+{
+	Vec2f g;
+	float length;
+
+	g.x = coastDistance(coast, x + coast->spacingX, z) - coastDistance(coast, x - coast->spacingX, z);
+	g.y = coastDistance(coast, x, z + coast->spacingZ) - coastDistance(coast, x, z - coast->spacingZ);
+
+	length = sqrtf(g.x * g.x + g.y * g.y);
+	if (length > 0.0f)
+	{
+		g.x /= length;
+		g.y /= length;
+	}
+	return g;
+}
+
+float coastClearance(const CoastField *coast, const Vec2f *points, int nPoints)
+{
+	float clearance = HUGE_VALF;
+	int i;
+
+	for (i = 0; i < nPoints; i++)
+		clearance = min(clearance, coastDistance(coast, points[i].x, points[i].y));
+	return clearance;
+}
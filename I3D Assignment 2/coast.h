@@ -0,0 +1,93 @@
+#ifndef COAST_H
+#define COAST_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "utils.h"
+
+/* Signed distance (GL units) from every terrain sample to the
+   waterline, positive over water and negative on land. Built with an
+   exact Euclidean distance transform in time linear in the samples,
+   so any distance to the shore afterwards is a bilinear lookup.
+   Distances are clamped to +/- band, which keeps the effect of
+   editing the terrain local (see updateCoastField). The cost of that
+   grows with the square of the band in samples, so fine terrains are
+   only sampled every stride rows and columns */
+typedef struct
+{
+	int rows, cols;			/* Field sample (i, j) is terrain */
+	int stride;			/* sample (i, j) * stride, clamped */
+	int gridRows, gridCols;		/* to the terrain's own rows x cols */
+	float originX, originZ;		/* World position of sample (0, 0) */
+	float spacingX, spacingZ;	/* Between samples along i and j */
+	float waterLevel;
+	float band;
+	float *distance;		/* rows x cols, row-major */
+} CoastField;
+
+/* An update of the field after some heights changed, which can be
+   spread over several calls. It takes the samples within two bands of
+   the change, transforms them along j a row at a time then along i a
+   column at a time, and rewrites the field one band around the change
+   as each column is done */
+typedef struct
+{
+	int i0, j0, rows, cols;			/* Field samples read */
+	int keepI0, keepJ0, keepI1, keepJ1;	/* and rewritten */
+	int rowsDone, columnsDone;		/* Of the kept columns */
+	float *land, *water;			/* NULL once finished */
+} CoastUpdate;
+
+/* Builds the field over a row-major rows x cols grid of samples,
+   where x varies with the row and z with the column (as the terrain
+   is laid out), taking every stride'th row and column of it. Samples
+   above waterLevel are land */
+void initCoastField(CoastField *coast, const Vec3f *vertices, int rows, int cols, int stride,
+	float waterLevel, float band);
+
+/* Starts updating the field for the heights of grid samples [i0, i1]
+   x [j0, j1] having changed. Which side of the water the samples it
+   needs are on is taken now, later changes need another update */
+void beginCoastUpdate(const CoastField *coast, const Vec3f *vertices, int i0, int j0, int i1, int j1,
+	CoastUpdate *update);
+
+/* Carries on with an update, reading whole rows or columns of its
+   samples until *budget (in samples read) is spent and taking what
+   was read off it. At least one row or column is done, so it always
+   gets somewhere. Returns true once it's finished and freed */
+bool continueCoastUpdate(CoastField *coast, CoastUpdate *update, double *budget);
+
+/* Frees an update that won't be finished */
+void cancelCoastUpdate(CoastUpdate *update);
+
+/* Samples an update for grid samples [i0, i1] x [j0, j1] reads */
+double coastUpdateCost(const CoastField *coast, int i0, int j0, int i1, int j1);
+
+/* Brings the field up to date after the heights of grid samples [i0,
+   i1] x [j0, j1] changed, all at once. Only samples within two bands
+   of them are read and one band of them rewritten */
+void updateCoastField(CoastField *coast, const Vec3f *vertices, int i0, int j0, int i1, int j1);
+
+/* Frees the distances */
+void cleanupCoastField(CoastField *coast);
+
+/* Signed distance to the shore at any world position, interpolated
+   between samples. Outside the map the nearest edge's distance is used
+   plus the distance to that edge, so it's always safe to call */
+float coastDistance(const CoastField *coast, float x, float z);
+
+/* Direction (x, z) the distance increases fastest at a position, away
+   from the nearest shore over water. Zero on flat stretches */
+Vec2f coastGradient(const CoastField *coast, float x, float z);
+
+/* Smallest signed distance over a set of (x, z) points, eg. samples
+   around a hull */
+float coastClearance(const CoastField *coast, const Vec2f *points, int nPoints);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
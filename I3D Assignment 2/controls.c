@@ -8,4 +8,8 @@ void initControls(Controls *controls)
 	controls->wireframe = false;
 	controls->day = true;
 	controls->mainCamera = true;
+	controls->clipmap = true;
+	controls->culling = true;
+	controls->cullStats = false;
+	controls->terrainMode = TERRAIN_LOD;
 }
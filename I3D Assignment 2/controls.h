@@ -7,6 +7,17 @@ extern "C" {
 
 #include "utils.h"
 
+/* How the seabed is drawn, 'T' cycles through them */
+typedef enum
+{
+	TERRAIN_LOD,		/* Quadtree LOD from each viewport's eye */
+	TERRAIN_RETAINED,	/* Full mesh from static buffers */
+	TERRAIN_IMMEDIATE,	/* Full mesh resubmitted every frame */
+	TERRAIN_STREAMED,	/* The open sea round it, in tiles streamed
+				   from disk around the boats */
+	N_TERRAIN_MODES
+} TerrainMode;
+
 /* Struct to handle different controls for debugging */
 typedef struct
 {
@@ -16,6 +27,10 @@ typedef struct
 	bool wireframe;
 	bool day;
 	bool mainCamera;
+	bool clipmap;
+	bool culling;
+	bool cullStats;
+	TerrainMode terrainMode;
 } Controls;
 
 extern Controls controls;
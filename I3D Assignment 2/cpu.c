@@ -0,0 +1,58 @@
+#include "cpu.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CPU_X86 1
+#include <cpuid.h>
+#endif
+
+#define FEATURE_SSE2 1
+#define FEATURE_AVX2 2
+
+/* Queries CPUID once and returns a bitmask of the features we use */
+static int cpuFeatures(void)
+{
+	static int features = -1;
+
+	if (features != -1)
+		return features;
+
+	features = 0;
+
+#ifdef CPU_X86
+	{
+		unsigned int a, b, c, d;
+
+		if (__get_cpuid(1, &a, &b, &c, &d))
+		{
+			if (d & bit_SSE2)
+				features |= FEATURE_SSE2;
+
+			/* AVX2 also needs the OS to save the ymm registers
+			   (OSXSAVE set and XCR0 bits 1 and 2 enabled) */
+			if ((c & bit_OSXSAVE) && (c & bit_AVX))
+			{
+				unsigned int xcr0, xcr0hi;
+				__asm__ volatile ("xgetbv" : "=a"(xcr0), "=d"(xcr0hi) : "c"(0));
+				if ((xcr0 & 6) == 6 && __get_cpuid_max(0, 0) >= 7)
+				{
+					__cpuid_count(7, 0, a, b, c, d);
+					if (b & bit_AVX2)
+						features |= FEATURE_AVX2;
+				}
+			}
+		}
+	}
+#endif
+
+	return features;
+}
+
+bool cpuHasSSE2(void)
+{
+	return (cpuFeatures() & FEATURE_SSE2) != 0;
+}
+
+bool cpuHasAVX2(void)
+{
+	return (cpuFeatures() & FEATURE_AVX2) != 0;
+}
@@ -0,0 +1,19 @@
+#ifndef CPU_H
+#define CPU_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "utils.h"
+
+/* Runtime CPU feature queries (CPUID on x86, false elsewhere). The
+   answers are cached after the first call */
+bool cpuHasSSE2(void);
+bool cpuHasAVX2(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,197 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fft.h"
+#include "jobs.h"
+
+/* Minimum rows/columns handed to each job */
+#define FFT_LINE_GRAIN 8
+
+/* Columns copied together, 8 complex floats fill a cache line */
+#define COLUMN_BLOCK 8
+
+/* Sets up twiddles and scratch for n x n transforms */
+bool initFFTPlan(FFTPlan *plan, int n)
+{
+	int k;
+
+	if (n < 2 || (n & (n - 1)) != 0)
+		return false;
+
+	plan->n = n;
+
+	plan->twiddles = malloc(n * sizeof(Complex));
+	for (k = 0; k < n; k++)
+	{
+		double angle = 2.0 * M_PI * k / n;
+		plan->twiddles[k].re = (float)cos(angle);
+		plan->twiddles[k].im = (float)sin(angle);
+	}
+
+	plan->scratch = malloc((size_t)n * n * sizeof(Complex));
+	plan->column = malloc((size_t)n * n * sizeof(Complex));
+
+	return true;
+}
+
+void cleanupFFTPlan(FFTPlan *plan)
+{
+	free(plan->twiddles);
+	free(plan->scratch);
+	free(plan->column);
+	plan->twiddles = plan->scratch = plan->column = NULL;
+}
+
+static Complex cAdd(Complex a, Complex b)
+{
+	Complex c = { a.re + b.re, a.im + b.im };
+	return c;
+}
+
+static Complex cSub(Complex a, Complex b)
+{
+	Complex c = { a.re - b.re, a.im - b.im };
+	return c;
+}
+
+static Complex cMul(Complex a, Complex b)
+{
+	Complex c = { a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re };
+	return c;
+}
+
+/* Multiplies by i */
+static Complex cMulI(Complex a)
+{
+	Complex c = { -a.im, a.re };
+	return c;
+}
+
+/* One radix-4 Stockham stage: a sub-transform of length n repeated
+   at stride s, read from src and written in order to dst */
+static void radix4Stage(const Complex *twiddles, int n, int s, const Complex *src, Complex *dst)
+{
+	int p, q, n1 = n / 4;
+
+	for (p = 0; p < n1; p++)
+	{
+		Complex w1 = twiddles[p * s];
+		Complex w2 = twiddles[2 * p * s];
+		Complex w3 = twiddles[3 * p * s];
+
+		for (q = 0; q < s; q++)
+		{
+			Complex a = src[q + s * p];
+			Complex b = src[q + s * (p + n1)];
+			Complex c = src[q + s * (p + 2 * n1)];
+			Complex d = src[q + s * (p + 3 * n1)];
+			Complex apc = cAdd(a, c), amc = cSub(a, c);
+			Complex bpd = cAdd(b, d), jbmd = cMulI(cSub(b, d));
+
+			dst[q + s * (4 * p)] = cAdd(apc, bpd);
+			dst[q + s * (4 * p + 1)] = cMul(w1, cAdd(amc, jbmd));
+			dst[q + s * (4 * p + 2)] = cMul(w2, cSub(apc, bpd));
+			dst[q + s * (4 * p + 3)] = cMul(w3, cSub(amc, jbmd));
+		}
+	}
+}
+
+/* One radix-2 Stockham stage, used once when log2 n is odd */
+static void radix2Stage(const Complex *twiddles, int n, int s, const Complex *src, Complex *dst)
+{
+	int p, q, m = n / 2;
+
+	for (p = 0; p < m; p++)
+	{
+		Complex w = twiddles[p * s];
+
+		for (q = 0; q < s; q++)
+		{
+			Complex a = src[q + s * p];
+			Complex b = src[q + s * (p + m)];
+
+			dst[q + s * (2 * p)] = cAdd(a, b);
+			dst[q + s * (2 * p + 1)] = cMul(w, cSub(a, b));
+		}
+	}
+}
+
+/* Inverse transforms one line in place, using work (same length) as
+   the other half of the Stockham ping-pong. Stockham keeps the
+   output in natural order, so there is no bit reversal pass */
+static void inverseLine(const FFTPlan *plan, Complex *line, Complex *work)
+{
+	Complex *src = line, *dst = work, *swap;
+	int n = plan->n, s = 1;
+
+	while (n > 1)
+	{
+		if (n % 4 == 0)
+		{
+			radix4Stage(plan->twiddles, n, s, src, dst);
+			n /= 4;
+			s *= 4;
+		}
+		else
+		{
+			radix2Stage(plan->twiddles, n, s, src, dst);
+			n /= 2;
+			s *= 2;
+		}
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	if (src != line)
+		memcpy(line, src, plan->n * sizeof(Complex));
+}
+
+/* Plane being transformed, shared by the row/column jobs */
+typedef struct
+{
+	FFTPlan *plan;
+	Complex *data;
+} FFTJob;
+
+static void inverseRows(int begin, int end, void *data)
+{
+	FFTJob *job = data;
+	int n = job->plan->n, i;
+
+	for (i = begin; i < end; i++)
+		inverseLine(job->plan, job->data + i * n, job->plan->scratch + i * n);
+}
+
+/* Columns are gathered into contiguous lines first, so the strided
+   loads happen once instead of once per stage. They are copied
+   COLUMN_BLOCK at a time so every row read uses a whole cache line */
+static void inverseColumns(int begin, int end, void *data)
+{
+	FFTJob *job = data;
+	int n = job->plan->n, i, j, k, block;
+
+	for (j = begin; j < end; j += COLUMN_BLOCK)
+	{
+		Complex *columns = job->plan->column + j * n;
+		block = min(COLUMN_BLOCK, end - j);
+
+		for (i = 0; i < n; i++)
+			for (k = 0; k < block; k++)
+				columns[k * n + i] = job->data[i * n + j + k];
+		for (k = 0; k < block; k++)
+			inverseLine(job->plan, columns + k * n, job->plan->scratch + (j + k) * n);
+		for (i = 0; i < n; i++)
+			for (k = 0; k < block; k++)
+				job->data[i * n + j + k] = columns[k * n + i];
+	}
+}
+
+/* Runs the row pass then the column pass */
+void inverseFFT2D(FFTPlan *plan, Complex *data)
+{
+	FFTJob job = { plan, data };
+
+	parallelFor(0, plan->n, FFT_LINE_GRAIN, inverseRows, &job);
+	parallelFor(0, plan->n, FFT_LINE_GRAIN, inverseColumns, &job);
+}
@@ -0,0 +1,44 @@
+#ifndef FFT_H
+#define FFT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "utils.h"
+
+/* Complex number, stored interleaved so planes can be handed around
+   as plain float arrays */
+typedef struct
+{
+	float re, im;
+} Complex;
+
+/* Precomputed twiddles and scratch for square n x n inverse FFTs,
+   n a power of two. The scratch is reused by every transform, so a
+   plan must only run one transform at a time */
+typedef struct
+{
+	int n;
+	Complex *twiddles;	/* exp(2 pi i k / n) for k < n */
+	Complex *scratch;	/* One n long line per row/column */
+	Complex *column;	/* Columns gathered for the second pass */
+} FFTPlan;
+
+/* Creates a plan for n x n transforms, returns false if n isn't a
+   power of two */
+bool initFFTPlan(FFTPlan *plan, int n);
+
+/* Frees the plan's tables */
+void cleanupFFTPlan(FFTPlan *plan);
+
+/* In place, unnormalised 2D inverse transform of the row-major
+   n x n plane data: data[x] = sum over k of data[k] e^(2 pi i k.x / n).
+   Rows and then columns are split across the job system */
+void inverseFFT2D(FFTPlan *plan, Complex *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
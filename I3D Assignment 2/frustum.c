@@ -0,0 +1,135 @@
+#include <math.h>
+#include <string.h>
+#include "frustum.h"
+#include "gl.h"
+
+/* Frustum the current viewport is culling against */
+static Frustum *cullFrustum = NULL;
+
+/* Builds the planes from the rows of projection * modelview
+   (Gribb and Hartmann), normalised so sphere tests can use the
+   plane distance directly */
+void extractFrustum(Frustum *frustum)
+{
+	float p[16], mv[16], m[16];
+	int i, j, k;
+
+	glGetFloatv(GL_PROJECTION_MATRIX, p);
+	glGetFloatv(GL_MODELVIEW_MATRIX, mv);
+
+	/* Column major m = p * mv */
+	for (i = 0; i < 4; i++)
+	{
+		for (j = 0; j < 4; j++)
+		{
+			m[j * 4 + i] = 0.0f;
+			for (k = 0; k < 4; k++)
+				m[j * 4 + i] += p[k * 4 + i] * mv[j * 4 + k];
+		}
+	}
+
+	/* Left/right, bottom/top, near/far are row 3 +/- rows 0, 1, 2 */
+	for (i = 0; i < 6; i++)
+	{
+		int row = i / 2;
+		float sign = (i % 2) ? -1.0f : 1.0f;
+		Vec4f *plane = &frustum->planes[i];
+		float len;
+
+		plane->x = m[3] + sign * m[row];
+		plane->y = m[7] + sign * m[4 + row];
+		plane->z = m[11] + sign * m[8 + row];
+		plane->w = m[15] + sign * m[12 + row];
+
+		len = sqrtf(plane->x * plane->x + plane->y * plane->y + plane->z * plane->z);
+		if (len > 0.0f)
+		{
+			plane->x /= len;
+			plane->y /= len;
+			plane->z /= len;
+			plane->w /= len;
+		}
+	}
+
+	/* The eye is -R^T t of the (rigid) modelview */
+	frustum->eye.x = -(mv[0] * mv[12] + mv[1] * mv[13] + mv[2] * mv[14]);
+	frustum->eye.y = -(mv[4] * mv[12] + mv[5] * mv[13] + mv[6] * mv[14]);
+	frustum->eye.z = -(mv[8] * mv[12] + mv[9] * mv[13] + mv[10] * mv[14]);
+
+	memcpy(frustum->projection, p, sizeof(p));
+	memcpy(frustum->modelview, mv, sizeof(mv));
+	glGetIntegerv(GL_VIEWPORT, frustum->viewport);
+
+	memset(frustum->drawn, 0, sizeof(frustum->drawn));
+	memset(frustum->culled, 0, sizeof(frustum->culled));
+}
+
+void setCullFrustum(Frustum *frustum)
+{
+	cullFrustum = frustum;
+}
+
+/* Rejects the box if its corner furthest along a plane's normal is
+   still outside that plane */
+bool frustumHasBox(const Frustum *frustum, Vec3f min, Vec3f max)
+{
+	int i;
+
+	for (i = 0; i < 6; i++)
+	{
+		const Vec4f *plane = &frustum->planes[i];
+		float x = plane->x >= 0.0f ? max.x : min.x;
+		float y = plane->y >= 0.0f ? max.y : min.y;
+		float z = plane->z >= 0.0f ? max.z : min.z;
+
+		if (plane->x * x + plane->y * y + plane->z * z + plane->w < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+bool frustumHasSphere(const Frustum *frustum, Vec3f centre, float radius)
+{
+	int i;
+
+	for (i = 0; i < 6; i++)
+	{
+		const Vec4f *plane = &frustum->planes[i];
+
+		if (plane->x * centre.x + plane->y * centre.y + plane->z * centre.z + plane->w < -radius)
+			return false;
+	}
+	return true;
+}
+
+bool boxVisible(CullKind kind, Vec3f min, Vec3f max)
+{
+	bool visible;
+
+	if (!cullFrustum)
+		return true;
+
+	visible = frustumHasBox(cullFrustum, min, max);
+	if (visible)
+		cullFrustum->drawn[kind]++;
+	else
+		cullFrustum->culled[kind]++;
+
+	return visible;
+}
+
+bool sphereVisible(CullKind kind, Vec3f centre, float radius)
+{
+	bool visible;
+
+	if (!cullFrustum)
+		return true;
+
+	visible = frustumHasSphere(cullFrustum, centre, radius);
+	if (visible)
+		cullFrustum->drawn[kind]++;
+	else
+		cullFrustum->culled[kind]++;
+
+	return visible;
+}
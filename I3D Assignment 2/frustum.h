@@ -0,0 +1,66 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "utils.h"
+
+/* What a cull test was for, each kind is counted separately */
+typedef enum
+{
+	CULL_WATER,
+	CULL_TERRAIN,
+	CULL_BOATS,
+	CULL_BALLS,
+	N_CULL_KINDS
+} CullKind;
+
+/* A view frustum as six inward facing planes (a, b, c, d with
+   ax + by + cz + d >= 0 inside) and the eye it's seen from, in world
+   space, plus how many things were drawn and culled against it. The
+   matrices and viewport it was made from are kept for unprojecting */
+typedef struct
+{
+	Vec4f planes[6];
+	Vec3f eye;
+	float projection[16], modelview[16];
+	int viewport[4];
+	int drawn[N_CULL_KINDS];
+	int culled[N_CULL_KINDS];
+} Frustum;
+
+/* A run of indices drawn together, with world space bounds. The
+   indices are relative to baseVertex */
+typedef struct
+{
+	int firstIndex;
+	int nIndices;
+	int baseVertex;
+	Vec3f min, max;
+} MeshChunk;
+
+/* Extracts the frustum from the current projection and modelview
+   matrices, so call it once the camera is set up and before any
+   model transforms. Resets the counters */
+void extractFrustum(Frustum *frustum);
+
+/* Makes boxVisible/sphereVisible test against (and count into) the
+   given frustum, NULL draws everything */
+void setCullFrustum(Frustum *frustum);
+
+/* True if any part of the box/sphere may be inside the frustum */
+bool frustumHasBox(const Frustum *frustum, Vec3f min, Vec3f max);
+bool frustumHasSphere(const Frustum *frustum, Vec3f centre, float radius);
+
+/* Tests against the current cull frustum and counts the result
+   under kind, always true when culling is off */
+bool boxVisible(CullKind kind, Vec3f min, Vec3f max);
+bool sphereVisible(CullKind kind, Vec3f centre, float radius);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
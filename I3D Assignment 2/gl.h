@@ -10,6 +10,11 @@ extern "C" {
 #include <Windows.h>
 #endif
 
+/* Expose buffer object entry points (GL 1.5) from the system headers */
+#ifndef GL_GLEXT_PROTOTYPES
+#define GL_GLEXT_PROTOTYPES 1
+#endif
+
 #ifdef __APPLE__
 #  include <OpenGL/gl.h>
 #  include <OpenGL/glu.h>
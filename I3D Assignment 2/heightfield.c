@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <zlib.h>
+#include "heightfield.h"
+
+/* Start of every PNG file */
+#define PNG_SIGNATURE "\x89PNG\r\n\x1a\n"
+
+/* 16 bit samples are scaled by this into 8 bit units */
+#define HEIGHTFIELD_16_SCALE (1.0f / 257.0f)
+
+/* Reads a big endian 32 bit number, as PNG chunks store them */
+static unsigned int readBigEndian(const unsigned char *p)
+{
+	return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+static int paethPredictor(int a, int b, int c)
+{
+	int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+
+	if (pa <= pb && pa <= pc)
+		return a;
+	return pb <= pc ? b : c;
+}
+
+/* Undoes a scanline's filter in place, against the one above it
+   (zeros for the first). bpp is the bytes per pixel the filters step
+   back by */
+static bool unfilterScanline(int filter, unsigned char *line, const unsigned char *above, int bytes, int bpp)
+{
+	int k;
+
+	switch (filter)
+	{
+	case 0:
+		break;
+	case 1:
+		for (k = bpp; k < bytes; k++)
+			line[k] += line[k - bpp];
+		break;
+	case 2:
+		for (k = 0; k < bytes; k++)
+			line[k] += above[k];
+		break;
+	case 3:
+		for (k = 0; k < bytes; k++)
+			line[k] += ((k >= bpp ? line[k - bpp] : 0) + above[k]) / 2;
+		break;
+	case 4:
+		for (k = 0; k < bytes; k++)
+			line[k] += paethPredictor(k >= bpp ? line[k - bpp] : 0, above[k], k >= bpp ? above[k - bpp] : 0);
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+/* Inflates the IDAT chunks a scanline at a time into two line
+   buffers, writing each line's first channel to the heights as it's
+   finished. Only the output and the two lines are ever allocated */
+static bool decodePNG(Heightfield *field, const unsigned char *file, size_t bytes)
+{
+	int width = 0, height = 0, depth = 0, channels = 0, bpp = 0, lineBytes = 0, row = 0, filled = 0, x;
+	unsigned char *lines = NULL, *line = NULL, *above = NULL;
+	size_t offset = 8;
+	bool ok = false, ended = false;
+	z_stream strm;
+	int ret = Z_OK;
+
+	if (bytes < 8 || memcmp(file, PNG_SIGNATURE, 8) != 0)
+		return false;
+	memset(&strm, 0, sizeof(strm));
+	if (inflateInit(&strm) != Z_OK)
+		return false;
+
+	while (!ended && offset + 12 <= bytes)
+	{
+		unsigned int length = readBigEndian(file + offset);
+		const unsigned char *type = file + offset + 4, *data = file + offset + 8;
+
+		if (length > bytes - offset - 12)
+			break;
+		offset += length + 12;
+
+		if (memcmp(type, "IHDR", 4) == 0 && length >= 13)
+		{
+			static const int typeChannels[] = { 1, 0, 3, 0, 2, 0, 4 };
+			unsigned int w = readBigEndian(data), h = readBigEndian(data + 4);
+
+			/* Only one header, and no palettes, packed pixels or
+			   interlacing */
+			depth = data[8];
+			channels = data[9] <= 6 ? typeChannels[data[9]] : 0;
+			if (lines || w < 2 || h < 2 || (depth != 8 && depth != 16) || channels == 0 ||
+				data[10] != 0 || data[11] != 0 || data[12] != 0)
+				goto done;
+			bpp = channels * depth / 8;
+
+			/* The sizes come from the file, so they're bounded before
+			   anything is worked out from them */
+			if (w > (unsigned int)(INT_MAX - 1) / bpp || h > INT_MAX ||
+				(size_t)w * h > HEIGHTFIELD_MAX_SAMPLES)
+				goto done;
+			width = w;
+			height = h;
+			lineBytes = width * bpp + 1;
+
+			field->owned = malloc((size_t)width * height * sizeof(float));
+			lines = calloc(2, lineBytes);
+			if (!field->owned || !lines)
+				goto done;
+			line = lines;
+			above = lines + lineBytes;
+		}
+		else if (memcmp(type, "IDAT", 4) == 0 && lines)
+		{
+			strm.next_in = (unsigned char *)data;
+			strm.avail_in = length;
+			while (row < height)
+			{
+				strm.next_out = line + filled;
+				strm.avail_out = lineBytes - filled;
+				ret = inflate(&strm, Z_NO_FLUSH);
+				filled = lineBytes - strm.avail_out;
+				if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+					goto done;
+
+				if (filled == lineBytes)
+				{
+					float *out = field->owned + (size_t)row * width;
+					unsigned char *swap;
+
+					if (!unfilterScanline(line[0], line + 1, above + 1, lineBytes - 1, bpp))
+						goto done;
+					if (depth == 8)
+						for (x = 0; x < width; x++)
+							out[x] = line[1 + x * bpp];
+					else
+						for (x = 0; x < width; x++)
+							out[x] = ((line[1 + x * bpp] << 8) | line[2 + x * bpp]) * HEIGHTFIELD_16_SCALE;
+
+					swap = line;
+					line = above;
+					above = swap;
+					filled = 0;
+					row++;
+				}
+				else if (strm.avail_in == 0 || ret != Z_OK)
+					break;
+			}
+		}
+		else if (memcmp(type, "IEND", 4) == 0)
+			ended = true;
+	}
+
+	ok = row == height && height > 0;
+	field->width = width;
+	field->height = height;
+	field->heights = field->owned;
+
+done:
+	inflateEnd(&strm);
+	free(lines);
+	if (!ok)
+	{
+		free(field->owned);
+		field->owned = NULL;
+	}
+	return ok;
+}
+
+/* Raw files have no header, so they must be square */
+static int rawSide(size_t bytes, size_t sampleBytes)
+{
+	int side = (int)sqrt((double)(bytes / sampleBytes));
+
+	while ((size_t)(side + 1) * (side + 1) * sampleBytes <= bytes)
+		side++;
+	if ((size_t)side * side > HEIGHTFIELD_MAX_SAMPLES)
+		return 0;
+	return (size_t)side * side * sampleBytes == bytes ? side : 0;
+}
+
+static bool littleEndian(void)
+{
+	const unsigned short one = 1;
+
+	return *(const unsigned char *)&one == 1;
+}
+
+static bool decodeRaw16(Heightfield *field, const unsigned char *file, size_t bytes)
+{
+	int side = rawSide(bytes, 2);
+	size_t k, n;
+
+	if (side < 2)
+		return false;
+	n = (size_t)side * side;
+	field->owned = malloc(n * sizeof(float));
+	if (!field->owned)
+		return false;
+	for (k = 0; k < n; k++)
+		field->owned[k] = (file[k * 2] | (file[k * 2 + 1] << 8)) * HEIGHTFIELD_16_SCALE;
+	field->width = field->height = side;
+	field->heights = field->owned;
+	return true;
+}
+
+/* Floats are used straight from the mapping when the byte order
+   matches, which it does on anything this runs on */
+static bool decodeRaw32(Heightfield *field, void *file, size_t bytes)
+{
+	int side = rawSide(bytes, 4);
+	size_t k, n;
+
+	if (side < 2)
+		return false;
+	field->width = field->height = side;
+	if (littleEndian())
+	{
+		field->heights = file;
+		return true;
+	}
+
+	n = (size_t)side * side;
+	field->owned = malloc(n * sizeof(float));
+	if (!field->owned)
+		return false;
+	for (k = 0; k < n; k++)
+	{
+		const unsigned char *p = (const unsigned char *)file + k * 4;
+		unsigned int bits = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+
+		memcpy(&field->owned[k], &bits, 4);
+	}
+	field->heights = field->owned;
+	return true;
+}
+
+static bool hasExtension(const char *filename, const char *extension)
+{
+	size_t length = strlen(filename), extensionLength = strlen(extension);
+
+	return length >= extensionLength && strcmp(filename + length - extensionLength, extension) == 0;
+}
+
+bool loadHeightfield(Heightfield *field, const char *filename)
+{
+	size_t bytes;
+	void *file;
+	bool ok = false;
+
+	memset(field, 0, sizeof(*field));
+	file = mapFile(filename, &bytes);
+	if (!file)
+		return false;
+
+	if (hasExtension(filename, ".png"))
+		ok = decodePNG(field, file, bytes);
+	else if (hasExtension(filename, ".r16"))
+		ok = decodeRaw16(field, file, bytes);
+	else if (hasExtension(filename, ".r32"))
+		ok = decodeRaw32(field, file, bytes);
+
+	/* Keep the mapping only if the heights are in it */
+	if (ok && !field->owned)
+	{
+		field->map = file;
+		field->mapBytes = bytes;
+	}
+	else
+		unmapFile(file, bytes);
+	if (!ok)
+		memset(field, 0, sizeof(*field));
+	return ok;
+}
+
+void freeHeightfield(Heightfield *field)
+{
+	if (field->map)
+		unmapFile(field->map, field->mapBytes);
+	free(field->owned);
+	memset(field, 0, sizeof(*field));
+}
+
+float sampleHeightfield(const Heightfield *field, float u, float v)
+{
+	float fx = clamp(u, 0.0f, 1.0f) * (field->width - 1);
+	float fy = clamp(1.0f - v, 0.0f, 1.0f) * (field->height - 1);
+	int x = min((int)fx, field->width - 2), y = min((int)fy, field->height - 2);
+	const float *p = field->heights + (size_t)y * field->width + x;
+	float tx = fx - x, ty = fy - y;
+	float top = p[0] + (p[1] - p[0]) * tx;
+	float bottom = p[field->width] + (p[field->width + 1] - p[field->width]) * tx;
+
+	return top + (bottom - top) * ty;
+}
@@ -0,0 +1,51 @@
+#ifndef HEIGHTFIELD_H
+#define HEIGHTFIELD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "utils.h"
+
+/* A single channel grid of heights, as read from a heightmap file.
+   Heights are in 8 bit units whatever the file's precision (0 to 255,
+   fractional for 16 bit files), so a heightmap can be swapped for a
+   finer one without changing how the terrain scales it. Raw float
+   files are used as they are */
+typedef struct
+{
+	int width, height;
+	const float *heights;	/* width x height, top row first */
+
+	void *map;		/* Set if heights point into a mapped file */
+	size_t mapBytes;
+	float *owned;		/* Otherwise, decoded into here */
+} Heightfield;
+
+/* The most heights a file may hold, 1 GB of floats */
+#define HEIGHTFIELD_MAX_SAMPLES (1 << 28)
+
+/* Reads a heightmap, picking the format from the extension:
+     .png  8 or 16 bit greyscale, RGB or RGBA (the first channel is used)
+     .r16  raw little endian unsigned 16 bit, square
+     .r32  raw little endian 32 bit float, square
+   Files are mapped and decoded straight into the heights, a scanline
+   at a time for PNGs, with no copy of the whole image along the way.
+   Returns false if the file can't be read, isn't supported or holds
+   more than HEIGHTFIELD_MAX_SAMPLES heights */
+bool loadHeightfield(Heightfield *field, const char *filename);
+
+/* Frees the heights, or unmaps the file */
+void freeHeightfield(Heightfield *field);
+
+/* Bilinear height at texture coordinates (u, v), from (0, 0) at the
+   bottom left of the image to (1, 1) top right, clamped to the edges.
+   The corners land exactly on the corner samples, so any grid can be
+   sampled from any size of heightmap */
+float sampleHeightfield(const Heightfield *field, float u, float v);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,395 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "jobs.h"
+
+/* Most threads we'll start, whatever the core count */
+#define MAX_JOB_THREADS 64
+
+/* Deques start this big and double when full */
+#define INITIAL_DEQUE_CAPACITY 256
+
+struct _Job
+{
+	JobFunc func;
+	void *data;
+	int pendingDeps;	/* Unfinished dependencies, +1 until submitted */
+	int finished;		/* Set once func has returned */
+	int nSuccessors;	/* Jobs waiting on this one */
+	int successorCapacity;
+	Job **successors;
+};
+
+/* A worker's deque of runnable jobs. The owner uses the bottom (tail),
+   thieves take from the top (head) */
+typedef struct
+{
+	pthread_mutex_t lock;
+	Job **items;
+	int head, tail;		/* Monotonic, wrapped by capacity */
+	int capacity;
+} Deque;
+
+static struct
+{
+	bool running;
+	int nThreads;
+	pthread_t threads[MAX_JOB_THREADS];
+	Deque deques[MAX_JOB_THREADS];
+	Deque outside;		/* Jobs queued by threads that aren't workers */
+
+	/* Idle workers sleep here until something is queued */
+	pthread_mutex_t sleepLock;
+	pthread_cond_t wake;
+	int queued;
+} jobs = { .running = false, .nThreads = 1 };
+
+/* Index of the calling thread's deque, -1 for non-worker threads */
+static __thread int workerIndex = -1;
+
+static void pushJob(Job *job);
+
+/* Runs a job and releases anything that was waiting on it */
+static void runJob(Job *job)
+{
+	int i;
+
+	job->func(job->data);
+
+	for (i = 0; i < job->nSuccessors; i++)
+	{
+		if (__atomic_sub_fetch(&job->successors[i]->pendingDeps, 1, __ATOMIC_ACQ_REL) == 0)
+			pushJob(job->successors[i]);
+	}
+
+	__atomic_store_n(&job->finished, 1, __ATOMIC_RELEASE);
+}
+
+static void initDeque(Deque *deque)
+{
+	pthread_mutex_init(&deque->lock, NULL);
+	deque->capacity = INITIAL_DEQUE_CAPACITY;
+	deque->items = malloc(deque->capacity * sizeof(Job *));
+	deque->head = deque->tail = 0;
+}
+
+static void cleanupDeque(Deque *deque)
+{
+	pthread_mutex_destroy(&deque->lock);
+	free(deque->items);
+	deque->items = NULL;
+}
+
+/* Queues a runnable job on the caller's deque (the outside one for
+   threads that aren't workers) and wakes a sleeping worker */
+static void pushJob(Job *job)
+{
+	Deque *deque;
+
+	/* Without worker threads there is nobody to hand it to */
+	if (!jobs.running)
+	{
+		runJob(job);
+		return;
+	}
+
+	deque = workerIndex >= 0 ? &jobs.deques[workerIndex] : &jobs.outside;
+
+	pthread_mutex_lock(&deque->lock);
+	if (deque->tail - deque->head == deque->capacity)
+	{
+		/* Grow, unwrapping the ring into the new array */
+		int i, n = deque->tail - deque->head;
+		Job **items = malloc(deque->capacity * 2 * sizeof(Job *));
+		for (i = 0; i < n; i++)
+			items[i] = deque->items[(deque->head + i) % deque->capacity];
+		free(deque->items);
+		deque->items = items;
+		deque->capacity *= 2;
+		deque->head = 0;
+		deque->tail = n;
+	}
+	deque->items[deque->tail % deque->capacity] = job;
+	deque->tail++;
+	pthread_mutex_unlock(&deque->lock);
+
+	__atomic_add_fetch(&jobs.queued, 1, __ATOMIC_ACQ_REL);
+
+	pthread_mutex_lock(&jobs.sleepLock);
+	pthread_cond_signal(&jobs.wake);
+	pthread_mutex_unlock(&jobs.sleepLock);
+}
+
+/* Takes the newest job from the bottom of our own deque */
+static Job *popJob(Deque *deque)
+{
+	Job *job = NULL;
+
+	pthread_mutex_lock(&deque->lock);
+	if (deque->tail > deque->head)
+	{
+		deque->tail--;
+		job = deque->items[deque->tail % deque->capacity];
+	}
+	pthread_mutex_unlock(&deque->lock);
+
+	return job;
+}
+
+/* Takes the oldest job from the top of another worker's deque */
+static Job *stealJob(Deque *deque)
+{
+	Job *job = NULL;
+
+	if (pthread_mutex_trylock(&deque->lock) != 0)
+		return NULL;
+	if (deque->tail > deque->head)
+	{
+		job = deque->items[deque->head % deque->capacity];
+		deque->head++;
+	}
+	pthread_mutex_unlock(&deque->lock);
+
+	return job;
+}
+
+/* Finds a job to run: our own deque first (the outside one for
+   outside threads), then the workers' starting from a rotating victim
+   so thieves spread out, then the outside one. Worker 0 leaves outside
+   jobs alone, it's the thread the frame waits on */
+static Job *findJob(void)
+{
+	static unsigned int victim = 0;
+	int i, start;
+	Job *job = NULL;
+
+	if (workerIndex >= 0)
+		job = popJob(&jobs.deques[workerIndex]);
+	else
+		job = popJob(&jobs.outside);
+
+	if (!job)
+	{
+		start = __atomic_fetch_add(&victim, 1, __ATOMIC_RELAXED) % jobs.nThreads;
+		for (i = 0; i < jobs.nThreads && !job; i++)
+		{
+			int index = (start + i) % jobs.nThreads;
+			if (index != workerIndex)
+				job = stealJob(&jobs.deques[index]);
+		}
+	}
+	if (!job && workerIndex > 0)
+		job = stealJob(&jobs.outside);
+
+	if (job)
+		__atomic_sub_fetch(&jobs.queued, 1, __ATOMIC_ACQ_REL);
+
+	return job;
+}
+
+/* Main loop of a worker thread */
+static void *workerMain(void *arg)
+{
+	Job *job;
+
+	workerIndex = (int)(size_t)arg;
+
+	while (true)
+	{
+		if ((job = findJob()) != NULL)
+		{
+			runJob(job);
+			continue;
+		}
+
+		/* Nothing to do, sleep until a push (checking queued under
+		   the lock so the wake up can't be missed) */
+		pthread_mutex_lock(&jobs.sleepLock);
+		while (jobs.running && __atomic_load_n(&jobs.queued, __ATOMIC_ACQUIRE) == 0)
+			pthread_cond_wait(&jobs.wake, &jobs.sleepLock);
+		pthread_mutex_unlock(&jobs.sleepLock);
+
+		if (!jobs.running)
+			break;
+	}
+
+	return NULL;
+}
+
+/* Starts the worker threads */
+void initJobs(int nThreads)
+{
+	int i;
+
+	if (jobs.running)
+		cleanupJobs();
+
+	if (nThreads <= 0)
+	{
+#ifdef _SC_NPROCESSORS_ONLN
+		nThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#else
+		nThreads = 1;
+#endif
+	}
+	nThreads = clamp(nThreads, 1, MAX_JOB_THREADS);
+
+	jobs.nThreads = nThreads;
+	jobs.queued = 0;
+	pthread_mutex_init(&jobs.sleepLock, NULL);
+	pthread_cond_init(&jobs.wake, NULL);
+	for (i = 0; i < nThreads; i++)
+		initDeque(&jobs.deques[i]);
+	initDeque(&jobs.outside);
+
+	/* The calling thread is worker 0 */
+	workerIndex = 0;
+	jobs.running = true;
+
+	for (i = 1; i < nThreads; i++)
+		pthread_create(&jobs.threads[i], NULL, workerMain, (void *)(size_t)i);
+}
+
+/* Stops and joins the worker threads */
+void cleanupJobs(void)
+{
+	int i;
+
+	if (!jobs.running)
+		return;
+
+	pthread_mutex_lock(&jobs.sleepLock);
+	jobs.running = false;
+	pthread_cond_broadcast(&jobs.wake);
+	pthread_mutex_unlock(&jobs.sleepLock);
+
+	for (i = 1; i < jobs.nThreads; i++)
+		pthread_join(jobs.threads[i], NULL);
+	for (i = 0; i < jobs.nThreads; i++)
+		cleanupDeque(&jobs.deques[i]);
+	cleanupDeque(&jobs.outside);
+
+	pthread_cond_destroy(&jobs.wake);
+	pthread_mutex_destroy(&jobs.sleepLock);
+	jobs.nThreads = 1;
+	workerIndex = -1;
+}
+
+int jobThreadCount(void)
+{
+	return jobs.running ? jobs.nThreads : 1;
+}
+
+/* Creates a job, held back until submitJob */
+Job *createJob(JobFunc func, void *data)
+{
+	Job *job = malloc(sizeof(Job));
+
+	job->func = func;
+	job->data = data;
+	job->pendingDeps = 1;
+	job->finished = 0;
+	job->nSuccessors = 0;
+	job->successorCapacity = 0;
+	job->successors = NULL;
+
+	return job;
+}
+
+/* Makes job wait for dependency, neither may be submitted yet */
+void addJobDependency(Job *job, Job *dependency)
+{
+	if (dependency->nSuccessors == dependency->successorCapacity)
+	{
+		dependency->successorCapacity = dependency->successorCapacity ? dependency->successorCapacity * 2 : 4;
+		dependency->successors = realloc(dependency->successors, dependency->successorCapacity * sizeof(Job *));
+	}
+	dependency->successors[dependency->nSuccessors++] = job;
+	job->pendingDeps++;
+}
+
+/* Drops the submit hold, queueing the job if nothing else holds it */
+void submitJob(Job *job)
+{
+	if (__atomic_sub_fetch(&job->pendingDeps, 1, __ATOMIC_ACQ_REL) == 0)
+		pushJob(job);
+}
+
+/* Helps out with other jobs until this one is done, then frees it */
+void waitJob(Job *job)
+{
+	Job *other;
+
+	while (!__atomic_load_n(&job->finished, __ATOMIC_ACQUIRE))
+	{
+		if (jobs.running && (other = findJob()) != NULL)
+			runJob(other);
+		else
+			sched_yield();
+	}
+
+	free(job->successors);
+	free(job);
+}
+
+/* One chunk of a parallelFor */
+typedef struct
+{
+	RangeFunc func;
+	void *data;
+	int begin, end;
+} RangeChunk;
+
+static void runRangeChunk(void *data)
+{
+	RangeChunk *chunk = data;
+	chunk->func(chunk->begin, chunk->end, chunk->data);
+}
+
+/* Splits [begin, end) into chunks of at least grain items, a few per
+   thread so stealing can even out the load */
+void parallelFor(int begin, int end, int grain, RangeFunc func, void *data)
+{
+	int i, n = end - begin, nChunks, chunkSize;
+	RangeChunk *chunks;
+	Job **chunkJobs;
+
+	if (n <= 0)
+		return;
+	if (grain < 1)
+		grain = 1;
+
+	if (!jobs.running || jobs.nThreads == 1 || n <= grain)
+	{
+		func(begin, end, data);
+		return;
+	}
+
+	chunkSize = max(grain, (n + jobs.nThreads * 4 - 1) / (jobs.nThreads * 4));
+	nChunks = (n + chunkSize - 1) / chunkSize;
+
+	chunks = malloc(nChunks * sizeof(RangeChunk));
+	chunkJobs = malloc(nChunks * sizeof(Job *));
+
+	for (i = 0; i < nChunks; i++)
+	{
+		chunks[i].func = func;
+		chunks[i].data = data;
+		chunks[i].begin = begin + i * chunkSize;
+		chunks[i].end = min(end, chunks[i].begin + chunkSize);
+		chunkJobs[i] = createJob(runRangeChunk, &chunks[i]);
+	}
+
+	/* Queue in reverse so our own pops take the first chunks in order
+	   while thieves start from the far end */
+	for (i = nChunks - 1; i >= 0; i--)
+		submitJob(chunkJobs[i]);
+	for (i = 0; i < nChunks; i++)
+		waitJob(chunkJobs[i]);
+
+	free(chunks);
+	free(chunkJobs);
+}
@@ -0,0 +1,59 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "utils.h"
+
+/* A small work-stealing job system. Each worker thread owns a deque,
+   it pushes and pops jobs at the bottom while idle workers steal from
+   the top of other deques. The thread that calls initJobs is worker 0
+   and runs jobs while it waits. Threads that aren't workers may also
+   submit and wait on jobs: theirs go on a deque of their own, run by
+   them while they wait and by the other workers, but never by worker
+   0, so background work can't stall whatever worker 0 waits on */
+
+/* Opaque job handle */
+typedef struct _Job Job;
+
+/* Function run by a job */
+typedef void (*JobFunc)(void *data);
+
+/* Function run over a sub-range [begin, end) by parallelFor */
+typedef void (*RangeFunc)(int begin, int end, void *data);
+
+/* Starts the job system with the given number of threads in total
+   (including the calling thread), 0 uses one per CPU core */
+void initJobs(int nThreads);
+
+/* Stops and joins the worker threads */
+void cleanupJobs(void);
+
+/* Number of threads running jobs, 1 if initJobs hasn't been called */
+int jobThreadCount(void);
+
+/* Creates a job that will run func(data). It doesn't run until
+   submitted, and must be waited on with waitJob which frees it */
+Job *createJob(JobFunc func, void *data);
+
+/* Makes job wait for dependency to finish before it runs. Both must
+   be created but not yet submitted */
+void addJobDependency(Job *job, Job *dependency);
+
+/* Queues a job, it runs once all of its dependencies have finished */
+void submitJob(Job *job);
+
+/* Runs other jobs until the given job has finished, then frees it */
+void waitJob(Job *job);
+
+/* Calls func over [begin, end) split into chunks of at least grain
+   items, spread across the workers. Returns when all are done */
+void parallelFor(int begin, int end, int grain, RangeFunc func, void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
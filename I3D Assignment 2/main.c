@@ -4,17 +4,30 @@
 /* Some global variables */
 Camera camera;
 Grid grid;
+Clipmap clipmaps[2];	/* One per viewport, centred on its boat */
 Light dayLight;
 Light nightLight;
-Boat boat1;
-Boat boat2;
+Fleet fleet;		/* The players' boats, then any others */
+static BallPool balls;		/* Every boat's cannonballs in play */
+static FleetContacts contacts;	/* Between them and their balls, this frame */
 Keys keys;
 Controls controls;
 Screen screen;
 Terrain terrain;
+static TerrainRebuild terrainRebuild;	/* A new island layout in the making */
+TerrainTiles world;		/* Streamed in the TERRAIN_STREAMED mode */
+static bool worldOpen;		/* Once its tiles are ready, as of this frame */
+static TerrainWorldOpener worldOpener;	/* Opens it the first time it's wanted */
+static bool fleetOnWorld;	/* The boats sail it rather than the arena */
 static GLuint waterTexture;
 static GLuint terrainTexture;
+static int activeViewport;	/* Viewport drawScene is drawing */
+Frustum frusta[2];		/* Each viewport's frustum and cull counters */
+static double terrainSeconds[N_TERRAIN_MODES];	/* Smoothed CPU time of
+						   one terrain draw per mode */
 Sky sky;
+static bool picked;		/* A terrain point has been picked with the */
+static Vec3f pickedPos;		/* middle mouse button, and where */
 
 bool gameOver;
 bool draw;
@@ -22,10 +35,31 @@ bool playerOneWins;
 
 int frame=0, time, timebase=0;
 
+/* The players' boats in the fleet */
+#define PLAYER_ONE 0
+#define PLAYER_TWO 1
+
+/* Room for the players and the other boats 'B' adds in groups of
+   FLEET_GROUP */
+#define FLEET_CAPACITY 1024
+#define FLEET_GROUP 16
+
+/* Furthest a boat is moved to find clear water when the seabed under
+   the fleet changes, see placeFleet */
+#define FLEET_PLACE_RANGE 1024.0f
+
+/* Cannonballs the whole fleet can have in play at once */
+#define BALL_POOL_CAPACITY 4096
+
 void drawScene(){
 	
-	float ambient1 [] = { 45/255.0, 35/255.0, 33/255.0, 1.0f };
-	float ambient2 [] = { 191/255.0, 163/255.0, 141/255.0, 1.0f };
+	Frustum *frustum = &frusta[activeViewport];
+	double start, *seconds;
+	
+	/* The camera is set up, cull everything below against what this
+	   viewport can see */
+	extractFrustum(frustum);
+	setCullFrustum(controls.culling ? frustum : NULL);
 	
 	if (controls.wireframe)
 		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
@@ -43,29 +77,57 @@ void drawScene(){
 	printFPS(-6, 6, -10);
 	
 	glBindTexture(GL_TEXTURE_2D, terrainTexture);
-	drawTerrain(&terrain);
+	start = timeNow();
+	if (controls.terrainMode == TERRAIN_LOD)
+		drawTerrainLOD(&terrain, frustum->eye);
+	else if (controls.terrainMode == TERRAIN_RETAINED)
+		drawTerrain(&terrain);
+	else if (controls.terrainMode == TERRAIN_STREAMED)
+	{
+		/* The arena stands in until the world is open */
+		if (worldOpen)
+			drawTerrainTiles(&world, frustum->eye);
+		else
+			drawTerrainLOD(&terrain, frustum->eye);
+	}
+	else
+		drawTerrainImmediate(&terrain);
+	seconds = &terrainSeconds[controls.terrainMode];
+	*seconds = *seconds ? *seconds * 0.95 + (timeNow() - start) * 0.05 : timeNow() - start;
 	
-	drawBoat(&boat1, ambient1);
-	drawAllBalls(&boat1);
+	drawFleet(&fleet);
+	drawAllBalls(&balls);
 	
-	drawBoat(&boat2, ambient2);
-	drawAllBalls(&boat2);
+	if (picked)
+		drawPickMarker(pickedPos);
 	
 	glBindTexture(GL_TEXTURE_2D, waterTexture);
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	drawGrid(&grid);
+	if (controls.clipmap)
+		drawClipmap(&clipmaps[activeViewport]);
+	else
+		drawGrid(&grid);
 	glDisable(GL_BLEND);
 	
 	if (controls.normals){
-		drawNormals(&grid, 1);
+		drawNormals(controls.clipmap ? &clipmaps[activeViewport].levels[0].grid : &grid, 1);
 		drawTerrainNormals(&terrain, 1);
 	}	
+	
+	setCullFrustum(NULL);
+	
+	if (controls.cullStats)
+	{
+		printCullStats(-6, 5.2, -10, frustum);
+		printTerrainTime(-6, 5.2 - (N_CULL_KINDS + 1) * 0.5f, -10);
+	}
 }
 
 void drawLeftScreen(){
 	/* Set the viewport to be rendered to */
 	glViewport(0, 0, screen.x/2, screen.y);
+	activeViewport = 0;
 	/* Clear previous projection (important, otherwise next step won't work) */
 	glLoadIdentity();
 	if(gameOver){
@@ -80,9 +142,11 @@ void drawLeftScreen(){
 	}else{
 		if (controls.mainCamera)
 		{
-			gluLookAt(boat1.pos.x, boat1.pos.y + 5.0, boat1.pos.z, boat2.pos.x, boat2.pos.y, boat2.pos.z, 0, 1, 0);
+			Vec3f boat1 = boatPos(&fleet, PLAYER_ONE), boat2 = boatPos(&fleet, PLAYER_TWO);
+			
+			gluLookAt(boat1.x, boat1.y + 5.0, boat1.z, boat2.x, boat2.y, boat2.z, 0, 1, 0);
 			glPushMatrix();
-			glTranslatef(boat1.pos.x, boat1.pos.y + 5.0, boat1.pos.z);
+			glTranslatef(boat1.x, boat1.y + 5.0, boat1.z);
 			drawSky(&sky);
 			glPopMatrix();
 			
@@ -98,6 +162,7 @@ void drawLeftScreen(){
 void drawRightScreen(){
 	/* Set the viewport to be rendered to */
 	glViewport(screen.x/2, 0, screen.x/2, screen.y);
+	activeViewport = 1;
 	/* Clear previous projection (important, otherwise next step won't work) */
 	glLoadIdentity();
 	if(gameOver){
@@ -112,10 +177,12 @@ void drawRightScreen(){
 	}else{
 		if (controls.mainCamera)
 		{
-			gluLookAt(boat2.pos.x, boat2.pos.y + 5.0, boat2.pos.z, boat1.pos.x, boat1.pos.y, boat1.pos.z, 0, 1, 0);
+			Vec3f boat1 = boatPos(&fleet, PLAYER_ONE), boat2 = boatPos(&fleet, PLAYER_TWO);
+			
+			gluLookAt(boat2.x, boat2.y + 5.0, boat2.z, boat1.x, boat1.y, boat1.z, 0, 1, 0);
 			
 			glPushMatrix();
-			glTranslatef(boat2.pos.x, boat2.pos.y + 5.0, boat2.pos.z);
+			glTranslatef(boat2.x, boat2.y + 5.0, boat2.z);
 			drawSky(&sky);
 			glPopMatrix();
 		}
@@ -197,28 +264,139 @@ void idle(void)
 	dt = (t2 - t1) / 1000.0;
 	t1 = t2;
 
+	/* The streamed world is used from this frame on once it's open */
+	if (!worldOpen)
+		worldOpen = terrainWorldOpened(&worldOpener);
+
+	/* Between frames, so nothing is using the terrain: take a rebuilt
+	   one if it's ready. Picks were on the old one */
+	if (swapRebuiltTerrain(&terrainRebuild, &terrain))
+		picked = false;
+
 	if(!gameOver){
-		updateGrid(&grid, dt);
-		updateBoat(&boat2, keys.up, keys.down, keys.left, keys.right, dt, &keys.boat2FireLeft, &keys.boat2FireRight);
-		updateAllBalls(&boat2);
-		ballsHitBoat(&boat1, &boat2);
+		updateWater(dt);
+		steerBoat(&fleet, PLAYER_ONE, keys.w, keys.s, keys.a, keys.d);
+		steerBoat(&fleet, PLAYER_TWO, keys.up, keys.down, keys.left, keys.right);
+		updateFleet(&fleet, dt);
+		
+		fireCannons(PLAYER_ONE, &keys.boat1FireLeft, &keys.boat1FireRight);
+		fireCannons(PLAYER_TWO, &keys.boat2FireLeft, &keys.boat2FireRight);
+		updateAllBalls(&balls, &terrain, fleetOnWorld ? &world : NULL, dt);
+		findFleetContacts(&contacts, &fleet, &balls);
 		
-		updateBoat(&boat1, keys.w, keys.s, keys.a, keys.d, dt, &keys.boat1FireLeft, &keys.boat1FireRight);
-		updateAllBalls(&boat1);
-		ballsHitBoat(&boat2, &boat1);
+		/* Craters from this frame's balls, before the boats test
+		 against the coast */
+		flushTerrainEdits(&terrain);
 		
+		/* Stream the world's tiles in around and ahead of the boats */
+		if (worldOpen && controls.terrainMode == TERRAIN_STREAMED)
+		{
+			TileViewer viewers[2];
+			
+			viewers[0] = getBoatViewer(&fleet, PLAYER_ONE);
+			viewers[1] = getBoatViewer(&fleet, PLAYER_TWO);
+			updateTerrainTiles(&world, viewers, 2);
+		}
+		placeFleet();
 		checkCollision();
 	}
 
 	glutPostRedisplay();
 }
 
+/* Moves the boats onto clear water of whichever seabed they now sail,
+   when the streamed world comes into or goes out of use. The world is
+   switched to once the tiles under both players are in at full
+   resolution, until then they stay on the arena */
+void placeFleet(void)
+{
+	bool streamed = worldOpen && controls.terrainMode == TERRAIN_STREAMED;
+	int boat, level;
+	float y;
+	
+	if (streamed == fleetOnWorld)
+		return;
+	if (streamed)
+	{
+		for (boat = PLAYER_ONE; boat <= PLAYER_TWO; boat++)
+			if (!terrainTilesHeight(&world, fleet.posX[boat], fleet.posZ[boat], &y, &level) || level > 0)
+				return;
+	}
+	for (boat = 0; boat < fleet.nBoats; boat++)
+		placeBoatClear(&terrain, streamed ? &world : NULL, &fleet, boat, FLEET_PLACE_RANGE);
+	fleetOnWorld = streamed;
+}
+
+/* Animates the water. With the clipmaps on, only their vertices are
+   evaluated, each centred on its viewport's boat */
+void updateWater(float dt)
+{
+	if (!controls.clipmap)
+	{
+		updateGrid(&grid, dt);
+		return;
+	}
+
+	advanceWaves(dt);
+	moveClipmap(&clipmaps[0], fleet.posX[PLAYER_ONE], fleet.posZ[PLAYER_ONE]);
+	moveClipmap(&clipmaps[1], fleet.posX[PLAYER_TWO], fleet.posZ[PLAYER_TWO]);
+	updateClipmap(&clipmaps[0]);
+	updateClipmap(&clipmaps[1]);
+}
+
+/* Fires a player's cannons on the key presses since the last frame */
+void fireCannons(int boat, bool *left, bool *right)
+{
+	if (*left)
+	{
+		*left = false;
+		initBall(&balls, &fleet, boat, true);
+	}
+	if (*right)
+	{
+		*right = false;
+		initBall(&balls, &fleet, boat, false);
+	}
+}
+
+/* Adds a group of boats sailing in circles at random clear spots of
+   the sea, for as long as the fleet has room */
+void addFleetGroup(void)
+{
+	static const float ambient[] = { 0.3f, 0.3f, 0.3f, 1.0f };
+	int k, tries;
+
+	for (k = 0; k < FLEET_GROUP; k++)
+	{
+		for (tries = 0; tries < 16; tries++)
+		{
+			Vec3f pos = cVec3f((rand() / (float)RAND_MAX - 0.5f) * grid.size, 0.3f,
+				(rand() / (float)RAND_MAX - 0.5f) * grid.size);
+			int boat = addBoat(&fleet, pos, ambient);
+
+			if (boat < 0)
+				return;
+			if (boatTerrainCollision(&terrain, &fleet, boat))
+			{
+				fleet.nBoats--;
+				continue;
+			}
+			fleet.heading[boat] = rand() % 360;
+			fleet.throttle[boat] = 1.0f;
+			fleet.steer[boat] = rand() % 2 ? 1.0f : -1.0f;
+			break;
+		}
+	}
+}
+
 void checkCollision(){
-	bool boats_collided = boatsCollided(&boat1, &boat2);
-	bool boat1Hit = boatDestroyed(&boat1);
-	bool boat2Hit = boatDestroyed(&boat2);
-	bool boat1Terrain = boatTerrainCollision(&terrain, &boat1);
-	bool boat2Terrain = boatTerrainCollision(&terrain, &boat2);
+	bool boats_collided = boatsInContact(&contacts, PLAYER_ONE, PLAYER_TWO);
+	bool boat1Hit = boatDestroyed(&fleet, PLAYER_ONE);
+	bool boat2Hit = boatDestroyed(&fleet, PLAYER_TWO);
+	bool boat1Terrain = fleetOnWorld ? boatTilesCollision(&world, &fleet, PLAYER_ONE) :
+		boatTerrainCollision(&terrain, &fleet, PLAYER_ONE);
+	bool boat2Terrain = fleetOnWorld ? boatTilesCollision(&world, &fleet, PLAYER_TWO) :
+		boatTerrainCollision(&terrain, &fleet, PLAYER_TWO);
 	
 	gameOver = (boats_collided || boat1Hit || boat2Hit || boat1Terrain || boat2Terrain);
 	if(boats_collided){
@@ -269,6 +447,52 @@ void mouseDown(int button, int state, int x, int y)
 		camera.rotating = state == GLUT_DOWN;
 	if (button == GLUT_RIGHT_BUTTON)
 		camera.zooming = state == GLUT_DOWN;
+	if (button == GLUT_MIDDLE_BUTTON && state == GLUT_DOWN)
+		pickTerrain(x, y);
+}
+
+/* Casts a ray from the near to the far plane through the pixel under
+   the mouse, in whichever viewport it's over, and marks the terrain
+   point it hits first */
+void pickTerrain(int x, int y)
+{
+	const Frustum *frustum = &frusta[x < screen.x / 2 ? 0 : 1];
+	GLdouble mv[16], p[16], nearX, nearY, nearZ, farX, farY, farZ;
+	float winY = screen.y - y;
+	Vec3f origin, dir;
+	RayHit hit;
+	int i;
+	
+	for (i = 0; i < 16; i++)
+	{
+		mv[i] = frustum->modelview[i];
+		p[i] = frustum->projection[i];
+	}
+	
+	/* Not drawn yet */
+	if (!gluUnProject(x, winY, 0.0, mv, p, frustum->viewport, &nearX, &nearY, &nearZ) ||
+		!gluUnProject(x, winY, 1.0, mv, p, frustum->viewport, &farX, &farY, &farZ))
+		return;
+	
+	origin = cVec3f(nearX, nearY, nearZ);
+	dir = cVec3f(farX - nearX, farY - nearY, farZ - nearZ);
+	picked = castHeightRay(&terrain.pyramid, origin, dir, 1.0f, &hit);
+	if (picked)
+		pickedPos = hit.pos;
+}
+
+/* Draws a small yellow sphere where the terrain was picked */
+void drawPickMarker(Vec3f pos)
+{
+	glPushAttrib(GL_CURRENT_BIT | GL_ENABLE_BIT);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_TEXTURE_2D);
+	glColor3f(1.0f, 1.0f, 0.0f);
+	glPushMatrix();
+	glTranslatef(pos.x, pos.y, pos.z);
+	glutWireSphere(0.5, 8, 8);
+	glPopMatrix();
+	glPopAttrib();
 }
 
 void updateKey(int key, bool state)
@@ -333,6 +557,83 @@ void printFPS(float x, float y, float z){
 	glPopMatrix();
 }
 
+/* Shows how many chunks/objects of each kind the viewport drew and
+   culled this frame, how many meshes are loaded and how the cannonball
+   pool is doing. The mesh cache's hits and savings are left to the
+   bench, the fleet loads each mesh once */
+void printCullStats(float x, float y, float z, const Frustum *frustum){
+	static const char *names[N_CULL_KINDS] = { "water", "terrain", "boats", "balls" };
+	char s[256];
+	int i;
+	MeshCacheStats meshes;
+	
+	glPushAttrib(GL_CURRENT_BIT | GL_ENABLE_BIT);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_TEXTURE_2D);
+	glColor3f(1.0f, 1.0f, 0.0f);
+	glPushMatrix();
+	glLoadIdentity();
+	for (i = 0; i < N_CULL_KINDS; i++)
+	{
+		snprintf(s, sizeof(s), "%s: %d drawn, %d culled", names[i], frustum->drawn[i], frustum->culled[i]);
+		renderBitmapString(x, y - i * 0.5f, z, GLUT_BITMAP_HELVETICA_12, s);
+	}
+	getMeshCacheStats(&meshes);
+	snprintf(s, sizeof(s), "meshes: %d loaded", meshes.live);
+	renderBitmapString(x, y - N_CULL_KINDS * 0.5f, z, GLUT_BITMAP_HELVETICA_12, s);
+	snprintf(s, sizeof(s), "cannonballs: %d/%d in play, %d fired, %d recycled, %d dropped", balls.nBalls,
+		balls.capacity, balls.fired, balls.recycled, balls.dropped);
+	renderBitmapString(x, y - (N_CULL_KINDS + 1) * 0.5f, z, GLUT_BITMAP_HELVETICA_12, s);
+	glPopMatrix();
+	glPopAttrib();
+}
+
+/* Shows the CPU time spent drawing the terrain per viewport in each
+   mode used so far, cycle them with 'T' to compare */
+void printTerrainTime(float x, float y, float z){
+	static const char *names[N_TERRAIN_MODES] = { "lod", "retained", "immediate", "streamed" };
+	char s[256];
+	int i, n;
+	
+	n = snprintf(s, sizeof(s), "terrain cpu ms (T cycles):");
+	for (i = 0; i < N_TERRAIN_MODES; i++)
+	{
+		if (terrainSeconds[i])
+			n += snprintf(s + n, sizeof(s) - n, " %s%s %.3f", names[i],
+				i == (int)controls.terrainMode ? "*" : "", terrainSeconds[i] * 1000.0);
+	}
+	if (controls.terrainMode == TERRAIN_LOD)
+		n += snprintf(s + n, sizeof(s) - n, ", %d patches, %d vertices",
+			terrain.lod.nPatches, terrain.lod.nVertices);
+	if (controls.terrainMode == TERRAIN_STREAMED && worldOpen)
+	{
+		TerrainTilesStats stats;
+		
+		getTerrainTilesStats(&world, &stats);
+		n += snprintf(s + n, sizeof(s) - n, ", %d tiles %.1f MB resident, %d loads",
+			stats.residentTiles, stats.residentBytes / 1048576.0, stats.loads);
+	}
+	else if (controls.terrainMode == TERRAIN_STREAMED)
+		n += snprintf(s + n, sizeof(s) - n, ", opening the world");
+	n += snprintf(s + n, sizeof(s) - n, ", startup %.1f ms%s", terrain.initSeconds * 1000.0,
+		terrain.fromCache ? " (cached)" : "");
+	if (terrainRebuilding(&terrainRebuild))
+		snprintf(s + n, sizeof(s) - n, ", rebuilding (R)");
+	else if (terrainRebuild.swaps)
+		snprintf(s + n, sizeof(s) - n, ", seed %u rebuilt in %.1f ms (R)", terrain.params.seed,
+			terrainRebuild.buildSeconds * 1000.0);
+	
+	glPushAttrib(GL_CURRENT_BIT | GL_ENABLE_BIT);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_TEXTURE_2D);
+	glColor3f(1.0f, 1.0f, 0.0f);
+	glPushMatrix();
+	glLoadIdentity();
+	renderBitmapString(x, y, z, GLUT_BITMAP_HELVETICA_12, s);
+	glPopMatrix();
+	glPopAttrib();
+}
+
 void printOnScreen(float x, float y, float z, char* s){
 	glDisable(GL_DEPTH_TEST);
 	glDisable(GL_LIGHTING);
@@ -357,6 +658,93 @@ void renderBitmapString(float x, float y, float z, void *font, char *string){
 	
 }
 
+/* Rebuilds the water grid with its vertex spacing scaled by 1/factor,
+   keeping its layout and tiling. With the clipmaps on their finest
+   spacing is scaled instead, keeping the vertices per ring */
+void resizeGrid(float factor)
+{
+	if (controls.clipmap)
+	{
+		int i;
+		for (i = 0; i < 2; i++)
+		{
+			float spacing = clipmaps[i].levels[0].spacing / factor;
+			int m = clipmaps[i].m;
+			cleanupClipmap(&clipmaps[i]);
+			initClipmap(&clipmaps[i], m, spacing, camera.clipFar * 2.0f, grid.size);
+		}
+		updateWater(0.0f);
+		return;
+	}
+
+	/* A tiled grid only holds one tile, scale the whole-sea
+	   tessellation it was built from */
+	float spacing = grid.tiled ? grid.tileSizeX / (grid.rows - 1) : grid.size / (grid.rows - 1);
+	int n = (int)((grid.size / spacing) * factor + 0.5f) + 1;
+	GridLayout layout = grid.layout;
+	bool tiled = grid.tiled;
+
+	cleanupGrid(&grid);
+	if (tiled)
+		initGridTiled(&grid, n, n, grid.size, layout);
+	else
+		initGridLayout(&grid, n, n, grid.size, layout);
+}
+
+/* Rebuilds the water grid at its current vertex spacing after the
+   waves have changed, retiling it for their new period (or making it
+   a full grid if they don't repeat) */
+static void rebuildWaterGrid(void)
+{
+	float spacing = grid.tiled ? grid.tileSizeX / (grid.rows - 1) : grid.size / (grid.rows - 1);
+	int n = (int)(grid.size / spacing + 0.5f) + 1;
+	GridLayout layout = grid.layout;
+
+	cleanupGrid(&grid);
+	initGridTiled(&grid, n, n, grid.size, layout);
+}
+
+/* Switches between the default two-component swell and a random
+   wind-driven spectrum of Gerstner waves */
+void toggleWaveSpectrum(void)
+{
+	static const SineFunction swell[] = {
+		{ 1, 0.5, 1, 1, 0, 0, 0 },
+		{ 1, 0.5, 1, 0, 1, 0, 0 }
+	};
+	static bool spectrum = false;
+	SineFunction components[32];
+
+	spectrum = !spectrum;
+	if (spectrum)
+	{
+		makeWaveSpectrum(components, 32, 0.6f, 2.0f, 1234);
+		setWaves(components, 32);
+	}
+	else
+		setWaves(swell, 2);
+
+	rebuildWaterGrid();
+}
+
+/* Switches the water between the wave components and an FFT ocean
+   patch, built the first time it's needed */
+void toggleFFTOcean(void)
+{
+	static Ocean ocean;
+	static bool built = false, enabled = false;
+
+	if (!built)
+		built = initOcean(&ocean, 128, 100, 12, 0.6f, 0.7f, 1234);
+	if (!built)
+		return;
+
+	enabled = !enabled;
+	setWaveOcean(enabled ? &ocean : NULL);
+
+	rebuildWaterGrid();
+}
+
 void keyboard(unsigned char key, int x, int y)
 {
 	switch (key)
@@ -388,14 +776,54 @@ void keyboard(unsigned char key, int x, int y)
 
 		case '-':
 		case '_':
-			cleanupGrid(&grid);
-			initGrid(&grid, grid.rows / 2, grid.cols / 2, grid.size);
+			resizeGrid(0.5f);
 			break;
 
 		case '+':
 		case '=':
-			cleanupGrid(&grid);
-			initGrid(&grid, grid.rows * 2, grid.cols * 2, grid.size);
+			resizeGrid(2.0f);
+			break;
+
+		case 'G':
+			toggleWaveSpectrum();
+			break;
+
+		case 'F':
+			toggleFFTOcean();
+			break;
+
+		case 'V':
+			controls.culling = !controls.culling;
+			break;
+
+		case 'S':
+			controls.cullStats = !controls.cullStats;
+			break;
+
+		case 'T':
+			controls.terrainMode = (controls.terrainMode + 1) % N_TERRAIN_MODES;
+			if (controls.terrainMode == TERRAIN_STREAMED)
+				startTerrainWorldOpen(&worldOpener, &world, TERRAIN_WORLD_TILES, TERRAIN_WORLD_BUDGET);
+			break;
+
+		case 'B':
+			addFleetGroup();
+			break;
+
+		case 'R':
+		{
+			/* A new island layout, swapped in once it's built */
+			TerrainParams params = terrain.params;
+
+			params.seed++;
+			requestTerrainRebuild(&terrainRebuild, &params);
+			break;
+		}
+
+		case 'C':
+			/* The grid isn't updated while the clipmaps are on */
+			controls.clipmap = !controls.clipmap;
+			updateWater(0.0f);
 			break;
 			
 		case 'w':
@@ -453,13 +881,41 @@ void keyboardSpecialUp(int key, int x, int y)
 	updateKeySpecial(key, false);
 }
 
+static void loadFleetJob(void *data)
+{
+	static const float ambient1[] = { 45/255.0, 35/255.0, 33/255.0, 1.0f };
+	static const float ambient2[] = { 191/255.0, 163/255.0, 141/255.0, 1.0f };
+	
+	initFleet((Fleet *)data, FLEET_CAPACITY, "galleon.obj");
+	initBallPool(&balls, BALL_POOL_CAPACITY);
+	initFleetContacts(&contacts);
+	addBoat((Fleet *)data, cVec3f(0, 0.3, -25), ambient1);
+	addBoat((Fleet *)data, cVec3f(0, 0.3, 25), ambient2);
+}
+
+static void loadTerrainJob(void *data)
+{
+	initTerrain((Terrain *)data, 200, 200, 200, 40);
+}
+
 void init(void)
 {
+	Job *terrainJob, *fleetJob;
+
 	gameOver = false;
 	playerOneWins = false;
+
+	/* Start the worker threads, one per core */
+	initJobs(0);
+
+	/* Setup the terrain and load the boats in the background while
+	   the GL state below is set up */
+	terrainJob = createJob(loadTerrainJob, &terrain);
+	fleetJob = createJob(loadFleetJob, &fleet);
+	submitJob(terrainJob);
+	submitJob(fleetJob);
+
 	initSky(&sky, 1);
-	/* Setup the terrain */
-	initTerrain(&terrain, 200, 200, 200, 40);
 	
 	/* Setup the camera in a default position */
 	initCamera(&camera);
@@ -468,16 +924,22 @@ void init(void)
 	initKeys(&keys);
 	initControls(&controls);
 
-	/* Setup the grid */
-	initGrid(&grid, 200, 200, 200);
+	/* Setup the grid, and the clipmaps used instead of it by default.
+	   They reach as far as can be seen from their boat */
+	initGridTiled(&grid, 200, 200, 200, GRID_LAYOUT_SOA);
+	initClipmap(&clipmaps[0], 65, 1.0f, camera.clipFar * 2.0f, grid.size);
+	initClipmap(&clipmaps[1], 65, 1.0f, camera.clipFar * 2.0f, grid.size);
 
 	/* Setup the lights */
 	initLight(&dayLight, cVec4f(1.2, 1, -1.5, 0), cVec4f(0.4, 0.3, 0.2, 1), cVec4f(0.5, 0.5, 0.5, 1), cVec4f(1, 1, 1, 0), 128);
 	initLight(&nightLight, cVec4f(1, 1, -2, 0), cVec4f(0, 0, 0.2, 1), cVec4f(0, 0, 0.2, 1), cVec4f(1, 1, 1, 0), 128);
 
-	/* Load the boat1 */
-	initBoat(&boat1, "galleon.obj", cVec3f(0, 0.3, -25));
-	initBoat(&boat2, "galleon.obj", cVec3f(0, 0.3, 25));
+	/* Wait for the terrain and boats */
+	waitJob(terrainJob);
+	waitJob(fleetJob);
+
+	/* Centre the clipmaps on the boats */
+	updateWater(0.0f);
 
 	/* Set appropriate defaults */
 	glEnable(GL_DEPTH_TEST);
@@ -503,6 +965,10 @@ void init(void)
 
 int main(int argc, char **argv)
 {
+	/* Benchmarks run headless, before GLUT opens a window */
+	if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+		return runBenchmarks(argc, argv);
+
 	/* Init glut, create window */
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
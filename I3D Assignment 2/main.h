@@ -9,6 +9,8 @@ extern "C" {
 #include "gl.h"
 #include "camera.h"
 #include "waves.h"
+#include "clipmap.h"
+#include "frustum.h"
 #include "utils.h"
 #include "light.h"
 #include "boat.h"
@@ -17,6 +19,8 @@ extern "C" {
 #include "seabed.h"
 #include "texture.h"
 #include "skybox.h"
+#include "jobs.h"
+#include "bench.h"
 #include <string.h>
 #include <stdio.h>
 	
@@ -39,6 +43,10 @@ extern "C" {
 	void mouseDown(int button, int state, int x, int y);
 	void updateKey(int key, bool state);
 	void keyboard(unsigned char key, int x, int y);
+	void resizeGrid(float factor);
+	void toggleWaveSpectrum(void);
+	void toggleFFTOcean(void);
+	void updateWater(float dt);
 	void updateKeySpecial(int key, bool state);
 	void keyUp(unsigned char key, int x, int y);
 	void keyboardSpecialDown(int key, int x, int y);
@@ -46,8 +54,15 @@ extern "C" {
 	void init(void);
 	void renderBitmapString(float x, float y, float z, void *font, char *string);
 	void printFPS(float x, float y, float z);
+	void printCullStats(float x, float y, float z, const Frustum *frustum);
+	void printTerrainTime(float x, float y, float z);
 	void printOnScreen(float x, float y, float z, char* s);
 	void checkCollision(void);
+	void fireCannons(int boat, bool *left, bool *right);
+	void placeFleet(void);
+	void addFleetGroup(void);
+	void pickTerrain(int x, int y);
+	void drawPickMarker(Vec3f pos);
 	
 #ifdef __cplusplus
 }
@@ -0,0 +1,147 @@
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include "mesh_cache.h"
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+/* Every asset with references, and the counters. Assets are few, a
+   list is plenty */
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t loaded;		/* Broadcast when any asset finishes loading */
+	MeshAsset *assets;
+	MeshCacheStats stats;
+} cache = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, { 0 } };
+
+/* The path assets are keyed by, or filename as given if it can't be
+   resolved (the load will fail then anyway) */
+static char *canonicalPath(const char *filename)
+{
+	char resolved[PATH_MAX];
+
+#ifdef _WIN32
+	if (_fullpath(resolved, filename, sizeof(resolved)))
+		return strdup(resolved);
+#else
+	if (realpath(filename, resolved))
+		return strdup(resolved);
+#endif
+	return strdup(filename);
+}
+
+static size_t meshBytes(const OBJMesh *mesh)
+{
+	return (size_t)mesh->numVertices * mesh->stride + (size_t)mesh->numIndices * sizeof(unsigned int);
+}
+
+MeshAsset *acquireMesh(const char *filename)
+{
+	char *path = canonicalPath(filename);
+	MeshAsset *asset;
+	OBJMesh *mesh;
+
+	pthread_mutex_lock(&cache.lock);
+	for (asset = cache.assets; asset; asset = asset->next)
+		if (strcmp(asset->path, path) == 0)
+			break;
+
+	if (asset)
+	{
+		/* Shared, once whoever is loading it is done */
+		free(path);
+		asset->refs++;
+		cache.stats.hits++;
+		while (!asset->loaded)
+			pthread_cond_wait(&cache.loaded, &cache.lock);
+		cache.stats.bytesSaved += asset->bytes;
+		pthread_mutex_unlock(&cache.lock);
+		return asset;
+	}
+
+	/* Listed before loading so other callers wait for this load */
+	asset = calloc(1, sizeof(MeshAsset));
+	asset->path = path;
+	asset->refs = 1;
+	asset->next = cache.assets;
+	cache.assets = asset;
+	cache.stats.misses++;
+	cache.stats.live++;
+	pthread_mutex_unlock(&cache.lock);
+
+	mesh = objMeshLoad(path);
+
+	pthread_mutex_lock(&cache.lock);
+	asset->mesh = mesh;
+	asset->bytes = mesh ? meshBytes(mesh) : 0;
+	asset->loaded = 1;
+	cache.stats.bytesLoaded += asset->bytes;
+	pthread_cond_broadcast(&cache.loaded);
+	pthread_mutex_unlock(&cache.lock);
+	return asset;
+}
+
+void releaseMesh(MeshAsset *asset)
+{
+	MeshAsset **link;
+
+	if (!asset)
+		return;
+
+	pthread_mutex_lock(&cache.lock);
+	if (--asset->refs > 0)
+	{
+		pthread_mutex_unlock(&cache.lock);
+		return;
+	}
+	for (link = &cache.assets; *link != asset; link = &(*link)->next)
+		;
+	*link = asset->next;
+	cache.stats.live--;
+	pthread_mutex_unlock(&cache.lock);
+
+	if (asset->uploaded)
+		cleanupMeshRenderer(&asset->renderer);
+	if (asset->mesh)
+		objMeshFree(&asset->mesh);
+	free(asset->path);
+	free(asset);
+}
+
+bool uploadMeshAsset(MeshAsset *asset)
+{
+	if (asset->uploaded)
+		return true;
+	if (!asset->mesh)
+		return false;
+
+	initMeshRenderer(&asset->renderer, asset->mesh);
+	asset->uploaded = true;
+
+	pthread_mutex_lock(&cache.lock);
+	cache.stats.uploads++;
+	pthread_mutex_unlock(&cache.lock);
+	return true;
+}
+
+bool drawMeshAsset(MeshAsset *asset)
+{
+	if (!uploadMeshAsset(asset))
+		return false;
+	drawMeshRenderer(&asset->renderer);
+	return true;
+}
+
+void getMeshCacheStats(MeshCacheStats *stats)
+{
+	pthread_mutex_lock(&cache.lock);
+	*stats = cache.stats;
+	pthread_mutex_unlock(&cache.lock);
+}
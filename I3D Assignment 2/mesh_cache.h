@@ -0,0 +1,67 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "utils.h"
+#include "obj/obj.h"
+#include "mesh_renderer.h"
+
+/* A mesh loaded once and shared by everything drawn with it, e.g.
+   every galleon of a fleet. The parsed OBJMesh and the buffers
+   uploaded from it belong to the cache, users hold a reference */
+typedef struct _MeshAsset
+{
+	char *path;		/* Canonical, what assets are looked up by */
+	int refs;
+	OBJMesh *mesh;		/* NULL if the file couldn't be loaded */
+	size_t bytes;		/* Of the parsed vertices and indices */
+	int loaded;		/* Set once mesh is final, see acquireMesh */
+
+	/* Uploaded by the first uploadMeshAsset */
+	MeshRenderer renderer;
+	bool uploaded;
+
+	struct _MeshAsset *next;
+} MeshAsset;
+
+/* Counters since the program started */
+typedef struct
+{
+	int hits;		/* Acquires of an already loaded (or loading) mesh */
+	int misses;		/* Acquires that loaded the file */
+	int uploads;		/* Meshes sent to buffer objects */
+	int live;		/* Assets still referenced */
+	size_t bytesLoaded;	/* Parsed by the misses */
+	size_t bytesSaved;	/* Not parsed or uploaded again thanks to hits */
+} MeshCacheStats;
+
+/* Returns a reference to the mesh in filename, loading it only if no
+   one holds it already. Files are matched by canonical path, so
+   "./galleon.obj" and "galleon.obj" are one asset. Safe to call from
+   several threads at once: a second caller for a mesh still loading
+   waits for it rather than loading it again. Check asset->mesh for
+   failure */
+MeshAsset *acquireMesh(const char *filename);
+
+/* Drops a reference, freeing the mesh (and its buffers, so call on
+   the GL thread once uploaded) when it was the last */
+void releaseMesh(MeshAsset *asset);
+
+/* Uploads the mesh for drawing (see mesh_renderer.h) the first time
+   it's called for an asset. Returns false if the mesh didn't load */
+bool uploadMeshAsset(MeshAsset *asset);
+
+/* Draws the mesh with its materials, uploading it if needed. Returns
+   false, drawing nothing, if the mesh didn't load */
+bool drawMeshAsset(MeshAsset *asset);
+
+void getMeshCacheStats(MeshCacheStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
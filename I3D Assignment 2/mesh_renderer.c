@@ -0,0 +1,309 @@
+#include <stdlib.h>
+#include <string.h>
+#include "mesh_renderer.h"
+#include "buffers.h"
+#include "gl.h"
+#include "texture.h"
+
+/* Offset into a bound buffer object, as a pointer */
+#define BUFFER_OFFSET(bytes) ((const char *)0 + (bytes))
+
+void buildMeshRanges(MeshRenderer *renderer, const OBJMesh *mesh)
+{
+	int f;
+
+	memset(renderer, 0, sizeof(*renderer));
+	renderer->stride = mesh->stride;
+	renderer->normalOffset = mesh->normalOffset;
+	renderer->texcoordOffset = mesh->texcoordOffset;
+	renderer->hasNormals = mesh->hasNormals != 0;
+	renderer->hasTexCoords = mesh->hasTexCoords != 0;
+	renderer->nVertices = mesh->numVertices;
+	renderer->nIndices = mesh->numIndices;
+	renderer->nMaterials = mesh->numMaterials;
+	renderer->materials = mesh->materials;
+
+	/* Halve the indices when they fit */
+	renderer->indexType = mesh->numVertices <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	renderer->vertexBytes = (size_t)mesh->numVertices * mesh->stride;
+	renderer->indexBytes = (size_t)mesh->numIndices *
+		(renderer->indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int));
+
+	renderer->ranges = malloc(max(mesh->numFacesets, 1) * sizeof(MeshDrawRange));
+	for (f = 0; f < mesh->numFacesets; f++)
+	{
+		const OBJFaceSet *set = &mesh->facesets[f];
+		MeshDrawRange *last = renderer->nRanges ? &renderer->ranges[renderer->nRanges - 1] : NULL;
+		int material = set->material < mesh->numMaterials ? set->material : -1;
+
+		if (set->indexEnd <= set->indexStart)
+			continue;
+		if (last && last->material == material && last->smooth == set->smooth &&
+			last->firstIndex + last->nIndices == set->indexStart)
+		{
+			last->nIndices += set->indexEnd - set->indexStart;
+			continue;
+		}
+		renderer->ranges[renderer->nRanges].firstIndex = set->indexStart;
+		renderer->ranges[renderer->nRanges].nIndices = set->indexEnd - set->indexStart;
+		renderer->ranges[renderer->nRanges].material = material;
+		renderer->ranges[renderer->nRanges].smooth = set->smooth;
+		renderer->nRanges++;
+	}
+
+	/* Meshes without facesets are one range in the caller's material */
+	if (mesh->numFacesets == 0 && mesh->numIndices > 0)
+	{
+		renderer->ranges[0].firstIndex = 0;
+		renderer->ranges[0].nIndices = mesh->numIndices;
+		renderer->ranges[0].material = -1;
+		renderer->ranges[0].smooth = 1;
+		renderer->nRanges = 1;
+	}
+}
+
+/* Sets a range's material, shading and texture */
+static void applyMeshRange(const MeshRenderer *renderer, const MeshDrawRange *range)
+{
+	glShadeModel(range->smooth ? GL_SMOOTH : GL_FLAT);
+	if (range->material >= 0)
+	{
+		const OBJMaterial *material = &renderer->materials[range->material];
+
+		glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, material->ambient);
+		glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, material->diffuse);
+		glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, material->specular);
+		glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, clamp(material->shininess, 0.0f, 128.0f));
+		if (renderer->textures[range->material])
+			glBindTexture(GL_TEXTURE_2D, renderer->textures[range->material]);
+	}
+}
+
+/* Draws the ranges in immediate mode, into the display list */
+static void compileMeshList(MeshRenderer *renderer, const OBJMesh *mesh)
+{
+	int r, i;
+
+	renderer->displayList = glGenLists(1);
+	glNewList(renderer->displayList, GL_COMPILE);
+	for (r = 0; r < renderer->nRanges; r++)
+	{
+		const MeshDrawRange *range = &renderer->ranges[r];
+
+		applyMeshRange(renderer, range);
+		glBegin(GL_TRIANGLES);
+		for (i = range->firstIndex; i < range->firstIndex + range->nIndices; i++)
+		{
+			const char *vert = (const char *)mesh->vertices + mesh->indices[i] * mesh->stride;
+
+			if (renderer->hasNormals)
+				glNormal3fv((const float *)(vert + mesh->normalOffset));
+			if (renderer->hasTexCoords)
+				glTexCoord2fv((const float *)(vert + mesh->texcoordOffset));
+			glVertex3fv((const float *)vert);
+		}
+		glEnd();
+	}
+	glEndList();
+}
+
+void initMeshRenderer(MeshRenderer *renderer, const OBJMesh *mesh)
+{
+	int m, i;
+
+	buildMeshRanges(renderer, mesh);
+
+	renderer->textures = calloc(max(mesh->numMaterials, 1), sizeof(unsigned int));
+	for (m = 0; m < mesh->numMaterials; m++)
+		if (mesh->materials[m].texture)
+			renderer->textures[m] = texture_load(mesh->materials[m].texture);
+
+	if (!buffersSupported())
+	{
+		compileMeshList(renderer, mesh);
+		return;
+	}
+
+	glGenBuffers(1, &renderer->vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, renderer->vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, renderer->vertexBytes, mesh->vertices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &renderer->indexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, renderer->indexBuffer);
+	if (renderer->indexType == GL_UNSIGNED_SHORT)
+	{
+		unsigned short *indices = malloc(max(renderer->indexBytes, 1));
+
+		for (i = 0; i < mesh->numIndices; i++)
+			indices[i] = (unsigned short)mesh->indices[i];
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, renderer->indexBytes, indices, GL_STATIC_DRAW);
+		free(indices);
+	}
+	else
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, renderer->indexBytes, mesh->indices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void drawMeshRenderer(const MeshRenderer *renderer)
+{
+	int r, indexSize = renderer->indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+
+	/* Material and shade model, and the texture binding */
+	glPushAttrib(GL_LIGHTING_BIT | GL_TEXTURE_BIT);
+
+	if (renderer->displayList)
+	{
+		glCallList(renderer->displayList);
+		glPopAttrib();
+		return;
+	}
+
+	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+	glBindBuffer(GL_ARRAY_BUFFER, renderer->vertexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, renderer->indexBuffer);
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, renderer->stride, BUFFER_OFFSET(0));
+	if (renderer->hasNormals)
+	{
+		glEnableClientState(GL_NORMAL_ARRAY);
+		glNormalPointer(GL_FLOAT, renderer->stride, BUFFER_OFFSET(renderer->normalOffset));
+	}
+	if (renderer->hasTexCoords)
+	{
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glTexCoordPointer(2, GL_FLOAT, renderer->stride, BUFFER_OFFSET(renderer->texcoordOffset));
+	}
+
+	for (r = 0; r < renderer->nRanges; r++)
+	{
+		const MeshDrawRange *range = &renderer->ranges[r];
+
+		applyMeshRange(renderer, range);
+		glDrawElements(GL_TRIANGLES, range->nIndices, renderer->indexType,
+			BUFFER_OFFSET((size_t)range->firstIndex * indexSize));
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glPopClientAttrib();
+	glPopAttrib();
+}
+
+/* out = a * b, column major 4x4 */
+static void multMatrix(float *out, const float *a, const float *b)
+{
+	int i, j;
+
+	for (j = 0; j < 4; j++)
+		for (i = 0; i < 4; i++)
+			out[j * 4 + i] = a[i] * b[j * 4] + a[4 + i] * b[j * 4 + 1] +
+				a[8 + i] * b[j * 4 + 2] + a[12 + i] * b[j * 4 + 3];
+}
+
+/* Loads the view times an instance's transform, and its ambient if
+   it differs from the one last set */
+static void loadMeshInstance(const float *view, const float *transforms, const float *ambients,
+	int instance, bool ambient, const float **lastAmbient)
+{
+	float modelview[16];
+
+	multMatrix(modelview, view, transforms + (size_t)instance * 16);
+	glLoadMatrixf(modelview);
+	if (ambient && ambients && (!*lastAmbient ||
+		memcmp(*lastAmbient, ambients + (size_t)instance * 4, 4 * sizeof(float)) != 0))
+	{
+		*lastAmbient = ambients + (size_t)instance * 4;
+		glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, *lastAmbient);
+	}
+}
+
+void drawMeshInstances(const MeshRenderer *renderer, const float *transforms, const float *ambients,
+	const int *instances, int nInstances)
+{
+	int r, k, indexSize = renderer->indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+	const float *lastAmbient = NULL;
+	float view[16];
+
+	if (nInstances == 0)
+		return;
+
+	glPushAttrib(GL_LIGHTING_BIT | GL_TEXTURE_BIT);
+	glPushMatrix();
+	glGetFloatv(GL_MODELVIEW_MATRIX, view);
+
+	/* Display lists hold their ranges' state, so go instance by
+	   instance */
+	if (renderer->displayList)
+	{
+		for (k = 0; k < nInstances; k++)
+		{
+			loadMeshInstance(view, transforms, ambients, instances[k], true, &lastAmbient);
+			glCallList(renderer->displayList);
+			lastAmbient = NULL;
+		}
+		glPopMatrix();
+		glPopAttrib();
+		return;
+	}
+
+	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+	glBindBuffer(GL_ARRAY_BUFFER, renderer->vertexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, renderer->indexBuffer);
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, renderer->stride, BUFFER_OFFSET(0));
+	if (renderer->hasNormals)
+	{
+		glEnableClientState(GL_NORMAL_ARRAY);
+		glNormalPointer(GL_FLOAT, renderer->stride, BUFFER_OFFSET(renderer->normalOffset));
+	}
+	if (renderer->hasTexCoords)
+	{
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glTexCoordPointer(2, GL_FLOAT, renderer->stride, BUFFER_OFFSET(renderer->texcoordOffset));
+	}
+
+	for (r = 0; r < renderer->nRanges; r++)
+	{
+		const MeshDrawRange *range = &renderer->ranges[r];
+
+		/* A range's own material replaces the instances' ambient */
+		applyMeshRange(renderer, range);
+		if (range->material >= 0)
+			lastAmbient = NULL;
+		for (k = 0; k < nInstances; k++)
+		{
+			loadMeshInstance(view, transforms, ambients, instances[k], range->material < 0, &lastAmbient);
+			glDrawElements(GL_TRIANGLES, range->nIndices, renderer->indexType,
+				BUFFER_OFFSET((size_t)range->firstIndex * indexSize));
+		}
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glPopClientAttrib();
+	glPopMatrix();
+	glPopAttrib();
+}
+
+void cleanupMeshRenderer(MeshRenderer *renderer)
+{
+	int m;
+
+	if (renderer->vertexBuffer)
+	{
+		glDeleteBuffers(1, &renderer->vertexBuffer);
+		glDeleteBuffers(1, &renderer->indexBuffer);
+	}
+	if (renderer->displayList)
+		glDeleteLists(renderer->displayList, 1);
+	if (renderer->textures)
+		for (m = 0; m < renderer->nMaterials; m++)
+			if (renderer->textures[m])
+				glDeleteTextures(1, &renderer->textures[m]);
+	free(renderer->textures);
+	free(renderer->ranges);
+	memset(renderer, 0, sizeof(*renderer));
+}
@@ -0,0 +1,77 @@
+#ifndef MESH_RENDERER_H
+#define MESH_RENDERER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "utils.h"
+#include "obj/obj.h"
+
+/* A run of indices drawn with one glDrawElements, under one
+   faceset's material and shading. Neighbouring facesets that would
+   set the same state are merged */
+typedef struct
+{
+	int firstIndex, nIndices;
+	int material;		/* Into the mesh's materials, -1 keeps the caller's */
+	int smooth;
+} MeshDrawRange;
+
+/* An OBJMesh uploaded once for drawing with a fixed number of GL
+   calls, however many triangles it has. The interleaved vertices go
+   into a buffer object as obj.c laid them out, the indices into
+   another (16 bit when there are few enough vertices), and each
+   range is one glDrawElements. Contexts without buffer objects get a
+   display list of the same ranges instead */
+typedef struct
+{
+	int nRanges;
+	MeshDrawRange *ranges;
+	int nMaterials;
+	OBJMaterial *materials;		/* The mesh's, which must outlive this */
+	unsigned int *textures;		/* Per material, 0 if untextured */
+
+	int stride, normalOffset, texcoordOffset;
+	bool hasNormals, hasTexCoords;
+	int nVertices, nIndices;
+	unsigned int indexType;		/* GL_UNSIGNED_SHORT or GL_UNSIGNED_INT */
+	size_t vertexBytes, indexBytes;
+
+	unsigned int vertexBuffer;
+	unsigned int indexBuffer;
+	unsigned int displayList;
+} MeshRenderer;
+
+/* Works out the draw ranges of a mesh, touching no GL state.
+   initMeshRenderer does this too, it's split out for measuring */
+void buildMeshRanges(MeshRenderer *renderer, const OBJMesh *mesh);
+
+/* Uploads the mesh and loads its materials' textures, on the GL
+   thread. The mesh's arrays can be freed afterwards, its materials
+   can't */
+void initMeshRenderer(MeshRenderer *renderer, const OBJMesh *mesh);
+
+/* Draws every range with its material and shading, leaving the
+   caller's material and shade model as they were. Ranges without a
+   material are drawn with whatever the caller set */
+void drawMeshRenderer(const MeshRenderer *renderer);
+
+/* Draws the mesh once for each of the given instances, where
+   transforms holds a column major 4x4 model matrix per instance
+   (applied after the current modelview) and ambients, if not NULL,
+   an RGBA ambient colour for the ranges without a material. The
+   arrays and pointers are set up once and each range's state once
+   for every instance, which then costs a matrix load and a
+   glDrawElements */
+void drawMeshInstances(const MeshRenderer *renderer, const float *transforms, const float *ambients,
+	const int *instances, int nInstances);
+
+/* Deletes the buffers, display list and textures */
+void cleanupMeshRenderer(MeshRenderer *renderer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,347 @@
+#include <stdlib.h>
+#include "noise.h"
+#include "cpu.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define NOISE_X86 1
+#include <immintrin.h>
+#endif
+
+/* 2d gradient noise peaks at about +/- sqrt(0.5), scale it to +/- 1 */
+#define NOISE_SCALE 1.41421356f
+
+/* The 8 gradients a lattice point can hash to, unit length */
+#define NOISE_DIAGONAL 0.70710678f
+static const float gradX[8] = {1, -1, 0, 0, NOISE_DIAGONAL, -NOISE_DIAGONAL, NOISE_DIAGONAL, -NOISE_DIAGONAL};
+static const float gradZ[8] = {0, 0, 1, -1, NOISE_DIAGONAL, NOISE_DIAGONAL, -NOISE_DIAGONAL, -NOISE_DIAGONAL};
+
+void initNoise(Noise *noise, unsigned int seed, int nOctaves, float frequency,
+	float lacunarity, float gain)
+{
+	unsigned int state = seed * 2654435761u + 1;
+	float amplitude = 1.0f;
+	int i, j, t;
+
+	nOctaves = clamp(nOctaves, 0, NOISE_MAX_OCTAVES);
+	noise->nOctaves = nOctaves;
+	for (i = 0; i < nOctaves; i++)
+	{
+		noise->frequency[i] = frequency;
+		noise->amplitude[i] = amplitude * NOISE_SCALE;
+		frequency *= lacunarity;
+		amplitude *= gain;
+	}
+
+	/* Fisher-Yates shuffle of 0-255 with a xorshift generator */
+	for (i = 0; i < 256; i++)
+		noise->perm[i] = i;
+	for (i = 255; i > 0; i--)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		j = state % (i + 1);
+		t = noise->perm[i];
+		noise->perm[i] = noise->perm[j];
+		noise->perm[j] = t;
+	}
+	for (i = 0; i < 256; i++)
+		noise->perm[256 + i] = noise->perm[i];
+}
+
+/* Gradient index of lattice point (i, j) */
+static int hashLattice(const Noise *noise, int i, int j)
+{
+	return noise->perm[noise->perm[i & 255] + (j & 255)] & 7;
+}
+
+/* floorf without the libm call, for the small values noise sees */
+static int fastFloor(float v)
+{
+	int i = (int)v;
+
+	return i - (v < i);
+}
+
+/* Perlin's quintic, so the noise has continuous second derivatives */
+static float fade(float t)
+{
+	return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+float noiseFBm(const Noise *noise, float x, float z)
+{
+	float total = 0.0f;
+	int o;
+
+	for (o = 0; o < noise->nOctaves; o++)
+	{
+		float fx = x * noise->frequency[o], fz = z * noise->frequency[o];
+		int i = fastFloor(fx), j = fastFloor(fz);
+		float tx = fx - i, tz = fz - j;
+		int h00 = hashLattice(noise, i, j), h01 = hashLattice(noise, i, j + 1);
+		int h10 = hashLattice(noise, i + 1, j), h11 = hashLattice(noise, i + 1, j + 1);
+		float n00 = gradX[h00] * tx + gradZ[h00] * tz;
+		float n01 = gradX[h01] * tx + gradZ[h01] * (tz - 1.0f);
+		float n10 = gradX[h10] * (tx - 1.0f) + gradZ[h10] * tz;
+		float n11 = gradX[h11] * (tx - 1.0f) + gradZ[h11] * (tz - 1.0f);
+		float u = fade(tx), v = fade(tz);
+		float a = n00 + v * (n01 - n00);
+		float b = n10 + v * (n11 - n10);
+
+		total += noise->amplitude[o] * (a + u * (b - a));
+	}
+	return total;
+}
+
+/* One octave along a row: every sample shares the lattice lines i and
+   i + 1, and the gradients on them are tabled so a sample's corners
+   are cell and cell + 1 of each table. Samples spread further apart
+   than a lattice cell get two entries of their own instead, rather
+   than tabling cells nothing lands in */
+typedef struct
+{
+	int *cell;		/* Each sample's first corner in the tables */
+	float *tz;		/* Each sample's offset into its cell */
+	float *gx0, *gz0;	/* Gradients along line i */
+	float *gx1, *gz1;	/* and line i + 1 */
+	float tx, u;		/* Offset from line i, and its fade */
+	float amplitude;
+} NoiseRow;
+
+/* Accumulates one octave into out[begin, end) */
+typedef void (*RowFunc)(const NoiseRow *row, float *out, int begin, int end);
+
+static void buildNoiseRow(const Noise *noise, int o, float x, const float *z, int n, NoiseRow *row)
+{
+	float f = noise->frequency[o];
+	float fx = x * f;
+	float zMin = z[0] * f, zMax = z[0] * f;
+	int i = fastFloor(fx), j, k, first, nCells;
+
+	row->tx = fx - i;
+	row->u = fade(row->tx);
+	row->amplitude = noise->amplitude[o];
+
+	for (k = 1; k < n; k++)
+	{
+		zMin = min(zMin, z[k] * f);
+		zMax = max(zMax, z[k] * f);
+	}
+	first = fastFloor(zMin);
+	nCells = fastFloor(zMax) - first + 2;
+
+	if (nCells <= 2 * n)
+	{
+		for (j = 0; j < nCells; j++)
+		{
+			int h0 = hashLattice(noise, i, first + j), h1 = hashLattice(noise, i + 1, first + j);
+
+			row->gx0[j] = gradX[h0];
+			row->gz0[j] = gradZ[h0];
+			row->gx1[j] = gradX[h1];
+			row->gz1[j] = gradZ[h1];
+		}
+		for (k = 0; k < n; k++)
+		{
+			float fz = z[k] * f;
+			int cz = fastFloor(fz);
+
+			row->cell[k] = cz - first;
+			row->tz[k] = fz - cz;
+		}
+		return;
+	}
+
+	for (k = 0; k < n; k++)
+	{
+		float fz = z[k] * f;
+		int cz = fastFloor(fz);
+
+		for (j = 0; j < 2; j++)
+		{
+			int h0 = hashLattice(noise, i, cz + j), h1 = hashLattice(noise, i + 1, cz + j);
+
+			row->gx0[2 * k + j] = gradX[h0];
+			row->gz0[2 * k + j] = gradZ[h0];
+			row->gx1[2 * k + j] = gradX[h1];
+			row->gz1[2 * k + j] = gradZ[h1];
+		}
+		row->cell[k] = 2 * k;
+		row->tz[k] = fz - cz;
+	}
+}
+
+static void accumulateScalar(const NoiseRow *row, float *out, int begin, int end)
+{
+	const float tx = row->tx, tx1 = row->tx - 1.0f;
+	int k;
+
+	for (k = begin; k < end; k++)
+	{
+		int c = row->cell[k];
+		float tz = row->tz[k], tz1 = tz - 1.0f;
+		float n00 = row->gx0[c] * tx + row->gz0[c] * tz;
+		float n01 = row->gx0[c + 1] * tx + row->gz0[c + 1] * tz1;
+		float n10 = row->gx1[c] * tx1 + row->gz1[c] * tz;
+		float n11 = row->gx1[c + 1] * tx1 + row->gz1[c + 1] * tz1;
+		float v = fade(tz);
+		float a = n00 + v * (n01 - n00);
+		float b = n10 + v * (n11 - n10);
+
+		out[k] += row->amplitude * (a + row->u * (b - a));
+	}
+}
+
+/* Sums the octaves into out with the given accumulator */
+static void noiseRow(const Noise *noise, float x, const float *z, float *out, int n, RowFunc accumulate)
+{
+	NoiseRow row;
+	float *tables;
+	int k, o;
+
+	for (k = 0; k < n; k++)
+		out[k] = 0.0f;
+	if (n <= 0)
+		return;
+
+	/* Room for two entries per sample, which also covers a dense
+	   table (see buildNoiseRow) */
+	tables = malloc((4 * (2 * n) + n) * sizeof(float));
+	row.cell = malloc(n * sizeof(int));
+	row.gx0 = tables;
+	row.gz0 = row.gx0 + 2 * n;
+	row.gx1 = row.gz0 + 2 * n;
+	row.gz1 = row.gx1 + 2 * n;
+	row.tz = row.gz1 + 2 * n;
+
+	for (o = 0; o < noise->nOctaves; o++)
+	{
+		buildNoiseRow(noise, o, x, z, n, &row);
+		accumulate(&row, out, 0, n);
+	}
+
+	free(tables);
+	free(row.cell);
+}
+
+void noiseRowScalar(const Noise *noise, float x, const float *z, float *out, int n)
+{
+	noiseRow(noise, x, z, out, n, accumulateScalar);
+}
+
+#ifdef NOISE_X86
+
+/* Loads table[cell[0..3]] */
+__attribute__((target("sse2")))
+static __m128 gather4(const float *table, const int *cell, int offset)
+{
+	return _mm_set_ps(table[cell[3] + offset], table[cell[2] + offset],
+		table[cell[1] + offset], table[cell[0] + offset]);
+}
+
+__attribute__((target("sse2")))
+static void accumulateSSE2(const NoiseRow *row, float *out, int begin, int end)
+{
+	const __m128 tx = _mm_set1_ps(row->tx), tx1 = _mm_set1_ps(row->tx - 1.0f);
+	const __m128 u = _mm_set1_ps(row->u), amplitude = _mm_set1_ps(row->amplitude);
+	const __m128 one = _mm_set1_ps(1.0f);
+	int k;
+
+	for (k = begin; k + 4 <= end; k += 4)
+	{
+		const int *c = row->cell + k;
+		__m128 tz = _mm_loadu_ps(row->tz + k), tz1 = _mm_sub_ps(tz, one);
+		__m128 n00 = _mm_add_ps(_mm_mul_ps(gather4(row->gx0, c, 0), tx), _mm_mul_ps(gather4(row->gz0, c, 0), tz));
+		__m128 n01 = _mm_add_ps(_mm_mul_ps(gather4(row->gx0, c, 1), tx), _mm_mul_ps(gather4(row->gz0, c, 1), tz1));
+		__m128 n10 = _mm_add_ps(_mm_mul_ps(gather4(row->gx1, c, 0), tx1), _mm_mul_ps(gather4(row->gz1, c, 0), tz));
+		__m128 n11 = _mm_add_ps(_mm_mul_ps(gather4(row->gx1, c, 1), tx1), _mm_mul_ps(gather4(row->gz1, c, 1), tz1));
+		__m128 v = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(tz, tz), tz), _mm_add_ps(_mm_mul_ps(tz,
+			_mm_sub_ps(_mm_mul_ps(tz, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f))), _mm_set1_ps(10.0f)));
+		__m128 a = _mm_add_ps(n00, _mm_mul_ps(v, _mm_sub_ps(n01, n00)));
+		__m128 b = _mm_add_ps(n10, _mm_mul_ps(v, _mm_sub_ps(n11, n10)));
+		__m128 value = _mm_add_ps(a, _mm_mul_ps(u, _mm_sub_ps(b, a)));
+
+		_mm_storeu_ps(out + k, _mm_add_ps(_mm_loadu_ps(out + k), _mm_mul_ps(amplitude, value)));
+	}
+	accumulateScalar(row, out, k, end);
+}
+
+__attribute__((target("avx2")))
+static void accumulateAVX2(const NoiseRow *row, float *out, int begin, int end)
+{
+	const __m256 tx = _mm256_set1_ps(row->tx), tx1 = _mm256_set1_ps(row->tx - 1.0f);
+	const __m256 u = _mm256_set1_ps(row->u), amplitude = _mm256_set1_ps(row->amplitude);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	int k;
+
+	for (k = begin; k + 8 <= end; k += 8)
+	{
+		__m256i c0 = _mm256_loadu_si256((const __m256i *)(row->cell + k));
+		__m256i c1 = _mm256_add_epi32(c0, _mm256_set1_epi32(1));
+		__m256 tz = _mm256_loadu_ps(row->tz + k), tz1 = _mm256_sub_ps(tz, one);
+		__m256 n00 = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(row->gx0, c0, 4), tx),
+			_mm256_mul_ps(_mm256_i32gather_ps(row->gz0, c0, 4), tz));
+		__m256 n01 = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(row->gx0, c1, 4), tx),
+			_mm256_mul_ps(_mm256_i32gather_ps(row->gz0, c1, 4), tz1));
+		__m256 n10 = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(row->gx1, c0, 4), tx1),
+			_mm256_mul_ps(_mm256_i32gather_ps(row->gz1, c0, 4), tz));
+		__m256 n11 = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(row->gx1, c1, 4), tx1),
+			_mm256_mul_ps(_mm256_i32gather_ps(row->gz1, c1, 4), tz1));
+		__m256 v = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(tz, tz), tz), _mm256_add_ps(_mm256_mul_ps(tz,
+			_mm256_sub_ps(_mm256_mul_ps(tz, _mm256_set1_ps(6.0f)), _mm256_set1_ps(15.0f))), _mm256_set1_ps(10.0f)));
+		__m256 a = _mm256_add_ps(n00, _mm256_mul_ps(v, _mm256_sub_ps(n01, n00)));
+		__m256 b = _mm256_add_ps(n10, _mm256_mul_ps(v, _mm256_sub_ps(n11, n10)));
+		__m256 value = _mm256_add_ps(a, _mm256_mul_ps(u, _mm256_sub_ps(b, a)));
+
+		_mm256_storeu_ps(out + k, _mm256_add_ps(_mm256_loadu_ps(out + k), _mm256_mul_ps(amplitude, value)));
+	}
+	accumulateSSE2(row, out, k, end);
+}
+
+void noiseRowSSE2(const Noise *noise, float x, const float *z, float *out, int n)
+{
+	noiseRow(noise, x, z, out, n, accumulateSSE2);
+}
+
+void noiseRowAVX2(const Noise *noise, float x, const float *z, float *out, int n)
+{
+	noiseRow(noise, x, z, out, n, accumulateAVX2);
+}
+
+#else
+
+/* No SIMD on this platform, the wide kernels are the scalar one */
+void noiseRowSSE2(const Noise *noise, float x, const float *z, float *out, int n)
+{
+	noiseRowScalar(noise, x, z, out, n);
+}
+
+void noiseRowAVX2(const Noise *noise, float x, const float *z, float *out, int n)
+{
+	noiseRowScalar(noise, x, z, out, n);
+}
+
+#endif
+
+/* Picks the widest kernel the CPU supports */
+NoiseKernel selectNoiseKernel(const char **name)
+{
+	const char *dummy;
+
+	if (!name)
+		name = &dummy;
+
+	if (cpuHasAVX2())
+	{
+		*name = "avx2";
+		return noiseRowAVX2;
+	}
+	if (cpuHasSSE2())
+	{
+		*name = "sse2";
+		return noiseRowSSE2;
+	}
+	*name = "scalar";
+	return noiseRowScalar;
+}
@@ -0,0 +1,56 @@
+#ifndef NOISE_H
+#define NOISE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "utils.h"
+
+/* Most octaves a fractal sum can have */
+#define NOISE_MAX_OCTAVES 16
+
+/* Seed initTerrain builds its noise from */
+#define NOISE_DEFAULT_SEED 57
+
+/* 2d gradient (Perlin) noise summed over octaves (fBm). The lattice
+   hashes come from a seeded permutation, each octave's frequency and
+   amplitude are tabled up front */
+typedef struct
+{
+	int nOctaves;
+	float frequency[NOISE_MAX_OCTAVES];
+	float amplitude[NOISE_MAX_OCTAVES];
+	int perm[512];		/* 0-255 shuffled, twice so hashes don't wrap */
+} Noise;
+
+/* Sets up nOctaves octaves, the first at the given frequency and
+   amplitude 1, each next one lacunarity times the frequency and gain
+   times the amplitude */
+void initNoise(Noise *noise, unsigned int seed, int nOctaves, float frequency,
+	float lacunarity, float gain);
+
+/* Reference single sample, roughly within +/- the sum of the
+   amplitudes */
+float noiseFBm(const Noise *noise, float x, float z);
+
+/* A noise kernel writes the fBm at (x, z[k]) to out[k] for n
+   samples, e.g. a row of terrain. The lattice gradients along the row
+   are hashed once per octave and shared by every sample they touch.
+   Any n and alignment; all kernels agree with noiseFBm to within
+   1e-5 of the amplitude sum */
+typedef void (*NoiseKernel)(const Noise *noise, float x, const float *z, float *out, int n);
+
+void noiseRowScalar(const Noise *noise, float x, const float *z, float *out, int n);
+void noiseRowSSE2(const Noise *noise, float x, const float *z, float *out, int n);
+void noiseRowAVX2(const Noise *noise, float x, const float *z, float *out, int n);
+
+/* Picks the widest kernel the CPU supports, optionally returning its
+   name for diagnostics */
+NoiseKernel selectNoiseKernel(const char **name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,218 @@
+#include <math.h>
+#include <stdlib.h>
+#include "ocean.h"
+#include "jobs.h"
+
+/* Gravity, and the fraction of the longest wavelength below which
+   the spectrum is damped out */
+#define GRAVITY 9.81f
+#define SMALL_WAVE_FRACTION 0.001f
+
+/* Minimum spectrum rows handed to each job */
+#define SPECTRUM_ROW_GRAIN 8
+
+/* Small LCG so the spectrum doesn't disturb rand() */
+static float oceanRandom(unsigned int *state)
+{
+	*state = *state * 1664525u + 1013904223u;
+	return ((*state >> 8) + 0.5f) / (float)(1 << 24);
+}
+
+/* Standard normal pair (Box-Muller) */
+static Complex gaussianPair(unsigned int *state)
+{
+	float u = oceanRandom(state), v = oceanRandom(state);
+	float r = sqrtf(-2.0f * logf(u));
+	Complex c = { r * cosf(2.0f * M_PI * v), r * sinf(2.0f * M_PI * v) };
+	return c;
+}
+
+/* Signed frequency of array index i, so index 0 is the mean and the
+   top half holds the negative frequencies the FFT expects there */
+static int frequencyIndex(int i, int n)
+{
+	return i < n / 2 ? i : i - n;
+}
+
+/* Phillips spectrum at wave vector (kx, kz) */
+static float phillips(float kx, float kz, float windX, float windZ, float windSpeed)
+{
+	float k2 = kx * kx + kz * kz;
+	float L = windSpeed * windSpeed / GRAVITY;
+	float l = L * SMALL_WAVE_FRACTION;
+	float cosine;
+
+	if (k2 == 0.0f)
+		return 0.0f;
+
+	cosine = (kx * windX + kz * windZ) / sqrtf(k2);
+
+	return expf(-1.0f / (k2 * L * L)) / (k2 * k2) * cosine * cosine * expf(-k2 * l * l);
+}
+
+/* Builds the spectrum and allocates the planes */
+bool initOcean(Ocean *ocean, int n, float size, float windSpeed, float windDir,
+	float height, unsigned int seed)
+{
+	int i, j;
+	float windX = cosf(windDir), windZ = sinf(windDir);
+	double variance = 0.0, scale;
+
+	if (!initFFTPlan(&ocean->plan, n))
+		return false;
+
+	ocean->n = n;
+	ocean->size = size;
+	ocean->time = -1.0f;
+	ocean->h0 = malloc(n * n * sizeof(Complex));
+	ocean->omega = malloc(n * n * sizeof(float));
+	ocean->heightSlopeX = malloc(n * n * sizeof(Complex));
+	ocean->slopeZ = malloc(n * n * sizeof(Complex));
+
+	for (i = 0; i < n; i++)
+	{
+		for (j = 0; j < n; j++)
+		{
+			float kx = 2.0f * M_PI * frequencyIndex(i, n) / size;
+			float kz = 2.0f * M_PI * frequencyIndex(j, n) / size;
+			float amplitude = sqrtf(0.5f * phillips(kx, kz, windX, windZ, windSpeed));
+			Complex g = gaussianPair(&seed);
+			Complex *h = &ocean->h0[i * n + j];
+
+			h->re = g.re * amplitude;
+			h->im = g.im * amplitude;
+			ocean->omega[i * n + j] = sqrtf(GRAVITY * sqrtf(kx * kx + kz * kz));
+			variance += h->re * h->re + h->im * h->im;
+		}
+	}
+
+	/* Each height sample sums h0(k) and h0(-k) for every k, so the
+	   variance is twice the spectrum's energy */
+	scale = variance > 0.0 ? height / sqrt(2.0 * variance) : 0.0;
+	for (i = 0; i < n * n; i++)
+	{
+		ocean->h0[i].re *= (float)scale;
+		ocean->h0[i].im *= (float)scale;
+	}
+
+	updateOcean(ocean, 0.0f);
+
+	return true;
+}
+
+void cleanupOcean(Ocean *ocean)
+{
+	free(ocean->h0);
+	free(ocean->omega);
+	free(ocean->heightSlopeX);
+	free(ocean->slopeZ);
+	ocean->h0 = ocean->heightSlopeX = ocean->slopeZ = NULL;
+	ocean->omega = NULL;
+	cleanupFFTPlan(&ocean->plan);
+}
+
+/* Spectrum rows being animated, shared by the jobs */
+typedef struct
+{
+	Ocean *ocean;
+	float t;
+} SpectrumJob;
+
+/* Animates rows [begin, end) of the spectrum:
+   h(k, t) = h0(k) e^(i w t) + conj(h0(-k)) e^(-i w t), and fills the
+   FFT inputs. The height and x slope are both real fields, so they
+   share one complex transform as h + i * dh/dx */
+static void animateSpectrumRows(int begin, int end, void *data)
+{
+	SpectrumJob *job = data;
+	Ocean *ocean = job->ocean;
+	int n = ocean->n, i, j;
+
+	for (i = begin; i < end; i++)
+	{
+		int mi = (n - i) % n;
+
+		/* The Nyquist row has no matching -k, its slope would come
+		   out complex and leak into the packed height */
+		float kx = i == n / 2 ? 0.0f : 2.0f * M_PI * frequencyIndex(i, n) / ocean->size;
+
+		for (j = 0; j < n; j++)
+		{
+			int mj = (n - j) % n;
+			float kz = j == n / 2 ? 0.0f : 2.0f * M_PI * frequencyIndex(j, n) / ocean->size;
+			float wt = ocean->omega[i * n + j] * job->t;
+			float c = cosf(wt), s = sinf(wt);
+			Complex a = ocean->h0[i * n + j];
+			Complex b = ocean->h0[mi * n + mj];
+			Complex h, ikxh, ikzh;
+
+			/* a e^(iwt) + conj(b) e^(-iwt) */
+			h.re = (a.re + b.re) * c - (a.im + b.im) * s;
+			h.im = (a.re - b.re) * s + (a.im - b.im) * c;
+
+			/* Derivatives are i k h */
+			ikxh.re = -kx * h.im;
+			ikxh.im = kx * h.re;
+			ikzh.re = -kz * h.im;
+			ikzh.im = kz * h.re;
+
+			/* h + i * (i kx h) */
+			ocean->heightSlopeX[i * n + j].re = h.re - ikxh.im;
+			ocean->heightSlopeX[i * n + j].im = h.im + ikxh.re;
+			ocean->slopeZ[i * n + j] = ikzh;
+		}
+	}
+}
+
+/* Animates the spectrum and runs the inverse FFTs */
+void updateOcean(Ocean *ocean, float t)
+{
+	SpectrumJob job = { ocean, t };
+	int i;
+
+	if (t == ocean->time)
+		return;
+
+	parallelFor(0, ocean->n, SPECTRUM_ROW_GRAIN, animateSpectrumRows, &job);
+	inverseFFT2D(&ocean->plan, ocean->heightSlopeX);
+	inverseFFT2D(&ocean->plan, ocean->slopeZ);
+
+	ocean->maxHeight = 0.0f;
+	for (i = 0; i < ocean->n * ocean->n; i++)
+		ocean->maxHeight = max(ocean->maxHeight, fabsf(ocean->heightSlopeX[i].re));
+
+	ocean->time = t;
+}
+
+/* Bilinearly interpolates the height and slopes at x, z, wrapping
+   around the patch */
+Vec4f sampleOcean(const Ocean *ocean, float x, float z)
+{
+	int n = ocean->n;
+	float u = x / ocean->size * n, v = z / ocean->size * n;
+	float fu = floorf(u), fv = floorf(v);
+	float tu = u - fu, tv = v - fv;
+	int i0 = (int)fu & (n - 1), j0 = (int)fv & (n - 1);
+	int i1 = (i0 + 1) & (n - 1), j1 = (j0 + 1) & (n - 1);
+	const Complex *hs = ocean->heightSlopeX;
+	const Complex *sz = ocean->slopeZ;
+	float w00 = (1 - tu) * (1 - tv), w01 = (1 - tu) * tv;
+	float w10 = tu * (1 - tv), w11 = tu * tv;
+	float h, gx, gz, len;
+	Vec4f result;
+
+	h = w00 * hs[i0 * n + j0].re + w01 * hs[i0 * n + j1].re
+		+ w10 * hs[i1 * n + j0].re + w11 * hs[i1 * n + j1].re;
+	gx = w00 * hs[i0 * n + j0].im + w01 * hs[i0 * n + j1].im
+		+ w10 * hs[i1 * n + j0].im + w11 * hs[i1 * n + j1].im;
+	gz = w00 * sz[i0 * n + j0].re + w01 * sz[i0 * n + j1].re
+		+ w10 * sz[i1 * n + j0].re + w11 * sz[i1 * n + j1].re;
+
+	len = sqrtf(gx * gx + 1.0f + gz * gz);
+	result.x = -gx / len;
+	result.y = 1.0f / len;
+	result.z = -gz / len;
+	result.w = h;
+
+	return result;
+}
@@ -0,0 +1,49 @@
+#ifndef OCEAN_H
+#define OCEAN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "utils.h"
+#include "fft.h"
+
+/* Tessendorf style ocean: a Phillips spectrum animated in frequency
+   space and brought back to heights and slopes with inverse FFTs.
+   The result is an n x n height field covering size x size GL units
+   that repeats in both directions */
+typedef struct
+{
+	int n;			/* Samples per side, a power of two */
+	float size;		/* Patch size in GL coords */
+	Complex *h0;		/* Initial spectrum amplitudes */
+	float *omega;		/* Dispersion, angular frequency per wave */
+	Complex *heightSlopeX;	/* Height (re) and x slope (im) */
+	Complex *slopeZ;	/* z slope (re) */
+	FFTPlan plan;
+	float time;		/* Time the field was last built for */
+	float maxHeight;	/* Largest |height| in the field */
+} Ocean;
+
+/* Builds the spectrum for an n x n ocean covering size GL units.
+   windSpeed (m/s) sets the longest waves, windDir is in radians and
+   height is the rms wave height the spectrum is scaled to. Returns
+   false if n isn't a power of two */
+bool initOcean(Ocean *ocean, int n, float size, float windSpeed, float windDir,
+	float height, unsigned int seed);
+
+/* Frees everything allocated by initOcean */
+void cleanupOcean(Ocean *ocean);
+
+/* Rebuilds the height field at time t (seconds) */
+void updateOcean(Ocean *ocean, float t);
+
+/* Bilinear lookup of the height field, returning the unit normal in
+   x,y,z and the height in w like calcSineValue */
+Vec4f sampleOcean(const Ocean *ocean, float x, float z);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
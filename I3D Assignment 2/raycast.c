@@ -0,0 +1,265 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "raycast.h"
+#include "jobs.h"
+
+/* Minimum cell rows per job when building a level */
+#define PYRAMID_ROW_GRAIN 16
+
+/* Slack on the barycentric test, so rays along a shared edge can't
+   slip between the triangles either side of it */
+#define RAYCAST_EDGE_EPSILON 1e-5f
+
+/* A cell of the pyramid waiting to be tested */
+typedef struct
+{
+	int level, i, j;
+} PyramidCell;
+
+/* Shared state for the level building jobs */
+typedef struct
+{
+	HeightPyramid *pyramid;
+	int level;
+} PyramidJob;
+
+/* Measures cell (i, j) of a level, from the samples for level 0 and
+   from the level below otherwise */
+static void measureCell(HeightPyramid *pyramid, int level, int i, int j)
+{
+	HeightRange *range = &pyramid->levels[level][i * pyramid->levelCols[level] + j];
+	int ci, cj;
+
+	range->minY = HUGE_VALF;
+	range->maxY = -HUGE_VALF;
+	if (level == 0)
+	{
+		for (ci = i; ci <= i + 1; ci++)
+		{
+			for (cj = j; cj <= j + 1; cj++)
+			{
+				float y = pyramid->vertices[ci * pyramid->cols + cj].y;
+				range->minY = min(range->minY, y);
+				range->maxY = max(range->maxY, y);
+			}
+		}
+		return;
+	}
+
+	for (ci = i * 2; ci < min(i * 2 + 2, pyramid->levelRows[level - 1]); ci++)
+	{
+		for (cj = j * 2; cj < min(j * 2 + 2, pyramid->levelCols[level - 1]); cj++)
+		{
+			const HeightRange *child = &pyramid->levels[level - 1][ci * pyramid->levelCols[level - 1] + cj];
+			range->minY = min(range->minY, child->minY);
+			range->maxY = max(range->maxY, child->maxY);
+		}
+	}
+}
+
+/* Measures rows [begin, end) of a level */
+static void buildLevelRows(int begin, int end, void *data)
+{
+	PyramidJob *job = data;
+	int i, j;
+
+	for (i = begin; i < end; i++)
+		for (j = 0; j < job->pyramid->levelCols[job->level]; j++)
+			measureCell(job->pyramid, job->level, i, j);
+}
+
+void initHeightPyramid(HeightPyramid *pyramid, const Vec3f *vertices, int rows, int cols)
+{
+	PyramidJob job;
+	int l;
+
+	memset(pyramid, 0, sizeof(*pyramid));
+	pyramid->rows = rows;
+	pyramid->cols = cols;
+	pyramid->vertices = vertices;
+
+	job.pyramid = pyramid;
+	pyramid->levelRows[0] = rows - 1;
+	pyramid->levelCols[0] = cols - 1;
+	for (l = 0; l < HEIGHT_PYRAMID_MAX_LEVELS; l++)
+	{
+		if (l > 0)
+		{
+			pyramid->levelRows[l] = (pyramid->levelRows[l - 1] + 1) / 2;
+			pyramid->levelCols[l] = (pyramid->levelCols[l - 1] + 1) / 2;
+		}
+		pyramid->levels[l] = malloc(pyramid->levelRows[l] * pyramid->levelCols[l] * sizeof(HeightRange));
+		pyramid->nLevels = l + 1;
+
+		job.level = l;
+		parallelFor(0, pyramid->levelRows[l], PYRAMID_ROW_GRAIN, buildLevelRows, &job);
+
+		if (pyramid->levelRows[l] == 1 && pyramid->levelCols[l] == 1)
+			break;
+	}
+}
+
+/* Cells touching a changed sample, then their parents up to the root */
+void updateHeightPyramid(HeightPyramid *pyramid, int i0, int j0, int i1, int j1)
+{
+	int l, i, j;
+
+	i0 = max(i0 - 1, 0);
+	j0 = max(j0 - 1, 0);
+	i1 = min(i1, pyramid->levelRows[0] - 1);
+	j1 = min(j1, pyramid->levelCols[0] - 1);
+	for (l = 0; l < pyramid->nLevels; l++)
+	{
+		for (i = i0; i <= i1; i++)
+			for (j = j0; j <= j1; j++)
+				measureCell(pyramid, l, i, j);
+		i0 /= 2;
+		j0 /= 2;
+		i1 /= 2;
+		j1 /= 2;
+	}
+}
+
+void cleanupHeightPyramid(HeightPyramid *pyramid)
+{
+	int l;
+
+	for (l = 0; l < pyramid->nLevels; l++)
+		free(pyramid->levels[l]);
+	memset(pyramid, 0, sizeof(*pyramid));
+}
+
+/* Clips [*t0, *t1] to where the ray is between lo and hi on one axis */
+static bool clipSlab(float o, float d, float lo, float hi, float *t0, float *t1)
+{
+	float a, b, inv;
+
+	if (d == 0.0f)
+		return o >= lo && o <= hi;
+
+	inv = 1.0f / d;
+	a = (lo - o) * inv;
+	b = (hi - o) * inv;
+	if (a > b)
+	{
+		float swap = a;
+		a = b;
+		b = swap;
+	}
+	*t0 = max(*t0, a);
+	*t1 = min(*t1, b);
+	return *t0 <= *t1;
+}
+
+/* Moller-Trumbore, keeping the hit if it's within [0, hit->t] */
+static bool intersectTriangle(Vec3f origin, Vec3f dir, Vec3f a, Vec3f b, Vec3f c, RayHit *hit)
+{
+	Vec3f e1 = { b.x - a.x, b.y - a.y, b.z - a.z };
+	Vec3f e2 = { c.x - a.x, c.y - a.y, c.z - a.z };
+	Vec3f p = { dir.y * e2.z - dir.z * e2.y, dir.z * e2.x - dir.x * e2.z, dir.x * e2.y - dir.y * e2.x };
+	float det = e1.x * p.x + e1.y * p.y + e1.z * p.z, inv, u, v, t;
+	Vec3f s, q;
+
+	if (fabsf(det) < 1e-12f)
+		return false;
+	inv = 1.0f / det;
+
+	s = cVec3f(origin.x - a.x, origin.y - a.y, origin.z - a.z);
+	u = (s.x * p.x + s.y * p.y + s.z * p.z) * inv;
+	if (u < -RAYCAST_EDGE_EPSILON || u > 1.0f + RAYCAST_EDGE_EPSILON)
+		return false;
+
+	q = cVec3f(s.y * e1.z - s.z * e1.y, s.z * e1.x - s.x * e1.z, s.x * e1.y - s.y * e1.x);
+	v = (dir.x * q.x + dir.y * q.y + dir.z * q.z) * inv;
+	if (v < -RAYCAST_EDGE_EPSILON || u + v > 1.0f + RAYCAST_EDGE_EPSILON)
+		return false;
+
+	t = (e2.x * q.x + e2.y * q.y + e2.z * q.z) * inv;
+	if (t < 0.0f || t > hit->t)
+		return false;
+
+	hit->t = t;
+	hit->pos = cVec3f(origin.x + dir.x * t, origin.y + dir.y * t, origin.z + dir.z * t);
+	hit->normal = cVec3f(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x);
+	if (hit->normal.y < 0.0f)
+		hit->normal = cVec3f(-hit->normal.x, -hit->normal.y, -hit->normal.z);
+	return true;
+}
+
+/* The cell is split along its (i, j+1) to (i+1, j) diagonal, like
+   the terrain's strips */
+bool intersectHeightCell(const HeightPyramid *pyramid, int i, int j, Vec3f origin, Vec3f dir, RayHit *hit)
+{
+	const Vec3f *v = pyramid->vertices + i * pyramid->cols + j;
+	Vec3f v00 = v[0], v01 = v[1], v10 = v[pyramid->cols], v11 = v[pyramid->cols + 1];
+	bool found = intersectTriangle(origin, dir, v00, v01, v10, hit);
+
+	/* Either may be nearer on a ray along the diagonal */
+	return intersectTriangle(origin, dir, v11, v10, v01, hit) || found;
+}
+
+bool castHeightRay(const HeightPyramid *pyramid, Vec3f origin, Vec3f dir, float maxT, RayHit *hit)
+{
+	PyramidCell stack[4 * HEIGHT_PYRAMID_MAX_LEVELS];
+	int top = 0, k;
+	bool found = false;
+
+	/* The child nearest along the ray is first, the furthest last.
+	   Cells don't overlap in x/z, so the first hit found is the
+	   nearest and later boxes are only clipped against it */
+	int nearI = dir.x < 0.0f, nearJ = dir.z < 0.0f;
+
+	hit->t = maxT;
+	hit->nodesVisited = 0;
+	stack[top].level = pyramid->nLevels - 1;
+	stack[top].i = stack[top].j = 0;
+	top++;
+
+	while (top > 0)
+	{
+		PyramidCell cell = stack[--top];
+		int level = cell.level;
+		const HeightRange *range = &pyramid->levels[level][cell.i * pyramid->levelCols[level] + cell.j];
+		int i0 = cell.i << level, i1 = min((cell.i + 1) << level, pyramid->rows - 1);
+		int j0 = cell.j << level, j1 = min((cell.j + 1) << level, pyramid->cols - 1);
+		Vec3f lo = pyramid->vertices[i0 * pyramid->cols + j0];
+		Vec3f hi = pyramid->vertices[i1 * pyramid->cols + j1];
+		float t0 = 0.0f, t1 = hit->t;
+
+		hit->nodesVisited++;
+		if (!clipSlab(origin.x, dir.x, min(lo.x, hi.x), max(lo.x, hi.x), &t0, &t1) ||
+			!clipSlab(origin.z, dir.z, min(lo.z, hi.z), max(lo.z, hi.z), &t0, &t1) ||
+			!clipSlab(origin.y, dir.y, range->minY, range->maxY, &t0, &t1))
+			continue;
+
+		if (level == 0)
+		{
+			found = intersectHeightCell(pyramid, cell.i, cell.j, origin, dir, hit) || found;
+			continue;
+		}
+
+		/* Push the children furthest first */
+		for (k = 3; k >= 0; k--)
+		{
+			int ci = cell.i * 2 + ((k >> 1) ^ nearI);
+			int cj = cell.j * 2 + ((k & 1) ^ nearJ);
+
+			if (ci >= pyramid->levelRows[level - 1] || cj >= pyramid->levelCols[level - 1])
+				continue;
+			stack[top].level = level - 1;
+			stack[top].i = ci;
+			stack[top].j = cj;
+			top++;
+		}
+	}
+
+	return found;
+}
+
+bool castHeightSegment(const HeightPyramid *pyramid, Vec3f from, Vec3f to, RayHit *hit)
+{
+	Vec3f dir = { to.x - from.x, to.y - from.y, to.z - from.z };
+
+	return castHeightRay(pyramid, from, dir, 1.0f, hit);
+}
@@ -0,0 +1,74 @@
+#ifndef RAYCAST_H
+#define RAYCAST_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "utils.h"
+
+/* Most levels a pyramid can have, enough for 32768 cells per side */
+#define HEIGHT_PYRAMID_MAX_LEVELS 16
+
+/* Lowest and highest height over an area */
+typedef struct
+{
+	float minY, maxY;
+} HeightRange;
+
+/* Min-max mip pyramid over a heightfield, for casting rays against
+   it. Level 0 holds the height range of every cell (the quad between
+   four samples), each level up the range of 2x2 cells of the one
+   below, until a single cell covers everything. A ray descends only
+   into cells whose box it passes through, nearest first, so it skips
+   over open water and sky in O(log n) steps */
+typedef struct
+{
+	int rows, cols;			/* Samples, as the terrain is laid out */
+	const Vec3f *vertices;		/* Owned by the caller */
+
+	int nLevels;
+	int levelRows[HEIGHT_PYRAMID_MAX_LEVELS], levelCols[HEIGHT_PYRAMID_MAX_LEVELS];
+	HeightRange *levels[HEIGHT_PYRAMID_MAX_LEVELS];
+} HeightPyramid;
+
+/* Where a ray met the heightfield, t is in units of the ray's dir */
+typedef struct
+{
+	float t;
+	Vec3f pos;
+	Vec3f normal;		/* Of the triangle hit, facing up */
+	int nodesVisited;	/* Cells of any level tested, hit or not */
+} RayHit;
+
+/* Builds the pyramid over a row-major rows x cols grid of samples,
+   where x varies with the row and z with the column. The samples must
+   outlive the pyramid */
+void initHeightPyramid(HeightPyramid *pyramid, const Vec3f *vertices, int rows, int cols);
+
+/* Brings the pyramid up to date after the heights of samples
+   [i0, i1] x [j0, j1] changed */
+void updateHeightPyramid(HeightPyramid *pyramid, int i0, int j0, int i1, int j1);
+
+/* Frees the levels */
+void cleanupHeightPyramid(HeightPyramid *pyramid);
+
+/* Finds the nearest point where origin + t * dir, 0 <= t <= maxT,
+   meets the triangles of the heightfield. Returns false on a miss,
+   hit->nodesVisited is set either way */
+bool castHeightRay(const HeightPyramid *pyramid, Vec3f origin, Vec3f dir, float maxT, RayHit *hit);
+
+/* The same for the segment from one point to another, t runs from 0
+   to 1 along it */
+bool castHeightSegment(const HeightPyramid *pyramid, Vec3f from, Vec3f to, RayHit *hit);
+
+/* Intersects the ray with the two triangles of cell (i, j) only,
+   keeping the hit if it's nearer than hit->t. Used by the traversal,
+   and for checking it against a plain cell by cell march */
+bool intersectHeightCell(const HeightPyramid *pyramid, int i, int j, Vec3f origin, Vec3f dir, RayHit *hit);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,12 +1,223 @@
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
 #include "seabed.h"
-#include "png_loader.h"
+#include "heightfield.h"
+#include "noise.h"
+#include "jobs.h"
+#include "buffers.h"
 #include "gl.h"
 #include "time.h"
+#include "terrain_cache.h"
 
-static Image* terrainLoader;
+/* Minimum number of rows handed to each job */
+#define TERRAIN_ROW_GRAIN 8
+
+/* Quads per side of the chunks the indices are grouped into, each
+   chunk is culled on its own */
+#define TERRAIN_CHUNK_QUADS 32
+
+/* Share of the edit tiles past which flushTerrainEdits rebuilds
+   everything whole, rather than tile by tile */
+#define TERRAIN_EDIT_REBUILD_SHARE 0.25f
+
+/* Heightmap the terrain is built from (a .png, .r16 or .r32, see
+ heightfield.h), and where the finished terrain is cached: a file per
+ tessellation and hash of everything else it was built from, so
+ rebuilt layouts don't replace the startup one. The most recently
+ used TERRAIN_CACHE_KEEP of each tessellation are kept */
+#define TERRAIN_HEIGHTMAP "heightmap.png"
+#define TERRAIN_CACHE_FILE "terrain-%dx%d-%08x.cache"
+#define TERRAIN_CACHE_FILES "terrain-%dx%d-*.cache"
+#define TERRAIN_CACHE_KEEP 4
+
+/* Noise added to the heightmap: three octaves, each twice the
+ frequency and amplitude of the last (what getPerlinNoise(x, z, 2, 4)
+ summed) */
+#define TERRAIN_NOISE_OCTAVES 3
+#define TERRAIN_NOISE_FREQUENCY 1.0f
+#define TERRAIN_NOISE_LACUNARITY 2.0f
+#define TERRAIN_NOISE_GAIN 2.0f
+
+/* The open sea's tiles for each size, and what they're built from:
+ a seabed at TERRAIN_WORLD_DEPTH with noise up to about twice
+ TERRAIN_WORLD_RELIEF either way, breaking the surface as islands */
+#define TERRAIN_WORLD_FILE "terrain-world-%d.tiles"
+#define TERRAIN_WORLD_DEPTH -25.0f
+#define TERRAIN_WORLD_RELIEF 40.0f
+#define TERRAIN_WORLD_OCTAVES 8
+#define TERRAIN_WORLD_FREQUENCY (1.0f / 1500.0f)
+#define TERRAIN_WORLD_LACUNARITY 2.0f
+#define TERRAIN_WORLD_GAIN 0.5f
+
+/* Whether initTerrain reads and writes the cache */
+static bool terrainCaching = true;
+
+/* Shared state for the row jobs of initTerrain */
+typedef struct
+{
+	int rows, cols;
+	float size, height_offset;
+	Vec3f *vertices;
+	const Heightfield *heightmap;	/* Or NULL for flat */
+	const Noise *noise;
+	NoiseKernel noiseKernel;
+} TerrainJob;
+
+/* Fills the vertices of rows [begin, end) from the heightmap plus
+   gradient noise, a whole row of noise at a time */
+static void generateTerrainRows(int begin, int end, void *data)
+{
+	TerrainJob *job = data;
+	int i, j, index;
+	float x, z, y, u;
+	float size = job->size;
+	float initial_x = (int)(-0.5*size), initial_z = (int)(-0.5*size);
+	float last_x = (int)(0.5*size), last_z = (int)(0.5*size);
+	float *rowZ = malloc(job->cols * sizeof(float));
+	float *rowV = malloc(job->cols * sizeof(float));
+	float *rowNoise = malloc(job->cols * sizeof(float));
+
+	for (j = 0; j < job->cols; j++)
+	{
+		z = j / (float)(job->cols - 1); /* range 0 to 1 */
+		rowZ[j] = (z - 0.5) * size; /* range -.5 size to .5 size */
+		rowV[j] = (rowZ[j] - initial_z)/(last_z - initial_z);
+	}
+
+	for (i = begin; i < end; i++)
+	{
+		x = i / (float)(job->rows - 1); /* range 0 to 1 */
+		x = (x - 0.5) * size; /* range -.5 size to .5 size */
+		u = (x - initial_x)/(last_x - initial_x);
+		index = i * job->cols;
+		job->noiseKernel(job->noise, x, rowZ, rowNoise, job->cols);
+		
+		for (j = 0; j < job->cols; j++)
+		{
+			z = rowZ[j];
+			
+			/* x runs across the heightmap and z up it */
+			y = job->height_offset - 255;
+			if (job->heightmap)
+				y += sampleHeightfield(job->heightmap, u, rowV[j]);
+			y += rowNoise[j];
+			job->vertices[index].x = x;
+			job->vertices[index].y = y;
+			job->vertices[index].z = z;
+			
+			index++;
+		}
+	}
+	
+	free(rowZ);
+	free(rowV);
+	free(rowNoise);
+}
+
+/* Fits each chunk's bounds to every vertex it uses */
+static void calcTerrainChunkBounds(Terrain *terrain)
+{
+	int c, i;
+	
+	for (c = 0; c < terrain->topology.nChunks; c++)
+	{
+		MeshChunk *chunk = &terrain->topology.chunks[c];
+		
+		chunk->min = chunk->max = terrain->vertices[chunk->baseVertex];
+		for (i = chunk->firstIndex; i < chunk->firstIndex + chunk->nIndices; i++)
+		{
+			if (terrain->topology.indices[i] == TOPOLOGY_RESTART)
+				continue;
+			
+			Vec3f v = terrain->vertices[chunk->baseVertex + terrain->topology.indices[i]];
+			chunk->min = cVec3f(min(chunk->min.x, v.x), min(chunk->min.y, v.y), min(chunk->min.z, v.z));
+			chunk->max = cVec3f(max(chunk->max.x, v.x), max(chunk->max.y, v.y), max(chunk->max.z, v.z));
+		}
+	}
+}
+
+/* Refits the heights of the bounds of chunk rows [begin, end) to their
+ samples, for after edits (x and z never change). Quicker than going
+ through the strips like calcTerrainChunkBounds */
+static void fitTerrainChunkRows(int begin, int end, void *data)
+{
+	Terrain *terrain = data;
+	const GridTopology *topology = &terrain->topology;
+	int r, c, i, j;
+	
+	for (r = begin; r < end; r++)
+	{
+		int i0 = r * topology->chunkRows, i1 = min(i0 + topology->chunkRows, terrain->rows - 1);
+		
+		for (c = 0; c < topology->chunkGridCols; c++)
+		{
+			MeshChunk *chunk = &topology->chunks[r * topology->chunkGridCols + c];
+			int j0 = c * topology->chunkCols, j1 = min(j0 + topology->chunkCols, terrain->cols - 1);
+			
+			chunk->min.y = HUGE_VALF;
+			chunk->max.y = -HUGE_VALF;
+			for (i = i0; i <= i1; i++)
+			{
+				const Vec3f *row = terrain->vertices + i * terrain->cols;
+				
+				for (j = j0; j <= j1; j++)
+				{
+					chunk->min.y = min(chunk->min.y, row[j].y);
+					chunk->max.y = max(chunk->max.y, row[j].y);
+				}
+			}
+		}
+	}
+}
+
+/* Builds the vertices, normals and strips of the terrain from the
+ heightmap and noise */
+static void generateTerrain(Terrain *terrain)
+{
+	int rows = terrain->rows, cols = terrain->cols, nVertices = terrain->nVertices;
+	float size = terrain->size;
+	TerrainJob job;
+	Noise noise;
+	Heightfield heightmap;
+	
+	/* load terrain heightmap */
+	bool loaded = loadHeightfield(&heightmap, TERRAIN_HEIGHTMAP);
+	
+	/* Allocate memory for the vertex/normal arrays */
+	Vec3f *vertices = calloc(nVertices, sizeof(Vec3f));
+	Vec3f *normals = calloc(nVertices, sizeof(Vec3f));
+	
+	/* Populate the vertex array from the heightmap, a few rows per
+	 job. The x and z values will never change */
+	job.rows = rows;
+	job.cols = cols;
+	job.size = size;
+	job.height_offset = terrain->params.heightOffset;
+	job.vertices = vertices;
+	job.heightmap = loaded ? &heightmap : NULL;
+	
+	initNoise(&noise, terrain->params.seed, terrain->params.octaves, TERRAIN_NOISE_FREQUENCY,
+		TERRAIN_NOISE_LACUNARITY, TERRAIN_NOISE_GAIN);
+	job.noise = &noise;
+	job.noiseKernel = selectNoiseKernel(0);
+	parallelFor(0, rows, TERRAIN_ROW_GRAIN, generateTerrainRows, &job);
+	if (loaded)
+		freeHeightfield(&heightmap);
+	
+	/* Build the strips which form triangles by referencing the
+	 vertices, one chunk at a time so each chunk is a single range
+	 with its own bounds. These never change */
+	buildGridTopology(&terrain->topology, rows, cols, TERRAIN_CHUNK_QUADS, 0, 0, 0);
+	
+	terrain->vertices = vertices;
+	terrain->normals = normals;
+	calcTerrainChunkBounds(terrain);
+	calcTerrainNormals(terrain);
+}
 
 /* Initialises a 3d terrain of the given tessellation
  and size in GL coordinates. Afterward, only
@@ -14,184 +225,797 @@ static Image* terrainLoader;
  via updateTerrain() */
 void initTerrain(Terrain *terrain, int rows, int cols, float size, float height_offset)
 {
-	int initial_x, initial_z, last_x, last_z;
-	int i, j, index, new_index, new_i, new_j;
-	float x, z, y;
+	TerrainParams params;
+	
+	defaultTerrainParams(&params, rows, cols, size, height_offset);
+	initTerrainWith(terrain, &params);
+}
+
+void defaultTerrainParams(TerrainParams *params, int rows, int cols, float size, float heightOffset)
+{
+	params->rows = rows;
+	params->cols = cols;
+	params->size = size;
+	params->heightOffset = heightOffset;
+	params->seed = NOISE_DEFAULT_SEED;
+	params->octaves = TERRAIN_NOISE_OCTAVES;
+}
+
+/* Heights per coast field sample along each side, keeping its samples
+ at least TERRAIN_COAST_SPACING apart */
+static int terrainCoastStride(const Terrain *terrain)
+{
+	float spacing = terrain->size / (float)(max(terrain->rows, terrain->cols) - 1);
+	
+	return max((int)ceilf(TERRAIN_COAST_SPACING / spacing), 1);
+}
+
+void initTerrainWith(Terrain *terrain, const TerrainParams *params)
+{
+	TerrainCacheKey key;
+	char cacheFile[256], cacheFiles[256];
+	bool keyed;
+	double start = timeNow();
+	int rows = params->rows, cols = params->cols;
+	float size = params->size;
 	
 	if (rows < 2)
 		rows = 2;
 	if (cols < 2)
 		cols = 2;
 	
-	int nVertices = (rows) * (cols);
-	int nIndices = (rows - 1) * (cols - 1) * 6;
-	
-	/* load terrain heightmap */
-	terrainLoader = load_png("heightmap.png");
-	
-	/* Allocate memory for the vertex/normal arrays and index
-	 array, this will be for drawing triangles */
-	Vec3f *vertices = calloc(nVertices, sizeof(Vec3f));
-	Vec3f *normals = calloc(nVertices, sizeof(Vec3f));
-	int *indices = calloc(nIndices, sizeof(int));
-	
-	/* Iterate through the number of rows and columns, populating
-	 the vertex array, the x and z values will never change,
-	 although the y value will when applying a wave effect to
-	 the grid */
-	index = 0;
+	/* Create the grid and assign variables */
+	terrain->rows = rows;
+	terrain->cols = cols;
+	terrain->size = size;
+	terrain->nVertices = rows * cols;
+	terrain->params = *params;
+	terrain->params.rows = rows;
+	terrain->params.cols = cols;
+	memset(&terrain->topology, 0, sizeof(terrain->topology));
+	memset(&terrain->cache, 0, sizeof(terrain->cache));
 	
-	initial_x = -0.5*size;
-	initial_z = -0.5*size;
-	last_x = 0.5*size;
-	last_z = 0.5*size;
+	/* Use the finished terrain from an earlier run, straight from the
+	 file, if nothing it was built from has changed since */
+	keyed = terrainCaching && makeTerrainCacheKey(&key, TERRAIN_HEIGHTMAP, rows, cols, size,
+		params->heightOffset, params->seed, params->octaves, TERRAIN_NOISE_FREQUENCY,
+		TERRAIN_NOISE_LACUNARITY, TERRAIN_NOISE_GAIN, TERRAIN_CHUNK_QUADS);
+	if (keyed)
+		snprintf(cacheFile, sizeof(cacheFile), TERRAIN_CACHE_FILE, rows, cols, hashTerrainCacheKey(&key));
 	
-	for (i = 0; i < rows; i++)
+	terrain->fromCache = keyed && openTerrainCache(&terrain->cache, cacheFile, &key);
+	if (terrain->fromCache)
 	{
-		x = i / (float)(rows - 1); /* range 0 to 1 */
-		x = (x - 0.5) * size; /* range -.5 size to .5 size */
-		
-		for (j = 0; j < cols; j++)
-		{
-			z = j / (float)(cols - 1); /* range 0 to 1 */
-			z = (z - 0.5) * size; /* range -.5 size to .5 size */
-			
-			//Y = (X-A)/(B-A) * (D-C) + C
-			new_i = ((x - initial_x)/(last_x - initial_x)) * terrainLoader->width;
-			new_j = ((z - initial_z)/(last_z - initial_z)) * terrainLoader->width;
-			new_index = (new_j*terrainLoader->width + new_i) * terrainLoader->channels;
-			y = (height_offset - 255) + terrainLoader->data[new_index];
-			y += getPerlinNoise(x, z, 2, 4); // adding perlin noise
-			vertices[index].x = x;
-			vertices[index].y = y;
-			vertices[index].z = z;
-			
-			//printf("%f %f %f\n", vertices[index].x, vertices[index].y, vertices[index].z);
-			index++;
-		}
+		terrain->vertices = terrain->cache.vertices;
+		terrain->normals = terrain->cache.normals;
+		setGridTopologyLayout(&terrain->topology, rows, cols, TERRAIN_CHUNK_QUADS);
+		terrain->topology.nIndices = terrain->topology.indexCapacity = terrain->cache.nIndices;
+		terrain->topology.indices = terrain->cache.indices;
+		terrain->topology.nChunks = terrain->topology.chunkCapacity = terrain->cache.nChunks;
+		terrain->topology.chunks = terrain->cache.chunks;
 	}
-	
-	/* Iterate again, this time creating an array of indices
-	 which form triangles by referencing previously
-	 generated vertices. This array will never change */
-	index = 0;
-#define GRID_VERTEX(i, j) ((i)*cols+(j))
-	for (i = 0; i < rows - 1; i++)
+	else
 	{
-		for (j = 0; j < cols - 1; j++)
+		generateTerrain(terrain);
+		if (keyed && writeTerrainCache(cacheFile, &key, terrain->vertices, terrain->normals,
+			terrain->nVertices, &terrain->topology))
 		{
-			indices[index++] = GRID_VERTEX(i, j);
-			indices[index++] = GRID_VERTEX(i, j + 1);
-			indices[index++] = GRID_VERTEX(i + 1, j);
-			indices[index++] = GRID_VERTEX(i + 1, j);
-			indices[index++] = GRID_VERTEX(i, j + 1);
-			indices[index++] = GRID_VERTEX(i + 1, j + 1);
+			snprintf(cacheFiles, sizeof(cacheFiles), TERRAIN_CACHE_FILES, rows, cols);
+			pruneTerrainCaches(cacheFiles, TERRAIN_CACHE_KEEP);
 		}
 	}
 	
-	/* Create the grid and assign variables */
-	terrain->rows = rows;
-	terrain->cols = cols;
-	terrain->size = size;
-	terrain->nVertices = nVertices;
-	terrain->nIndices = nIndices;
-	terrain->vertices = vertices;
-	terrain->normals = normals;
-	terrain->indices = indices;
+	initCDLOD(&terrain->lod, terrain->vertices, terrain->normals, rows, cols, size, CDLOD_DEFAULT_TOLERANCE);
+	initCoastField(&terrain->coast, terrain->vertices, rows, cols, terrainCoastStride(terrain),
+		TERRAIN_WATER_LEVEL, TERRAIN_COAST_BAND);
+	initHeightPyramid(&terrain->pyramid, terrain->vertices, rows, cols);
 	
-	calcTerrainNormals(terrain);
+	terrain->edited = false;
+	terrain->editTileRows = (rows + TERRAIN_EDIT_TILE - 1) / TERRAIN_EDIT_TILE;
+	terrain->editTileCols = (cols + TERRAIN_EDIT_TILE - 1) / TERRAIN_EDIT_TILE;
+	terrain->editTiles = calloc(terrain->editTileRows * terrain->editTileCols, 1);
+	terrain->coastTiles = calloc(terrain->editTileRows * terrain->editTileCols, 1);
+	terrain->coastPending = 0;
+	terrain->coastUpdate.land = terrain->coastUpdate.water = NULL;
+	terrain->coastUpdating = 0;
+	
+	/* GL objects can only be made on the first draw */
+	terrain->vertexBuffer = 0;
+	terrain->indexBuffer = 0;
+	terrain->displayLists = 0;
+	
+	terrain->initSeconds = timeNow() - start;
+}
+
+void setTerrainCaching(bool enabled)
+{
+	terrainCaching = enabled;
+}
+
+/* Deletes the GL objects, which only the GL thread can do */
+static void releaseTerrainGL(Terrain *terrain)
+{
+	if (terrain->vertexBuffer)
+	{
+		glDeleteBuffers(1, &terrain->vertexBuffer);
+		glDeleteBuffers(1, &terrain->indexBuffer);
+	}
+	if (terrain->displayLists)
+		glDeleteLists(terrain->displayLists, terrain->topology.nChunks);
+	releaseCDLODGL(&terrain->lod);
+	terrain->vertexBuffer = 0;
+	terrain->indexBuffer = 0;
+	terrain->displayLists = 0;
 }
 
 /* Deletes all memory dynamically allocated by initGrid */
 void cleanupTerrain(Terrain *terrain)
 {
-	free(terrain->vertices);
-	free(terrain->normals);
-	free(terrain->indices);
+	/* Before the topology and quadtree go, they're what says how many
+	 lists and buffers there are */
+	releaseTerrainGL(terrain);
+	if (terrain->cache.map)
+	{
+		/* The arrays are in the mapped file */
+		closeTerrainCache(&terrain->cache);
+		terrain->topology.indices = 0;
+		terrain->topology.chunks = 0;
+	}
+	else
+	{
+		free(terrain->vertices);
+		free(terrain->normals);
+	}
+	cleanupCDLOD(&terrain->lod);
+	cleanupCoastField(&terrain->coast);
+	cancelCoastUpdate(&terrain->coastUpdate);
+	cleanupHeightPyramid(&terrain->pyramid);
+	free(terrain->editTiles);
+	free(terrain->coastTiles);
+	terrain->editTiles = 0;
+	terrain->coastTiles = 0;
+	cleanupGridTopology(&terrain->topology);
 	
 	terrain->nVertices = 0;
-	terrain->nIndices = 0;
 	terrain->normals = 0;
-	terrain->indices = 0;
 }
 
-/* Draws a given grid */
-void drawTerrain(Terrain *terrain)
-{	
-	/* Draw blue water with a white specular highlight */
+/* A terrain being built on its own thread */
+struct _TerrainBuilder
+{
+	pthread_t thread;
+	TerrainParams params;
+	Terrain terrain;
+	int finished;		/* Set by the thread once terrain is built */
+	double seconds;
+};
+
+static void *buildTerrainMain(void *arg)
+{
+	TerrainBuilder *builder = arg;
+	double start = timeNow();
+	
+	initTerrainWith(&builder->terrain, &builder->params);
+	builder->seconds = timeNow() - start;
+	__atomic_store_n(&builder->finished, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/* Frees a retired terrain's memory, which for big terrains takes
+   longer than a frame should. Its GL objects are already gone, so
+   nothing here touches GL */
+static void *freeTerrainMain(void *arg)
+{
+	Terrain *terrain = arg;
+	
+	cleanupTerrain(terrain);
+	free(terrain);
+	return NULL;
+}
+
+/* Releases the retired terrain's GL objects here, and the rest on a
+   thread of its own */
+static void freeRetiredTerrain(TerrainRebuild *rebuild)
+{
+	Terrain *retired = malloc(sizeof(Terrain));
+	pthread_t thread;
+	
+	releaseTerrainGL(&rebuild->retired);
+	*retired = rebuild->retired;
+	if (pthread_create(&thread, NULL, freeTerrainMain, retired) == 0)
+		pthread_detach(thread);
+	else
+		freeTerrainMain(retired);
+	rebuild->hasRetired = false;
+}
+
+bool requestTerrainRebuild(TerrainRebuild *rebuild, const TerrainParams *params)
+{
+	TerrainBuilder *builder;
+	
+	if (rebuild->builder)
+		return false;
+	
+	builder = calloc(1, sizeof(TerrainBuilder));
+	builder->params = *params;
+	if (pthread_create(&builder->thread, NULL, buildTerrainMain, builder) != 0)
+	{
+		free(builder);
+		return false;
+	}
+	rebuild->builder = builder;
+	return true;
+}
+
+bool swapRebuiltTerrain(TerrainRebuild *rebuild, Terrain *terrain)
+{
+	TerrainBuilder *builder = rebuild->builder;
+	double start = timeNow();
+	
+	/* A whole frame has been drawn since this was swapped out */
+	if (rebuild->hasRetired)
+		freeRetiredTerrain(rebuild);
+	
+	if (!builder || !__atomic_load_n(&builder->finished, __ATOMIC_ACQUIRE))
+		return false;
+	
+	/* The thread is done, joining it doesn't wait */
+	pthread_join(builder->thread, NULL);
+	rebuild->retired = *terrain;
+	rebuild->hasRetired = true;
+	*terrain = builder->terrain;
+	rebuild->buildSeconds = builder->seconds;
+	rebuild->swaps++;
+	free(builder);
+	rebuild->builder = NULL;
+	
+	rebuild->swapSeconds = timeNow() - start;
+	return true;
+}
+
+bool terrainRebuilding(const TerrainRebuild *rebuild)
+{
+	return rebuild->builder != NULL;
+}
+
+void cleanupTerrainRebuild(TerrainRebuild *rebuild)
+{
+	if (rebuild->builder)
+	{
+		pthread_join(rebuild->builder->thread, NULL);
+		cleanupTerrain(&rebuild->builder->terrain);
+		free(rebuild->builder);
+		rebuild->builder = NULL;
+	}
+	if (rebuild->hasRetired)
+	{
+		cleanupTerrain(&rebuild->retired);
+		rebuild->hasRetired = false;
+	}
+}
+
+/* Sends vertex i of the terrain in immediate mode */
+static void emitTerrainVertex(int i, void *data)
+{
+	Terrain *terrain = data;
+	
+	/* A common cause of bugs/crashing when indexing
+	 vertices is accessing arrays out of bounds. assert
+	 is a great way to catch this early */
+	assert(i >= 0 && i < terrain->nVertices);
+	
+	Vec3f v = terrain->vertices[i];
+	Vec3f n = terrain->normals[i];
+	Vec2f t = {(v.x/terrain->size) - 0.5, (v.z/terrain->size) - 0.5};
+	
+	glTexCoord2f(t.x, t.y);
+	glNormal3f(n.x, n.y, n.z);
+	glVertex3f(v.x, v.y, v.z);
+}
+
+/* Applies the terrain's material, this will interact with the light
+ to produce the final colour */
+static void applyTerrainMaterial(void)
+{
 	static float diffuse[] = {1, 1, 1, 1};
 	static float ambient[] = {1, 1, 1, 1};
 	static float specular[] = {1, 1, 1, 1};
 	static float shininess = 256.0f;
 	
-	int i;
-	
-	/* Apply the material, this will interact with the light to
-	 produce the final colour */
 	glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, ambient);
 	glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, diffuse);
 	glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, specular);
 	glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, shininess);
+}
+
+/* Tests every chunk against the viewport's frustum, returning how
+ many are visible */
+static int findVisibleChunks(Terrain *terrain, bool *visible)
+{
+	int c, nVisible = 0;
 	
-	/* Draw the grid, as triangles */
-	glBegin(GL_TRIANGLES);
+	for (c = 0; c < terrain->topology.nChunks; c++)
+	{
+		const MeshChunk *chunk = &terrain->topology.chunks[c];
+		
+		visible[c] = boxVisible(CULL_TERRAIN, chunk->min, chunk->max);
+		if (visible[c])
+			nVisible++;
+	}
+	return nVisible;
+}
+
+/* Interleaves vertices [first, first + n) into out */
+static void interleaveTerrainVertices(const Terrain *terrain, int first, int n, TerrainVertex *out)
+{
+	int i;
 	
-	for (i = 0; i < terrain->nIndices; i++)
+	for (i = 0; i < n; i++)
 	{
-		/* A common cause of bugs/crashing when indexing
-		 vertices is accessing arrays out of bounds. assert
-		 is a great way to catch this early */
-		assert(terrain->indices[i] >= 0 && terrain->indices[i] < terrain->nVertices);
+		out[i].pos = terrain->vertices[first + i];
+		out[i].normal = terrain->normals[first + i];
+		out[i].texcoord.x = (terrain->vertices[first + i].x/terrain->size) - 0.5;
+		out[i].texcoord.y = (terrain->vertices[first + i].z/terrain->size) - 0.5;
+	}
+}
+
+/* Interleaves positions, normals and texcoords and uploads them with
+ the strips, once. Edits are patched in by flushTerrainEdits */
+static void createTerrainBuffers(Terrain *terrain)
+{
+	TerrainVertex *interleaved = malloc(terrain->nVertices * sizeof(TerrainVertex));
+	
+	interleaveTerrainVertices(terrain, 0, terrain->nVertices, interleaved);
+	
+	glGenBuffers(1, &terrain->vertexBuffer);
+	glGenBuffers(1, &terrain->indexBuffer);
+	
+	glBindBuffer(GL_ARRAY_BUFFER, terrain->vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, terrain->nVertices * sizeof(TerrainVertex),
+		interleaved, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, terrain->indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, terrain->topology.nIndices * sizeof(unsigned short),
+		terrain->topology.indices, GL_STATIC_DRAW);
+	
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	
+	free(interleaved);
+}
+
+/* Points the arrays at the vertex buffer starting from vertex base */
+static void bindTerrainBuffers(int baseVertex, void *data)
+{
+	size_t offset = baseVertex * sizeof(TerrainVertex);
+	
+	(void)data;
+	glVertexPointer(3, GL_FLOAT, sizeof(TerrainVertex), (void *)offset);
+	glNormalPointer(GL_FLOAT, sizeof(TerrainVertex), (void *)(offset + sizeof(Vec3f)));
+	glTexCoordPointer(2, GL_FLOAT, sizeof(TerrainVertex), (void *)(offset + 2 * sizeof(Vec3f)));
+}
+
+/* Compiles chunk c's display list */
+static void compileTerrainList(Terrain *terrain, int c)
+{
+	glNewList(terrain->displayLists + c, GL_COMPILE);
+	drawTopologyChunkImmediate(&terrain->topology, c, emitTerrainVertex, terrain);
+	glEndList();
+}
+
+/* Compiles one display list per chunk, for contexts without buffer
+ objects */
+static void compileTerrainLists(Terrain *terrain)
+{
+	int c;
+	
+	terrain->displayLists = glGenLists(terrain->topology.nChunks);
+	for (c = 0; c < terrain->topology.nChunks; c++)
+		compileTerrainList(terrain, c);
+}
+
+void drawTerrain(Terrain *terrain)
+{
+	int c, nVisible;
+	bool *visible = malloc(max(terrain->topology.nChunks, 1) * sizeof(bool));
+	
+	applyTerrainMaterial();
+	nVisible = findVisibleChunks(terrain, visible);
+	
+	if (nVisible > 0 && buffersSupported())
+	{
+		if (!terrain->vertexBuffer)
+			createTerrainBuffers(terrain);
+		
+		glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_NORMAL_ARRAY);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 		
-		Vec3f v = terrain->vertices[terrain->indices[i]];
-		Vec3f n = terrain->normals[terrain->indices[i]];
-		Vec2f t = {(v.x/terrain->size) - 0.5, (v.z/terrain->size) - 0.5};
+		glBindBuffer(GL_ARRAY_BUFFER, terrain->vertexBuffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, terrain->indexBuffer);
+		drawTopologyChunks(&terrain->topology, visible, bindTerrainBuffers, terrain);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 		
-		glTexCoord2f(t.x, t.y);
-		glNormal3f(n.x, n.y, n.z);
-		glVertex3f(v.x, v.y, v.z);		
+		glPopClientAttrib();
 	}
-	glEnd();
+	else if (nVisible > 0)
+	{
+		/* Call the visible chunks' lists in one go */
+		GLuint *lists = malloc(nVisible * sizeof(GLuint));
+		
+		if (!terrain->displayLists)
+			compileTerrainLists(terrain);
+		
+		nVisible = 0;
+		for (c = 0; c < terrain->topology.nChunks; c++)
+			if (visible[c])
+				lists[nVisible++] = terrain->displayLists + c;
+		glCallLists(nVisible, GL_UNSIGNED_INT, lists);
+		
+		free(lists);
+	}
+	
+	free(visible);
+}
+
+void drawTerrainLOD(Terrain *terrain, Vec3f eye)
+{
+	applyTerrainMaterial();
+	selectCDLOD(&terrain->lod, eye);
+	drawCDLOD(&terrain->lod);
+}
+
+void drawTerrainImmediate(Terrain *terrain)
+{
+	int c;
+	bool *visible = malloc(max(terrain->topology.nChunks, 1) * sizeof(bool));
+	
+	applyTerrainMaterial();
+	findVisibleChunks(terrain, visible);
+	
+	/* Draw the grid, as triangle strips */
+	for (c = 0; c < terrain->topology.nChunks; c++)
+	{
+		if (visible[c])
+			drawTopologyChunkImmediate(&terrain->topology, c, emitTerrainVertex, terrain);
+	}
+	
+	free(visible);
+}
+
+/* Normal of sample (i, j), across the samples either side of it */
+static Vec3f calcTerrainNormal(const Terrain *terrain, int i, int j)
+{
+	//(i,j) -> (i)*cols+(j)
+	Vec3f vup = {0,0,0}, vdown = {0,0,0}, vleft = {0,0,0}, vright = {0,0,0};
+	
+	if(j<terrain->cols-1){
+		//(i, j+1)
+		vdown = terrain->vertices[(i)*terrain->cols+(j+1)];
+	}
+	
+	if(j>0){
+		//(i, j-1)
+		vup = terrain->vertices[(i)*terrain->cols+(j-1)];
+	}
+	
+	if(i<terrain->rows-1){
+		//(i+1, j)
+		vright = terrain->vertices[(i+1)*terrain->cols+(j)];
+	}
+	
+	if(i>0){
+		//(i-1, j)
+		vleft = terrain->vertices[(i-1)*terrain->cols+(j)];
+	}			
+	
+	Vec3f verticalVector = {vup.x - vdown.x, vup.y - vdown.y, vup.z - vdown.z};
+	Vec3f horizontalVector = {vright.x - vleft.x, vright.y - vleft.y, vright.z - vleft.z};
+	
+	return getCrossProduct(verticalVector, horizontalVector);
+}
+
+/* Computes the normals of rows [begin, end) */
+static void calcTerrainNormalRows(int begin, int end, void *data)
+{
+	Terrain *terrain = data;
+	int i, j, index = begin * terrain->cols;
+	
+	for(i=begin; i<end; i++)
+		for(j=0; j<terrain->cols; j++)
+			terrain->normals[index++] = calcTerrainNormal(terrain, i, j);
 }
 
 void calcTerrainNormals(Terrain* terrain)
 {
-	int i, j, index = 0;
+	parallelFor(0, terrain->rows, TERRAIN_ROW_GRAIN, calcTerrainNormalRows, terrain);
+}
+
+void deformTerrain(Terrain *terrain, float x, float z, float radius, float delta)
+{
+	int i, j;
+	float r2 = radius * radius;
+	
+	/* Samples sit at (i/(rows-1) - 0.5) * size along x, likewise z */
+	float ci = (x / terrain->size + 0.5f) * (terrain->rows - 1);
+	float cj = (z / terrain->size + 0.5f) * (terrain->cols - 1);
+	float ri = radius / terrain->size * (terrain->rows - 1);
+	float rj = radius / terrain->size * (terrain->cols - 1);
+	int i0 = max((int)ceilf(ci - ri), 0), i1 = min((int)floorf(ci + ri), terrain->rows - 1);
+	int j0 = max((int)ceilf(cj - rj), 0), j1 = min((int)floorf(cj + rj), terrain->cols - 1);
 	
-	for(i=0; i<terrain->rows; i++){
-		for(j=0; j<terrain->cols; j++){
+	if (r2 <= 0.0f)
+		return;
+	
+	for (i = i0; i <= i1; i++)
+	{
+		for (j = j0; j <= j1; j++)
+		{
+			Vec3f *v = &terrain->vertices[i * terrain->cols + j];
+			unsigned char *tile = &terrain->editTiles[i / TERRAIN_EDIT_TILE * terrain->editTileCols + j / TERRAIN_EDIT_TILE];
+			float dx = v->x - x, dz = v->z - z, d2 = dx * dx + dz * dz, w, y;
 			
-			//(i,j) -> (i)*cols+(j)
-			Vec3f vup = {0,0,0}, vdown = {0,0,0}, vleft = {0,0,0}, vright = {0,0,0};
+			if (d2 >= r2)
+				continue;
+			w = 1.0f - d2 / r2;
+			y = v->y + delta * w * w;
 			
-			if(j<terrain->cols){
-				//(i, j+1)
-				vdown = terrain->vertices[(i)*terrain->cols+(j+1)];
-			}
+			/* The coast field only sees which side of the water
+			 samples are on */
+			if ((v->y > TERRAIN_WATER_LEVEL) != (y > TERRAIN_WATER_LEVEL))
+				*tile = TERRAIN_EDIT_SHORE;
+			else
+				*tile = max(*tile, TERRAIN_EDIT_HEIGHTS);
+			v->y = y;
+			terrain->edited = true;
+		}
+	}
+}
+
+/* Brings everything but the coast field and display lists up to date
+ for samples [i0, i1] x [j0, j1], marking the chunks whose lists need
+ recompiling */
+static void flushTerrainRect(Terrain *terrain, int i0, int j0, int i1, int j1, bool *chunksEdited)
+{
+	GridTopology *topology = &terrain->topology;
+	int i, j, ci, cj, cols = terrain->cols;
+	int ni0 = max(i0 - 1, 0), nj0 = max(j0 - 1, 0);
+	int ni1 = min(i1 + 1, terrain->rows - 1), nj1 = min(j1 + 1, cols - 1);
+	float minY = HUGE_VALF, maxY = -HUGE_VALF;
+	
+	for (i = i0; i <= i1; i++)
+	{
+		for (j = j0; j <= j1; j++)
+		{
+			minY = min(minY, terrain->vertices[i * cols + j].y);
+			maxY = max(maxY, terrain->vertices[i * cols + j].y);
+		}
+	}
+	
+	/* Normals reach one sample further, to the edited samples'
+	 neighbours */
+	for (i = ni0; i <= ni1; i++)
+		for (j = nj0; j <= nj1; j++)
+			terrain->normals[i * cols + j] = calcTerrainNormal(terrain, i, j);
+	
+	/* Chunks only ever grow, which is safe for culling and saves
+	 rescanning them. Samples on a chunk's edge belong to the chunk
+	 before too */
+	for (ci = max(ni0 - 1, 0) / topology->chunkRows;
+		ci <= min(ni1, terrain->rows - 2) / topology->chunkRows; ci++)
+	{
+		for (cj = max(nj0 - 1, 0) / topology->chunkCols;
+			cj <= min(nj1, cols - 2) / topology->chunkCols; cj++)
+		{
+			int c = ci * topology->chunkGridCols + cj;
+			MeshChunk *chunk = &topology->chunks[c];
 			
-			if(j>0){
-				//(i, j-1)
-				vup = terrain->vertices[(i)*terrain->cols+(j-1)];
-			}
+			chunk->min.y = min(chunk->min.y, minY);
+			chunk->max.y = max(chunk->max.y, maxY);
+			chunksEdited[c] = true;
+		}
+	}
+	
+	updateCDLODArea(&terrain->lod, i0, j0, i1, j1);
+	updateHeightPyramid(&terrain->pyramid, i0, j0, i1, j1);
+	
+	/* Patch the changed run of each row into the vertex buffer */
+	if (terrain->vertexBuffer)
+	{
+		int n = nj1 - nj0 + 1;
+		TerrainVertex *row = malloc(n * sizeof(TerrainVertex));
+		
+		glBindBuffer(GL_ARRAY_BUFFER, terrain->vertexBuffer);
+		for (i = ni0; i <= ni1; i++)
+		{
+			interleaveTerrainVertices(terrain, i * cols + nj0, n, row);
+			glBufferSubData(GL_ARRAY_BUFFER, (i * cols + nj0) * sizeof(TerrainVertex),
+				n * sizeof(TerrainVertex), row);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		free(row);
+	}
+}
+
+/* Rebuilds everything derived from the heights over the whole
+ terrain, for when most of it has been edited */
+static void rebuildTerrain(Terrain *terrain)
+{
+	int c;
+	float tolerance = terrain->lod.tolerance;
+	
+	calcTerrainNormals(terrain);
+	parallelFor(0, terrain->topology.nChunks / terrain->topology.chunkGridCols, 1, fitTerrainChunkRows, terrain);
+	releaseCDLODGL(&terrain->lod);
+	cleanupCDLOD(&terrain->lod);
+	initCDLOD(&terrain->lod, terrain->vertices, terrain->normals, terrain->rows, terrain->cols,
+		terrain->size, tolerance);
+	cleanupHeightPyramid(&terrain->pyramid);
+	initHeightPyramid(&terrain->pyramid, terrain->vertices, terrain->rows, terrain->cols);
+	cleanupCoastField(&terrain->coast);
+	cancelCoastUpdate(&terrain->coastUpdate);
+	initCoastField(&terrain->coast, terrain->vertices, terrain->rows, terrain->cols,
+		terrainCoastStride(terrain), TERRAIN_WATER_LEVEL, TERRAIN_COAST_BAND);
+	
+	if (terrain->vertexBuffer)
+	{
+		TerrainVertex *interleaved = malloc(terrain->nVertices * sizeof(TerrainVertex));
+		
+		interleaveTerrainVertices(terrain, 0, terrain->nVertices, interleaved);
+		glBindBuffer(GL_ARRAY_BUFFER, terrain->vertexBuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, terrain->nVertices * sizeof(TerrainVertex), interleaved);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		free(interleaved);
+	}
+	if (terrain->displayLists)
+	{
+		for (c = 0; c < terrain->topology.nChunks; c++)
+			compileTerrainList(terrain, c);
+	}
+	
+	memset(terrain->editTiles, 0, terrain->editTileRows * terrain->editTileCols);
+	memset(terrain->coastTiles, 0, terrain->editTileRows * terrain->editTileCols);
+	terrain->coastPending = 0;
+	terrain->coastUpdating = 0;
+	terrain->edited = false;
+}
+
+/* Samples [i0, i1] x [j0, j1] of edit tile (ti, tj) */
+static void editTileRect(const Terrain *terrain, int ti, int tj, int *i0, int *j0, int *i1, int *j1)
+{
+	*i0 = ti * TERRAIN_EDIT_TILE;
+	*j0 = tj * TERRAIN_EDIT_TILE;
+	*i1 = min(*i0 + TERRAIN_EDIT_TILE, terrain->rows) - 1;
+	*j1 = min(*j0 + TERRAIN_EDIT_TILE, terrain->cols) - 1;
+}
+
+/* Starts updating the coast field for the pending shore tiles. Nearby
+ tiles are cheaper done together in one box, far apart ones cheaper
+ done on their own, one per update */
+static void beginTerrainCoast(Terrain *terrain)
+{
+	int ti, tj, i0, j0, i1, j1, first = -1;
+	int si0 = terrain->rows, sj0 = terrain->cols, si1 = -1, sj1 = -1;
+	int nTiles = terrain->editTileRows * terrain->editTileCols;
+	double tileCost = 0.0;
+	
+	for (ti = 0; ti < terrain->editTileRows; ti++)
+	{
+		for (tj = 0; tj < terrain->editTileCols; tj++)
+		{
+			if (!terrain->coastTiles[ti * terrain->editTileCols + tj])
+				continue;
+			if (first < 0)
+				first = ti * terrain->editTileCols + tj;
+			editTileRect(terrain, ti, tj, &i0, &j0, &i1, &j1);
+			tileCost += coastUpdateCost(&terrain->coast, i0, j0, i1, j1);
+			si0 = min(si0, i0);
+			sj0 = min(sj0, j0);
+			si1 = max(si1, i1);
+			sj1 = max(sj1, j1);
+		}
+	}
+	
+	if (coastUpdateCost(&terrain->coast, si0, sj0, si1, sj1) <= tileCost)
+	{
+		beginCoastUpdate(&terrain->coast, terrain->vertices, si0, sj0, si1, sj1, &terrain->coastUpdate);
+		terrain->coastUpdating = 0;
+		for (ti = 0; ti < nTiles; ti++)
+			terrain->coastUpdating += terrain->coastTiles[ti];
+		memset(terrain->coastTiles, 0, nTiles);
+	}
+	else
+	{
+		editTileRect(terrain, first / terrain->editTileCols, first % terrain->editTileCols, &i0, &j0, &i1, &j1);
+		beginCoastUpdate(&terrain->coast, terrain->vertices, i0, j0, i1, j1, &terrain->coastUpdate);
+		terrain->coastUpdating = 1;
+		terrain->coastTiles[first] = 0;
+	}
+}
+
+/* Carries on updating the coast field around the pending shore tiles
+ until TERRAIN_COAST_BUDGET samples have been read. Tiles edited again
+ while their update is under way are pending again, and done after */
+static void updateTerrainCoast(Terrain *terrain)
+{
+	double budget = TERRAIN_COAST_BUDGET;
+	
+	while (budget > 0.0 && terrain->coastPending > 0)
+	{
+		if (!terrain->coastUpdate.land)
+			beginTerrainCoast(terrain);
+		if (continueCoastUpdate(&terrain->coast, &terrain->coastUpdate, &budget))
+		{
+			terrain->coastPending -= terrain->coastUpdating;
+			terrain->coastUpdating = 0;
+		}
+	}
+}
+
+void flushTerrainEdits(Terrain *terrain)
+{
+	int ti, tj, c, nEdited;
+	bool *chunksEdited;
+	
+	if (!terrain->edited)
+	{
+		updateTerrainCoast(terrain);
+		return;
+	}
+	
+	nEdited = 0;
+	for (ti = 0; ti < terrain->editTileRows * terrain->editTileCols; ti++)
+		nEdited += terrain->editTiles[ti] != TERRAIN_EDIT_NONE;
+	if (nEdited > TERRAIN_EDIT_REBUILD_SHARE * terrain->editTileRows * terrain->editTileCols)
+	{
+		rebuildTerrain(terrain);
+		return;
+	}
+	
+	chunksEdited = calloc(max(terrain->topology.nChunks, 1), sizeof(bool));
+	
+	/* Runs of edited tiles along a row are flushed as one rect, a
+	 crater spans a few and the quadtree's coarse levels reach well
+	 past each tile */
+	for (ti = 0; ti < terrain->editTileRows; ti++)
+	{
+		for (tj = 0; tj < terrain->editTileCols; tj++)
+		{
+			int index = ti * terrain->editTileCols + tj, run;
+			int i0, j0, i1, j1, ri0, rj0;
 			
-			if(i<terrain->rows){
-				//(i+1, j)
-				vright = terrain->vertices[(i+1)*terrain->cols+(j)];
+			if (terrain->editTiles[index] == TERRAIN_EDIT_NONE)
+				continue;
+			editTileRect(terrain, ti, tj, &ri0, &rj0, &i1, &j1);
+			for (run = tj; run < terrain->editTileCols && terrain->editTiles[index + run - tj] != TERRAIN_EDIT_NONE; run++)
+			{
+				if (terrain->editTiles[index + run - tj] == TERRAIN_EDIT_SHORE && !terrain->coastTiles[index + run - tj])
+				{
+					terrain->coastTiles[index + run - tj] = 1;
+					terrain->coastPending++;
+				}
 			}
-			
-			if(i>0){
-				//(i-1, j)
-				vleft = terrain->vertices[(i-1)*terrain->cols+(j)];
-			}			
-			
-			Vec3f verticalVector = {vup.x - vdown.x, vup.y - vdown.y, vup.z - vdown.z};
-			Vec3f horizontalVector = {vright.x - vleft.x, vright.y - vleft.y, vright.z - vleft.z};
-			
-			Vec3f normal = getCrossProduct(verticalVector, horizontalVector);
-			
-			terrain->normals[index++] = normal;
+			editTileRect(terrain, ti, run - 1, &i0, &j0, &i1, &j1);
+			flushTerrainRect(terrain, ri0, rj0, i1, j1, chunksEdited);
+			tj = run - 1;
 		}
 	}
+	
+	/* The coast field is rebuilt a band or two around each change,
+	 which is the bulk of a flush on fine terrains */
+	updateTerrainCoast(terrain);
+	
+	if (terrain->displayLists)
+	{
+		for (c = 0; c < terrain->topology.nChunks; c++)
+			if (chunksEdited[c])
+				compileTerrainList(terrain, c);
+	}
+	
+	memset(terrain->editTiles, 0, terrain->editTileRows * terrain->editTileCols);
+	terrain->edited = false;
+	free(chunksEdited);
 }
 
 Vec3f getCrossProduct(Vec3f a, Vec3f b){
@@ -211,6 +1035,78 @@ Vec3f getCrossProduct(Vec3f a, Vec3f b){
 	return normal;
 }
 
+/* Noise the world's tiles are sampled from */
+typedef struct
+{
+	Noise noise;
+	NoiseKernel kernel;
+} WorldSource;
+
+static void worldHeightRow(float x, const float *z, float *out, int n, void *data)
+{
+	const WorldSource *source = data;
+	int k;
+	
+	source->kernel(&source->noise, x, z, out, n);
+	for (k = 0; k < n; k++)
+		out[k] = TERRAIN_WORLD_DEPTH + TERRAIN_WORLD_RELIEF * out[k];
+}
+
+bool openTerrainWorld(TerrainTiles *tiles, int tilesPerSide, size_t budget)
+{
+	/* Tiles are rebuilt when anything they're made from changes */
+	float params[] = { TERRAIN_WORLD_SPACING, TERRAIN_WORLD_DEPTH, TERRAIN_WORLD_RELIEF, TERRAIN_WORLD_OCTAVES,
+		TERRAIN_WORLD_FREQUENCY, TERRAIN_WORLD_LACUNARITY, TERRAIN_WORLD_GAIN, NOISE_DEFAULT_SEED };
+	const unsigned char *bytes = (const unsigned char *)params;
+	unsigned int key = 2166136261u;
+	char filename[256];
+	WorldSource source;
+	size_t i;
+	
+	for (i = 0; i < sizeof(params); i++)
+		key = (key ^ bytes[i]) * 16777619u;
+	snprintf(filename, sizeof(filename), TERRAIN_WORLD_FILE, tilesPerSide);
+	if (openTerrainTiles(tiles, filename, key, budget))
+		return true;
+	
+	initNoise(&source.noise, NOISE_DEFAULT_SEED, TERRAIN_WORLD_OCTAVES, TERRAIN_WORLD_FREQUENCY,
+		TERRAIN_WORLD_LACUNARITY, TERRAIN_WORLD_GAIN);
+	source.kernel = selectNoiseKernel(0);
+	return buildTerrainTiles(filename, tilesPerSide, TERRAIN_WORLD_SPACING, key, worldHeightRow, &source) &&
+		openTerrainTiles(tiles, filename, key, budget);
+}
+
+static void *openWorldMain(void *arg)
+{
+	TerrainWorldOpener *opener = arg;
+	
+	if (openTerrainWorld(opener->tiles, opener->tilesPerSide, opener->budget))
+		__atomic_store_n(&opener->opened, 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&opener->opening, 0, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+void startTerrainWorldOpen(TerrainWorldOpener *opener, TerrainTiles *tiles, int tilesPerSide, size_t budget)
+{
+	pthread_t thread;
+	
+	if (__atomic_load_n(&opener->opened, __ATOMIC_ACQUIRE) ||
+		__atomic_exchange_n(&opener->opening, 1, __ATOMIC_ACQ_REL))
+		return;
+	opener->tiles = tiles;
+	opener->tilesPerSide = tilesPerSide;
+	opener->budget = budget;
+	if (pthread_create(&thread, NULL, openWorldMain, opener) == 0)
+		pthread_detach(thread);
+	else
+		__atomic_store_n(&opener->opening, 0, __ATOMIC_RELEASE);
+}
+
+bool terrainWorldOpened(const TerrainWorldOpener *opener)
+{
+	return __atomic_load_n(&opener->opened, __ATOMIC_ACQUIRE);
+}
+
 /* Draws normal vectors of the grid as lines, for debugging purposes */
 void drawTerrainNormals(Terrain *terrain, float size)
 {
@@ -240,6 +1136,8 @@ void drawTerrainNormals(Terrain *terrain, float size)
 	glPopAttrib();
 }
 
+/* The value noise the terrain used before noise.h, kept to compare
+ against (see bench.c) */
 float getNoise(int x, int y){
 	int n;
 	n = x + y * 57;
@@ -6,32 +6,211 @@ extern "C" {
 #endif
 	
 #include "utils.h"
+#include "frustum.h"
+#include "topology.h"
+#include "cdlod.h"
+#include "coast.h"
+#include "raycast.h"
+#include "terrain_cache.h"
+#include "terrain_tiles.h"
+	
+	/* Height of the calm sea, terrain above it is land */
+#define TERRAIN_WATER_LEVEL 0.0f
+	
+	/* Furthest from the shore (GL units) the coast field measures,
+	 anything further away is reported as this far */
+#define TERRAIN_COAST_BAND 16.0f
+	
+	/* Tiles per side of the open sea streamed around the arena, see
+	 openTerrainWorld. At TERRAIN_WORLD_SPACING apart that's about 16
+	 km across */
+#define TERRAIN_WORLD_TILES 64
+#define TERRAIN_WORLD_SPACING 4.0f
+	
+	/* Bytes of the world's tiles kept resident while streaming */
+#define TERRAIN_WORLD_BUDGET (48 << 20)
+	
+	/* Side (in samples) of the tiles edits are tracked in, scattered
+	 edits are flushed tile by tile rather than as one box around
+	 them all */
+#define TERRAIN_EDIT_TILE 32
+	
+	/* Closest (GL units) the coast field's samples are, finer terrains
+	 only give it every few of theirs. Collisions don't need more, and
+	 updating the field costs the square of the band in samples */
+#define TERRAIN_COAST_SPACING 0.5f
+	
+	/* Samples the coast field may read per flushTerrainEdits. Updates
+	 bigger than that carry on over the next flushes, a row or column
+	 at a time */
+#define TERRAIN_COAST_BUDGET (1 << 16)
+	
+	/* State of each edit tile */
+	typedef enum
+	{
+		TERRAIN_EDIT_NONE,
+		TERRAIN_EDIT_HEIGHTS,	/* Heights changed */
+		TERRAIN_EDIT_SHORE	/* And some went from land to water or back */
+	} TerrainEdit;
+	
+	/* Layout of one vertex in the terrain's vertex buffer */
+	typedef struct
+	{
+		Vec3f pos;
+		Vec3f normal;
+		Vec2f texcoord;
+	} TerrainVertex;
+	
+	/* Everything a terrain is generated from besides the heightmap */
+	typedef struct
+	{
+		int rows, cols;		/* Tessellation */
+		float size;		/* Width and depth in GL coords */
+		float heightOffset;	/* Added to the heightmap's 0-255, less 255 */
+		unsigned int seed;	/* Of the noise on top */
+		int octaves;
+	} TerrainParams;
 	
 	/* The Grid struct is used to hold the grid of vertices representing
 	 the waves */
 	typedef struct
 	{
+		TerrainParams params;	/* It was generated from */
 		int rows;		/* No. of vertices per row (tessellation) */
 		int cols;		/* No. of vertices per col (tessellation) */
 		float size;		/* Size of the grid in GL coords (width and height are equal) */
 		int nVertices;		/* Total no. of vertices */
-		int nIndices;		/* Total no. of indices */
 		Vec3f *vertices;	/* 1d array of vertices */
 		Vec3f *normals;		/* 1d array of normal vectors, maps to
 									 locations of vertices */
-		int *indices;	/* 1d array of indices */
+		GridTopology topology;	/* Strips in chunks culled separately */
+		
+		/* Retained mode data. The vertices are interleaved and
+		 uploaded on the first draw, contexts without buffer objects
+		 compile a display list per chunk instead */
+		unsigned int vertexBuffer;
+		unsigned int indexBuffer;
+		unsigned int displayLists;	/* First of nChunks lists */
+		
+		CDLOD lod;		/* Quadtree over the vertices */
+		CoastField coast;	/* Distance to the shore, for collisions */
+		HeightPyramid pyramid;	/* Height ranges, for casting rays */
+		
+		/* The vertices, normals and strips come from this file when
+		 it's mapped, rather than from the heightmap */
+		TerrainCache cache;
+		bool fromCache;
+		double initSeconds;	/* Time initTerrain took */
+		
+		/* Tiles of samples changed by deformTerrain since the last
+		 flush, see TerrainEdit */
+		bool edited;
+		int editTileRows, editTileCols;
+		unsigned char *editTiles;
+		
+		/* Edit tiles whose coast field is still to be updated, and how
+		 many, counting the coastUpdating tiles the update under way
+		 (if coastUpdate.land is set) is for */
+		unsigned char *coastTiles;
+		int coastPending;
+		CoastUpdate coastUpdate;
+		int coastUpdating;
 	} Terrain;
 	
+	/* Opaque thread generating a terrain, see TerrainRebuild */
+	typedef struct _TerrainBuilder TerrainBuilder;
+	
+	/* Regenerates the terrain in the background, e.g. with a new seed
+	 for each match. A whole new Terrain is built on its own thread
+	 (borrowing idle job workers) while the old one is drawn and
+	 collided with, then swapped in at a frame boundary. The old one is
+	 kept a frame, until nothing drawn references it, then its GL
+	 objects are deleted and its memory freed on another thread */
+	typedef struct
+	{
+		TerrainBuilder *builder;	/* The rebuild in flight, if any */
+		Terrain retired;		/* Swapped out last frame */
+		bool hasRetired;
+		int swaps;
+		double buildSeconds;		/* Of the last rebuild, on its thread */
+		double swapSeconds;		/* Of the last swap, on the main thread */
+	} TerrainRebuild;
+	
+	/* Opens the streamed world on a thread of its own (see
+	 openTerrainWorld), since the first run builds its tiles file */
+	typedef struct
+	{
+		TerrainTiles *tiles;
+		int tilesPerSide;
+		size_t budget;
+		int opening;		/* While the thread runs */
+		int opened;		/* Set by the thread once the tiles can be used */
+	} TerrainWorldOpener;
+	
 	/* Initialises a 2d grid of the given size, divided into the given
-	 number of rows and cols */
+	 number of rows and cols, with the default noise */
 	void initTerrain(Terrain *terrain, int rows, int cols, float size, float height_offset);
+	
+	/* The parameters initTerrain uses */
+	void defaultTerrainParams(TerrainParams *params, int rows, int cols, float size, float heightOffset);
+	
+	/* Same as initTerrain with any parameters. Touches no GL state, so
+	 it can run on any thread */
+	void initTerrainWith(Terrain *terrain, const TerrainParams *params);
 		
-	/* Deletes all memory dynamically allocated by initGrid */
+	/* Deletes all memory dynamically allocated by initGrid, and the GL
+	 objects of a terrain that has been drawn, which only the GL thread
+	 can do */
 	void cleanupTerrain(Terrain *terrain);
+	
+	/* Turns the cache of finished terrains on or off (it's on by
+	 default). Terrains are cached in the working directory under a
+	 hash of their tessellation, parameters and seed, a few per
+	 tessellation, and rebuilt when the heightmap or any parameter
+	 changes */
+	void setTerrainCaching(bool enabled);
 			
-	/* Draws a given grid */
+	/* Draws the chunks of the terrain inside the view frustum from
+	 its buffer objects (or display lists), built on the first call */
 	void drawTerrain(Terrain *terrain);
 	
+	/* Same, resubmitting every vertex in immediate mode */
+	void drawTerrainImmediate(Terrain *terrain);
+	
+	/* Draws the terrain with its level of detail chosen per node by
+	 distance from the eye, see cdlod.h */
+	void drawTerrainLOD(Terrain *terrain, Vec3f eye);
+	
+	/* Raises (or with a negative delta lowers) the terrain by up to
+	 delta around (x, z), falling off smoothly to nothing at radius.
+	 Only the heights change, everything derived from them waits for
+	 flushTerrainEdits */
+	void deformTerrain(Terrain *terrain, float x, float z, float radius, float delta);
+	
+	/* Brings the normals, bounds, quadtree, ray pyramid and GL objects
+	 up to date with the edits since the last flush, touching only the
+	 area they covered. The coast field follows reading no more than
+	 TERRAIN_COAST_BUDGET samples a flush, so after shore edits it can
+	 lag a few flushes behind. Call once a frame */
+	void flushTerrainEdits(Terrain *terrain);
+	
+	/* Starts building a terrain from params in the background. Returns
+	 false if a rebuild is still in flight */
+	bool requestTerrainRebuild(TerrainRebuild *rebuild, const TerrainParams *params);
+	
+	/* Call at a frame boundary on the GL thread, before anything uses
+	 the terrain: releases the terrain retired by the last swap and, if a
+	 rebuild has finished, swaps it into *terrain. Never waits for the
+	 builder. Returns true if the terrain changed */
+	bool swapRebuiltTerrain(TerrainRebuild *rebuild, Terrain *terrain);
+	
+	/* Whether a rebuild is in flight */
+	bool terrainRebuilding(const TerrainRebuild *rebuild);
+	
+	/* Waits for any rebuild in flight and frees everything but the
+	 terrain in use */
+	void cleanupTerrainRebuild(TerrainRebuild *rebuild);
+	
 	void calcTerrainNormals(Terrain* terrain);
 	
 	Vec3f getCrossProduct(Vec3f vector1, Vec3f vector2);
@@ -42,6 +221,18 @@ extern "C" {
 	float interpolateNoise(float x, float y);
 	float getPerlinNoise(float x, float y, int p, int o);
 	
+	/* Opens the tiles of a tilesPerSide x tilesPerSide world of open
+	 sea, building them from noise first if their file is missing or
+	 out of date. See terrain_tiles.h */
+	bool openTerrainWorld(TerrainTiles *tiles, int tilesPerSide, size_t budget);
+	
+	/* Starts opening the world into tiles in the background, unless
+	 it's open or opening already. A failed open can be started again */
+	void startTerrainWorldOpen(TerrainWorldOpener *opener, TerrainTiles *tiles, int tilesPerSide, size_t budget);
+	
+	/* Whether the world has opened, its tiles can be used once it has */
+	bool terrainWorldOpened(const TerrainWorldOpener *opener);
+	
 	/* Draws normal vectors of the grid as lines, for debugging
 	 purposes */
 	void drawTerrainNormals(Terrain *terrain, float size);
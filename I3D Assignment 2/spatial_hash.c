@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "spatial_hash.h"
+
+/* Fewest buckets a hash has */
+#define SPATIAL_HASH_MIN_BUCKETS 64
+
+/* Mixes a cell's coordinates into a bucket */
+static int cellBucket(const SpatialHash *hash, int cellX, int cellZ)
+{
+	unsigned int h = (unsigned int)cellX * 73856093u ^ (unsigned int)cellZ * 19349663u;
+
+	return (int)(h & (unsigned int)(hash->nBuckets - 1));
+}
+
+static int cellOf(const SpatialHash *hash, float v)
+{
+	return (int)floorf(v / hash->cellSize);
+}
+
+void initSpatialHash(SpatialHash *hash, float cellSize)
+{
+	memset(hash, 0, sizeof(*hash));
+	hash->cellSize = cellSize;
+}
+
+void cleanupSpatialHash(SpatialHash *hash)
+{
+	free(hash->starts);
+	free(hash->sorted);
+	free(hash->cellX);
+	free(hash->cellZ);
+	free(hash->bucket);
+	initSpatialHash(hash, hash->cellSize);
+}
+
+void buildSpatialHash(SpatialHash *hash, const float *x, const float *z, int stride, int n)
+{
+	int i, b, nBuckets = SPATIAL_HASH_MIN_BUCKETS;
+
+	if (n > hash->objectCapacity)
+	{
+		hash->objectCapacity = max(n, hash->objectCapacity * 2);
+		hash->sorted = realloc(hash->sorted, hash->objectCapacity * sizeof(int));
+		hash->cellX = realloc(hash->cellX, hash->objectCapacity * sizeof(int));
+		hash->cellZ = realloc(hash->cellZ, hash->objectCapacity * sizeof(int));
+		hash->bucket = realloc(hash->bucket, hash->objectCapacity * sizeof(int));
+	}
+	while (nBuckets < n * 2)
+		nBuckets *= 2;
+	if (nBuckets != hash->nBuckets)
+	{
+		hash->nBuckets = nBuckets;
+		hash->starts = realloc(hash->starts, (nBuckets + 1) * sizeof(int));
+	}
+	hash->nObjects = n;
+
+	/* Count each bucket's objects */
+	memset(hash->starts, 0, (nBuckets + 1) * sizeof(int));
+	for (i = 0; i < n; i++)
+	{
+		hash->cellX[i] = cellOf(hash, x[(size_t)i * stride]);
+		hash->cellZ[i] = cellOf(hash, z[(size_t)i * stride]);
+		hash->bucket[i] = cellBucket(hash, hash->cellX[i], hash->cellZ[i]);
+		hash->starts[hash->bucket[i]]++;
+	}
+
+	/* Running totals make them the ends of the buckets, which placing
+	   the objects from the last back turns into the starts */
+	for (b = 1; b <= nBuckets; b++)
+		hash->starts[b] += hash->starts[b - 1];
+	for (i = n - 1; i >= 0; i--)
+		hash->sorted[--hash->starts[hash->bucket[i]]] = i;
+}
+
+/* The distinct buckets of cells [x0, x1] x [z0, z1], up to 3 x 3 */
+static int rangeBuckets(const SpatialHash *hash, int x0, int z0, int x1, int z1, int *buckets)
+{
+	int cx, cz, k, n = 0;
+
+	for (cx = x0; cx <= x1; cx++)
+		for (cz = z0; cz <= z1; cz++)
+		{
+			int b = cellBucket(hash, cx, cz);
+
+			for (k = 0; k < n && buckets[k] != b; k++)
+				;
+			if (k == n)
+				buckets[n++] = b;
+		}
+	return n;
+}
+
+void spatialHashPairs(const SpatialHash *hash, SpatialHashVisit visit, void *data)
+{
+	int s, k, buckets[9];
+
+	for (s = 0; s < hash->nObjects; s++)
+	{
+		int a = hash->sorted[s], cx = hash->cellX[a], cz = hash->cellZ[a];
+		int nBuckets = rangeBuckets(hash, cx - 1, cz - 1, cx + 1, cz + 1, buckets);
+
+		for (k = 0; k < nBuckets; k++)
+		{
+			int t;
+
+			/* Buckets hold other cells too, skip those */
+			for (t = hash->starts[buckets[k]]; t < hash->starts[buckets[k] + 1]; t++)
+			{
+				int b = hash->sorted[t];
+
+				if (b > a && abs(hash->cellX[b] - cx) <= 1 && abs(hash->cellZ[b] - cz) <= 1)
+					visit(a, b, data);
+			}
+		}
+	}
+}
+
+void spatialHashQuery(const SpatialHash *hash, int query, float x, float z, float radius,
+	SpatialHashVisit visit, void *data)
+{
+	int x0 = cellOf(hash, x - radius), z0 = cellOf(hash, z - radius);
+	int x1 = min(cellOf(hash, x + radius), x0 + 2), z1 = min(cellOf(hash, z + radius), z0 + 2);
+	int k, t, nBuckets, buckets[9];
+
+	if (hash->nObjects == 0)
+		return;
+
+	nBuckets = rangeBuckets(hash, x0, z0, x1, z1, buckets);
+	for (k = 0; k < nBuckets; k++)
+		for (t = hash->starts[buckets[k]]; t < hash->starts[buckets[k] + 1]; t++)
+		{
+			int b = hash->sorted[t];
+
+			if (hash->cellX[b] >= x0 && hash->cellX[b] <= x1 && hash->cellZ[b] >= z0 && hash->cellZ[b] <= z1)
+				visit(query, b, data);
+		}
+}
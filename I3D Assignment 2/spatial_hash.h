@@ -0,0 +1,55 @@
+#ifndef SPATIAL_HASH_H
+#define SPATIAL_HASH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "utils.h"
+
+/* Objects bucketed by the square cell of the sea (x, z) they're in,
+   for finding what's near what without testing every pair. Cells are
+   hashed into a power of two buckets, at least twice as many as
+   there are objects, and the objects are counting sorted by bucket,
+   so a rebuild is linear in the objects. Objects only need to be
+   near each other in x and z to be candidates, the caller's tests
+   decide the rest */
+typedef struct
+{
+	float cellSize;
+	int nObjects, objectCapacity;
+	int nBuckets;
+	int *starts;		/* Where each bucket's objects begin in sorted, nBuckets + 1 */
+	int *sorted;		/* Object indices, by bucket and then index */
+	int *cellX, *cellZ;	/* Each object's cell */
+	int *bucket;		/* Each object's bucket */
+} SpatialHash;
+
+/* Called with each candidate pair found */
+typedef void (*SpatialHashVisit)(int a, int b, void *data);
+
+/* Sets the cell size, which should be at least the largest distance
+   anything will be tested at */
+void initSpatialHash(SpatialHash *hash, float cellSize);
+
+void cleanupSpatialHash(SpatialHash *hash);
+
+/* Buckets objects [0, n), object i at (x[i * stride], z[i * stride]).
+   The stride, in floats, lets positions be read straight out of an
+   array of structs */
+void buildSpatialHash(SpatialHash *hash, const float *x, const float *z, int stride, int n);
+
+/* Visits every pair of objects a < b in the same or neighbouring
+   cells once */
+void spatialHashPairs(const SpatialHash *hash, SpatialHashVisit visit, void *data);
+
+/* Visits (query, b) for every object b in the cells within radius of
+   (x, z), where radius is at most the cell size */
+void spatialHashQuery(const SpatialHash *hash, int query, float x, float z, float radius,
+	SpatialHashVisit visit, void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,238 @@
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <glob.h>
+#include <utime.h>
+#include <sys/stat.h>
+#endif
+#include "terrain_cache.h"
+
+/* Start of every cache file */
+#define TERRAIN_CACHE_MAGIC "I3DTERRN"
+
+/* Arrays start on multiples of this, so they're aligned in the map */
+#define TERRAIN_CACHE_ALIGN 64
+
+/* The file starts with this header, the arrays follow at the given
+   offsets */
+typedef struct
+{
+	char magic[8];
+	TerrainCacheKey key;
+	int nVertices, nIndices, nChunks;
+	size_t vertexOffset, normalOffset, indexOffset, chunkOffset;
+	size_t bytes;			/* Of the whole file */
+} TerrainCacheHeader;
+
+static size_t alignOffset(size_t offset)
+{
+	return (offset + TERRAIN_CACHE_ALIGN - 1) / TERRAIN_CACHE_ALIGN * TERRAIN_CACHE_ALIGN;
+}
+
+/* Lays out the arrays after the header */
+static void layoutHeader(TerrainCacheHeader *header, int nVertices, int nIndices, int nChunks)
+{
+	header->nVertices = nVertices;
+	header->nIndices = nIndices;
+	header->nChunks = nChunks;
+	header->vertexOffset = alignOffset(sizeof(TerrainCacheHeader));
+	header->normalOffset = alignOffset(header->vertexOffset + nVertices * sizeof(Vec3f));
+	header->indexOffset = alignOffset(header->normalOffset + nVertices * sizeof(Vec3f));
+	header->chunkOffset = alignOffset(header->indexOffset + nIndices * sizeof(unsigned short));
+	header->bytes = header->chunkOffset + nChunks * sizeof(MeshChunk);
+}
+
+bool makeTerrainCacheKey(TerrainCacheKey *key, const char *heightmap, int rows, int cols,
+	float size, float heightOffset, unsigned int noiseSeed, int noiseOctaves,
+	float noiseFrequency, float noiseLacunarity, float noiseGain, int chunkQuads)
+{
+	size_t bytes, i;
+	const unsigned char *data = mapFile(heightmap, &bytes);
+	unsigned long long hash = 14695981039346656037ULL;
+
+	if (!data)
+		return false;
+	for (i = 0; i < bytes; i++)
+		hash = (hash ^ data[i]) * 1099511628211ULL;
+	unmapFile((void *)data, bytes);
+
+	/* Clear the padding too, keys are compared with memcmp */
+	memset(key, 0, sizeof(*key));
+	key->version = TERRAIN_CACHE_VERSION;
+	key->heightmapHash[0] = (unsigned int)hash;
+	key->heightmapHash[1] = (unsigned int)(hash >> 32);
+	key->rows = rows;
+	key->cols = cols;
+	key->size = size;
+	key->heightOffset = heightOffset;
+	key->noiseSeed = noiseSeed;
+	key->noiseOctaves = noiseOctaves;
+	key->noiseFrequency = noiseFrequency;
+	key->noiseLacunarity = noiseLacunarity;
+	key->noiseGain = noiseGain;
+	key->chunkQuads = chunkQuads;
+	return true;
+}
+
+unsigned int hashTerrainCacheKey(const TerrainCacheKey *key)
+{
+	const unsigned char *bytes = (const unsigned char *)key;
+	unsigned int hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < sizeof(*key); i++)
+		hash = (hash ^ bytes[i]) * 16777619u;
+	return hash;
+}
+
+bool openTerrainCache(TerrainCache *cache, const char *filename, const TerrainCacheKey *key)
+{
+	TerrainCacheHeader expected;
+	const TerrainCacheHeader *header;
+	char *map;
+
+	memset(cache, 0, sizeof(*cache));
+	map = mapFile(filename, &cache->bytes);
+	if (!map)
+		return false;
+
+	/* Anything from another key, version or a truncated write is
+	   thrown away */
+	header = (const TerrainCacheHeader *)map;
+	if (cache->bytes < sizeof(TerrainCacheHeader) ||
+		memcmp(header->magic, TERRAIN_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+		memcmp(&header->key, key, sizeof(*key)) != 0)
+	{
+		unmapFile(map, cache->bytes);
+		return false;
+	}
+	layoutHeader(&expected, header->nVertices, header->nIndices, header->nChunks);
+	if (header->nVertices != key->rows * key->cols || header->bytes != expected.bytes ||
+		header->indexOffset != expected.indexOffset || header->chunkOffset != expected.chunkOffset ||
+		cache->bytes != expected.bytes)
+	{
+		unmapFile(map, cache->bytes);
+		return false;
+	}
+
+	cache->map = map;
+	cache->nVertices = header->nVertices;
+	cache->nIndices = header->nIndices;
+	cache->nChunks = header->nChunks;
+	cache->vertices = (Vec3f *)(map + expected.vertexOffset);
+	cache->normals = (Vec3f *)(map + expected.normalOffset);
+	cache->indices = (unsigned short *)(map + expected.indexOffset);
+	cache->chunks = (MeshChunk *)(map + expected.chunkOffset);
+
+#ifndef _WIN32
+	/* Used now, so pruneTerrainCaches keeps it */
+	utime(filename, NULL);
+#endif
+	return true;
+}
+
+void closeTerrainCache(TerrainCache *cache)
+{
+	unmapFile(cache->map, cache->bytes);
+	memset(cache, 0, sizeof(*cache));
+}
+
+/* Writes bytes then pads the file out to offset */
+static bool writeAt(FILE *file, const void *data, size_t bytes, size_t offset)
+{
+	static const char zeros[TERRAIN_CACHE_ALIGN];
+	long at = ftell(file);
+
+	if (at < 0 || (size_t)at > offset || fwrite(zeros, 1, offset - at, file) != offset - at)
+		return false;
+	return fwrite(data, 1, bytes, file) == bytes;
+}
+
+bool writeTerrainCache(const char *filename, const TerrainCacheKey *key, const Vec3f *vertices,
+	const Vec3f *normals, int nVertices, const GridTopology *topology)
+{
+	TerrainCacheHeader header;
+	char temp[1024];
+	FILE *file;
+	bool ok;
+
+	snprintf(temp, sizeof(temp), "%s.tmp", filename);
+	file = fopen(temp, "wb");
+	if (!file)
+		return false;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TERRAIN_CACHE_MAGIC, sizeof(header.magic));
+	header.key = *key;
+	layoutHeader(&header, nVertices, topology->nIndices, topology->nChunks);
+
+	ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		writeAt(file, vertices, nVertices * sizeof(Vec3f), header.vertexOffset) &&
+		writeAt(file, normals, nVertices * sizeof(Vec3f), header.normalOffset) &&
+		writeAt(file, topology->indices, topology->nIndices * sizeof(unsigned short), header.indexOffset) &&
+		writeAt(file, topology->chunks, topology->nChunks * sizeof(MeshChunk), header.chunkOffset);
+	ok = fclose(file) == 0 && ok;
+
+	/* rename only replaces an existing file atomically on POSIX */
+#ifdef _WIN32
+	if (ok)
+		remove(filename);
+#endif
+	if (!ok || rename(temp, filename) != 0)
+	{
+		remove(temp);
+		return false;
+	}
+	return true;
+}
+
+#ifndef _WIN32
+/* A cache file found by pruneTerrainCaches */
+typedef struct
+{
+	time_t used;
+	size_t path;		/* Into the glob's paths */
+} CacheFile;
+
+/* Most recently used first */
+static int compareCacheFiles(const void *a, const void *b)
+{
+	time_t ta = ((const CacheFile *)a)->used, tb = ((const CacheFile *)b)->used;
+
+	return (ta < tb) - (ta > tb);
+}
+#endif
+
+void pruneTerrainCaches(const char *pattern, int keep)
+{
+#ifndef _WIN32
+	glob_t found;
+	CacheFile *files;
+	struct stat info;
+	size_t i, n = 0;
+
+	if (glob(pattern, 0, NULL, &found) != 0)
+		return;
+
+	files = malloc(found.gl_pathc * sizeof(CacheFile));
+	for (i = 0; i < found.gl_pathc; i++)
+		if (stat(found.gl_pathv[i], &info) == 0)
+		{
+			files[n].used = info.st_mtime;
+			files[n].path = i;
+			n++;
+		}
+	qsort(files, n, sizeof(CacheFile), compareCacheFiles);
+	for (i = keep > 0 ? (size_t)keep : 0; i < n; i++)
+		remove(found.gl_pathv[files[i].path]);
+
+	free(files);
+	globfree(&found);
+#else
+	(void)pattern;
+	(void)keep;
+#endif
+}
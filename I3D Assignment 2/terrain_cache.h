@@ -0,0 +1,72 @@
+#ifndef TERRAIN_CACHE_H
+#define TERRAIN_CACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "utils.h"
+#include "topology.h"
+
+/* Bump whenever the file layout or the way the terrain is generated
+   changes, so caches from older builds are rebuilt */
+#define TERRAIN_CACHE_VERSION 2
+
+/* Everything the finished terrain depends on. A cache is only used if
+   its key matches byte for byte */
+typedef struct
+{
+	unsigned int version;
+	unsigned int heightmapHash[2];	/* 64 bit FNV-1a of the file */
+	int rows, cols;
+	float size, heightOffset;
+	unsigned int noiseSeed;
+	int noiseOctaves;
+	float noiseFrequency, noiseLacunarity, noiseGain;
+	int chunkQuads;
+} TerrainCacheKey;
+
+/* A cache file mapped into memory. The arrays point straight into the
+   mapping, which is copy-on-write: they can be changed, but must not
+   be freed */
+typedef struct
+{
+	void *map;
+	size_t bytes;
+	int nVertices, nIndices, nChunks;
+	Vec3f *vertices;
+	Vec3f *normals;
+	unsigned short *indices;	/* The terrain's strips */
+	MeshChunk *chunks;		/* With their bounds */
+} TerrainCache;
+
+/* Hashes the heightmap and fills in the key. Returns false if the
+   heightmap can't be read */
+bool makeTerrainCacheKey(TerrainCacheKey *key, const char *heightmap, int rows, int cols,
+	float size, float heightOffset, unsigned int noiseSeed, int noiseOctaves,
+	float noiseFrequency, float noiseLacunarity, float noiseGain, int chunkQuads);
+
+/* A hash of the whole key, for naming its file */
+unsigned int hashTerrainCacheKey(const TerrainCacheKey *key);
+
+/* Maps the cache file if it exists, is intact and was written with
+   the same key. Returns false otherwise, leaving cache->map NULL */
+bool openTerrainCache(TerrainCache *cache, const char *filename, const TerrainCacheKey *key);
+
+/* Deletes all but the keep most recently written or opened of the
+   files matching the glob pattern. Does nothing on Windows */
+void pruneTerrainCaches(const char *pattern, int keep);
+
+/* Unmaps the file */
+void closeTerrainCache(TerrainCache *cache);
+
+/* Writes the finished terrain under the key, replacing the file in
+   one step so a half written cache is never opened */
+bool writeTerrainCache(const char *filename, const TerrainCacheKey *key, const Vec3f *vertices,
+	const Vec3f *normals, int nVertices, const GridTopology *topology);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,854 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "terrain_tiles.h"
+#include "jobs.h"
+#include "buffers.h"
+#include "frustum.h"
+#include "gl.h"
+
+/* Start of every tile file */
+#define TERRAIN_TILES_MAGIC "I3DTILES"
+
+/* The header and every tile start on multiples of this */
+#define TERRAIN_TILES_ALIGN 64
+
+/* Samples per side of a tile with its apron: one more sample all the
+   way round, so normals along the edges match the next tile's */
+#define TILE_APRON_SAMPLES (TERRAIN_TILE_SAMPLES + 2)
+
+/* Tiles start with their bounds, padded to this, then the heights */
+#define TILE_HEADER_BYTES TERRAIN_TILES_ALIGN
+
+/* Vertices per side of a tile's mesh, the samples plus a skirt */
+#define TILE_MESH_VERTICES (TERRAIN_TILE_SAMPLES + 2)
+
+/* Skirts hang this many of the tile's sample spacings below its
+   edges, hiding the cracks where tiles of different levels meet */
+#define TILE_SKIRT_SPACINGS 4.0f
+
+/* Fewest slots whatever the budget: the pinned tile and the tiles
+   around one viewer at a couple of levels */
+#define TERRAIN_TILES_MIN_SLOTS 32
+
+/* Most newly loaded tiles sent to buffer objects per draw, so a burst
+   of loads is spread over frames. The rest draw from memory */
+#define TERRAIN_TILE_UPLOADS_PER_DRAW 4
+
+/* The file starts with this header, then each level's tiles follow
+   row by row */
+typedef struct
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int key;
+	int tileQuads;
+	int nLevels;
+	int tilesPerSide;
+	float spacing;
+	float originX, originZ;
+	size_t levelOffset[TERRAIN_TILES_MAX_LEVELS];
+	size_t tileBytes;
+	size_t bytes;			/* Of the whole file */
+} TerrainTilesHeader;
+
+/* Start of each tile in the file */
+typedef struct
+{
+	float minY, maxY;		/* Over the samples, not the apron */
+} TileHeader;
+
+struct _TileLoader
+{
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	bool quit;
+	int *queue;			/* Slots waiting to load */
+	int nQueued;
+	TerrainTiles *tiles;
+};
+
+/* A tile wanted this frame */
+typedef struct
+{
+	int level, i, j;
+	float priority;
+} WantedTile;
+
+/* Shared state for the jobs building one row of tiles */
+typedef struct
+{
+	int level, row;
+	float spacing, originX, originZ;
+	size_t tileBytes;
+	char *out;			/* The row's tiles, as in the file */
+	TileHeightFunc height;
+	void *data;
+} TileBuildJob;
+
+static size_t alignOffset(size_t offset)
+{
+	return (offset + TERRAIN_TILES_ALIGN - 1) / TERRAIN_TILES_ALIGN * TERRAIN_TILES_ALIGN;
+}
+
+static int tilesAtLevel(int tilesPerSide, int level)
+{
+	return max(tilesPerSide >> level, 1);
+}
+
+/* Lays out the levels after the header */
+static void layoutHeader(TerrainTilesHeader *header, int tilesPerSide)
+{
+	int l, side;
+	size_t offset = alignOffset(sizeof(TerrainTilesHeader));
+
+	header->tileQuads = TERRAIN_TILE_QUADS;
+	header->tilesPerSide = tilesPerSide;
+	header->tileBytes = alignOffset(TILE_HEADER_BYTES + TILE_APRON_SAMPLES * TILE_APRON_SAMPLES * sizeof(float));
+	header->nLevels = 0;
+	memset(header->levelOffset, 0, sizeof(header->levelOffset));
+	for (l = 0; l < TERRAIN_TILES_MAX_LEVELS; l++)
+	{
+		side = tilesAtLevel(tilesPerSide, l);
+		header->levelOffset[l] = offset;
+		header->nLevels = l + 1;
+		offset += (size_t)side * side * header->tileBytes;
+		if (side == 1)
+			break;
+	}
+	header->bytes = offset;
+}
+
+/* Samples the tiles [begin, end) of one row of a level, with their
+   aprons */
+static void buildTileRange(int begin, int end, void *data)
+{
+	TileBuildJob *job = data;
+	float step = job->spacing * (1 << job->level);
+	float z[TILE_APRON_SAMPLES];
+	int t, i, j;
+
+	for (t = begin; t < end; t++)
+	{
+		char *tile = job->out + t * job->tileBytes;
+		TileHeader *header = (TileHeader *)tile;
+		float *heights = (float *)(tile + TILE_HEADER_BYTES);
+
+		for (j = 0; j < TILE_APRON_SAMPLES; j++)
+			z[j] = job->originZ + (t * TERRAIN_TILE_QUADS + j - 1) * step;
+		for (i = 0; i < TILE_APRON_SAMPLES; i++)
+		{
+			float x = job->originX + (job->row * TERRAIN_TILE_QUADS + i - 1) * step;
+			job->height(x, z, heights + i * TILE_APRON_SAMPLES, TILE_APRON_SAMPLES, job->data);
+		}
+
+		header->minY = HUGE_VALF;
+		header->maxY = -HUGE_VALF;
+		for (i = 1; i <= TERRAIN_TILE_SAMPLES; i++)
+		{
+			for (j = 1; j <= TERRAIN_TILE_SAMPLES; j++)
+			{
+				header->minY = min(header->minY, heights[i * TILE_APRON_SAMPLES + j]);
+				header->maxY = max(header->maxY, heights[i * TILE_APRON_SAMPLES + j]);
+			}
+		}
+	}
+}
+
+bool buildTerrainTiles(const char *filename, int tilesPerSide, float spacing, unsigned int key,
+	TileHeightFunc height, void *data)
+{
+	static const char zeros[TERRAIN_TILES_ALIGN];
+	TerrainTilesHeader header;
+	TileBuildJob job;
+	char temp[1024];
+	FILE *file;
+	bool ok;
+	int l, row, side;
+
+	if (tilesPerSide < 1 || (tilesPerSide & (tilesPerSide - 1)) != 0 ||
+		tilesPerSide > 1 << (TERRAIN_TILES_MAX_LEVELS - 1))
+		return false;
+
+	snprintf(temp, sizeof(temp), "%s.tmp", filename);
+	file = fopen(temp, "wb");
+	if (!file)
+		return false;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TERRAIN_TILES_MAGIC, sizeof(header.magic));
+	header.version = TERRAIN_TILES_VERSION;
+	header.key = key;
+	header.spacing = spacing;
+	header.originX = header.originZ = -0.5f * tilesPerSide * TERRAIN_TILE_QUADS * spacing;
+	layoutHeader(&header, tilesPerSide);
+
+	ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(zeros, 1, header.levelOffset[0] - sizeof(header), file) == header.levelOffset[0] - sizeof(header);
+
+	/* One row of tiles in memory at a time, its tiles sampled in
+	   parallel */
+	job.spacing = spacing;
+	job.originX = header.originX;
+	job.originZ = header.originZ;
+	job.tileBytes = header.tileBytes;
+	job.height = height;
+	job.data = data;
+	job.out = calloc(tilesPerSide, header.tileBytes);
+	for (l = 0; l < header.nLevels && ok; l++)
+	{
+		side = tilesAtLevel(tilesPerSide, l);
+		job.level = l;
+		for (row = 0; row < side && ok; row++)
+		{
+			job.row = row;
+			parallelFor(0, side, 1, buildTileRange, &job);
+			ok = fwrite(job.out, header.tileBytes, side, file) == (size_t)side;
+		}
+	}
+	free(job.out);
+	ok = fclose(file) == 0 && ok;
+
+	/* rename only replaces an existing file atomically on POSIX */
+#ifdef _WIN32
+	if (ok)
+		remove(filename);
+#endif
+	if (!ok || rename(temp, filename) != 0)
+	{
+		remove(temp);
+		return false;
+	}
+	return true;
+}
+
+/* Bytes a resident tile costs: its mapped pages and its vertices, in
+   memory until uploaded and on the GPU after */
+static size_t tileFootprint(const TerrainTiles *tiles)
+{
+	return tiles->tileBytes + TILE_MESH_VERTICES * TILE_MESH_VERTICES * sizeof(TerrainTileVertex);
+}
+
+/* Height of sample (i, j) of a tile, -1 and TERRAIN_TILE_SAMPLES
+   reach into the apron */
+static float tileHeight(const TerrainTile *tile, int i, int j)
+{
+	return tile->heights[(i + 1) * TILE_APRON_SAMPLES + (j + 1)];
+}
+
+/* Builds the vertices of a loaded tile, the samples with a ring of
+   skirt vertices under its edges */
+static void meshTile(const TerrainTiles *tiles, TerrainTile *tile)
+{
+	float step = tiles->spacing * (1 << tile->level);
+	float skirt = TILE_SKIRT_SPACINGS * step;
+	int vi, vj;
+
+	for (vi = 0; vi < TILE_MESH_VERTICES; vi++)
+	{
+		int i = clamp(vi - 1, 0, TERRAIN_TILE_SAMPLES - 1);
+
+		for (vj = 0; vj < TILE_MESH_VERTICES; vj++)
+		{
+			int j = clamp(vj - 1, 0, TERRAIN_TILE_SAMPLES - 1);
+			TerrainTileVertex *v = &tile->verts[vi * TILE_MESH_VERTICES + vj];
+			float dx = (tileHeight(tile, i + 1, j) - tileHeight(tile, i - 1, j)) / (2.0f * step);
+			float dz = (tileHeight(tile, i, j + 1) - tileHeight(tile, i, j - 1)) / (2.0f * step);
+			float length = sqrtf(dx * dx + 1.0f + dz * dz);
+			bool edge = vi != i + 1 || vj != j + 1;
+
+			v->pos.x = tiles->originX + (tile->i * TERRAIN_TILE_QUADS + i) * step;
+			v->pos.y = tileHeight(tile, i, j) - (edge ? skirt : 0.0f);
+			v->pos.z = tiles->originZ + (tile->j * TERRAIN_TILE_QUADS + j) * step;
+			v->normal = cVec3f(-dx / length, 1.0f / length, -dz / length);
+			v->texcoord.x = i / (float)TERRAIN_TILE_QUADS;
+			v->texcoord.y = j / (float)TERRAIN_TILE_QUADS;
+		}
+	}
+}
+
+/* Maps and meshes a tile, outside the lock. Returns false if it
+   couldn't be read */
+static bool loadTile(const TerrainTiles *tiles, TerrainTile *tile)
+{
+	int side = tilesAtLevel(tiles->tilesPerSide, tile->level);
+	size_t offset = tiles->levelOffset[tile->level] + ((size_t)tile->i * side + tile->j) * tiles->tileBytes;
+	const TileHeader *header;
+
+	tile->map = mapFileRange(tiles->filename, offset, tiles->tileBytes);
+	if (!tile->map)
+		return false;
+	tile->mapBytes = tiles->tileBytes;
+	header = tile->map;
+	tile->minY = header->minY;
+	tile->maxY = header->maxY;
+	tile->heights = (const float *)((const char *)tile->map + TILE_HEADER_BYTES);
+
+	tile->verts = malloc(TILE_MESH_VERTICES * TILE_MESH_VERTICES * sizeof(TerrainTileVertex));
+	meshTile(tiles, tile);
+	return true;
+}
+
+/* Forgets a slot was the home of the tile it last held. Only the
+   main thread touches the resident index */
+static void clearResident(TerrainTiles *tiles, int slot)
+{
+	const TerrainTile *tile = &tiles->slots[slot];
+	int *resident = &tiles->resident[tile->level][tile->i * tilesAtLevel(tiles->tilesPerSide, tile->level) + tile->j];
+
+	if (*resident == slot)
+		*resident = -1;
+}
+
+/* Releases whatever a slot holds and frees it, with the lock held */
+static void releaseTile(TerrainTiles *tiles, int slot)
+{
+	TerrainTile *tile = &tiles->slots[slot];
+	int side = tilesAtLevel(tiles->tilesPerSide, tile->level);
+
+	if (tile->state == TILE_READY)
+	{
+		size_t offset = tiles->levelOffset[tile->level] + ((size_t)tile->i * side + tile->j) * tiles->tileBytes;
+
+		unmapFileRange(tile->map, offset, tile->mapBytes);
+		free(tile->verts);
+		if (tile->vertexBuffer)
+			glDeleteBuffers(1, &tile->vertexBuffer);
+		tiles->stats.residentTiles--;
+		tiles->stats.residentBytes -= tileFootprint(tiles);
+	}
+	clearResident(tiles, slot);
+
+	tile->map = NULL;
+	tile->heights = NULL;
+	tile->verts = NULL;
+	tile->vertexBuffer = 0;
+	__atomic_store_n(&tile->state, TILE_FREE, __ATOMIC_RELEASE);
+}
+
+/* Loads queued tiles, most urgent first, until told to quit */
+static void *runLoader(void *data)
+{
+	TileLoader *loader = data;
+	TerrainTiles *tiles = loader->tiles;
+
+	pthread_mutex_lock(&loader->lock);
+	while (!loader->quit)
+	{
+		int k, best = 0, slot;
+		TerrainTile *tile;
+		bool loaded;
+
+		if (loader->nQueued == 0)
+		{
+			pthread_cond_wait(&loader->wake, &loader->lock);
+			continue;
+		}
+
+		for (k = 1; k < loader->nQueued; k++)
+		{
+			if (tiles->slots[loader->queue[k]].priority < tiles->slots[loader->queue[best]].priority)
+				best = k;
+		}
+		slot = loader->queue[best];
+		loader->queue[best] = loader->queue[--loader->nQueued];
+		tile = &tiles->slots[slot];
+		__atomic_store_n(&tile->state, TILE_LOADING, __ATOMIC_RELEASE);
+
+		pthread_mutex_unlock(&loader->lock);
+		loaded = loadTile(tiles, tile);
+		pthread_mutex_lock(&loader->lock);
+
+		if (loaded)
+		{
+			tiles->stats.loads++;
+			tiles->stats.residentTiles++;
+			tiles->stats.residentBytes += tileFootprint(tiles);
+			tiles->stats.peakBytes = max(tiles->stats.peakBytes, tiles->stats.residentBytes);
+			__atomic_store_n(&tile->state, TILE_READY, __ATOMIC_RELEASE);
+		}
+		else
+		{
+			/* The main thread sees it free and asks again */
+			__atomic_store_n(&tile->state, TILE_FREE, __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&loader->lock);
+	return NULL;
+}
+
+bool openTerrainTiles(TerrainTiles *tiles, const char *filename, unsigned int key, size_t budget)
+{
+	TerrainTilesHeader header, expected;
+	FILE *file = fopen(filename, "rb");
+	long bytes;
+	int l, s;
+
+	memset(tiles, 0, sizeof(*tiles));
+	if (!file)
+		return false;
+
+	/* Anything from another key, version or a truncated write is
+	   refused */
+	if (fread(&header, sizeof(header), 1, file) != 1 || fseek(file, 0, SEEK_END) != 0)
+		header.version = 0;
+	bytes = ftell(file);
+	fclose(file);
+	if (header.version != TERRAIN_TILES_VERSION || memcmp(header.magic, TERRAIN_TILES_MAGIC, sizeof(header.magic)) != 0 ||
+		header.key != key || header.tilesPerSide < 1 || (header.tilesPerSide & (header.tilesPerSide - 1)) != 0 ||
+		header.tilesPerSide > 1 << (TERRAIN_TILES_MAX_LEVELS - 1))
+		return false;
+	layoutHeader(&expected, header.tilesPerSide);
+	if (header.tileQuads != TERRAIN_TILE_QUADS || header.nLevels != expected.nLevels ||
+		header.tileBytes != expected.tileBytes || header.bytes != expected.bytes ||
+		memcmp(header.levelOffset, expected.levelOffset, sizeof(header.levelOffset)) != 0 ||
+		bytes < 0 || (size_t)bytes != expected.bytes)
+		return false;
+
+	snprintf(tiles->filename, sizeof(tiles->filename), "%s", filename);
+	tiles->nLevels = header.nLevels;
+	tiles->tilesPerSide = header.tilesPerSide;
+	tiles->spacing = header.spacing;
+	tiles->originX = header.originX;
+	tiles->originZ = header.originZ;
+	memcpy(tiles->levelOffset, header.levelOffset, sizeof(tiles->levelOffset));
+	tiles->tileBytes = header.tileBytes;
+	tiles->range = TERRAIN_TILES_DEFAULT_RANGE;
+	tiles->lookahead = TERRAIN_TILES_DEFAULT_LOOKAHEAD;
+
+	tiles->nSlots = max((int)(budget / tileFootprint(tiles)), TERRAIN_TILES_MIN_SLOTS);
+	tiles->slots = calloc(tiles->nSlots, sizeof(TerrainTile));
+	for (l = 0; l < tiles->nLevels; l++)
+	{
+		int n = tilesAtLevel(tiles->tilesPerSide, l) * tilesAtLevel(tiles->tilesPerSide, l);
+
+		tiles->resident[l] = malloc(n * sizeof(int));
+		tiles->wanted[l] = malloc(n * sizeof(int));
+		for (s = 0; s < n; s++)
+		{
+			tiles->resident[l][s] = -1;
+			tiles->wanted[l][s] = -1;
+		}
+	}
+
+	/* One chunk, the mesh is well under 65536 vertices */
+	buildGridTopology(&tiles->topology, TILE_MESH_VERTICES, TILE_MESH_VERTICES, TILE_MESH_VERTICES, 0, 0, 0);
+
+	tiles->loader = calloc(1, sizeof(TileLoader));
+	tiles->loader->tiles = tiles;
+	tiles->loader->queue = malloc(tiles->nSlots * sizeof(int));
+	pthread_mutex_init(&tiles->loader->lock, NULL);
+	pthread_cond_init(&tiles->loader->wake, NULL);
+	pthread_create(&tiles->loader->thread, NULL, runLoader, tiles->loader);
+	return true;
+}
+
+void closeTerrainTiles(TerrainTiles *tiles)
+{
+	TileLoader *loader = tiles->loader;
+	int l, s;
+
+	if (!loader)
+		return;
+
+	pthread_mutex_lock(&loader->lock);
+	loader->quit = true;
+	pthread_cond_signal(&loader->wake);
+	pthread_mutex_unlock(&loader->lock);
+	pthread_join(loader->thread, NULL);
+
+	for (s = 0; s < tiles->nSlots; s++)
+	{
+		if (tiles->slots[s].state != TILE_FREE)
+			releaseTile(tiles, s);
+	}
+	pthread_mutex_destroy(&loader->lock);
+	pthread_cond_destroy(&loader->wake);
+	free(loader->queue);
+	free(loader);
+
+	if (tiles->indexBuffer)
+		glDeleteBuffers(1, &tiles->indexBuffer);
+	cleanupGridTopology(&tiles->topology);
+	for (l = 0; l < tiles->nLevels; l++)
+	{
+		free(tiles->resident[l]);
+		free(tiles->wanted[l]);
+	}
+	free(tiles->slots);
+	memset(tiles, 0, sizeof(*tiles));
+}
+
+/* Distance in x/z from a point to a tile */
+static float tileDistance(const TerrainTiles *tiles, int level, int i, int j, float x, float z)
+{
+	float size = TERRAIN_TILE_QUADS * tiles->spacing * (1 << level);
+	float x0 = tiles->originX + i * size, z0 = tiles->originZ + j * size;
+	float dx = max(max(x0 - x, x - (x0 + size)), 0.0f);
+	float dz = max(max(z0 - z, z - (z0 + size)), 0.0f);
+
+	return sqrtf(dx * dx + dz * dz);
+}
+
+/* Adds a tile to the wanted list, once per frame */
+static void wantTile(TerrainTiles *tiles, int level, int i, int j, float priority,
+	WantedTile **wanted, int *nWanted, int *capacity)
+{
+	int side = tilesAtLevel(tiles->tilesPerSide, level);
+	WantedTile *w;
+
+	if (tiles->wanted[level][i * side + j] == tiles->frame)
+		return;
+	tiles->wanted[level][i * side + j] = tiles->frame;
+
+	if (*nWanted == *capacity)
+	{
+		*capacity = max(*capacity * 2, 64);
+		*wanted = realloc(*wanted, *capacity * sizeof(WantedTile));
+	}
+	w = &(*wanted)[(*nWanted)++];
+	w->level = level;
+	w->i = i;
+	w->j = j;
+	w->priority = priority;
+}
+
+/* Wants the tiles of a level within radius of (x, z), which is along
+   the way ahead of a viewer */
+static void wantTilesAround(TerrainTiles *tiles, int level, float x, float z, float radius, float along,
+	WantedTile **wanted, int *nWanted, int *capacity)
+{
+	int side = tilesAtLevel(tiles->tilesPerSide, level);
+	float size = TERRAIN_TILE_QUADS * tiles->spacing * (1 << level);
+	int i0 = max((int)floorf((x - radius - tiles->originX) / size), 0);
+	int i1 = min((int)floorf((x + radius - tiles->originX) / size), side - 1);
+	int j0 = max((int)floorf((z - radius - tiles->originZ) / size), 0);
+	int j1 = min((int)floorf((z + radius - tiles->originZ) / size), side - 1);
+	int i, j;
+
+	for (i = i0; i <= i1; i++)
+	{
+		for (j = j0; j <= j1; j++)
+		{
+			float distance = tileDistance(tiles, level, i, j, x, z);
+
+			/* Nearest along the way first, coarse tiles (the
+			   fallbacks) ahead of fine ones as far */
+			if (distance <= radius)
+				wantTile(tiles, level, i, j, (along + distance) / (1 << level), wanted, nWanted, capacity);
+		}
+	}
+}
+
+static int compareWanted(const void *a, const void *b)
+{
+	float pa = ((const WantedTile *)a)->priority, pb = ((const WantedTile *)b)->priority;
+
+	return (pa > pb) - (pa < pb);
+}
+
+/* Finds a free slot, or evicts the least recently wanted ready tile
+   that wasn't wanted this frame. Returns -1 if everything is in use */
+static int claimSlot(TerrainTiles *tiles)
+{
+	int s, lru = -1;
+
+	for (s = 0; s < tiles->nSlots; s++)
+	{
+		const TerrainTile *tile = &tiles->slots[s];
+
+		if (tile->state == TILE_FREE)
+		{
+			clearResident(tiles, s);
+			return s;
+		}
+		if (tile->state == TILE_READY && tile->lastUsed < tiles->frame && tile->level < tiles->nLevels - 1 &&
+			(lru < 0 || tile->lastUsed < tiles->slots[lru].lastUsed))
+			lru = s;
+	}
+	if (lru >= 0)
+	{
+		releaseTile(tiles, lru);
+		tiles->stats.evictions++;
+	}
+	return lru;
+}
+
+void updateTerrainTiles(TerrainTiles *tiles, const TileViewer *viewers, int nViewers)
+{
+	TileLoader *loader = tiles->loader;
+	WantedTile *wanted = NULL;
+	int nWanted = 0, capacity = 0;
+	int v, l, k, w;
+
+	tiles->frame++;
+
+	/* The top tile covers everything, and is always wanted */
+	wantTile(tiles, tiles->nLevels - 1, 0, 0, -1.0f, &wanted, &nWanted, &capacity);
+	for (v = 0; v < nViewers; v++)
+	{
+		const TileViewer *viewer = &viewers[v];
+		float ahead = viewer->speed * tiles->lookahead;
+
+		for (l = 0; l < tiles->nLevels - 1; l++)
+		{
+			/* Points every half tile along the way ahead */
+			float size = TERRAIN_TILE_QUADS * tiles->spacing * (1 << l);
+			int nSteps = (int)ceilf(ahead / (0.5f * size));
+
+			for (k = 0; k <= nSteps; k++)
+			{
+				float along = nSteps > 0 ? ahead * k / nSteps : 0.0f;
+
+				wantTilesAround(tiles, l, viewer->pos.x + viewer->heading.x * along,
+					viewer->pos.z + viewer->heading.y * along, tiles->range * size, along,
+					&wanted, &nWanted, &capacity);
+			}
+		}
+	}
+	qsort(wanted, nWanted, sizeof(WantedTile), compareWanted);
+
+	pthread_mutex_lock(&loader->lock);
+
+	/* Mark what's already resident or on its way first, so none of it
+	   is evicted for the new requests */
+	for (w = 0; w < nWanted; w++)
+	{
+		int side = tilesAtLevel(tiles->tilesPerSide, wanted[w].level);
+		int *resident = &tiles->resident[wanted[w].level][wanted[w].i * side + wanted[w].j];
+		int s = *resident;
+
+		if (s < 0)
+			continue;
+		if (tiles->slots[s].state == TILE_FREE)
+		{
+			/* Failed to load, try again */
+			*resident = -1;
+			continue;
+		}
+		tiles->slots[s].lastUsed = tiles->frame;
+		tiles->slots[s].priority = wanted[w].priority;
+	}
+
+	for (w = 0; w < nWanted; w++)
+	{
+		int side = tilesAtLevel(tiles->tilesPerSide, wanted[w].level);
+		int *resident = &tiles->resident[wanted[w].level][wanted[w].i * side + wanted[w].j];
+		TerrainTile *tile;
+		int s;
+
+		if (*resident >= 0)
+			continue;
+		s = claimSlot(tiles);
+		if (s < 0)
+		{
+			tiles->stats.overBudget++;
+			continue;
+		}
+
+		tile = &tiles->slots[s];
+		tile->level = wanted[w].level;
+		tile->i = wanted[w].i;
+		tile->j = wanted[w].j;
+		tile->lastUsed = tiles->frame;
+		tile->priority = wanted[w].priority;
+		tile->state = TILE_QUEUED;
+		*resident = s;
+		loader->queue[loader->nQueued++] = s;
+		tiles->stats.requests++;
+	}
+
+	/* Queued tiles left behind aren't worth loading any more */
+	for (k = 0; k < loader->nQueued; k++)
+	{
+		int s = loader->queue[k];
+
+		if (tiles->slots[s].lastUsed == tiles->frame)
+			continue;
+		loader->queue[k--] = loader->queue[--loader->nQueued];
+		releaseTile(tiles, s);
+		tiles->stats.cancels++;
+	}
+
+	if (loader->nQueued > 0)
+		pthread_cond_signal(&loader->wake);
+	pthread_mutex_unlock(&loader->lock);
+
+	free(wanted);
+}
+
+/* Slot of a tile if it's ready to use, -1 otherwise */
+static int readyTile(const TerrainTiles *tiles, int level, int i, int j)
+{
+	int s = tiles->resident[level][i * tilesAtLevel(tiles->tilesPerSide, level) + j];
+
+	if (s < 0 || __atomic_load_n(&tiles->slots[s].state, __ATOMIC_ACQUIRE) != TILE_READY)
+		return -1;
+	return s;
+}
+
+/* Adds the tile to the selection, or its children where they're all
+   ready and wanted at their distance from the eye */
+static int selectTile(TerrainTiles *tiles, int level, int i, int j, Vec3f eye, int *selected, int n, int maxTiles)
+{
+	int s = readyTile(tiles, level, i, j), k;
+
+	if (s < 0 || n >= maxTiles)
+		return n;
+
+	if (level > 0 && tileDistance(tiles, level, i, j, eye.x, eye.z) <=
+		tiles->range * TERRAIN_TILE_QUADS * tiles->spacing * (1 << (level - 1)))
+	{
+		bool ready = true;
+
+		for (k = 0; k < 4 && ready; k++)
+			ready = readyTile(tiles, level - 1, i * 2 + (k >> 1), j * 2 + (k & 1)) >= 0;
+		if (ready)
+		{
+			for (k = 0; k < 4; k++)
+				n = selectTile(tiles, level - 1, i * 2 + (k >> 1), j * 2 + (k & 1), eye, selected, n, maxTiles);
+			return n;
+		}
+	}
+
+	selected[n] = s;
+	return n + 1;
+}
+
+int selectTerrainTiles(TerrainTiles *tiles, Vec3f eye, int *selected, int maxTiles)
+{
+	return selectTile(tiles, tiles->nLevels - 1, 0, 0, eye, selected, 0, maxTiles);
+}
+
+/* Sends vertex i of a tile in immediate mode */
+static void emitTileVertex(int i, void *data)
+{
+	const TerrainTileVertex *v = &((const TerrainTile *)data)->verts[i];
+
+	glTexCoord2f(v->texcoord.x, v->texcoord.y);
+	glNormal3f(v->normal.x, v->normal.y, v->normal.z);
+	glVertex3f(v->pos.x, v->pos.y, v->pos.z);
+}
+
+void drawTerrainTiles(TerrainTiles *tiles, Vec3f eye)
+{
+	int *selected = malloc(tiles->nSlots * sizeof(int));
+	int n = selectTerrainTiles(tiles, eye, selected, tiles->nSlots), k, uploads = 0;
+	bool useBuffers = buffersSupported();
+
+	if (useBuffers && !tiles->indexBuffer)
+	{
+		glGenBuffers(1, &tiles->indexBuffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tiles->indexBuffer);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, tiles->topology.nIndices * sizeof(unsigned short),
+			tiles->topology.indices, GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+
+	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	if (useBuffers)
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tiles->indexBuffer);
+
+	for (k = 0; k < n; k++)
+	{
+		TerrainTile *tile = &tiles->slots[selected[k]];
+		float size = TERRAIN_TILE_QUADS * tiles->spacing * (1 << tile->level);
+		float skirt = TILE_SKIRT_SPACINGS * tiles->spacing * (1 << tile->level);
+		Vec3f lo = { tiles->originX + tile->i * size, tile->minY - skirt, tiles->originZ + tile->j * size };
+		Vec3f hi = { lo.x + size, tile->maxY, lo.z + size };
+
+		if (!boxVisible(CULL_TERRAIN, lo, hi))
+			continue;
+
+		if (useBuffers && !tile->vertexBuffer && uploads < TERRAIN_TILE_UPLOADS_PER_DRAW)
+		{
+			glGenBuffers(1, &tile->vertexBuffer);
+			glBindBuffer(GL_ARRAY_BUFFER, tile->vertexBuffer);
+			glBufferData(GL_ARRAY_BUFFER, TILE_MESH_VERTICES * TILE_MESH_VERTICES * sizeof(TerrainTileVertex),
+				tile->verts, GL_STATIC_DRAW);
+			free(tile->verts);
+			tile->verts = NULL;
+			uploads++;
+			tiles->stats.uploads++;
+		}
+
+		if (tile->vertexBuffer)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, tile->vertexBuffer);
+			glVertexPointer(3, GL_FLOAT, sizeof(TerrainTileVertex), (void *)0);
+			glNormalPointer(GL_FLOAT, sizeof(TerrainTileVertex), (void *)sizeof(Vec3f));
+			glTexCoordPointer(2, GL_FLOAT, sizeof(TerrainTileVertex), (void *)(2 * sizeof(Vec3f)));
+			drawTopologyChunk(&tiles->topology, 0);
+		}
+		else
+			drawTopologyChunkImmediate(&tiles->topology, 0, emitTileVertex, tile);
+	}
+
+	if (useBuffers)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+	glPopClientAttrib();
+	free(selected);
+}
+
+/* The triangles split each quad along its (i, j+1) to (i+1, j)
+   diagonal, like the mesh's strips */
+bool terrainTilesHeight(const TerrainTiles *tiles, float x, float z, float *y, int *level)
+{
+	float fx = (x - tiles->originX) / tiles->spacing, fz = (z - tiles->originZ) / tiles->spacing;
+	float extent = (float)tiles->tilesPerSide * TERRAIN_TILE_QUADS;
+	int l;
+
+	if (!tiles->slots || fx < 0.0f || fz < 0.0f || fx > extent || fz > extent)
+		return false;
+
+	for (l = 0; l < tiles->nLevels; l++)
+	{
+		float u = fx / (1 << l), v = fz / (1 << l);
+		int side = tilesAtLevel(tiles->tilesPerSide, l);
+		int ti = min((int)(u / TERRAIN_TILE_QUADS), side - 1), tj = min((int)(v / TERRAIN_TILE_QUADS), side - 1);
+		int s = readyTile(tiles, l, ti, tj), i, j;
+		const TerrainTile *tile;
+		float a, b;
+
+		if (s < 0)
+			continue;
+		tile = &tiles->slots[s];
+		u -= ti * TERRAIN_TILE_QUADS;
+		v -= tj * TERRAIN_TILE_QUADS;
+		i = min((int)u, TERRAIN_TILE_QUADS - 1);
+		j = min((int)v, TERRAIN_TILE_QUADS - 1);
+		a = u - i;
+		b = v - j;
+
+		if (a + b <= 1.0f)
+		{
+			float h00 = tileHeight(tile, i, j);
+			*y = h00 + a * (tileHeight(tile, i + 1, j) - h00) + b * (tileHeight(tile, i, j + 1) - h00);
+		}
+		else
+		{
+			float h11 = tileHeight(tile, i + 1, j + 1);
+			*y = h11 + (1.0f - a) * (tileHeight(tile, i, j + 1) - h11) + (1.0f - b) * (tileHeight(tile, i + 1, j) - h11);
+		}
+		if (level)
+			*level = l;
+		return true;
+	}
+	return false;
+}
+
+void getTerrainTilesStats(TerrainTiles *tiles, TerrainTilesStats *stats)
+{
+	pthread_mutex_lock(&tiles->loader->lock);
+	*stats = tiles->stats;
+	pthread_mutex_unlock(&tiles->loader->lock);
+}
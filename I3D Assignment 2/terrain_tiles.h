@@ -0,0 +1,174 @@
+#ifndef TERRAIN_TILES_H
+#define TERRAIN_TILES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "utils.h"
+#include "topology.h"
+
+/* Quads per side of every tile, at every level of the pyramid */
+#define TERRAIN_TILE_QUADS 64
+
+/* Samples per side of a tile, the last row and column are the first
+   of the next tile's */
+#define TERRAIN_TILE_SAMPLES (TERRAIN_TILE_QUADS + 1)
+
+/* Most levels a pyramid can have, enough for 2048 tiles per side */
+#define TERRAIN_TILES_MAX_LEVELS 12
+
+/* Defaults for how far around (in tile sizes) and ahead (in seconds)
+   of the viewers tiles are wanted */
+#define TERRAIN_TILES_DEFAULT_RANGE 1.5f
+#define TERRAIN_TILES_DEFAULT_LOOKAHEAD 3.0f
+
+/* Bump whenever the file layout changes */
+#define TERRAIN_TILES_VERSION 1
+
+/* Fills out[k] with the height at (x, z[k]) for n samples, the
+   source terrain tiles are built from */
+typedef void (*TileHeightFunc)(float x, const float *z, float *out, int n, void *data);
+
+/* Layout of one vertex of a tile's vertex buffer */
+typedef struct
+{
+	Vec3f pos;
+	Vec3f normal;
+	Vec2f texcoord;
+} TerrainTileVertex;
+
+/* Where a tile's slot is at */
+typedef enum
+{
+	TILE_FREE,
+	TILE_QUEUED,	/* Waiting for the loader */
+	TILE_LOADING,	/* Being read by the loader, hands off */
+	TILE_READY
+} TileState;
+
+/* A slot for one resident tile. Level l tiles are the heightfield
+   sampled every 2^l level 0 spacings, so each covers 2x2 tiles of the
+   level below */
+typedef struct
+{
+	int level, i, j;
+	TileState state;
+	int lastUsed;		/* Frame it was last wanted in */
+	float priority;		/* Lowest is loaded first */
+
+	void *map;		/* The tile's pages of the file */
+	size_t mapBytes;
+	const float *heights;	/* With a one sample apron, see terrain_tiles.c */
+	float minY, maxY;
+
+	TerrainTileVertex *verts;	/* Built by the loader, freed once uploaded */
+	unsigned int vertexBuffer;
+} TerrainTile;
+
+/* Something tiles are streamed in around, e.g. a boat. Tiles ahead
+   along its heading are fetched before it gets there */
+typedef struct
+{
+	Vec3f pos;
+	Vec2f heading;		/* Unit (x, z) direction of travel */
+	float speed;		/* GL units per second */
+} TileViewer;
+
+/* Counters since the tiles were opened */
+typedef struct
+{
+	int requests;		/* Tiles queued for loading */
+	int loads;		/* Tiles the loader finished */
+	int cancels;		/* Queued tiles no longer wanted before loading */
+	int evictions;		/* Ready tiles dropped for the budget */
+	int uploads;		/* Tiles sent to buffer objects */
+	int overBudget;		/* Wanted tiles that found no slot */
+	int residentTiles;
+	size_t residentBytes;	/* Mapped, plus vertices in memory or on the GPU */
+	size_t peakBytes;
+} TerrainTilesStats;
+
+/* Opaque background loader */
+typedef struct _TileLoader TileLoader;
+
+/* A heightfield too big for memory, streamed from a pyramid of tiles
+   on disk. Only a budget's worth of tiles is resident at once: a
+   loader thread maps and meshes the ones wanted around the viewers,
+   the least recently wanted are evicted to make room, and the
+   coarsest tile covering everything is pinned so there's always
+   something to draw and collide with. Drawing and height queries use
+   the finest resident tiles, never waiting for the disk */
+typedef struct
+{
+	char filename[256];
+	int nLevels;
+	int tilesPerSide;		/* At level 0, a power of two */
+	float spacing;			/* Between level 0 samples */
+	float originX, originZ;		/* World position of sample (0, 0) */
+	size_t levelOffset[TERRAIN_TILES_MAX_LEVELS];
+	size_t tileBytes;		/* Of each tile in the file */
+
+	int nSlots;
+	TerrainTile *slots;
+	int *resident[TERRAIN_TILES_MAX_LEVELS];	/* Slot of each tile, or -1 */
+	int *wanted[TERRAIN_TILES_MAX_LEVELS];		/* Last frame each was wanted */
+	int frame;
+	float range;			/* Tiles are wanted this many tile
+					   sizes around the viewers */
+	float lookahead;		/* And this many seconds ahead */
+
+	TileLoader *loader;
+	TerrainTilesStats stats;
+
+	/* Shared by every tile: the grid with a skirt round it */
+	GridTopology topology;
+	unsigned int indexBuffer;
+} TerrainTiles;
+
+/* Writes the pyramid for a tilesPerSide x tilesPerSide tile map with
+   the given sample spacing, centred on the origin, sampling height
+   tile by tile so it's never all in memory. key is stored to check
+   against later, e.g. a seed. Returns false if the file can't be
+   written */
+bool buildTerrainTiles(const char *filename, int tilesPerSide, float spacing, unsigned int key,
+	TileHeightFunc height, void *data);
+
+/* Opens a pyramid written with the given key and starts its loader,
+   with room for budget bytes of tiles (but always at least enough for
+   the pinned tile and a few more). Returns false if the file is
+   missing, damaged or from another key or version */
+bool openTerrainTiles(TerrainTiles *tiles, const char *filename, unsigned int key, size_t budget);
+
+/* Stops the loader and releases every tile, and the GL objects */
+void closeTerrainTiles(TerrainTiles *tiles);
+
+/* Starts a frame: works out the tiles wanted around the viewers,
+   queues those that aren't resident nearest first, evicting the least
+   recently wanted to make room, and drops queued ones that are no
+   longer wanted. Never blocks on the loader. Needs the GL context if
+   tiles have been drawn, evicted tiles delete their buffers */
+void updateTerrainTiles(TerrainTiles *tiles, const TileViewer *viewers, int nViewers);
+
+/* Picks the resident tiles to draw from an eye: the finest covering
+   each area that's wanted at that distance. Writes up to maxTiles
+   slot indices, returning how many */
+int selectTerrainTiles(TerrainTiles *tiles, Vec3f eye, int *selected, int maxTiles);
+
+/* Draws the selected tiles inside the view frustum, uploading a few
+   newly loaded ones to buffer objects each call */
+void drawTerrainTiles(TerrainTiles *tiles, Vec3f eye);
+
+/* Height of the finest resident tile at (x, z), interpolated across
+   its triangles. Returns false outside the map, or before anything is
+   resident. level (optional) is set to the level used */
+bool terrainTilesHeight(const TerrainTiles *tiles, float x, float z, float *y, int *level);
+
+/* Locks the loader to read stats consistently */
+void getTerrainTilesStats(TerrainTiles *tiles, TerrainTilesStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,363 @@
+#include <stdlib.h>
+#include <assert.h>
+#include "topology.h"
+#include "buffers.h"
+#include "gl.h"
+
+/* Longest strip, in quads. Each strip shares a column of vertices
+   with the one before it; the two columns (2 * (quads + 1) vertices)
+   have to fit in the post-transform cache for that column to still
+   be there when it's reused, so this suits caches of 16 and up */
+#define TOPOLOGY_STRIP_QUADS 7
+
+/* Quad rows per chunk, as many as chunkQuads allows while keeping
+   every relative index below TOPOLOGY_RESTART */
+static int chunkRowsFor(int cols, int chunkQuads)
+{
+	int chunkRows = min(chunkQuads, (TOPOLOGY_RESTART - 1 - chunkQuads) / cols);
+
+	assert(chunkRows > 0);
+	return max(chunkRows, 1);
+}
+
+/* Upper bound on the indices of the whole grid: two per quad, plus
+   a start pair and restart for up to two pieces of every strip (a
+   hole can split a strip in two) */
+static int maxIndices(int rows, int cols, int chunkRows)
+{
+	int ci, nStrips = 0;
+
+	for (ci = 0; ci < rows - 1; ci += chunkRows)
+	{
+		int bandRows = min(chunkRows, rows - 1 - ci);
+		nStrips += (bandRows + TOPOLOGY_STRIP_QUADS - 1) / TOPOLOGY_STRIP_QUADS * (cols - 1);
+	}
+	return 2 * (rows - 1) * (cols - 1) + nStrips * 2 * 3;
+}
+
+void buildGridTopology(GridTopology *topology, int rows, int cols, int chunkQuads,
+	int holeI, int holeJ, int holeSize)
+{
+	int ci, cj, si, i, j, index = 0;
+	int chunkRows = chunkRowsFor(cols, chunkQuads);
+	int nChunks = ((rows - 2) / chunkRows + 1) * ((cols - 2) / chunkQuads + 1);
+	int nIndices = maxIndices(rows, cols, chunkRows);
+	unsigned short *indices;
+
+	/* Only grow the arrays, moving a clipmap hole rebuilds often */
+	if (nIndices > topology->indexCapacity)
+	{
+		free(topology->indices);
+		topology->indices = malloc(nIndices * sizeof(unsigned short));
+		topology->indexCapacity = nIndices;
+	}
+	if (nChunks > topology->chunkCapacity)
+	{
+		free(topology->chunks);
+		topology->chunks = malloc(nChunks * sizeof(MeshChunk));
+		topology->chunkCapacity = nChunks;
+	}
+
+	indices = topology->indices;
+	setGridTopologyLayout(topology, rows, cols, chunkQuads);
+	topology->nChunks = 0;
+
+	#define IN_HOLE(i, j) ((i) >= holeI && (i) < holeI + holeSize && (j) >= holeJ && (j) < holeJ + holeSize)
+	#define CHUNK_VERTEX(i, j) ((i - ci)*cols+(j - cj))
+	for (ci = 0; ci < rows - 1; ci += chunkRows)
+	{
+		for (cj = 0; cj < cols - 1; cj += chunkQuads)
+		{
+			MeshChunk *chunk = &topology->chunks[topology->nChunks];
+			int endI = min(ci + chunkRows, rows - 1);
+			int endJ = min(cj + chunkQuads, cols - 1);
+
+			chunk->firstIndex = index;
+			chunk->baseVertex = ci * cols + cj;
+
+			/* One strip down each column of quads, walking i. Its
+			   triangles are (i,j) (i,j+1) (i+1,j) then (i+1,j)
+			   (i,j+1) (i+1,j+1), the same diagonal and winding as
+			   the triangle lists this replaces */
+			for (si = ci; si < endI; si += TOPOLOGY_STRIP_QUADS)
+			{
+				for (j = cj; j < endJ; j++)
+				{
+					bool open = false;
+
+					for (i = si; i < min(si + TOPOLOGY_STRIP_QUADS, endI); i++)
+					{
+						if (IN_HOLE(i, j))
+						{
+							if (open)
+								indices[index++] = TOPOLOGY_RESTART;
+							open = false;
+							continue;
+						}
+						if (!open)
+						{
+							indices[index++] = CHUNK_VERTEX(i, j);
+							indices[index++] = CHUNK_VERTEX(i, j + 1);
+							open = true;
+						}
+						indices[index++] = CHUNK_VERTEX(i + 1, j);
+						indices[index++] = CHUNK_VERTEX(i + 1, j + 1);
+					}
+					if (open)
+						indices[index++] = TOPOLOGY_RESTART;
+				}
+			}
+
+			/* Drop the trailing restart, and chunks entirely
+			   inside the hole */
+			if (index > chunk->firstIndex)
+				index--;
+			chunk->nIndices = index - chunk->firstIndex;
+			if (chunk->nIndices > 0)
+				topology->nChunks++;
+		}
+	}
+	#undef CHUNK_VERTEX
+	#undef IN_HOLE
+
+	assert(index <= nIndices);
+	topology->nIndices = index;
+}
+
+void setGridTopologyLayout(GridTopology *topology, int rows, int cols, int chunkQuads)
+{
+	topology->rows = rows;
+	topology->cols = cols;
+	topology->chunkRows = chunkRowsFor(cols, chunkQuads);
+	topology->chunkCols = chunkQuads;
+	topology->chunkGridCols = (cols - 2) / chunkQuads + 1;
+}
+
+void cleanupGridTopology(GridTopology *topology)
+{
+	free(topology->indices);
+	free(topology->chunks);
+
+	topology->indices = 0;
+	topology->chunks = 0;
+	topology->nIndices = 0;
+	topology->nChunks = 0;
+	topology->indexCapacity = 0;
+	topology->chunkCapacity = 0;
+}
+
+void drawTopologyChunk(const GridTopology *topology, int chunk)
+{
+	const MeshChunk *c = &topology->chunks[chunk];
+	int i, start;
+
+	if (primitiveRestartSupported())
+	{
+		setPrimitiveRestart(true, TOPOLOGY_RESTART);
+		glDrawElements(GL_TRIANGLE_STRIP, c->nIndices, GL_UNSIGNED_SHORT,
+			(void *)(c->firstIndex * sizeof(unsigned short)));
+		setPrimitiveRestart(false, TOPOLOGY_RESTART);
+		return;
+	}
+
+	/* No restart, find the strips on the CPU and draw them one by one */
+	start = c->firstIndex;
+	for (i = c->firstIndex; i <= c->firstIndex + c->nIndices; i++)
+	{
+		if (i < c->firstIndex + c->nIndices && topology->indices[i] != TOPOLOGY_RESTART)
+			continue;
+		if (i > start)
+			glDrawElements(GL_TRIANGLE_STRIP, i - start, GL_UNSIGNED_SHORT,
+				(void *)(start * sizeof(unsigned short)));
+		start = i + 1;
+	}
+}
+
+void drawTopologyChunks(const GridTopology *topology, const bool *visible,
+	void (*bind)(int baseVertex, void *data), void *data)
+{
+	int c, n = 0;
+
+	if (primitiveRestartSupported() && baseVertexSupported())
+	{
+		GLsizei *counts = malloc(max(topology->nChunks, 1) * sizeof(GLsizei));
+		GLint *bases = malloc(max(topology->nChunks, 1) * sizeof(GLint));
+		const void **offsets = malloc(max(topology->nChunks, 1) * sizeof(void *));
+
+		for (c = 0; c < topology->nChunks; c++)
+		{
+			const MeshChunk *chunk = &topology->chunks[c];
+
+			if (visible && !visible[c])
+				continue;
+			counts[n] = chunk->nIndices;
+			bases[n] = chunk->baseVertex;
+			offsets[n] = (void *)(chunk->firstIndex * sizeof(unsigned short));
+			n++;
+		}
+
+		if (n > 0)
+		{
+			bind(0, data);
+			setPrimitiveRestart(true, TOPOLOGY_RESTART);
+			glMultiDrawElementsBaseVertex(GL_TRIANGLE_STRIP, counts, GL_UNSIGNED_SHORT,
+				offsets, n, bases);
+			setPrimitiveRestart(false, TOPOLOGY_RESTART);
+		}
+
+		free(counts);
+		free(bases);
+		free(offsets);
+		return;
+	}
+
+	for (c = 0; c < topology->nChunks; c++)
+	{
+		if (visible && !visible[c])
+			continue;
+		bind(topology->chunks[c].baseVertex, data);
+		drawTopologyChunk(topology, c);
+	}
+}
+
+void drawTopologyInstances(const GridTopology *topology, const int *baseVertices, int n,
+	void (*bind)(int baseVertex, void *data), void *data)
+{
+	int c, k, m = 0;
+
+	if (n == 0)
+		return;
+
+	if (primitiveRestartSupported() && baseVertexSupported())
+	{
+		GLsizei *counts = malloc(n * topology->nChunks * sizeof(GLsizei));
+		GLint *bases = malloc(n * topology->nChunks * sizeof(GLint));
+		const void **offsets = malloc(n * topology->nChunks * sizeof(void *));
+
+		for (k = 0; k < n; k++)
+		{
+			for (c = 0; c < topology->nChunks; c++)
+			{
+				const MeshChunk *chunk = &topology->chunks[c];
+
+				counts[m] = chunk->nIndices;
+				bases[m] = baseVertices[k] + chunk->baseVertex;
+				offsets[m] = (void *)(chunk->firstIndex * sizeof(unsigned short));
+				m++;
+			}
+		}
+
+		bind(0, data);
+		setPrimitiveRestart(true, TOPOLOGY_RESTART);
+		glMultiDrawElementsBaseVertex(GL_TRIANGLE_STRIP, counts, GL_UNSIGNED_SHORT, offsets, m, bases);
+		setPrimitiveRestart(false, TOPOLOGY_RESTART);
+
+		free(counts);
+		free(bases);
+		free(offsets);
+		return;
+	}
+
+	for (k = 0; k < n; k++)
+	{
+		for (c = 0; c < topology->nChunks; c++)
+		{
+			bind(baseVertices[k] + topology->chunks[c].baseVertex, data);
+			drawTopologyChunk(topology, c);
+		}
+	}
+}
+
+void drawTopologyChunkImmediate(const GridTopology *topology, int chunk,
+	void (*emit)(int vertex, void *data), void *data)
+{
+	const MeshChunk *c = &topology->chunks[chunk];
+	int i;
+
+	glBegin(GL_TRIANGLE_STRIP);
+	for (i = c->firstIndex; i < c->firstIndex + c->nIndices; i++)
+	{
+		if (topology->indices[i] == TOPOLOGY_RESTART)
+		{
+			glEnd();
+			glBegin(GL_TRIANGLE_STRIP);
+			continue;
+		}
+		emit(c->baseVertex + topology->indices[i], data);
+	}
+	glEnd();
+}
+
+/* FIFO cache state: a vertex is cached if it missed less than
+   cacheSize misses ago. Restarts don't flush it */
+typedef struct
+{
+	int *missedAt;		/* Miss count when each vertex was loaded, -1 never */
+	int misses;
+	int cacheSize;
+} VertexCache;
+
+static void initVertexCache(VertexCache *cache, int nVertices, int cacheSize)
+{
+	int i;
+
+	cache->missedAt = malloc(max(nVertices, 1) * sizeof(int));
+	for (i = 0; i < nVertices; i++)
+		cache->missedAt[i] = -1;
+	cache->misses = 0;
+	cache->cacheSize = cacheSize;
+}
+
+static void touchVertex(VertexCache *cache, int vertex)
+{
+	int at = cache->missedAt[vertex];
+
+	if (at < 0 || cache->misses - at >= cache->cacheSize)
+		cache->missedAt[vertex] = cache->misses++;
+}
+
+void measureGridTopology(const GridTopology *topology, int cacheSize, TopologyStats *stats)
+{
+	VertexCache cache;
+	int c, i, stripLength;
+
+	initVertexCache(&cache, topology->rows * topology->cols, cacheSize);
+	stats->nTriangles = 0;
+
+	for (c = 0; c < topology->nChunks; c++)
+	{
+		const MeshChunk *chunk = &topology->chunks[c];
+
+		stripLength = 0;
+		for (i = chunk->firstIndex; i < chunk->firstIndex + chunk->nIndices; i++)
+		{
+			if (topology->indices[i] == TOPOLOGY_RESTART)
+			{
+				stripLength = 0;
+				continue;
+			}
+			touchVertex(&cache, chunk->baseVertex + topology->indices[i]);
+			if (++stripLength >= 3)
+				stats->nTriangles++;
+		}
+	}
+
+	stats->indexBytes = topology->nIndices * sizeof(unsigned short);
+	stats->acmr = stats->nTriangles ? cache.misses / (float)stats->nTriangles : 0.0f;
+	free(cache.missedAt);
+}
+
+void measureTriangleList(const int *indices, int nIndices, int nVertices, int cacheSize, TopologyStats *stats)
+{
+	VertexCache cache;
+	int i;
+
+	initVertexCache(&cache, nVertices, cacheSize);
+	for (i = 0; i < nIndices; i++)
+		touchVertex(&cache, indices[i]);
+
+	stats->indexBytes = nIndices * sizeof(int);
+	stats->nTriangles = nIndices / 3;
+	stats->acmr = stats->nTriangles ? cache.misses / (float)stats->nTriangles : 0.0f;
+	free(cache.missedAt);
+}
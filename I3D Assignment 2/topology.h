@@ -0,0 +1,91 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "utils.h"
+#include "frustum.h"
+
+/* Index that ends one strip and starts the next */
+#define TOPOLOGY_RESTART 0xFFFF
+
+/* Triangle strip indices for a rows x cols grid of vertices stored
+   row-major (vertex (i, j) is i * cols + j), split into square
+   chunks. Each chunk's indices are 16 bit and relative to its
+   baseVertex, so a chunk never spans more than 65535 vertices, and
+   holds one strip per row of quads separated by TOPOLOGY_RESTART */
+typedef struct
+{
+	int rows, cols;
+	int nIndices;
+	unsigned short *indices;
+	int nChunks;
+	MeshChunk *chunks;	/* Bounds are left for the owner to fill */
+	int indexCapacity, chunkCapacity;
+
+	/* Quads along i and j per chunk, and chunks per row of them.
+	   Without a hole chunk (r, c) is chunks[r * chunkGridCols + c] */
+	int chunkRows, chunkCols;
+	int chunkGridCols;
+} GridTopology;
+
+/* Index buffer size and post-transform vertex cache behaviour of a
+   mesh, see measureGridTopology */
+typedef struct
+{
+	size_t indexBytes;
+	int nTriangles;
+	float acmr;		/* Cache misses per triangle */
+} TopologyStats;
+
+/* (Re)builds the topology of a rows x cols grid with chunks of at
+   most chunkQuads x chunkQuads quads, leaving out the holeSize x
+   holeSize quads starting at quad (holeI, holeJ). Existing storage
+   is reused when it's big enough */
+void buildGridTopology(GridTopology *topology, int rows, int cols, int chunkQuads,
+	int holeI, int holeJ, int holeSize);
+
+/* Sets the size and chunk layout buildGridTopology gives a rows x
+   cols grid, for topologies whose arrays come from elsewhere */
+void setGridTopologyLayout(GridTopology *topology, int rows, int cols, int chunkQuads);
+
+/* Frees the index and chunk arrays */
+void cleanupGridTopology(GridTopology *topology);
+
+/* Draws one chunk from the bound element array buffer, with the
+   vertex pointers already offset to the chunk's baseVertex. Uses
+   primitive restart when the context has it, one draw per strip
+   otherwise */
+void drawTopologyChunk(const GridTopology *topology, int chunk);
+
+/* Draws the chunks flagged in visible (all of them if NULL) from
+   the bound element array buffer. With base vertex support that's a
+   single draw, with bind(0, data) called first; otherwise bind is
+   called with each chunk's baseVertex to move the vertex pointers
+   before drawTopologyChunk */
+void drawTopologyChunks(const GridTopology *topology, const bool *visible,
+	void (*bind)(int baseVertex, void *data), void *data);
+
+/* Draws every chunk n times, each with its indices offset by one
+   of baseVertices, for meshes that repeat the same topology. Uses the
+   same single draw or bind per copy as drawTopologyChunks */
+void drawTopologyInstances(const GridTopology *topology, const int *baseVertices, int n,
+	void (*bind)(int baseVertex, void *data), void *data);
+
+/* Same, in immediate mode: calls emit(vertex, data) with the
+   absolute vertex index between glBegin/glEnd pairs */
+void drawTopologyChunkImmediate(const GridTopology *topology, int chunk,
+	void (*emit)(int vertex, void *data), void *data);
+
+/* Simulates a FIFO post-transform cache of cacheSize vertices over
+   the strips, or over a plain triangle list of 32 bit indices */
+void measureGridTopology(const GridTopology *topology, int cacheSize, TopologyStats *stats);
+void measureTriangleList(const int *indices, int nIndices, int nVertices, int cacheSize, TopologyStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,5 +1,19 @@
+#define _POSIX_C_SOURCE 200112L
+
 #include "utils.h"
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <malloc.h>
+#include <stdio.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 /* Constructor for a Vec3f struct */
 Vec3f cVec3f(float x, float y, float z)
@@ -25,3 +39,149 @@ Vec4f cVec4f(float x, float y, float z, float w)
 float getDistanceDiff(Vec3f a, Vec3f b){
 	return sqrt((pow((a.x - b.x),2)) + (pow((a.y - b.y),2)) + (pow((a.z - b.z),2)));
 }
+
+float getDistanceSquared(Vec3f a, Vec3f b){
+	float dx = a.x - b.x, dy = a.y - b.y, dz = a.z - b.z;
+	return dx * dx + dy * dy + dz * dz;
+}
+
+
+/* Allocates zeroed memory aligned to the given power of two */
+void *alignedCalloc(size_t count, size_t size, size_t alignment)
+{
+	void *ptr = NULL;
+	size_t bytes = count * size;
+
+#ifdef _WIN32
+	ptr = _aligned_malloc(bytes, alignment);
+#else
+	if (posix_memalign(&ptr, alignment, bytes) != 0)
+		ptr = NULL;
+#endif
+
+	if (ptr)
+		memset(ptr, 0, bytes);
+	return ptr;
+}
+
+/* Frees memory from alignedCalloc */
+void alignedFree(void *ptr)
+{
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+/* Monotonic wall clock time in seconds */
+double timeNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Maps the file, or reads it into memory where there's no mmap */
+void *mapFile(const char *filename, size_t *bytes)
+{
+#ifdef _WIN32
+	FILE *file = fopen(filename, "rb");
+	void *data;
+	long size;
+
+	if (!file)
+		return NULL;
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	data = size > 0 ? malloc(size) : NULL;
+	if (data && fread(data, 1, size, file) != (size_t)size)
+	{
+		free(data);
+		data = NULL;
+	}
+	fclose(file);
+	*bytes = data ? size : 0;
+	return data;
+#else
+	struct stat info;
+	void *data;
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		return NULL;
+	}
+	data = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+	*bytes = info.st_size;
+	return data;
+#endif
+}
+
+void *mapFileRange(const char *filename, size_t offset, size_t bytes)
+{
+#ifdef _WIN32
+	FILE *file = fopen(filename, "rb");
+	void *data;
+
+	if (!file)
+		return NULL;
+	data = bytes > 0 ? malloc(bytes) : NULL;
+	if (data && (fseek(file, (long)offset, SEEK_SET) != 0 || fread(data, 1, bytes, file) != bytes))
+	{
+		free(data);
+		data = NULL;
+	}
+	fclose(file);
+	return data;
+#else
+	/* mmap wants a page aligned offset, map from the page it's in */
+	size_t skip = offset % sysconf(_SC_PAGESIZE);
+	struct stat info;
+	char *data;
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &info) != 0 || bytes == 0 || offset + bytes > (size_t)info.st_size)
+	{
+		close(fd);
+		return NULL;
+	}
+	data = mmap(NULL, skip + bytes, PROT_READ, MAP_PRIVATE, fd, (off_t)(offset - skip));
+	close(fd);
+	return data == MAP_FAILED ? NULL : data + skip;
+#endif
+}
+
+void unmapFileRange(void *data, size_t offset, size_t bytes)
+{
+	if (!data)
+		return;
+#ifdef _WIN32
+	free(data);
+#else
+	{
+		size_t skip = offset % sysconf(_SC_PAGESIZE);
+		munmap((char *)data - skip, skip + bytes);
+	}
+#endif
+}
+
+void unmapFile(void *data, size_t bytes)
+{
+	if (!data)
+		return;
+#ifdef _WIN32
+	free(data);
+#else
+	munmap(data, bytes);
+#endif
+}
@@ -7,6 +7,8 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
+
 /* Bools are handy, we should have some */
 #if WIN32
 #define bool int
@@ -54,6 +56,30 @@ Vec4f cVec4f(float x, float y, float z, float w);
 	
 float getDistanceDiff(Vec3f, Vec3f);
 
+/* The distance squared, for comparing against a squared radius
+   without a square root */
+float getDistanceSquared(Vec3f, Vec3f);
+
+/* Allocates zeroed memory aligned to the given power of two (for
+   SIMD loads), must be released with alignedFree */
+void *alignedCalloc(size_t count, size_t size, size_t alignment);
+void alignedFree(void *ptr);
+
+/* Monotonic wall clock time in seconds, for timing */
+double timeNow(void);
+
+/* Maps a whole file into memory copy-on-write, so the data can be
+   changed without touching the file. Returns NULL if it can't be read,
+   must be released with unmapFile */
+void *mapFile(const char *filename, size_t *bytes);
+void unmapFile(void *data, size_t bytes);
+
+/* Maps bytes of a file from offset read only, for reading parts of
+   files bigger than memory. Returns NULL if they can't be read,
+   release with unmapFileRange and the same offset and bytes */
+void *mapFileRange(const char *filename, size_t offset, size_t bytes);
+void unmapFileRange(void *data, size_t offset, size_t bytes);
+
 #ifdef __cplusplus
 }
 #endif
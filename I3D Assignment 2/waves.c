@@ -1,25 +1,188 @@
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include "waves.h"
+#include "waves_simd.h"
+#include "buffers.h"
+#include "jobs.h"
 #include "gl.h"
+#include "frustum.h"
 
-/* A amplitude, k (period * 2pi), w omega (speed) */
-SineFunction sineWaveX = { 1.0f, 0.5f, 1.0f };
-SineFunction sineWaveZ = { 1.0f, 0.5f, 1.0f };
+/* Minimum rows / SIMD blocks / vertices handed to each job */
+#define LATTICE_ROW_GRAIN 16
+#define KERNEL_BLOCK_GRAIN 4
+#define VERTEX_GRAIN 4096
+
+/* Vertices the batched kernel evaluates per call, small enough that
+   its eight arrays stay in L1 while it loops over the components */
+#define KERNEL_BLOCK 256
+
+/* Longest common period waveTilePeriod looks for, in multiples of
+   the first component's period, and how close to a whole number of
+   periods the others must land */
+#define MAX_PERIOD_MULTIPLE 64
+#define PERIOD_TOLERANCE 1e-3f
+
+/* Quads per side of the chunks the indices are grouped into, each
+   chunk is culled on its own */
+#define GRID_CHUNK_QUADS 16
+
+/* Layout of one vertex in the grid's vertex buffer */
+typedef struct
+{
+	Vec3f pos;
+	Vec3f normal;
+} GridVertex;
+
+/* The active wave components. The default is the original pair of
+   sine waves, one travelling along x and one along z:
+   A amplitude, k (period * 2pi), w omega (speed), direction x/z,
+   phase, steepness */
+static SineFunction waves[MAX_WAVES] = {
+	{ 1.0f, 0.5f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f },
+	{ 1.0f, 0.5f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f },
+};
+static int nWaves = 2;
+
+/* True if any component has a Gerstner steepness */
+static bool wavesSteep = false;
 
 /* An absolute measure of time passed (in seconds) */
 static float animationTime = 0;
 
+/* FFT ocean replacing the wave components when set */
+static Ocean *waveOcean = NULL;
+
+/* Kernel used for SoA grids, picked by CPUID on first use */
+static WaveKernel waveKernel = NULL;
+
+/* Per-row and per-column tables for the separable path, grown as
+   needed and reused every tick. Rows hold the sum of the components
+   travelling along x, columns those travelling along z */
+static struct
+{
+	int rowCapacity, colCapacity;
+	float *rowX;			/* x coordinate of each row */
+	float *rowHeight, *rowSlope;	/* Height and -dh/dx of each row */
+	float *rowSteep, *rowDisp;	/* Gerstner normal y term and x shift */
+	float *colHeight, *colSlope;	/* Height and -dh/dz of each column */
+	float *colSteep, *colDisp;	/* Gerstner normal y term and z shift */
+} waveTables;
+
+/* Replaces the active wave components */
+void setWaves(const SineFunction *components, int n)
+{
+	int i;
+
+	nWaves = clamp(n, 0, MAX_WAVES);
+	wavesSteep = false;
+	for (i = 0; i < nWaves; i++)
+	{
+		waves[i] = components[i];
+		if (waves[i].steepness != 0.0f)
+			wavesSteep = true;
+	}
+}
+
+/* Switches to (or, with NULL, away from) an FFT ocean */
+void setWaveOcean(Ocean *ocean)
+{
+	waveOcean = ocean;
+}
+
+/* Highest the active waves can raise (or lower) the surface */
+float waveHeightBound(void)
+{
+	float bound = 0.0f;
+	int i;
+
+	if (waveOcean)
+		return waveOcean->maxHeight;
+
+	for (i = 0; i < nWaves; i++)
+		bound += fabsf(waves[i].A);
+	return bound;
+}
+
+/* Furthest Gerstner waves can move a vertex sideways */
+float waveDisplacementBound(void)
+{
+	float bound = 0.0f;
+	int i;
+
+	if (waveOcean)
+		return 0.0f;
+
+	for (i = 0; i < nWaves; i++)
+		bound += fabsf(waves[i].steepness * waves[i].A);
+	return bound;
+}
+
+/* Returns the active wave components and their count */
+int getWaves(const SineFunction **components)
+{
+	*components = waves;
+	return nWaves;
+}
+
+/* Small LCG so spectra don't disturb rand() */
+static float spectrumRandom(unsigned int *state)
+{
+	*state = *state * 1664525u + 1013904223u;
+	return (*state >> 8) / (float)(1 << 24);
+}
+
+/* Fills components with n directional Gerstner waves spread around
+   the wind direction (in radians). Wavelengths are spaced
+   geometrically, amplitudes scale with wavelength and speeds follow
+   deep water dispersion (w^2 = g k). The steepness is split between
+   the components so the crests never loop over */
+void makeWaveSpectrum(SineFunction *components, int n, float wind, float amplitude, unsigned int seed)
+{
+	int i;
+	float minLength = 4.0f, maxLength = 40.0f;
+	float totalA = 0.0f;
+
+	for (i = 0; i < n; i++)
+	{
+		float u = n > 1 ? i / (float)(n - 1) : 0.0f;
+		float length = minLength * powf(maxLength / minLength, u);
+		float angle = wind + (spectrumRandom(&seed) - 0.5f) * (float)(M_PI * 2.0 / 3.0);
+		SineFunction *f = &components[i];
+
+		f->k = 2.0f * M_PI / length;
+		f->A = length * (0.5f + spectrumRandom(&seed));
+		f->w = sqrtf(9.8f * f->k);
+		f->dirX = cosf(angle);
+		f->dirZ = sinf(angle);
+		f->phase = spectrumRandom(&seed) * 2.0f * M_PI;
+		totalA += f->A;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		components[i].A *= amplitude / totalA;
+		components[i].steepness = 0.8f / (components[i].k * components[i].A * n);
+	}
+}
+
 /* Initialises a 2d grid of the given tessellation
    and size in GL coordinates. Afterward, only
    the grid Y values and normals need to be updated
    via updateGrid() */
 void initGrid(Grid *grid, int rows, int cols, float size)
+{
+	initGridLayout(grid, rows, cols, size, GRID_LAYOUT_AOS);
+}
+
+/* Builds the vertices and indices of a rows x cols grid covering
+   extentX by extentZ GL units around the given centre */
+static void buildGrid(Grid *grid, int rows, int cols, float extentX, float extentZ,
+	float centreX, float centreZ, GridLayout layout)
 {
 	int i, j, index;
 	float x, z;
-	float start = -size / 2.0f;
 	
 	if (rows < 2)
 		rows = 2;
@@ -27,13 +190,38 @@ void initGrid(Grid *grid, int rows, int cols, float size)
 		cols = 2;
 	
 	int nVertices = (rows) * (cols);
-	int nIndices = (rows - 1) * (cols - 1) * 6;
 
-	/* Allocate memory for the vertex/normal arrays and index
-	   array, this will be for drawing triangles */
-	Vec3f *vertices = calloc(nVertices, sizeof(Vec3f));
-	Vec3f *normals = calloc(nVertices, sizeof(Vec3f));
-	int *indices = calloc(nIndices, sizeof(int));
+	/* SoA arrays are padded so the kernels never need a scalar tail */
+	int nPadded = (nVertices + WAVE_SIMD_WIDTH - 1) & ~(WAVE_SIMD_WIDTH - 1);
+
+	/* Allocate memory for the vertex/normal arrays, the strips are
+	   built by setGridHole */
+	Vec3f *vertices = NULL;
+	Vec3f *normals = NULL;
+
+	grid->layout = layout;
+	grid->nPadded = nPadded;
+	grid->x = grid->z = grid->y = NULL;
+	grid->nx = grid->ny = grid->nz = NULL;
+	grid->dx = grid->dz = NULL;
+	grid->displaced = grid->wasDisplaced = false;
+
+	if (layout == GRID_LAYOUT_SOA)
+	{
+		grid->x = alignedCalloc(nPadded, sizeof(float), WAVE_SIMD_ALIGN);
+		grid->z = alignedCalloc(nPadded, sizeof(float), WAVE_SIMD_ALIGN);
+		grid->y = alignedCalloc(nPadded, sizeof(float), WAVE_SIMD_ALIGN);
+		grid->nx = alignedCalloc(nPadded, sizeof(float), WAVE_SIMD_ALIGN);
+		grid->ny = alignedCalloc(nPadded, sizeof(float), WAVE_SIMD_ALIGN);
+		grid->nz = alignedCalloc(nPadded, sizeof(float), WAVE_SIMD_ALIGN);
+		grid->dx = alignedCalloc(nPadded, sizeof(float), WAVE_SIMD_ALIGN);
+		grid->dz = alignedCalloc(nPadded, sizeof(float), WAVE_SIMD_ALIGN);
+	}
+	else
+	{
+		vertices = calloc(nVertices, sizeof(Vec3f));
+		normals = calloc(nVertices, sizeof(Vec3f));
+	}
 
 	/* Iterate through the number of rows and columns, populating
 	   the vertex array, the x and z values will never change,
@@ -43,62 +231,482 @@ void initGrid(Grid *grid, int rows, int cols, float size)
 	for (i = 0; i < rows; i++)
 	{
 		x = i / (float)(rows - 1); /* range 0 to 1 */
-		x = (x - 0.5) * size; /* range -.5 size to .5 size */
+		x = (x - 0.5) * extentX + centreX; /* range -.5 size to .5 size */
 
 		for (j = 0; j < cols; j++)
 		{
 			z = j / (float)(cols - 1); /* range 0 to 1 */
-			z = (z - 0.5) * size; /* range -.5 size to .5 size */
+			z = (z - 0.5) * extentZ + centreZ; /* range -.5 size to .5 size */
 		
-			vertices[index].x = x;
-			vertices[index].z = z;
+			if (layout == GRID_LAYOUT_SOA)
+			{
+				grid->x[index] = x;
+				grid->z[index] = z;
+			}
+			else
+			{
+				vertices[index].x = x;
+				vertices[index].z = z;
+			}
 			index++;
 		}
 	}
 
-	/* Iterate again, this time creating an array of indices
-	   which form triangles by referencing previously
-	   generated vertices. This array will never change */
-	index = 0;
-	#define GRID_VERTEX(i, j) ((i)*cols+(j))
-	for (i = 0; i < rows - 1; i++)
-	{
-		for (j = 0; j < cols - 1; j++)
-		{
-			indices[index++] = GRID_VERTEX(i, j);
-			indices[index++] = GRID_VERTEX(i, j + 1);
-			indices[index++] = GRID_VERTEX(i + 1, j);
-			indices[index++] = GRID_VERTEX(i + 1, j);
-			indices[index++] = GRID_VERTEX(i, j + 1);
-			indices[index++] = GRID_VERTEX(i + 1, j + 1);
-		}
-	}
-
 	/* Create the grid and assign variables */
 	grid->rows = rows;
 	grid->cols = cols;
-	grid->size = size;
 	grid->nVertices = nVertices;
-	grid->nIndices = nIndices;
 	grid->vertices = vertices;
 	grid->normals = normals;
-	grid->indices = indices;
-	
+	memset(&grid->topology, 0, sizeof(grid->topology));
+	grid->texcoordBuffer = 0;
+	grid->vertexBuffer = 0;
+	grid->indexBuffer = 0;
+
+	setGridHole(grid, 0, 0, 0);
+	grid->meshDirty = false;
+}
+
+/* Works out the x/z extent of each chunk from the undisplaced
+   vertices, the height is padded at draw time since it changes
+   every tick */
+static void calcChunkBounds(Grid *grid)
+{
+	int c, i;
+
+	for (c = 0; c < grid->topology.nChunks; c++)
+	{
+		MeshChunk *chunk = &grid->topology.chunks[c];
+
+		chunk->min = cVec3f(HUGE_VALF, 0.0f, HUGE_VALF);
+		chunk->max = cVec3f(-HUGE_VALF, 0.0f, -HUGE_VALF);
+		for (i = chunk->firstIndex; i < chunk->firstIndex + chunk->nIndices; i++)
+		{
+			int index;
+			
+			if (grid->topology.indices[i] == TOPOLOGY_RESTART)
+				continue;
+
+			index = chunk->baseVertex + grid->topology.indices[i];
+			float x = grid->layout == GRID_LAYOUT_SOA ? grid->x[index] : grid->vertices[index].x;
+			float z = grid->layout == GRID_LAYOUT_SOA ? grid->z[index] : grid->vertices[index].z;
+
+			chunk->min.x = min(chunk->min.x, x);
+			chunk->max.x = max(chunk->max.x, x);
+			chunk->min.z = min(chunk->min.z, z);
+			chunk->max.z = max(chunk->max.z, z);
+		}
+	}
+}
+
+/* Builds the strips which form the grid's triangles, chunk by
+   chunk so each chunk is one range. Quads inside the hole are left
+   out */
+void setGridHole(Grid *grid, int holeI, int holeJ, int holeSize)
+{
+	buildGridTopology(&grid->topology, grid->rows, grid->cols, GRID_CHUNK_QUADS,
+		holeI, holeJ, holeSize);
+	calcChunkBounds(grid);
+	grid->meshDirty = true;
+}
+
+/* Moves a grid in place so vertex (0, 0) sits at (cornerX, cornerZ)
+   with the given spacing. The indices are kept, the buffers are
+   re-uploaded on the next draw */
+void placeGrid(Grid *grid, float cornerX, float cornerZ, float spacing)
+{
+	int i, j, index = 0;
+
+	for (i = 0; i < grid->rows; i++)
+	{
+		for (j = 0; j < grid->cols; j++)
+		{
+			if (grid->layout == GRID_LAYOUT_SOA)
+			{
+				grid->x[index] = cornerX + i * spacing;
+				grid->z[index] = cornerZ + j * spacing;
+			}
+			else
+			{
+				grid->vertices[index].x = cornerX + i * spacing;
+				grid->vertices[index].z = cornerZ + j * spacing;
+			}
+			index++;
+		}
+	}
+
+	calcChunkBounds(grid);
+	grid->meshDirty = true;
+}
+
+/* As initGrid, storing the vertex data in the given layout */
+void initGridLayout(Grid *grid, int rows, int cols, float size, GridLayout layout)
+{
+	buildGrid(grid, rows, cols, size, size, 0.0f, 0.0f, layout);
+
+	grid->size = size;
+	grid->tiled = false;
+	grid->tileSizeX = grid->tileSizeZ = size;
+	grid->tilesX = grid->tilesZ = 1;
+
 	/* Update the grid Y values */
 	updateGrid(grid, 0.0f);
 }
 
+/* Finds the shortest distance along one axis (0 for x, 1 for z)
+   over which every component repeats. Returns false if the
+   components' periods have no common multiple in range */
+static bool axisPeriod(int axis, float *period)
+{
+	int i, m;
+	float first = 0.0f;
+
+	/* A component repeats every 2pi / (k * dir) along the axis, ones
+	   travelling across it repeat over any distance */
+	for (i = 0; i < nWaves && first == 0.0f; i++)
+	{
+		float kAxis = fabsf(waves[i].k * (axis == 0 ? waves[i].dirX : waves[i].dirZ));
+		if (waves[i].A != 0.0f && kAxis > 1e-6f)
+			first = 2.0f * M_PI / kAxis;
+	}
+	if (first == 0.0f)
+		return false;
+
+	for (m = 1; m <= MAX_PERIOD_MULTIPLE; m++)
+	{
+		float candidate = first * m;
+		bool common = true;
+
+		for (i = 0; i < nWaves && common; i++)
+		{
+			float kAxis = fabsf(waves[i].k * (axis == 0 ? waves[i].dirX : waves[i].dirZ));
+			float cycles = candidate * kAxis / (2.0f * M_PI);
+
+			if (waves[i].A != 0.0f && fabsf(cycles - floorf(cycles + 0.5f)) > PERIOD_TOLERANCE * cycles)
+				common = false;
+		}
+
+		if (common)
+		{
+			*period = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Finds the spatial period of the active waves along x and z.
+   Returns false if they don't repeat */
+bool waveTilePeriod(float *periodX, float *periodZ)
+{
+	/* The FFT patch repeats by construction */
+	if (waveOcean)
+	{
+		*periodX = *periodZ = waveOcean->size;
+		return true;
+	}
+
+	return axisPeriod(0, periodX) && axisPeriod(1, periodZ);
+}
+
+/* Initialises a grid holding a single period of the waves, at the
+   vertex spacing a rows x cols grid of the given size would have.
+   drawGrid repeats the tile across the whole sea so memory and
+   update cost don't depend on the size of the ocean. Falls back to
+   a full grid when the waves aren't periodic */
+void initGridTiled(Grid *grid, int rows, int cols, float size, GridLayout layout)
+{
+	float periodX, periodZ, startX, startZ;
+	int tileRows, tileCols;
+
+	if (rows < 2)
+		rows = 2;
+	if (cols < 2)
+		cols = 2;
+
+	if (!waveTilePeriod(&periodX, &periodZ) || periodX >= size || periodZ >= size)
+	{
+		initGridLayout(grid, rows, cols, size, layout);
+		return;
+	}
+
+	/* Round the tile tessellation so the tile's edges land exactly
+	   on the period, the spacing stays close to the full grid's */
+	tileRows = (int)(periodX / (size / (rows - 1)) + 0.5f) + 1;
+	tileCols = (int)(periodZ / (size / (cols - 1)) + 0.5f) + 1;
+
+	/* Start the tiles on a whole number of periods so every copy
+	   sees the same phase */
+	startX = floorf(-0.5f * size / periodX) * periodX;
+	startZ = floorf(-0.5f * size / periodZ) * periodZ;
+
+	buildGrid(grid, tileRows, tileCols, periodX, periodZ,
+		startX + 0.5f * periodX, startZ + 0.5f * periodZ, layout);
+
+	grid->size = size;
+	grid->tiled = true;
+	grid->tileSizeX = periodX;
+	grid->tileSizeZ = periodZ;
+	grid->tilesX = (int)ceilf((0.5f * size - startX) / periodX);
+	grid->tilesZ = (int)ceilf((0.5f * size - startZ) / periodZ);
+
+	updateGrid(grid, 0.0f);
+}
+
 /* Deletes all memory dynamically allocated by initGrid */
 void cleanupGrid(Grid *grid)
 {
+	cleanupGridBuffers(grid);
+
 	free(grid->vertices);
 	free(grid->normals);
-	free(grid->indices);
+	cleanupGridTopology(&grid->topology);
+	alignedFree(grid->x);
+	alignedFree(grid->z);
+	alignedFree(grid->y);
+	alignedFree(grid->nx);
+	alignedFree(grid->ny);
+	alignedFree(grid->nz);
+	alignedFree(grid->dx);
+	alignedFree(grid->dz);
 
 	grid->nVertices = 0;
-	grid->nIndices = 0;
+	grid->vertices = 0;
 	grid->normals = 0;
-	grid->indices = 0;
+	grid->x = grid->z = grid->y = 0;
+	grid->nx = grid->ny = grid->nz = 0;
+	grid->dx = grid->dz = 0;
+}
+
+/* Returns the position of vertex i whatever the layout */
+Vec3f gridVertex(Grid *grid, int i)
+{
+	if (grid->layout == GRID_LAYOUT_SOA)
+		return cVec3f(grid->x[i] + grid->dx[i], grid->y[i], grid->z[i] + grid->dz[i]);
+	return grid->vertices[i];
+}
+
+/* Returns the normal of vertex i whatever the layout */
+Vec3f gridNormal(Grid *grid, int i)
+{
+	if (grid->layout == GRID_LAYOUT_SOA)
+		return cVec3f(grid->nx[i], grid->ny[i], grid->nz[i]);
+	return grid->normals[i];
+}
+
+/* Releases the grid's buffer objects */
+void cleanupGridBuffers(Grid *grid)
+{
+	if (grid->vertexBuffer)
+	{
+		glDeleteBuffers(1, &grid->texcoordBuffer);
+		glDeleteBuffers(1, &grid->vertexBuffer);
+		glDeleteBuffers(1, &grid->indexBuffer);
+	}
+	grid->texcoordBuffer = 0;
+	grid->vertexBuffer = 0;
+	grid->indexBuffer = 0;
+}
+
+/* Creates the buffer objects for the grid. Texcoords, indices and
+   the x/z of each vertex are uploaded here, and again only if the
+   grid is moved or its indices replaced */
+static void createGridBuffers(Grid *grid)
+{
+	int i;
+	Vec2f *texcoords = malloc(grid->nVertices * sizeof(Vec2f));
+	GridVertex *verts = malloc(grid->nVertices * sizeof(GridVertex));
+
+	for (i = 0; i < grid->nVertices; i++)
+	{
+		verts[i].pos = gridVertex(grid, i);
+		verts[i].normal = gridNormal(grid, i);
+		texcoords[i].x = (verts[i].pos.x / grid->size) - 0.5;
+		texcoords[i].y = (verts[i].pos.z / grid->size) - 0.5;
+	}
+
+	if (!grid->vertexBuffer)
+	{
+		glGenBuffers(1, &grid->texcoordBuffer);
+		glGenBuffers(1, &grid->vertexBuffer);
+		glGenBuffers(1, &grid->indexBuffer);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, grid->texcoordBuffer);
+	glBufferData(GL_ARRAY_BUFFER, grid->nVertices * sizeof(Vec2f), texcoords, GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ARRAY_BUFFER, grid->vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, grid->nVertices * sizeof(GridVertex), verts, GL_DYNAMIC_DRAW);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, grid->indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, grid->topology.nIndices * sizeof(unsigned short),
+		grid->topology.indices, GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	free(texcoords);
+	free(verts);
+
+	grid->buffersDirty = false;
+	grid->meshDirty = false;
+}
+
+/* Streams the heights and normals written by updateGrid into the
+   vertex buffer. x/z are left untouched in the mapped store unless
+   Gerstner waves displace them */
+static void streamGridBuffers(Grid *grid)
+{
+	int i;
+	GridVertex *verts;
+
+	glBindBuffer(GL_ARRAY_BUFFER, grid->vertexBuffer);
+	verts = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+	if (!verts)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		return;
+	}
+
+	if (grid->layout == GRID_LAYOUT_SOA && (grid->displaced || grid->wasDisplaced))
+	{
+		/* Gerstner waves also move x/z (or just stopped doing so) */
+		for (i = 0; i < grid->nVertices; i++)
+		{
+			verts[i].pos = gridVertex(grid, i);
+			verts[i].normal = gridNormal(grid, i);
+		}
+		grid->wasDisplaced = grid->displaced;
+	}
+	else if (grid->layout == GRID_LAYOUT_SOA)
+	{
+		for (i = 0; i < grid->nVertices; i++)
+		{
+			verts[i].pos.y = grid->y[i];
+			verts[i].normal.x = grid->nx[i];
+			verts[i].normal.y = grid->ny[i];
+			verts[i].normal.z = grid->nz[i];
+		}
+	}
+	else
+	{
+		for (i = 0; i < grid->nVertices; i++)
+		{
+			verts[i].pos.y = grid->vertices[i].y;
+			verts[i].normal = grid->normals[i];
+		}
+	}
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	grid->buffersDirty = false;
+}
+
+/* Points the arrays at the grid's buffers starting from vertex
+   base, the chunks' indices are 16 bit and relative to it */
+static void bindGridBuffers(int baseVertex, void *data)
+{
+	Grid *grid = data;
+	size_t base = baseVertex;
+
+	glBindBuffer(GL_ARRAY_BUFFER, grid->texcoordBuffer);
+	glTexCoordPointer(2, GL_FLOAT, sizeof(Vec2f), (void *)(base * sizeof(Vec2f)));
+
+	glBindBuffer(GL_ARRAY_BUFFER, grid->vertexBuffer);
+	glVertexPointer(3, GL_FLOAT, sizeof(GridVertex), (void *)(base * sizeof(GridVertex)));
+	glNormalPointer(GL_FLOAT, sizeof(GridVertex), (void *)(base * sizeof(GridVertex) + sizeof(Vec3f)));
+}
+
+/* Draws the visible chunks of the grid from its buffer objects.
+   Both split-screen viewports share the same buffers, the first draw
+   after an update does the upload */
+static void drawGridBuffers(Grid *grid, const bool *visible)
+{
+	if (!grid->vertexBuffer || grid->meshDirty)
+		createGridBuffers(grid);
+	else if (grid->buffersDirty)
+		streamGridBuffers(grid);
+
+	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, grid->indexBuffer);
+	drawTopologyChunks(&grid->topology, visible, bindGridBuffers, grid);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	glPopClientAttrib();
+}
+
+/* Sends vertex i of the grid in immediate mode */
+static void emitGridVertex(int i, void *data)
+{
+	Grid *grid = data;
+
+	/* A common cause of bugs/crashing when indexing
+	   vertices is accessing arrays out of bounds. assert
+	   is a great way to catch this early */
+	assert(i >= 0 && i < grid->nVertices);
+
+	Vec3f v = gridVertex(grid, i);
+	Vec3f n = gridNormal(grid, i);
+	Vec2f t = {(v.x/grid->size) - 0.5, (v.z/grid->size) - 0.5};
+
+	glTexCoord2f(t.x, t.y);
+	glNormal3f(n.x, n.y, n.z);
+	glVertex3f(v.x, v.y, v.z);
+}
+
+/* Draws one copy of the grid's vertices, offset by (offsetX,
+   offsetZ) in world space, skipping chunks outside the frustum */
+static void drawGridTile(Grid *grid, float offsetX, float offsetZ)
+{
+	int c, nVisible = 0;
+	bool *visible = malloc(max(grid->topology.nChunks, 1) * sizeof(bool));
+
+	/* The chunks' bounds are flat, pad them by how far the waves can
+	   move a vertex */
+	float height = waveHeightBound();
+	float spread = waveDisplacementBound();
+
+	for (c = 0; c < grid->topology.nChunks; c++)
+	{
+		const MeshChunk *chunk = &grid->topology.chunks[c];
+
+		visible[c] = boxVisible(CULL_WATER,
+			cVec3f(chunk->min.x + offsetX - spread, -height, chunk->min.z + offsetZ - spread),
+			cVec3f(chunk->max.x + offsetX + spread, height, chunk->max.z + offsetZ + spread));
+		if (visible[c])
+			nVisible++;
+	}
+
+	if (nVisible == 0)
+	{
+		free(visible);
+		return;
+	}
+
+	/* Use buffer objects where we can, falling back to immediate
+	   mode on old contexts */
+	if (buffersSupported())
+	{
+		drawGridBuffers(grid, visible);
+		free(visible);
+		return;
+	}
+	
+	/* Draw the grid, as triangle strips */
+	for (c = 0; c < grid->topology.nChunks; c++)
+	{
+		if (visible[c])
+			drawTopologyChunkImmediate(&grid->topology, c, emitGridVertex, grid);
+	}
+
+	free(visible);
 }
 
 /* Draws a given grid */
@@ -110,7 +718,7 @@ void drawGrid(Grid *grid)
 	static float specular[] = {1, 1, 1, 1};
 	static float shininess = 100.0f;
 
-	int i;
+	int tx, tz;
 
 	/* Apply the material, this will interact with the light to
 	   produce the final colour */
@@ -118,89 +726,271 @@ void drawGrid(Grid *grid)
 	glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, diffuse);
 	glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, specular);
 	glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, shininess);
-	
-	/* Draw the grid, as triangles */
-	glBegin(GL_TRIANGLES);
-	
-	for (i = 0; i < grid->nIndices; i++)
+
+	if (!grid->tiled)
 	{
-		/* A common cause of bugs/crashing when indexing
-		   vertices is accessing arrays out of bounds. assert
-		   is a great way to catch this early */
-		assert(grid->indices[i] >= 0 && grid->indices[i] < grid->nVertices);
-		
-		Vec3f v = grid->vertices[grid->indices[i]];
-		Vec3f n = grid->normals[grid->indices[i]];
-		Vec2f t = {(v.x/grid->size) - 0.5, (v.z/grid->size) - 0.5};
-		
-		
-		glTexCoord2f(t.x, t.y);
-		glNormal3f(n.x, n.y, n.z);
-		glVertex3f(v.x, v.y, v.z);
-		
-		/* printf("%f %f %f\n", v.x, v.y, v.z); */
+		drawGridTile(grid, 0.0f, 0.0f);
+		return;
+	}
+
+	/* Repeat the tile across the sea, shifting the texture with it
+	   so the water texture still spans the whole ocean */
+	for (tx = 0; tx < grid->tilesX; tx++)
+	{
+		for (tz = 0; tz < grid->tilesZ; tz++)
+		{
+			glMatrixMode(GL_TEXTURE);
+			glPushMatrix();
+			glTranslatef(tx * grid->tileSizeX / grid->size, tz * grid->tileSizeZ / grid->size, 0);
+			glMatrixMode(GL_MODELVIEW);
+			glPushMatrix();
+			glTranslatef(tx * grid->tileSizeX, 0, tz * grid->tileSizeZ);
+
+			drawGridTile(grid, tx * grid->tileSizeX, tz * grid->tileSizeZ);
+
+			glPopMatrix();
+			glMatrixMode(GL_TEXTURE);
+			glPopMatrix();
+			glMatrixMode(GL_MODELVIEW);
+		}
 	}
-	glEnd();
 }
 
-/* Calculates the y value of an individual sine function given a
-   position */
-float calcHeight(SineFunction *f, float x, float t)
+/* Accumulates all wave components, returning a vec4 where the first
+   3 values represent the normal, and w represents the height. This is
+   the scalar kernel for a single point, so the grid kernels agree with
+   it exactly (scalar) or to within their stated tolerance (SIMD) */
+Vec4f calcSineValue(float x, float z)
 {
-	return f->A * sinf(f->k * x + f->w * t);
+	Vec4f v; /* normal x,y,z and height w */
+
+	/* Same bilinear lookup the grid is filled with */
+	if (waveOcean)
+		return sampleOcean(waveOcean, x, z);
+
+	waveKernelScalar(&x, &z, &v.w, &v.x, &v.y, &v.z, NULL, NULL, 1,
+		waves, nWaves, animationTime);
+	
+	return v;
 }
 
-/* Calculates the un-normalized normal vector of a sine function
-   given a position */
-Vec2f calcNormal(SineFunction *f, float x, float t)
+/* True if every component travels exactly along x or along z, so the
+   height is a function of x plus a function of z, and the normal's
+   x/z slopes each depend on one axis only */
+bool wavesSeparable(void)
 {
-	Vec2f n;
-	n.x = - f->A * f->k * cosf(f->k * x + f->w * t);
-	n.y = 1.0;
-	return n;
+	int i;
+
+	if (waveOcean)
+		return false;
+
+	for (i = 0; i < nWaves; i++)
+	{
+		if (waves[i].dirX != 0.0f && waves[i].dirZ != 0.0f)
+			return false;
+	}
+	return true;
 }
 
+/* Makes sure the lattice tables can hold the given number of rows
+   and cols */
+static void reserveWaveTables(int rows, int cols)
+{
+	if (rows > waveTables.rowCapacity)
+	{
+		waveTables.rowCapacity = rows;
+		waveTables.rowX = realloc(waveTables.rowX, rows * sizeof(float));
+		waveTables.rowHeight = realloc(waveTables.rowHeight, rows * sizeof(float));
+		waveTables.rowSlope = realloc(waveTables.rowSlope, rows * sizeof(float));
+		waveTables.rowSteep = realloc(waveTables.rowSteep, rows * sizeof(float));
+		waveTables.rowDisp = realloc(waveTables.rowDisp, rows * sizeof(float));
+	}
+	if (cols > waveTables.colCapacity)
+	{
+		waveTables.colCapacity = cols;
+		waveTables.colHeight = realloc(waveTables.colHeight, cols * sizeof(float));
+		waveTables.colSlope = realloc(waveTables.colSlope, cols * sizeof(float));
+		waveTables.colSteep = realloc(waveTables.colSteep, cols * sizeof(float));
+		waveTables.colDisp = realloc(waveTables.colDisp, cols * sizeof(float));
+	}
+}
 
-/* Accumulates all sine functions, returning a vec4 where the first 3
-   values represent the normal, and w represents the height */
-Vec4f calcSineValue(float x, float z)
+/* Sums the components travelling along one axis (0 for x, 1 for z)
+   at n coordinates along it */
+static void fillWaveTable(int axis, const float *coords, int n,
+	float *height, float *slope, float *steep, float *disp)
 {
-	float magnitude;
-	Vec4f v; /* normal x,y,z and height w */
+	int i, c;
 	float t = animationTime;
 
-	/* Sum the heights */
-	v.w = calcHeight(&sineWaveX, x, t) + calcHeight(&sineWaveZ, z, t);
-	
-	/* Find the normal for each sine wave */
-	Vec2f normalX = calcNormal(&sineWaveX, x, t);
-	Vec2f normalZ = calcNormal(&sineWaveZ, z, t);
-	
-	/* Combine the normals */
-	/* Note: this only works because the sine waves are linearly
-	         independent and do not "share" x/z */
-	v.x = normalX.x;
-	v.y = 1.0f;
-	v.z = normalZ.x;
-	
-	/* Normalize */
-	magnitude = sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
-	v.x /= magnitude;
-	v.y /= magnitude;
-	v.z /= magnitude;
-	
-	return v;
+	for (i = 0; i < n; i++)
+		height[i] = slope[i] = steep[i] = disp[i] = 0.0f;
+
+	for (c = 0; c < nWaves; c++)
+	{
+		const SineFunction *f = &waves[c];
+		float dir = axis == 0 ? f->dirX : f->dirZ;
+		float kAxis = f->k * dir;
+		float p0 = wavePhase(f, t);
+		float qa = f->steepness * f->A;
+
+		if (dir == 0.0f)
+			continue;
+
+		for (i = 0; i < n; i++)
+		{
+			float theta = kAxis * coords[i] + p0;
+			float s = sinf(theta), co = cosf(theta);
+
+			height[i] += f->A * s;
+			slope[i] -= kAxis * f->A * co;
+			steep[i] += qa * f->k * s;
+			disp[i] += qa * dir * co;
+		}
+	}
 }
 
-/* Updates the given grid to apply a wave effect based on a sine wave, 
-   animates using dt */
-void updateGrid(Grid *grid, float dt)
+/* Output of evalWaveLattice shared by its row jobs */
+typedef struct
+{
+	int cols, stride;
+	float *y, *nx, *ny, *nz, *dx, *dz;
+} LatticeJob;
+
+/* Composes rows [begin, end) of a lattice from the wave tables */
+static void composeLatticeRows(int begin, int end, void *data)
 {
+	LatticeJob *job = data;
+	int i, j;
+
+	for (i = begin; i < end; i++)
+	{
+		const float h = waveTables.rowHeight[i];
+		const float gx = waveTables.rowSlope[i];
+		const float gx2 = gx * gx;
+		const float gy0 = 1.0f - waveTables.rowSteep[i];
+		const float *colHeight = waveTables.colHeight;
+		const float *colSlope = waveTables.colSlope;
+		const float *colSteep = waveTables.colSteep;
+		float *ry = job->y + i * job->stride;
+		float *rnx = job->nx + i * job->stride;
+		float *rny = job->ny + i * job->stride;
+		float *rnz = job->nz + i * job->stride;
+
+		/* Simple enough for the compiler to vectorize */
+		for (j = 0; j < job->cols; j++)
+		{
+			float gz = colSlope[j];
+			float gy = gy0 - colSteep[j];
+			float inv = 1.0f / sqrtf(gx2 + gy * gy + gz * gz);
+
+			ry[j] = h + colHeight[j];
+			rnx[j] = gx * inv;
+			rny[j] = gy * inv;
+			rnz[j] = gz * inv;
+		}
+
+		if (job->dx)
+		{
+			float *rdx = job->dx + i * job->stride;
+			float *rdz = job->dz + i * job->stride;
+
+			for (j = 0; j < job->cols; j++)
+			{
+				rdx[j] = waveTables.rowDisp[i];
+				rdz[j] = waveTables.colDisp[j];
+			}
+		}
+	}
+}
+
+/* Evaluates separable waves over the lattice (xs[i], zs[j]). Only
+   rows + cols sin/cos pairs are needed, each vertex is then composed
+   from the tables with adds, multiplies and one reciprocal sqrt */
+void evalWaveLattice(const float *xs, int rows, const float *zs, int cols, int stride,
+	float *y, float *nx, float *ny, float *nz, float *dx, float *dz)
+{
+	LatticeJob job = { cols, stride, y, nx, ny, nz, dx, dz };
+
+	reserveWaveTables(rows, cols);
+
+	/* The tables are cheap (rows + cols trig calls), only the
+	   compose below is split across the job system */
+	fillWaveTable(0, xs, rows, waveTables.rowHeight, waveTables.rowSlope,
+		waveTables.rowSteep, waveTables.rowDisp);
+	fillWaveTable(1, zs, cols, waveTables.colHeight, waveTables.colSlope,
+		waveTables.colSteep, waveTables.colDisp);
+
+	parallelFor(0, rows, LATTICE_ROW_GRAIN, composeLatticeRows, &job);
+}
+
+/* Points evaluated by evalWavePoints, shared by its jobs */
+typedef struct
+{
+	const float *x, *z;
+	float *y, *nx, *ny, *nz, *dx, *dz;
+	int n;
+} PointsJob;
+
+/* Runs the batched kernel over blocks [begin, end) of KERNEL_BLOCK
+   vertices */
+static void runKernelBlocks(int begin, int end, void *data)
+{
+	PointsJob *job = data;
+	int b;
+
+	for (b = begin; b < end; b++)
+	{
+		int first = b * KERNEL_BLOCK;
+		int n = min(KERNEL_BLOCK, job->n - first);
+
+		waveKernel(job->x + first, job->z + first, job->y + first,
+			job->nx + first, job->ny + first, job->nz + first,
+			job->dx ? job->dx + first : NULL, job->dz ? job->dz + first : NULL,
+			n, waves, nWaves, animationTime);
+	}
+}
+
+/* Evaluates every component at n arbitrary points with the batched
+   SIMD kernel. n must be a multiple of WAVE_SIMD_WIDTH and the arrays
+   WAVE_SIMD_ALIGN aligned; dx/dz may be NULL. With the FFT ocean on
+   the points are looked up in it instead, as calcSineValue does */
+void evalWavePoints(const float *x, const float *z, float *y,
+	float *nx, float *ny, float *nz, float *dx, float *dz, int n)
+{
+	PointsJob job = { x, z, y, nx, ny, nz, dx, dz, n };
 	int i;
 
-	animationTime += dt;
+	if (waveOcean)
+	{
+		for (i = 0; i < n; i++)
+		{
+			Vec4f v = sampleOcean(waveOcean, x[i], z[i]);
 
-	for (i = 0; i < grid->nVertices; i++)
+			y[i] = v.w;
+			nx[i] = v.x;
+			ny[i] = v.y;
+			nz[i] = v.z;
+			if (dx)
+				dx[i] = dz[i] = 0.0f;
+		}
+		return;
+	}
+
+	if (!waveKernel)
+		waveKernel = selectWaveKernel(NULL);
+
+	parallelFor(0, (n + KERNEL_BLOCK - 1) / KERNEL_BLOCK, KERNEL_BLOCK_GRAIN,
+		runKernelBlocks, &job);
+}
+
+/* Scalar reference update of AoS vertices [begin, end) */
+static void updateVertices(int begin, int end, void *data)
+{
+	Grid *grid = data;
+	int i;
+
+	for (i = begin; i < end; i++)
 	{
 		Vec4f v = calcSineValue(grid->vertices[i].x, grid->vertices[i].z);
 
@@ -213,6 +1003,116 @@ void updateGrid(Grid *grid, float dt)
 	}
 }
 
+/* Fills vertices [begin, end) from the FFT ocean */
+static void sampleOceanVertices(int begin, int end, void *data)
+{
+	Grid *grid = data;
+	int i;
+
+	for (i = begin; i < end; i++)
+	{
+		Vec3f pos = gridVertex(grid, i);
+		Vec4f v = sampleOcean(waveOcean, pos.x, pos.z);
+
+		if (grid->layout == GRID_LAYOUT_SOA)
+		{
+			grid->y[i] = v.w;
+			grid->nx[i] = v.x;
+			grid->ny[i] = v.y;
+			grid->nz[i] = v.z;
+		}
+		else
+		{
+			grid->vertices[i].y = v.w;
+			grid->normals[i] = cVec3f(v.x, v.y, v.z);
+		}
+	}
+}
+
+/* Builds the ocean's height field for this tick and fills the grid
+   from it, at O(N log N) in the ocean's resolution plus one bilinear
+   lookup per vertex */
+static void updateGridOcean(Grid *grid)
+{
+	if (grid->displaced)
+	{
+		memset(grid->dx, 0, grid->nPadded * sizeof(float));
+		memset(grid->dz, 0, grid->nPadded * sizeof(float));
+		grid->displaced = false;
+	}
+
+	updateOcean(waveOcean, animationTime);
+	parallelFor(0, grid->nVertices, VERTEX_GRAIN, sampleOceanVertices, grid);
+
+	grid->buffersDirty = true;
+}
+
+/* Advances the waves by dt without touching any grid */
+void advanceWaves(float dt)
+{
+	animationTime += dt;
+}
+
+/* Updates the given grid to apply a wave effect based on a sine wave, 
+   animates using dt */
+void updateGrid(Grid *grid, float dt)
+{
+	advanceWaves(dt);
+	evalGrid(grid);
+}
+
+/* Evaluates the waves at every vertex of the grid, at the current
+   time */
+void evalGrid(Grid *grid)
+{
+	int i;
+
+	if (waveOcean)
+	{
+		updateGridOcean(grid);
+		return;
+	}
+
+	if (grid->layout == GRID_LAYOUT_SOA)
+	{
+		/* Gerstner waves move vertices sideways as well */
+		float *dx = wavesSteep ? grid->dx : NULL;
+		float *dz = wavesSteep ? grid->dz : NULL;
+
+		if (grid->displaced && !wavesSteep)
+		{
+			memset(grid->dx, 0, grid->nPadded * sizeof(float));
+			memset(grid->dz, 0, grid->nPadded * sizeof(float));
+		}
+		grid->displaced = wavesSteep;
+
+		/* Separable waves go through the per-row/column tables, the
+		   batched per-vertex kernel handles everything else */
+		if (wavesSeparable())
+		{
+			reserveWaveTables(grid->rows, grid->cols);
+			for (i = 0; i < grid->rows; i++)
+				waveTables.rowX[i] = grid->x[i * grid->cols];
+
+			/* The first row holds every column's z */
+			evalWaveLattice(waveTables.rowX, grid->rows, grid->z, grid->cols, grid->cols,
+				grid->y, grid->nx, grid->ny, grid->nz, dx, dz);
+		}
+		else
+		{
+			evalWavePoints(grid->x, grid->z, grid->y, grid->nx, grid->ny, grid->nz,
+				dx, dz, grid->nPadded);
+		}
+
+		grid->buffersDirty = true;
+		return;
+	}
+
+	parallelFor(0, grid->nVertices, VERTEX_GRAIN, updateVertices, grid);
+
+	grid->buffersDirty = true;
+}
+
 /* Draws normal vectors of the grid as lines, for debugging purposes */
 void drawNormals(Grid *grid, float size)
 {
@@ -231,10 +1131,11 @@ void drawNormals(Grid *grid, float size)
 	   the direction of the normal vector */
 	for (i = 0; i < grid->nVertices; i++)
 	{
-		glVertex3f(grid->vertices[i].x, grid->vertices[i].y, grid->vertices[i].z);
-		glVertex3f(grid->vertices[i].x + grid->normals[i].x * size,
-			grid->vertices[i].y + grid->normals[i].y * size,
-			grid->vertices[i].z + grid->normals[i].z * size);
+		Vec3f v = gridVertex(grid, i);
+		Vec3f n = gridNormal(grid, i);
+
+		glVertex3f(v.x, v.y, v.z);
+		glVertex3f(v.x + n.x * size, v.y + n.y * size, v.z + n.z * size);
 	}
 
 	glEnd();
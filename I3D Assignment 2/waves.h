@@ -6,51 +6,175 @@ extern "C" {
 #endif
 
 #include "utils.h"
+#include "ocean.h"
+#include "frustum.h"
+#include "topology.h"
+
+/* How a Grid stores its vertex data. AOS keeps the vertices/normals
+   Vec3f arrays, SOA keeps one aligned float array per component so
+   the wave kernels can work on several vertices at once */
+typedef enum
+{
+	GRID_LAYOUT_AOS,
+	GRID_LAYOUT_SOA
+} GridLayout;
 
 /* The Grid struct is used to hold the grid of vertices representing
    the waves */
 typedef struct
 {
+	GridLayout layout;	/* Which of the arrays below are in use */
 	int rows;		/* No. of vertices per row (tessellation) */
 	int cols;		/* No. of vertices per col (tessellation) */
 	float size;		/* Size of the grid in GL coords (width and height are equal) */
 	int nVertices;		/* Total no. of vertices */
-	int nIndices;		/* Total no. of indices */
 	Vec3f *vertices;	/* 1d array of vertices */
 	Vec3f *normals;		/* 1d array of normal vectors, maps to
 				   locations of vertices */
-	int *indices;		/* 1d array of indices */
+	GridTopology topology;	/* Strips in chunks culled separately, the
+				   chunks' bounds are flat x/z, y is padded
+				   when drawn */
+
+	/* Structure-of-arrays storage, used instead of vertices/normals
+	   when layout is GRID_LAYOUT_SOA. Each array is padded to
+	   nPadded floats and aligned for SIMD loads */
+	int nPadded;
+	float *x, *z;		/* Fixed grid positions */
+	float *y;		/* Wave heights */
+	float *nx, *ny, *nz;	/* Unit normals */
+	float *dx, *dz;		/* Gerstner horizontal displacement */
+	bool displaced;		/* dx/dz are non-zero */
+	bool wasDisplaced;	/* displaced as of the last upload */
+
+	/* Periodic tile mode: the vertices hold one period of the waves
+	   and drawGrid repeats them tilesX x tilesZ times */
+	bool tiled;
+	float tileSizeX, tileSizeZ;	/* Spatial period along x/z */
+	int tilesX, tilesZ;		/* Copies drawn along x/z */
+
+	/* Buffer objects used when the context supports them, created
+	   on the first draw. The texcoord and index buffers never
+	   change, the vertex buffer holds interleaved positions and
+	   normals of which only y and the normal are streamed */
+	unsigned int texcoordBuffer;
+	unsigned int vertexBuffer;
+	unsigned int indexBuffer;
+	bool buffersDirty;	/* Heights/normals changed since last upload */
+	bool meshDirty;		/* x/z or indices changed, upload everything */
 } Grid;
 
+/* Most components setWaves accepts */
+#define MAX_WAVES 64
+
 /* Struct to model a sine function, waves are modelled as a sum of one
-   or more sine waves */
+   or more sine waves. Each travels along (dirX, dirZ), a unit vector;
+   with a steepness above 0 it becomes a Gerstner wave, whose crests
+   sharpen as vertices are pulled horizontally towards them */
 typedef struct
 {
 	float A;		/* Amplitude of the wave */
-	float k;		/* Wave period (in 2pi) */
-	float w;		/* Angular frequency along the x axis */
+	float k;		/* Wave number (2pi / wavelength) */
+	float w;		/* Angular frequency */
+	float dirX, dirZ;	/* Direction of travel */
+	float phase;		/* Phase offset */
+	float steepness;	/* Gerstner Q, 0 for a plain sine, keep
+				   Q * k * A summed over all waves below 1 */
 } SineFunction;
 
+/* Replaces the active wave components (at most MAX_WAVES) */
+void setWaves(const SineFunction *components, int n);
+
+/* Makes the grid and calcSineValue use an FFT ocean instead of the
+   wave components, NULL switches back. The ocean is borrowed, it
+   must outlive its use here */
+void setWaveOcean(Ocean *ocean);
+
+/* Bounds on how far the active waves move the surface vertically
+   and horizontally, for culling */
+float waveHeightBound(void);
+float waveDisplacementBound(void);
+
+/* Points components at the active waves, returning how many */
+int getWaves(const SineFunction **components);
+
+/* Fills n components sampled from a wind-driven spectrum, wind is the
+   main direction in radians and amplitude the total height budget.
+   The same seed always gives the same sea */
+void makeWaveSpectrum(SineFunction *components, int n, float wind, float amplitude, unsigned int seed);
+
 /* Initialises a 2d grid of the given size, divided into the given
    number of rows and cols */
 void initGrid(Grid *grid, int rows, int cols, float size);
 
+/* As initGrid, with an explicit storage layout */
+void initGridLayout(Grid *grid, int rows, int cols, float size, GridLayout layout);
+
+/* Initialises a grid holding only one spatial period of the waves
+   at the spacing of a rows x cols grid of the given size, drawn
+   repeated across the sea. Falls back to initGridLayout when the
+   waves aren't periodic */
+void initGridTiled(Grid *grid, int rows, int cols, float size, GridLayout layout);
+
+/* Gets the spatial period of the active waves along x and z, returns
+   false if they don't repeat */
+bool waveTilePeriod(float *periodX, float *periodZ);
+
+/* Rebuilds the strips leaving out the holeSize x holeSize quads
+   starting at quad (holeI, holeJ), 0 for no hole */
+void setGridHole(Grid *grid, int holeI, int holeJ, int holeSize);
+
+/* Moves the grid so vertex (0, 0) is at (cornerX, cornerZ), with the
+   given spacing between vertices. The texcoords still map the water
+   texture over grid->size, and the waves are re-evaluated by the next
+   update */
+void placeGrid(Grid *grid, float cornerX, float cornerZ, float spacing);
+
+/* Returns the position/normal of vertex i whatever the layout */
+Vec3f gridVertex(Grid *grid, int i);
+Vec3f gridNormal(Grid *grid, int i);
+
 /* Deletes all memory dynamically allocated by initGrid */
 void cleanupGrid(Grid *grid);
 
 /* Draws a given grid */
 void drawGrid(Grid *grid);
 
+/* Releases the grid's buffer objects (needs a current GL context) */
+void cleanupGridBuffers(Grid *grid);
+
 /* Returns normal x,y,z and height w in a Vec4
    at the point on the wave given by x, z */
 Vec4f calcSineValue(float x, float z);
 
+/* True if the active waves split into a function of x plus a
+   function of z */
+bool wavesSeparable(void);
+
+/* Evaluates separable waves at every point (xs[i], zs[j]), writing
+   heights, unit normals and (if dx isn't NULL) displacements
+   row-major with the given row stride */
+void evalWaveLattice(const float *xs, int rows, const float *zs, int cols, int stride,
+	float *y, float *nx, float *ny, float *nz, float *dx, float *dz);
+
+/* Evaluates the active waves at n points with the batched SIMD
+   kernel, n must be a multiple of WAVE_SIMD_WIDTH and the arrays
+   aligned to WAVE_SIMD_ALIGN. dx/dz may be NULL. Samples the FFT
+   ocean instead when it's on, like calcSineValue */
+void evalWavePoints(const float *x, const float *z, float *y,
+	float *nx, float *ny, float *nz, float *dx, float *dz, int n);
+
 /* Updates the given grid to apply a wave effect based on a sine wave,
    animates using dt */
 void updateGrid(Grid *grid, float dt);
 
+/* updateGrid split in two, for when several grids share one tick:
+   advanceWaves moves time on, evalGrid evaluates a grid at the
+   current time */
+void advanceWaves(float dt);
+void evalGrid(Grid *grid);
+
 /* Draws normal vectors of the grid as lines, for debugging
-   purposes */
+   purposes (only the first copy of a tiled grid) */
 void drawNormals(Grid *grid, float size);
 
 #ifdef __cplusplus
@@ -0,0 +1,352 @@
+#include <math.h>
+#include "waves_simd.h"
+#include "cpu.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define WAVES_X86 1
+#include <immintrin.h>
+#endif
+
+/* Cephes sinf/cosf range reduction (pi/4 split in three parts) and
+   minimax polynomial coefficients */
+#define SC_FOPI 1.27323954473516f
+#define SC_DP1 0.78515625f
+#define SC_DP2 2.4187564849853515625e-4f
+#define SC_DP3 3.77489497744594108e-8f
+#define SC_COS0 2.443315711809948e-5f
+#define SC_COS1 -1.388731625493765e-3f
+#define SC_COS2 4.166664568298827e-2f
+#define SC_SIN0 -1.9515295891e-4f
+#define SC_SIN1 8.3321608736e-3f
+#define SC_SIN2 -1.6666654611e-1f
+
+float wavePhase(const SineFunction *f, float t)
+{
+	/* In double, so the product keeps the precision the wrap saves */
+	return (float)fmod((double)f->w * t + f->phase, 2.0 * M_PI);
+}
+
+/* Reference kernel, calcSineValue is this with n = 1 */
+void waveKernelScalar(const float *x, const float *z,
+	float *y, float *nx, float *ny, float *nz, float *dx, float *dz, int n,
+	const SineFunction *waves, int nWaves, float t)
+{
+	int i, c;
+	float magnitude;
+
+	/* nx/ny/nz accumulate the un-normalized normal */
+	for (i = 0; i < n; i++)
+	{
+		y[i] = 0.0f;
+		nx[i] = 0.0f;
+		ny[i] = 1.0f;
+		nz[i] = 0.0f;
+	}
+	if (dx)
+	{
+		for (i = 0; i < n; i++)
+			dx[i] = dz[i] = 0.0f;
+	}
+
+	for (c = 0; c < nWaves; c++)
+	{
+		const SineFunction *f = &waves[c];
+		const float kx = f->k * f->dirX, kz = f->k * f->dirZ;
+		const float p0 = wavePhase(f, t);
+		const float ax = kx * f->A, az = kz * f->A;
+		const float qa = f->steepness * f->A, qka = qa * f->k;
+
+		for (i = 0; i < n; i++)
+		{
+			float theta = kx * x[i] + kz * z[i] + p0;
+			float s = sinf(theta), co = cosf(theta);
+
+			y[i] += f->A * s;
+			nx[i] -= ax * co;
+			nz[i] -= az * co;
+			if (qa != 0.0f)
+			{
+				ny[i] -= qka * s;
+				if (dx)
+				{
+					dx[i] += qa * f->dirX * co;
+					dz[i] += qa * f->dirZ * co;
+				}
+			}
+		}
+	}
+
+	/* Normalize */
+	for (i = 0; i < n; i++)
+	{
+		magnitude = sqrt(nx[i] * nx[i] + ny[i] * ny[i] + nz[i] * nz[i]);
+		nx[i] /= magnitude;
+		ny[i] /= magnitude;
+		nz[i] /= magnitude;
+	}
+}
+
+#ifdef WAVES_X86
+
+/* Computes sin and cos of 4 floats at once */
+__attribute__((target("sse2")))
+static void sincos4(__m128 x, __m128 *s, __m128 *c)
+{
+	const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+	__m128 signSin, signCos, y, z, polyMask, ys, yc;
+	__m128i j, swap;
+
+	/* Work on |x|, remembering the sign for sin */
+	signSin = _mm_and_ps(x, signMask);
+	x = _mm_andnot_ps(signMask, x);
+
+	/* Octant j (rounded up to even) and its float value */
+	j = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(SC_FOPI)));
+	j = _mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+	y = _mm_cvtepi32_ps(j);
+
+	swap = _mm_slli_epi32(_mm_and_si128(j, _mm_set1_epi32(4)), 29);
+	signSin = _mm_xor_ps(signSin, _mm_castsi128_ps(swap));
+	signCos = _mm_castsi128_ps(_mm_slli_epi32(_mm_andnot_si128(
+		_mm_sub_epi32(j, _mm_set1_epi32(2)), _mm_set1_epi32(4)), 29));
+	polyMask = _mm_castsi128_ps(_mm_cmpeq_epi32(
+		_mm_and_si128(j, _mm_set1_epi32(2)), _mm_setzero_si128()));
+
+	/* Extended precision reduction x - j * pi/4 */
+	x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(SC_DP1)));
+	x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(SC_DP2)));
+	x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(SC_DP3)));
+	z = _mm_mul_ps(x, x);
+
+	yc = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(SC_COS0), z), _mm_set1_ps(SC_COS1));
+	yc = _mm_add_ps(_mm_mul_ps(yc, z), _mm_set1_ps(SC_COS2));
+	yc = _mm_mul_ps(_mm_mul_ps(yc, z), z);
+	yc = _mm_sub_ps(yc, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+	yc = _mm_add_ps(yc, _mm_set1_ps(1.0f));
+
+	ys = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(SC_SIN0), z), _mm_set1_ps(SC_SIN1));
+	ys = _mm_add_ps(_mm_mul_ps(ys, z), _mm_set1_ps(SC_SIN2));
+	ys = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(ys, z), x), x);
+
+	/* Pick the right polynomial for each octant */
+	*s = _mm_xor_ps(_mm_or_ps(_mm_and_ps(polyMask, ys), _mm_andnot_ps(polyMask, yc)), signSin);
+	*c = _mm_xor_ps(_mm_or_ps(_mm_and_ps(polyMask, yc), _mm_andnot_ps(polyMask, ys)), signCos);
+}
+
+/* Computes sin and cos of 8 floats at once */
+__attribute__((target("avx2")))
+static void sincos8(__m256 x, __m256 *s, __m256 *c)
+{
+	const __m256 signMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x80000000));
+	__m256 signSin, signCos, y, z, polyMask, ys, yc;
+	__m256i j, swap;
+
+	signSin = _mm256_and_ps(x, signMask);
+	x = _mm256_andnot_ps(signMask, x);
+
+	j = _mm256_cvttps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(SC_FOPI)));
+	j = _mm256_and_si256(_mm256_add_epi32(j, _mm256_set1_epi32(1)), _mm256_set1_epi32(~1));
+	y = _mm256_cvtepi32_ps(j);
+
+	swap = _mm256_slli_epi32(_mm256_and_si256(j, _mm256_set1_epi32(4)), 29);
+	signSin = _mm256_xor_ps(signSin, _mm256_castsi256_ps(swap));
+	signCos = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_andnot_si256(
+		_mm256_sub_epi32(j, _mm256_set1_epi32(2)), _mm256_set1_epi32(4)), 29));
+	polyMask = _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+		_mm256_and_si256(j, _mm256_set1_epi32(2)), _mm256_setzero_si256()));
+
+	x = _mm256_sub_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(SC_DP1)));
+	x = _mm256_sub_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(SC_DP2)));
+	x = _mm256_sub_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(SC_DP3)));
+	z = _mm256_mul_ps(x, x);
+
+	yc = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(SC_COS0), z), _mm256_set1_ps(SC_COS1));
+	yc = _mm256_add_ps(_mm256_mul_ps(yc, z), _mm256_set1_ps(SC_COS2));
+	yc = _mm256_mul_ps(_mm256_mul_ps(yc, z), z);
+	yc = _mm256_sub_ps(yc, _mm256_mul_ps(z, _mm256_set1_ps(0.5f)));
+	yc = _mm256_add_ps(yc, _mm256_set1_ps(1.0f));
+
+	ys = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(SC_SIN0), z), _mm256_set1_ps(SC_SIN1));
+	ys = _mm256_add_ps(_mm256_mul_ps(ys, z), _mm256_set1_ps(SC_SIN2));
+	ys = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(ys, z), x), x);
+
+	*s = _mm256_xor_ps(_mm256_or_ps(_mm256_and_ps(polyMask, ys), _mm256_andnot_ps(polyMask, yc)), signSin);
+	*c = _mm256_xor_ps(_mm256_or_ps(_mm256_and_ps(polyMask, yc), _mm256_andnot_ps(polyMask, ys)), signCos);
+}
+
+/* Components outer, 4 vertices per inner iteration */
+__attribute__((target("sse2")))
+void waveKernelSSE2(const float *x, const float *z,
+	float *y, float *nx, float *ny, float *nz, float *dx, float *dz, int n,
+	const SineFunction *waves, int nWaves, float t)
+{
+	int i, c;
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+
+	for (i = 0; i < n; i += 4)
+	{
+		_mm_store_ps(y + i, zero);
+		_mm_store_ps(nx + i, zero);
+		_mm_store_ps(ny + i, one);
+		_mm_store_ps(nz + i, zero);
+		if (dx)
+		{
+			_mm_store_ps(dx + i, zero);
+			_mm_store_ps(dz + i, zero);
+		}
+	}
+
+	for (c = 0; c < nWaves; c++)
+	{
+		const SineFunction *f = &waves[c];
+		const float qa = f->steepness * f->A;
+		const __m128 kx = _mm_set1_ps(f->k * f->dirX), kz = _mm_set1_ps(f->k * f->dirZ);
+		const __m128 p0 = _mm_set1_ps(wavePhase(f, t));
+		const __m128 a = _mm_set1_ps(f->A);
+		const __m128 ax = _mm_set1_ps(f->k * f->dirX * f->A), az = _mm_set1_ps(f->k * f->dirZ * f->A);
+		const __m128 qka = _mm_set1_ps(qa * f->k);
+		const __m128 qax = _mm_set1_ps(qa * f->dirX), qaz = _mm_set1_ps(qa * f->dirZ);
+
+		for (i = 0; i < n; i += 4)
+		{
+			__m128 s, co;
+			__m128 theta = _mm_add_ps(_mm_add_ps(_mm_mul_ps(kx, _mm_load_ps(x + i)),
+				_mm_mul_ps(kz, _mm_load_ps(z + i))), p0);
+
+			sincos4(theta, &s, &co);
+
+			_mm_store_ps(y + i, _mm_add_ps(_mm_load_ps(y + i), _mm_mul_ps(a, s)));
+			_mm_store_ps(nx + i, _mm_sub_ps(_mm_load_ps(nx + i), _mm_mul_ps(ax, co)));
+			_mm_store_ps(nz + i, _mm_sub_ps(_mm_load_ps(nz + i), _mm_mul_ps(az, co)));
+			if (qa != 0.0f)
+			{
+				_mm_store_ps(ny + i, _mm_sub_ps(_mm_load_ps(ny + i), _mm_mul_ps(qka, s)));
+				if (dx)
+				{
+					_mm_store_ps(dx + i, _mm_add_ps(_mm_load_ps(dx + i), _mm_mul_ps(qax, co)));
+					_mm_store_ps(dz + i, _mm_add_ps(_mm_load_ps(dz + i), _mm_mul_ps(qaz, co)));
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < n; i += 4)
+	{
+		__m128 gx = _mm_load_ps(nx + i), gy = _mm_load_ps(ny + i), gz = _mm_load_ps(nz + i);
+		__m128 inv = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy)), _mm_mul_ps(gz, gz))));
+
+		_mm_store_ps(nx + i, _mm_mul_ps(gx, inv));
+		_mm_store_ps(ny + i, _mm_mul_ps(gy, inv));
+		_mm_store_ps(nz + i, _mm_mul_ps(gz, inv));
+	}
+}
+
+/* Components outer, 8 vertices per inner iteration */
+__attribute__((target("avx2")))
+void waveKernelAVX2(const float *x, const float *z,
+	float *y, float *nx, float *ny, float *nz, float *dx, float *dz, int n,
+	const SineFunction *waves, int nWaves, float t)
+{
+	int i, c;
+	const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+
+	for (i = 0; i < n; i += 8)
+	{
+		_mm256_store_ps(y + i, zero);
+		_mm256_store_ps(nx + i, zero);
+		_mm256_store_ps(ny + i, one);
+		_mm256_store_ps(nz + i, zero);
+		if (dx)
+		{
+			_mm256_store_ps(dx + i, zero);
+			_mm256_store_ps(dz + i, zero);
+		}
+	}
+
+	for (c = 0; c < nWaves; c++)
+	{
+		const SineFunction *f = &waves[c];
+		const float qa = f->steepness * f->A;
+		const __m256 kx = _mm256_set1_ps(f->k * f->dirX), kz = _mm256_set1_ps(f->k * f->dirZ);
+		const __m256 p0 = _mm256_set1_ps(wavePhase(f, t));
+		const __m256 a = _mm256_set1_ps(f->A);
+		const __m256 ax = _mm256_set1_ps(f->k * f->dirX * f->A), az = _mm256_set1_ps(f->k * f->dirZ * f->A);
+		const __m256 qka = _mm256_set1_ps(qa * f->k);
+		const __m256 qax = _mm256_set1_ps(qa * f->dirX), qaz = _mm256_set1_ps(qa * f->dirZ);
+
+		for (i = 0; i < n; i += 8)
+		{
+			__m256 s, co;
+			__m256 theta = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(kx, _mm256_load_ps(x + i)),
+				_mm256_mul_ps(kz, _mm256_load_ps(z + i))), p0);
+
+			sincos8(theta, &s, &co);
+
+			_mm256_store_ps(y + i, _mm256_add_ps(_mm256_load_ps(y + i), _mm256_mul_ps(a, s)));
+			_mm256_store_ps(nx + i, _mm256_sub_ps(_mm256_load_ps(nx + i), _mm256_mul_ps(ax, co)));
+			_mm256_store_ps(nz + i, _mm256_sub_ps(_mm256_load_ps(nz + i), _mm256_mul_ps(az, co)));
+			if (qa != 0.0f)
+			{
+				_mm256_store_ps(ny + i, _mm256_sub_ps(_mm256_load_ps(ny + i), _mm256_mul_ps(qka, s)));
+				if (dx)
+				{
+					_mm256_store_ps(dx + i, _mm256_add_ps(_mm256_load_ps(dx + i), _mm256_mul_ps(qax, co)));
+					_mm256_store_ps(dz + i, _mm256_add_ps(_mm256_load_ps(dz + i), _mm256_mul_ps(qaz, co)));
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < n; i += 8)
+	{
+		__m256 gx = _mm256_load_ps(nx + i), gy = _mm256_load_ps(ny + i), gz = _mm256_load_ps(nz + i);
+		__m256 inv = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(
+			_mm256_mul_ps(gx, gx), _mm256_mul_ps(gy, gy)), _mm256_mul_ps(gz, gz))));
+
+		_mm256_store_ps(nx + i, _mm256_mul_ps(gx, inv));
+		_mm256_store_ps(ny + i, _mm256_mul_ps(gy, inv));
+		_mm256_store_ps(nz + i, _mm256_mul_ps(gz, inv));
+	}
+}
+
+#else
+
+/* No SIMD on this platform, the wide kernels are the scalar one */
+void waveKernelSSE2(const float *x, const float *z,
+	float *y, float *nx, float *ny, float *nz, float *dx, float *dz, int n,
+	const SineFunction *waves, int nWaves, float t)
+{
+	waveKernelScalar(x, z, y, nx, ny, nz, dx, dz, n, waves, nWaves, t);
+}
+
+void waveKernelAVX2(const float *x, const float *z,
+	float *y, float *nx, float *ny, float *nz, float *dx, float *dz, int n,
+	const SineFunction *waves, int nWaves, float t)
+{
+	waveKernelScalar(x, z, y, nx, ny, nz, dx, dz, n, waves, nWaves, t);
+}
+
+#endif
+
+/* Picks the widest kernel the CPU supports */
+WaveKernel selectWaveKernel(const char **name)
+{
+	const char *dummy;
+
+	if (!name)
+		name = &dummy;
+
+	if (cpuHasAVX2())
+	{
+		*name = "avx2";
+		return waveKernelAVX2;
+	}
+	if (cpuHasSSE2())
+	{
+		*name = "sse2";
+		return waveKernelSSE2;
+	}
+	*name = "scalar";
+	return waveKernelScalar;
+}
@@ -0,0 +1,59 @@
+#ifndef WAVES_SIMD_H
+#define WAVES_SIMD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "waves.h"
+
+/* SIMD width the SoA arrays are padded to, and their alignment in
+   bytes (a cache line, which also covers AVX) */
+#define WAVE_SIMD_WIDTH 16
+#define WAVE_SIMD_ALIGN 64
+
+/* A wave kernel sums nWaves directional sine/Gerstner components
+   over n vertices stored as separate x/z arrays, writing the height
+   and unit normal into y/nx/ny/nz and, when dx/dz aren't NULL, the
+   Gerstner horizontal displacement. Components are the outer loop
+   and vertices the inner one, so each component's direction,
+   frequency and phase stay in registers; callers should keep n small
+   enough (a few hundred vertices) for the arrays to stay in L1. n
+   must be a multiple of WAVE_SIMD_WIDTH and all arrays
+   WAVE_SIMD_ALIGN aligned, except for the scalar kernel which takes
+   any n and alignment.
+
+   The SIMD kernels use a polynomial sincos (Cephes coefficients) and
+   agree with the scalar kernel to within 2e-6 * sum(A) in height and
+   2e-6 * nWaves in each normal component for arguments below 8192
+   radians. Every kernel wraps each component's phase with wavePhase,
+   so that holds however long t runs, as long as k * x stays below it.
+   The scalar kernel is what calcSineValue uses, so the two are
+   bit-identical */
+typedef void (*WaveKernel)(const float *x, const float *z,
+	float *y, float *nx, float *ny, float *nz, float *dx, float *dz, int n,
+	const SineFunction *waves, int nWaves, float t);
+
+void waveKernelScalar(const float *x, const float *z,
+	float *y, float *nx, float *ny, float *nz, float *dx, float *dz, int n,
+	const SineFunction *waves, int nWaves, float t);
+void waveKernelSSE2(const float *x, const float *z,
+	float *y, float *nx, float *ny, float *nz, float *dx, float *dz, int n,
+	const SineFunction *waves, int nWaves, float t);
+void waveKernelAVX2(const float *x, const float *z,
+	float *y, float *nx, float *ny, float *nz, float *dx, float *dz, int n,
+	const SineFunction *waves, int nWaves, float t);
+
+/* A component's phase w * t + phase at time t, wrapped into
+   [0, 2 pi) */
+float wavePhase(const SineFunction *f, float t);
+
+/* Picks the widest kernel the CPU supports, optionally returning its
+   name for diagnostics */
+WaveKernel selectWaveKernel(const char **name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif